@@ -0,0 +1,229 @@
+// Copyright 2021 The RDSS Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RDSS_ARENA_H_
+#define RDSS_ARENA_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+#include <absl/base/thread_annotations.h>
+#include <absl/status/status.h>
+#include <absl/strings/str_format.h>
+#include <absl/synchronization/mutex.h>
+
+#include "logging/logging.hpp"
+
+namespace rdss {
+
+////////////////////////////////////////////////////////////////////////////////
+
+// The memory of a single query. Small allocations are carved out of large
+// chunks and never freed individually; the chunks are released together when
+// the arena is destroyed. Allocations too large to share a chunk get blocks of
+// their own, which are freed as soon as they are deallocated, so that
+// intermediate results dropped early give their memory back.
+//
+// Every byte the arena takes from the system is charged against its budget.
+// Allocation never fails, since the containers using the arena cannot handle
+// failure; instead, the arena records that the budget was exceeded, and
+// callers poll `CheckBudget` at points where they can abandon their work.
+// Any number of threads may allocate from an arena at once.
+//
+// An arena may have a parent, to which it also charges every byte it takes;
+// it fails the budget check whenever its parent does, and gives its bytes
+// back to the parent when it is destroyed. This lets short-lived work be
+// charged against a longer-lived budget without keeping its chunks.
+class MemoryArena {
+public:
+    static constexpr int64_t kUnlimited = std::numeric_limits<int64_t>::max();
+
+    // The size of the chunks small allocations are carved out of.
+    static constexpr size_t kChunkSize = size_t(1) << 18;
+
+    // Allocations larger than this get blocks of their own.
+    static constexpr size_t kLargeAllocation = kChunkSize / 8;
+
+    explicit MemoryArena(int64_t budget_ = kUnlimited,
+                         std::shared_ptr<MemoryArena> parent_ = nullptr)
+        : budget(budget_)
+        , parent(std::move(parent_))
+        , exhausted(false)
+        , chunks()
+        , position(0)
+        , bytes_reserved(0)
+        , peak_bytes_reserved(0) {}
+
+    MemoryArena(const MemoryArena&) = delete;
+    MemoryArena& operator=(const MemoryArena&) = delete;
+
+    ~MemoryArena() {
+        if (parent != nullptr) {
+            parent->Release(BytesReserved());
+        }
+    }
+
+    void* Allocate(size_t bytes, size_t alignment) {
+        RDSS_DCHECK_LE(alignment, alignof(std::max_align_t));
+        absl::MutexLock lock(&mutex);
+        if (bytes > kLargeAllocation) {
+            Charge(bytes);
+            return ::operator new(bytes);
+        }
+        position = (position + alignment - 1) / alignment * alignment;
+        if (chunks.empty() || (position + bytes > kChunkSize)) {
+            chunks.emplace_back(new char[kChunkSize]);
+            position = 0;
+            Charge(kChunkSize);
+        }
+        void* result = chunks.back().get() + position;
+        position += bytes;
+        return result;
+    }
+
+    void Deallocate(void* pointer, size_t bytes) {
+        if (bytes > kLargeAllocation) {
+            ::operator delete(pointer);
+            Release(bytes);
+        }
+    }
+
+    // The number of bytes currently taken from the system.
+    int64_t BytesReserved() const {
+        absl::MutexLock lock(&mutex);
+        return bytes_reserved;
+    }
+
+    // The largest number of bytes that were ever taken at once.
+    int64_t PeakBytesReserved() const {
+        absl::MutexLock lock(&mutex);
+        return peak_bytes_reserved;
+    }
+
+    int64_t Budget() const {
+        return budget;
+    }
+
+    // Fails once the arena, or its parent, has ever held more than its
+    // budget.
+    absl::Status CheckBudget() const {
+        if (exhausted.load(std::memory_order_relaxed)) {
+            return absl::ResourceExhaustedError(absl::StrFormat(
+                "query exceeded its memory budget of %d bytes", budget));
+        }
+        return (parent == nullptr) ? absl::OkStatus() : parent->CheckBudget();
+    }
+
+private:
+    void Charge(size_t bytes) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex) {
+        bytes_reserved += bytes;
+        peak_bytes_reserved = std::max(peak_bytes_reserved, bytes_reserved);
+        if (bytes_reserved > budget) {
+            exhausted.store(true, std::memory_order_relaxed);
+        }
+        if (parent != nullptr) {
+            absl::MutexLock lock(&parent->mutex);
+            parent->Charge(bytes);
+        }
+    }
+
+    void Release(int64_t bytes) {
+        {
+            absl::MutexLock lock(&mutex);
+            bytes_reserved -= bytes;
+        }
+        if (parent != nullptr) {
+            parent->Release(bytes);
+        }
+    }
+
+    int64_t budget;
+    std::shared_ptr<MemoryArena> parent;
+    std::atomic<bool> exhausted;
+
+    mutable absl::Mutex mutex;
+    std::vector<std::unique_ptr<char[]>> chunks ABSL_GUARDED_BY(mutex);
+    // The offset of the first free byte in the last chunk.
+    size_t position ABSL_GUARDED_BY(mutex);
+    int64_t bytes_reserved ABSL_GUARDED_BY(mutex);
+    int64_t peak_bytes_reserved ABSL_GUARDED_BY(mutex);
+};
+
+// Returns an error if `arena` is non-null and has exceeded its budget.
+inline absl::Status CheckMemoryBudget(const MemoryArena* arena) {
+    return (arena == nullptr) ? absl::OkStatus() : arena->CheckBudget();
+}
+
+// The number of tuples an operator whose output is not bounded by its input,
+// such as a join, inserts between checks of the memory budget.
+constexpr int32_t kTuplesPerBudgetCheck = 1024;
+
+// An allocator that takes memory from a `MemoryArena`, or from the global
+// heap when it has none. Containers using it keep their arena alive, so an
+// arena's chunks are freed once the last container allocated from it is.
+template<typename T>
+class ArenaAllocator {
+public:
+    using value_type = T;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    ArenaAllocator() : arena() {}
+
+    explicit ArenaAllocator(std::shared_ptr<MemoryArena> arena_)
+        : arena(std::move(arena_)) {}
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.Arena()) {}
+
+    T* allocate(size_t n) {
+        if (arena == nullptr) {
+            return std::allocator<T>().allocate(n);
+        }
+        return static_cast<T*>(arena->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* pointer, size_t n) {
+        if (arena == nullptr) {
+            std::allocator<T>().deallocate(pointer, n);
+        } else {
+            arena->Deallocate(pointer, n * sizeof(T));
+        }
+    }
+
+    const std::shared_ptr<MemoryArena>& Arena() const {
+        return arena;
+    }
+
+    template<typename U>
+    bool operator==(const ArenaAllocator<U>& other) const {
+        return arena == other.Arena();
+    }
+
+private:
+    std::shared_ptr<MemoryArena> arena;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace rdss
+
+#endif  // RDSS_ARENA_H_
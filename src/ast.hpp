@@ -15,12 +15,14 @@
 #ifndef RDSS_AST_H_
 #define RDSS_AST_H_
 
+#include <algorithm>
 #include <cstdint>
 #include <functional>
 #include <string>
 #include <vector>
 
 #include <absl/container/btree_set.h>
+#include <absl/hash/hash.h>
 #include <absl/memory/memory.h>
 #include <absl/strings/str_cat.h>
 #include <absl/strings/str_format.h>
@@ -29,6 +31,7 @@
 #include <absl/types/optional.h>
 
 #include "attr.hpp"
+#include "hash_cons.hpp"
 #include "predicate.hpp"
 #include "logging/logging.hpp"
 
@@ -96,19 +99,32 @@ struct Relation {
     virtual std::string ToString() const = 0;
     virtual int32_t Arity() const = 0;
     virtual bool IsLocal() const = 0;
+    // The relations this one is computed from, in order.
+    virtual std::vector<Relation*> Children() const = 0;
+    // Hashes and compares everything but the children, for relations of the
+    // same kind.
+    virtual size_t ParameterHash() const = 0;
+    virtual bool SameParameters(const Relation& other) const = 0;
     virtual ~Relation() = default;
+
+    // A hash of the whole plan rooted here, set by the factory that made it.
+    size_t structural_hash = 0;
 };
 
+// Makes each distinct plan once: making a relation structurally equal to one
+// made before returns the earlier one, so equal subplans are the same node
+// and everything keyed on `Relation*`, such as the interpreter's results, is
+// shared between them. Relations that read predicates should take them from
+// a single `PredicateFactory`, which shares equal predicates the same way.
 struct RelationFactory {
     std::vector<std::unique_ptr<Relation>> relations;
+    HashConsSet<Relation> canonical;
 
     template<typename T, typename... Args>
     T* Make(Args&&... args) {
         std::unique_ptr<T> value =
             absl::make_unique<T>(std::forward<Args>(args)...);
-        T* ptr = value.get();
-        relations.push_back(std::move(value));
-        return ptr;
+        return canonical.Intern(std::move(value), &relations);
     }
 };
 
@@ -122,6 +138,11 @@ struct RelName {
     }
 
     auto operator<=>(const RelName&) const = default;
+
+    template<typename H>
+    friend H AbslHashValue(H h, const RelName& rel_name) {
+        return H::combine(std::move(h), rel_name.name);
+    }
 };
 
 
@@ -155,6 +176,19 @@ struct RelationReference : public Relation {
     bool IsLocal() const override {
         return local;
     }
+
+    std::vector<Relation*> Children() const override {
+        return {};
+    }
+
+    size_t ParameterHash() const override {
+        return absl::HashOf(name, arity, local);
+    }
+
+    bool SameParameters(const Relation& other) const override {
+        const auto& r = static_cast<const RelationReference&>(other);
+        return (name == r.name) && (arity == r.arity) && (local == r.local);
+    }
 };
 
 using JoinOn = absl::btree_set<std::pair<Attr, Attr>>;
@@ -192,6 +226,99 @@ struct RelationJoin : public Relation {
     bool IsLocal() const override {
         return lhs->IsLocal() || rhs->IsLocal();
     }
+
+    std::vector<Relation*> Children() const override {
+        return {lhs, rhs};
+    }
+
+    size_t ParameterHash() const override {
+        return absl::HashOf(attributes);
+    }
+
+    bool SameParameters(const Relation& other) const override {
+        const auto& r = static_cast<const RelationJoin&>(other);
+        return attributes == r.attributes;
+    }
+};
+
+// The natural join of any number of relations. Attribute `j` of input `i` is
+// bound to the join variable `variables[i][j]`, and the result has one
+// attribute per variable, where attribute `v` holds the value of variable `v`.
+// Variables are numbered densely from zero.
+//
+// `variable_order` is the global order in which a worst-case optimal join
+// binds variables; when empty, variables are bound in increasing order.
+struct RelationMultiJoin : public Relation {
+    std::vector<Relation*> inputs;
+    std::vector<std::vector<int32_t>> variables;
+    AttrPermutation variable_order;
+
+    RelationMultiJoin(
+        const std::vector<Relation*>& inputs_,
+        const std::vector<std::vector<int32_t>>& variables_,
+        const AttrPermutation& variable_order_ = {})
+        : inputs(inputs_)
+        , variables(variables_)
+        , variable_order(variable_order_) {}
+
+    std::string ToString() const override {
+        std::vector<std::string> input_strings;
+        for (int32_t i = 0; i < inputs.size(); i++) {
+            input_strings.push_back(
+                absl::StrFormat("[%s] %s",
+                                absl::StrJoin(variables.at(i), ", "),
+                                inputs.at(i)->ToString()));
+        }
+        return absl::StrFormat("MultiJoin(%s)",
+                               absl::StrJoin(input_strings, ", "));
+    }
+
+    int32_t Arity() const override {
+        int32_t result_arity = 0;
+        for (int32_t i = 0; i < inputs.size(); i++) {
+            RDSS_CHECK_EQ(inputs.at(i)->Arity(), variables.at(i).size())
+                << "type error got past the typechecker";
+            for (int32_t variable : variables.at(i)) {
+                result_arity = std::max(result_arity, variable + 1);
+            }
+        }
+        return result_arity;
+    }
+
+    bool IsLocal() const override {
+        for (Relation* input : inputs) {
+            if (input->IsLocal()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::vector<Relation*> Children() const override {
+        return inputs;
+    }
+
+    size_t ParameterHash() const override {
+        return absl::HashOf(variables, variable_order);
+    }
+
+    bool SameParameters(const Relation& other) const override {
+        const auto& r = static_cast<const RelationMultiJoin&>(other);
+        return (variables == r.variables)
+            && (variable_order == r.variable_order);
+    }
+
+    // The order in which variables are bound, with the default filled in.
+    AttrPermutation VariableOrder() const {
+        if (!variable_order.empty()) {
+            return variable_order;
+        }
+        AttrPermutation result;
+        for (int32_t v = 0; v < Arity(); v++) {
+            result.push_back(v);
+        }
+        return result;
+    }
 };
 
 struct RelationSemijoin : public Relation {
@@ -223,6 +350,19 @@ struct RelationSemijoin : public Relation {
     bool IsLocal() const override {
         return lhs->IsLocal() || rhs->IsLocal();
     }
+
+    std::vector<Relation*> Children() const override {
+        return {lhs, rhs};
+    }
+
+    size_t ParameterHash() const override {
+        return absl::HashOf(attributes);
+    }
+
+    bool SameParameters(const Relation& other) const override {
+        const auto& r = static_cast<const RelationSemijoin&>(other);
+        return attributes == r.attributes;
+    }
 };
 
 struct RelationUnion : public Relation {
@@ -250,6 +390,18 @@ struct RelationUnion : public Relation {
     bool IsLocal() const override {
         return lhs->IsLocal() || rhs->IsLocal();
     }
+
+    std::vector<Relation*> Children() const override {
+        return {lhs, rhs};
+    }
+
+    size_t ParameterHash() const override {
+        return 0;
+    }
+
+    bool SameParameters(const Relation& other) const override {
+        return true;
+    }
 };
 
 struct RelationDifference : public Relation {
@@ -277,6 +429,18 @@ struct RelationDifference : public Relation {
     bool IsLocal() const override {
         return lhs->IsLocal() || rhs->IsLocal();
     }
+
+    std::vector<Relation*> Children() const override {
+        return {lhs, rhs};
+    }
+
+    size_t ParameterHash() const override {
+        return 0;
+    }
+
+    bool SameParameters(const Relation& other) const override {
+        return true;
+    }
 };
 
 struct RelationSelect : public Relation {
@@ -300,6 +464,19 @@ struct RelationSelect : public Relation {
     bool IsLocal() const override {
         return rel->IsLocal();
     }
+
+    std::vector<Relation*> Children() const override {
+        return {rel};
+    }
+
+    size_t ParameterHash() const override {
+        return predicate->structural_hash;
+    }
+
+    bool SameParameters(const Relation& other) const override {
+        const auto& r = static_cast<const RelationSelect&>(other);
+        return predicate == r.predicate;
+    }
 };
 
 struct RelationMap : public Relation {
@@ -325,6 +502,22 @@ struct RelationMap : public Relation {
     bool IsLocal() const override {
         return rel->IsLocal();
     }
+
+    std::vector<Relation*> Children() const override {
+        return {rel};
+    }
+
+    size_t ParameterHash() const override {
+        return absl::HashOf(function.name, function.arguments,
+                            function.results);
+    }
+
+    bool SameParameters(const Relation& other) const override {
+        const auto& r = static_cast<const RelationMap&>(other);
+        return (function.name == r.function.name)
+            && (function.arguments == r.function.arguments)
+            && (function.results == r.function.results);
+    }
 };
 
 struct RelationView : public Relation {
@@ -344,6 +537,51 @@ struct RelationView : public Relation {
     bool IsLocal() const override {
         return rel.IsLocal();
     }
+
+    std::vector<Relation*> Children() const override {
+        return {rel.rel};
+    }
+
+    size_t ParameterHash() const override {
+        return absl::HashOf(rel.perm);
+    }
+
+    bool SameParameters(const Relation& other) const override {
+        const auto& r = static_cast<const RelationView&>(other);
+        return rel.perm == r.rel.perm;
+    }
+};
+
+// Every tuple of `rel` exactly once, whatever its multiplicity in `rel`.
+struct RelationDistinct : public Relation {
+    Relation* rel;
+
+    explicit RelationDistinct(Relation* rel_) : rel(rel_) {}
+
+    std::string ToString() const override {
+        return absl::StrFormat("Distinct(%s)",
+                               rel->ToString());
+    }
+
+    int32_t Arity() const override {
+        return rel->Arity();
+    }
+
+    bool IsLocal() const override {
+        return rel->IsLocal();
+    }
+
+    std::vector<Relation*> Children() const override {
+        return {rel};
+    }
+
+    size_t ParameterHash() const override {
+        return 0;
+    }
+
+    bool SameParameters(const Relation& other) const override {
+        return true;
+    }
 };
 
 ////////////////////////////////////////////////////////////////////////////////
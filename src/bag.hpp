@@ -0,0 +1,113 @@
+// Copyright 2021 The RDSS Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RDSS_BAG_H_
+#define RDSS_BAG_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <absl/container/flat_hash_map.h>
+#include <absl/status/status.h>
+#include <absl/types/span.h>
+
+#include "arena.hpp"
+#include "hash_index.hpp"
+#include "macros.hpp"
+#include "table.hpp"
+
+namespace rdss {
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Operators over tables with multiplicities (see `Table`). Tables without
+// multiplicities are read as bags in which every row occurs once.
+
+// Appends every distinct tuple of `inputs` to `result` once, with the sum of
+// its multiplicities across all of `inputs`. The result has multiplicities
+// even if none of the inputs do.
+inline absl::Status Consolidate(absl::Span<const Table* const> inputs,
+                                Table* result) {
+    result->AddMultiplicities();
+    absl::flat_hash_map<Key, int32_t, KeyHash, KeyEq> rows;
+    Key key;
+    for (const Table* input : inputs) {
+        if (input->Width() != result->Width()) {
+            return absl::InternalError(
+                "given table does not match table width");
+        }
+        std::vector<Attr> all_attrs;
+        for (int32_t k = 0; k < input->Width(); k++) {
+            all_attrs.push_back(k);
+        }
+        for (int32_t i = 0; i < input->NumberOfTuples(); i++) {
+            int64_t multiplicity = input->Multiplicity(i);
+            if (multiplicity == 0) {
+                continue;
+            }
+            GatherKey(input->GetTupleView(i), all_attrs, &key);
+            auto [it, inserted] =
+                rows.try_emplace(key, result->NumberOfTuples());
+            if (inserted) {
+                RETURN_IF_ERROR(result->InsertTuple(key, multiplicity));
+            } else {
+                result->MutableMultiplicities()[it->second] += multiplicity;
+            }
+        }
+        RETURN_IF_ERROR(CheckMemoryBudget(result->Arena().get()));
+    }
+    return absl::OkStatus();
+}
+
+// Bag difference: every tuple of `lhs` occurs in the result as many times as
+// it occurs in `lhs` minus the number of times it occurs in `rhs`, if that is
+// positive.
+inline absl::Status BagDifference(const Table& lhs,
+                                  const Table& rhs,
+                                  Table* result) {
+    std::vector<Attr> all_attrs;
+    for (int32_t k = 0; k < rhs.Width(); k++) {
+        all_attrs.push_back(k);
+    }
+    absl::flat_hash_map<Key, int64_t, KeyHash, KeyEq> removed;
+    Key key;
+    for (int32_t j = 0; j < rhs.NumberOfTuples(); j++) {
+        GatherKey(rhs.GetTupleView(j), all_attrs, &key);
+        removed[key] += rhs.Multiplicity(j);
+    }
+
+    result->AddMultiplicities();
+    for (int32_t i = 0; i < lhs.NumberOfTuples(); i++) {
+        TupleView tuple = lhs.GetTupleView(i);
+        int64_t multiplicity = tuple.Multiplicity();
+        GatherKey(tuple, all_attrs, &key);
+        auto it = removed.find(key);
+        if (it != removed.end()) {
+            int64_t taken = std::min(it->second, multiplicity);
+            it->second -= taken;
+            multiplicity -= taken;
+        }
+        if (multiplicity > 0) {
+            RETURN_IF_ERROR(result->InsertTuple(key, multiplicity));
+        }
+    }
+    return CheckMemoryBudget(result->Arena().get());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace rdss
+
+#endif  // RDSS_BAG_H_
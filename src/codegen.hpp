@@ -175,6 +175,11 @@ struct Codegen {
         return absl::OkStatus();
     }
 
+    absl::Status ProcessRelationMultiJoin(RelationMultiJoin* rel) {
+        return absl::UnimplementedError(
+            "Codegen does not yet support MultiJoin");
+    }
+
     absl::Status ProcessRelationSemijoin(RelationSemijoin* rel) {
         VarName rel_name = source->Fresh();
         Type* rel_type = typing_context.at(rel);
@@ -275,6 +280,23 @@ struct Codegen {
         return absl::OkStatus();
     }
 
+    absl::Status ProcessRelationDistinct(RelationDistinct* rel) {
+        // Every relation in the generated code is a hash set already, so
+        // this only forwards the changes to its input.
+        view_relations[rel] = SimpleRelationCode(source->Fresh().name,
+                                                 typing_context.at(rel));
+
+        RETURN_IF_ERROR(this->ProcessRelation(rel->rel));
+
+        InsertionOfView(rel->rel)->body.push_back(
+            new ActionInvoke(InsertionOfView(rel)->name, {VarName("tuple")}));
+
+        DeletionOfView(rel->rel)->body.push_back(
+            new ActionInvoke(DeletionOfView(rel)->name, {VarName("tuple")}));
+
+        return absl::OkStatus();
+    }
+
     absl::Status ProcessRelationDifference(RelationDifference* rel) {
         view_relations[rel] = SimpleRelationCode(source->Fresh().name,
                                                  typing_context.at(rel));
@@ -351,6 +373,67 @@ struct Codegen {
         return absl::OkStatus();
     }
 
+    // Types `rel` and every relation it depends on that has no type yet from
+    // the types of their inputs, so that plans produced by `Rewriter` can be
+    // processed without typing their new nodes by hand. References must be
+    // typed already.
+    absl::Status InferTypes(Relation* rel) {
+        if (typing_context.contains(rel)) {
+            return absl::OkStatus();
+        }
+        for (Relation* child : rel->Children()) {
+            RETURN_IF_ERROR(this->InferTypes(child));
+        }
+        auto elements_of = [&](Relation* child) {
+            return DynamicCast<Type, TypeRow>(typing_context.at(child))
+                .value()->elements;
+        };
+
+        std::vector<Type*> elements;
+        if (auto r = DynamicCast<Relation, RelationReference>(rel)) {
+            return absl::InvalidArgumentError(absl::StrCat(
+                "no type was given for relation ", r.value()->name.ToString()));
+        } else if (auto r = DynamicCast<Relation, RelationJoin>(rel)) {
+            elements = elements_of(r.value()->lhs);
+            std::vector<Type*> rhs_elements = elements_of(r.value()->rhs);
+            std::vector<Attr> rhs_indices = RHSIndices(r.value()->attributes);
+            for (int32_t i = 0; i < rhs_elements.size(); i++) {
+                if (std::find(rhs_indices.begin(), rhs_indices.end(), i)
+                    == rhs_indices.end()) {
+                    elements.push_back(rhs_elements.at(i));
+                }
+            }
+        } else if (auto r = DynamicCast<Relation, RelationMultiJoin>(rel)) {
+            elements.resize(rel->Arity(), nullptr);
+            for (int32_t i = 0; i < r.value()->inputs.size(); i++) {
+                std::vector<Type*> input_elements =
+                    elements_of(r.value()->inputs.at(i));
+                for (int32_t j = 0; j < input_elements.size(); j++) {
+                    elements.at(r.value()->variables.at(i).at(j)) =
+                        input_elements.at(j);
+                }
+            }
+        } else if (auto r = DynamicCast<Relation, RelationMap>(rel)) {
+            return absl::UnimplementedError(
+                "cannot infer the type of a Map");
+        } else if (auto r = DynamicCast<Relation, RelationView>(rel)) {
+            elements.resize(rel->Arity(), nullptr);
+            std::vector<Type*> viewed_elements = elements_of(r.value()->rel.rel);
+            for (int32_t i = 0; i < r.value()->rel.perm.size(); i++) {
+                if (r.value()->rel.perm.at(i).has_value()) {
+                    elements.at(r.value()->rel.perm.at(i).value()) =
+                        viewed_elements.at(i);
+                }
+            }
+        } else {
+            // Every other relation has the type of its first input.
+            elements = elements_of(rel->Children().at(0));
+        }
+        typing_context[rel] = new TypeRow(elements);
+
+        return absl::OkStatus();
+    }
+
     absl::Status ProcessRelation(Relation* rel) {
         if (view_relations.contains(rel)) {
             return absl::OkStatus();
@@ -360,10 +443,14 @@ struct Codegen {
             RETURN_IF_ERROR(ProcessRelationReference(r.value()));
         } else if (auto r = DynamicCast<Relation, RelationJoin>(rel)) {
             RETURN_IF_ERROR(ProcessRelationJoin(r.value()));
+        } else if (auto r = DynamicCast<Relation, RelationMultiJoin>(rel)) {
+            RETURN_IF_ERROR(ProcessRelationMultiJoin(r.value()));
         } else if (auto r = DynamicCast<Relation, RelationSemijoin>(rel)) {
             RETURN_IF_ERROR(ProcessRelationSemijoin(r.value()));
         } else if (auto r = DynamicCast<Relation, RelationUnion>(rel)) {
             RETURN_IF_ERROR(ProcessRelationUnion(r.value()));
+        } else if (auto r = DynamicCast<Relation, RelationDistinct>(rel)) {
+            RETURN_IF_ERROR(ProcessRelationDistinct(r.value()));
         } else if (auto r = DynamicCast<Relation, RelationDifference>(rel)) {
             RETURN_IF_ERROR(ProcessRelationDifference(r.value()));
         } else if (auto r = DynamicCast<Relation, RelationSelect>(rel)) {
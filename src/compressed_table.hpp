@@ -0,0 +1,592 @@
+// Copyright 2021 The RDSS Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RDSS_COMPRESSED_TABLE_H_
+#define RDSS_COMPRESSED_TABLE_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <absl/strings/str_format.h>
+#include <absl/types/span.h>
+
+#include "ast.hpp"
+#include "filesystem/file_descriptor.hpp"
+#include "macros.hpp"
+#include "morsel.hpp"
+#include "predicate.hpp"
+#include "selection.hpp"
+#include "table.hpp"
+#include "table_file.hpp"
+#include "thread_pool.hpp"
+
+namespace rdss {
+
+////////////////////////////////////////////////////////////////////////////////
+
+constexpr int32_t kDefaultRowGroupSize = 65536;
+
+enum class ChunkEncoding : uint8_t {
+    // Every value is stored as its difference from the chunk minimum, packed
+    // into `bit_width` bits.
+    kBitPacked = 0,
+    // Runs of equal values are stored as (value, length) pairs.
+    kRunLength = 1,
+};
+
+// Describes how one column of one row group is stored, along with the zone
+// map of that column: the smallest and largest value in the row group.
+struct ChunkDescriptor {
+    ChunkEncoding encoding;
+    uint8_t bit_width;
+    uint16_t reserved;
+    Value min;
+    Value max;
+    // The number of runs, for run-length encoded chunks.
+    uint32_t runs;
+    // Where the encoded values start, relative to the start of the payload,
+    // and how many bytes they take. Offsets are multiples of 8.
+    uint64_t offset;
+    uint64_t size;
+};
+
+static_assert(sizeof(ChunkDescriptor) == 32);
+
+// A table stored in row groups of a fixed number of rows, with each column of
+// each row group compressed separately by frame-of-reference bit-packing or
+// run-length encoding, whichever is smaller. Row groups are decoded one at a
+// time, and their zone maps let scans skip row groups that cannot contain a
+// tuple they are looking for.
+//
+// A compressed table is immutable and cheap to copy. Its encoded values either
+// live in memory or are read in place from a file written by
+// `WriteCompressedTableFile`.
+class CompressedTable {
+public:
+    static CompressedTable Compress(const Table& table,
+                                    int32_t rows_per_group
+                                        = kDefaultRowGroupSize);
+
+    int32_t Width() const {
+        return width;
+    }
+
+    int32_t NumberOfTuples() const {
+        return number_of_tuples;
+    }
+
+    int32_t RowsPerGroup() const {
+        return rows_per_group;
+    }
+
+    int32_t NumberOfRowGroups() const {
+        return (number_of_tuples + rows_per_group - 1) / rows_per_group;
+    }
+
+    int32_t RowGroupSize(int32_t group) const {
+        return std::min(rows_per_group,
+                        number_of_tuples - group * rows_per_group);
+    }
+
+    const ChunkDescriptor& Chunk(int32_t group, Attr attr) const {
+        return chunks[group * width + attr];
+    }
+
+    // The number of bytes taken by the encoded values.
+    uint64_t PayloadSize() const {
+        return payload_size;
+    }
+
+    // Decodes column `attr` of row group `group` into `out`, which must have
+    // room for `RowGroupSize(group)` values.
+    absl::Status DecodeColumn(int32_t group, Attr attr, Value* out) const;
+
+    // Appends the tuples of row group `group` to `result`.
+    absl::Status DecodeRowGroup(int32_t group, Table* result) const {
+        int32_t n = RowGroupSize(group);
+        std::vector<Value*> destination = result->Extend(n);
+        for (int32_t k = 0; k < width; k++) {
+            RETURN_IF_ERROR(DecodeColumn(group, k, destination[k]));
+        }
+        return absl::OkStatus();
+    }
+
+    // Appends every tuple to `result`.
+    absl::Status Decompress(Table* result) const {
+        for (int32_t g = 0; g < NumberOfRowGroups(); g++) {
+            RETURN_IF_ERROR(DecodeRowGroup(g, result));
+        }
+        return absl::OkStatus();
+    }
+
+private:
+    friend absl::Status WriteCompressedTableFile(
+        const CompressedTable& table, const std::filesystem::path& path);
+    friend absl::StatusOr<CompressedTable> MapCompressedTableFile(
+        const std::filesystem::path& path);
+
+    CompressedTable(int32_t width_,
+                    int32_t number_of_tuples_,
+                    int32_t rows_per_group_,
+                    std::vector<ChunkDescriptor> chunks_,
+                    const uint8_t* payload_,
+                    uint64_t payload_size_,
+                    std::shared_ptr<const void> storage_)
+        : width(width_)
+        , number_of_tuples(number_of_tuples_)
+        , rows_per_group(rows_per_group_)
+        , chunks(std::move(chunks_))
+        , payload(payload_)
+        , payload_size(payload_size_)
+        , storage(std::move(storage_)) {}
+
+    int32_t width;
+    int32_t number_of_tuples;
+    int32_t rows_per_group;
+    // Row-major: the chunk of column `k` of row group `g` is at
+    // `g * width + k`.
+    std::vector<ChunkDescriptor> chunks;
+    const uint8_t* payload;
+    uint64_t payload_size;
+    // Keeps `payload` alive.
+    std::shared_ptr<const void> storage;
+};
+
+namespace internal {
+
+inline int32_t BitWidth(uint32_t range) {
+    int32_t bits = 0;
+    while ((bits < 32) && ((range >> bits) != 0)) {
+        bits++;
+    }
+    return bits;
+}
+
+inline uint64_t BitPackedSize(int32_t n, int32_t bit_width) {
+    return (uint64_t(n) * bit_width + 63) / 64 * 8;
+}
+
+// Appends the encoding of `values` to `payload`, which is kept a multiple of
+// 8 bytes long, and returns its descriptor.
+inline ChunkDescriptor EncodeChunk(absl::Span<const Value> values,
+                                   std::vector<uint64_t>* payload) {
+    ChunkDescriptor chunk;
+    std::memset(&chunk, 0, sizeof(chunk));
+    chunk.min = values.empty() ? 0 : values[0];
+    chunk.max = chunk.min;
+    uint32_t runs = 0;
+    for (int32_t i = 0; i < values.size(); i++) {
+        chunk.min = std::min(chunk.min, values[i]);
+        chunk.max = std::max(chunk.max, values[i]);
+        if ((i == 0) || (values[i] != values[i - 1])) {
+            runs++;
+        }
+    }
+    chunk.bit_width = BitWidth(uint32_t(chunk.max) - uint32_t(chunk.min));
+    chunk.offset = payload->size() * 8;
+
+    uint64_t packed_size = BitPackedSize(values.size(), chunk.bit_width);
+    uint64_t run_length_size = uint64_t(runs) * 8;
+    if (run_length_size < packed_size) {
+        chunk.encoding = ChunkEncoding::kRunLength;
+        chunk.runs = runs;
+        chunk.size = run_length_size;
+        for (int32_t i = 0; i < values.size();) {
+            int32_t j = i;
+            while ((j < values.size()) && (values[j] == values[i])) {
+                j++;
+            }
+            payload->push_back(uint64_t(uint32_t(values[i]))
+                               | (uint64_t(j - i) << 32));
+            i = j;
+        }
+    } else {
+        chunk.encoding = ChunkEncoding::kBitPacked;
+        chunk.size = packed_size;
+        size_t first_word = payload->size();
+        payload->resize(first_word + packed_size / 8, 0);
+        uint64_t* words = payload->data() + first_word;
+        int32_t bits = chunk.bit_width;
+        for (int32_t i = 0; (bits > 0) && (i < values.size()); i++) {
+            uint64_t delta = uint32_t(values[i]) - uint32_t(chunk.min);
+            uint64_t bit = uint64_t(i) * bits;
+            uint64_t shift = bit % 64;
+            words[bit / 64] |= delta << shift;
+            if (shift + bits > 64) {
+                words[bit / 64 + 1] |= delta >> (64 - shift);
+            }
+        }
+    }
+    return chunk;
+}
+
+}  // namespace internal
+
+inline CompressedTable CompressedTable::Compress(const Table& table,
+                                                 int32_t rows_per_group) {
+    RDSS_CHECK_GT(rows_per_group, 0);
+    int32_t n = table.NumberOfTuples();
+    auto payload = std::make_shared<std::vector<uint64_t>>();
+    std::vector<ChunkDescriptor> chunks;
+    for (int32_t begin = 0; begin < n; begin += rows_per_group) {
+        int32_t size = std::min(rows_per_group, n - begin);
+        for (int32_t k = 0; k < table.Width(); k++) {
+            chunks.push_back(internal::EncodeChunk(
+                table.Column(k).subspan(begin, size), payload.get()));
+        }
+    }
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(payload->data());
+    uint64_t size = payload->size() * 8;
+    return CompressedTable(table.Width(), n, rows_per_group,
+                           std::move(chunks), data, size, std::move(payload));
+}
+
+inline absl::Status CompressedTable::DecodeColumn(int32_t group,
+                                                  Attr attr,
+                                                  Value* out) const {
+    const ChunkDescriptor& chunk = Chunk(group, attr);
+    const uint64_t* words =
+        reinterpret_cast<const uint64_t*>(payload + chunk.offset);
+    int32_t n = RowGroupSize(group);
+    switch (chunk.encoding) {
+        case ChunkEncoding::kBitPacked: {
+            int32_t bits = chunk.bit_width;
+            if (bits == 0) {
+                std::fill(out, out + n, chunk.min);
+                return absl::OkStatus();
+            }
+            uint64_t mask = (bits == 64) ? ~uint64_t(0)
+                                         : (uint64_t(1) << bits) - 1;
+            for (int32_t i = 0; i < n; i++) {
+                uint64_t bit = uint64_t(i) * bits;
+                uint64_t shift = bit % 64;
+                uint64_t delta = words[bit / 64] >> shift;
+                if (shift + bits > 64) {
+                    delta |= words[bit / 64 + 1] << (64 - shift);
+                }
+                out[i] = Value(uint32_t(chunk.min) + uint32_t(delta & mask));
+            }
+            return absl::OkStatus();
+        }
+        case ChunkEncoding::kRunLength: {
+            int32_t i = 0;
+            for (uint32_t r = 0; r < chunk.runs; r++) {
+                Value value = Value(uint32_t(words[r]));
+                int32_t length = int32_t(words[r] >> 32);
+                if (length > n - i) {
+                    return absl::DataLossError(
+                        "run-length encoded chunk is longer than its row "
+                        "group");
+                }
+                std::fill(out + i, out + i + length, value);
+                i += length;
+            }
+            if (i != n) {
+                return absl::DataLossError(
+                    "run-length encoded chunk is shorter than its row group");
+            }
+            return absl::OkStatus();
+        }
+    }
+    return absl::DataLossError("unknown chunk encoding");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// A compressed table file holds a `CompressedTableHeader`, then the
+// descriptors of every chunk in the order `CompressedTable::Chunk` uses, and
+// then, starting at `payload_offset`, the encoded values.
+
+constexpr char kCompressedTableFileMagic[8] =
+    {'R', 'D', 'S', 'S', 'C', 'T', 'B', '\0'};
+
+constexpr uint32_t kCompressedTableFileVersion = 1;
+
+struct CompressedTableHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t width;
+    uint32_t rows_per_group;
+    uint64_t number_of_tuples;
+    uint64_t payload_offset;
+    uint64_t payload_size;
+    uint8_t padding[16];
+};
+
+static_assert(sizeof(CompressedTableHeader) == 64);
+
+inline absl::Status WriteCompressedTableFile(
+    const CompressedTable& table, const std::filesystem::path& path) {
+    CompressedTableHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, kCompressedTableFileMagic, sizeof(header.magic));
+    header.version = kCompressedTableFileVersion;
+    header.byte_order = kTableFileByteOrder;
+    header.width = table.width;
+    header.rows_per_group = table.rows_per_group;
+    header.number_of_tuples = table.number_of_tuples;
+    header.payload_offset =
+        sizeof(header) + table.chunks.size() * sizeof(ChunkDescriptor);
+    header.payload_size = table.payload_size;
+
+    FileDescriptor fd(
+        open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0664));
+    if (fd.get() == -1) {
+        return internal::TableFileErrno(path, "open");
+    }
+    RETURN_IF_ERROR(
+        internal::WriteAll(fd.get(), &header, sizeof(header), path));
+    RETURN_IF_ERROR(internal::WriteAll(
+        fd.get(), table.chunks.data(),
+        table.chunks.size() * sizeof(ChunkDescriptor), path));
+    return internal::WriteAll(
+        fd.get(), table.payload, table.payload_size, path);
+}
+
+// Maps the compressed table file at `path` into memory. Encoded values are
+// read in place, so only the row groups a query decodes are read from disk.
+inline absl::StatusOr<CompressedTable> MapCompressedTableFile(
+    const std::filesystem::path& path) {
+    FileDescriptor fd(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd.get() == -1) {
+        if (errno == ENOENT) {
+            return absl::NotFoundError(absl::StrFormat(
+                "no table file at %s", path.string()));
+        }
+        return internal::TableFileErrno(path, "open");
+    }
+    struct stat info;
+    if (fstat(fd.get(), &info) != 0) {
+        return internal::TableFileErrno(path, "fstat");
+    }
+    uint64_t size = info.st_size;
+    if (size < sizeof(CompressedTableHeader)) {
+        return internal::TableFileError(path, "file is too short");
+    }
+
+    void* address = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd.get(), 0);
+    if (address == MAP_FAILED) {
+        return internal::TableFileErrno(path, "mmap");
+    }
+    std::shared_ptr<const void> mapping(
+        address, [size](const void* pointer) {
+            munmap(const_cast<void*>(pointer), size);
+        });
+    const uint8_t* bytes = static_cast<const uint8_t*>(address);
+
+    CompressedTableHeader header;
+    std::memcpy(&header, bytes, sizeof(header));
+    if (std::memcmp(header.magic, kCompressedTableFileMagic,
+                    sizeof(header.magic)) != 0) {
+        return internal::TableFileError(path, "bad magic number");
+    }
+    if (header.version != kCompressedTableFileVersion) {
+        return internal::TableFileError(path, absl::StrFormat(
+            "unsupported version %d", header.version));
+    }
+    if (header.byte_order != kTableFileByteOrder) {
+        return internal::TableFileError(path, "wrong byte order");
+    }
+    if ((header.number_of_tuples > std::numeric_limits<int32_t>::max())
+        || (header.rows_per_group == 0)
+        || (header.rows_per_group > std::numeric_limits<int32_t>::max())) {
+        return internal::TableFileError(path, "bad row groups");
+    }
+    if (header.width > std::numeric_limits<int32_t>::max()) {
+        return internal::TableFileError(path, absl::StrFormat(
+            "width %d is too large", header.width));
+    }
+
+    uint64_t groups = (header.number_of_tuples + header.rows_per_group - 1)
+        / header.rows_per_group;
+    uint64_t number_of_chunks;
+    uint64_t descriptors_size;
+    if (!internal::CheckedMultiply(groups, header.width, &number_of_chunks)
+        || !internal::CheckedMultiply(number_of_chunks,
+                                      sizeof(ChunkDescriptor),
+                                      &descriptors_size)
+        || (descriptors_size > size - sizeof(header))
+        || (header.payload_offset != sizeof(header) + descriptors_size)
+        || (header.payload_offset % 8 != 0)
+        || (header.payload_size != size - header.payload_offset)) {
+        return internal::TableFileError(
+            path, "file size does not match its header");
+    }
+
+    std::vector<ChunkDescriptor> chunks(number_of_chunks);
+    std::memcpy(chunks.data(), bytes + sizeof(header), descriptors_size);
+    for (const ChunkDescriptor& chunk : chunks) {
+        if ((chunk.offset % 8 != 0)
+            || (chunk.offset > header.payload_size)
+            || (chunk.size > header.payload_size - chunk.offset)) {
+            return internal::TableFileError(path, "chunk out of bounds");
+        }
+    }
+    for (int32_t g = 0; g < groups; g++) {
+        uint64_t rows = std::min<uint64_t>(
+            header.rows_per_group,
+            header.number_of_tuples - g * header.rows_per_group);
+        for (int32_t k = 0; k < header.width; k++) {
+            const ChunkDescriptor& chunk =
+                chunks[uint64_t(g) * header.width + k];
+            uint64_t expected =
+                (chunk.encoding == ChunkEncoding::kRunLength)
+                ? uint64_t(chunk.runs) * 8
+                : internal::BitPackedSize(rows, chunk.bit_width);
+            if ((chunk.bit_width > 32) || (chunk.size != expected)) {
+                return internal::TableFileError(path, "bad chunk size");
+            }
+        }
+    }
+
+    return CompressedTable(header.width, header.number_of_tuples,
+                           header.rows_per_group, std::move(chunks),
+                           bytes + header.payload_offset,
+                           header.payload_size, std::move(mapping));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// What the zone maps of a row group say about a predicate.
+enum class ZoneMatch {
+    // No tuple in the row group satisfies the predicate.
+    kNone,
+    // Some tuples might.
+    kSome,
+    // Every tuple does.
+    kAll,
+};
+
+// Decides, from zone maps alone, whether the tuples of row group `group`
+// satisfy `predicate`. Conservative: answers `kSome` whenever it cannot tell.
+inline ZoneMatch MatchRowGroup(Predicate* predicate,
+                               const CompressedTable& table,
+                               int32_t group) {
+    if (auto p = DynamicCast<Predicate, PredicateAnd>(predicate)) {
+        ZoneMatch result = ZoneMatch::kAll;
+        for (Predicate* child : p.value()->children) {
+            ZoneMatch child_match = MatchRowGroup(child, table, group);
+            if (child_match == ZoneMatch::kNone) {
+                return ZoneMatch::kNone;
+            }
+            if (child_match == ZoneMatch::kSome) {
+                result = ZoneMatch::kSome;
+            }
+        }
+        return result;
+    } else if (auto p = DynamicCast<Predicate, PredicateOr>(predicate)) {
+        ZoneMatch result = ZoneMatch::kNone;
+        for (Predicate* child : p.value()->children) {
+            ZoneMatch child_match = MatchRowGroup(child, table, group);
+            if (child_match == ZoneMatch::kAll) {
+                return ZoneMatch::kAll;
+            }
+            if (child_match == ZoneMatch::kSome) {
+                result = ZoneMatch::kSome;
+            }
+        }
+        return result;
+    } else if (auto p = DynamicCast<Predicate, PredicateNot>(predicate)) {
+        switch (MatchRowGroup(p.value()->pred, table, group)) {
+            case ZoneMatch::kNone: return ZoneMatch::kAll;
+            case ZoneMatch::kSome: return ZoneMatch::kSome;
+            case ZoneMatch::kAll: return ZoneMatch::kNone;
+        }
+    } else if (auto p = DynamicCast<Predicate, PredicateLessThan>(predicate)) {
+        const ChunkDescriptor& chunk = table.Chunk(group, p.value()->attr);
+        if (chunk.max < p.value()->integer) {
+            return ZoneMatch::kAll;
+        }
+        if (chunk.min >= p.value()->integer) {
+            return ZoneMatch::kNone;
+        }
+    } else if (auto p = DynamicCast<Predicate, PredicateEquals>(predicate)) {
+        const ChunkDescriptor& chunk = table.Chunk(group, p.value()->attr);
+        if ((p.value()->integer < chunk.min)
+            || (p.value()->integer > chunk.max)) {
+            return ZoneMatch::kNone;
+        }
+        if ((chunk.min == chunk.max) && (chunk.min == p.value()->integer)) {
+            return ZoneMatch::kAll;
+        }
+    }
+    return ZoneMatch::kSome;
+}
+
+// Appends the tuples of `table` that satisfy `predicate` to `result`. Row
+// groups that the zone maps rule out are not decoded at all, and row groups
+// that they show to match entirely are decoded without evaluating the
+// predicate. Row groups are scanned concurrently when a pool is given.
+inline absl::Status SelectCompressed(Predicate* predicate,
+                                     const CompressedTable& table,
+                                     ThreadPool* pool,
+                                     Table* result) {
+    int32_t groups = table.NumberOfRowGroups();
+    std::vector<Table> chunks;
+    chunks.reserve(groups);
+    for (int32_t g = 0; g < groups; g++) {
+        chunks.emplace_back(table.Width(), result->Arena());
+    }
+    std::vector<absl::Status> statuses(groups);
+    ParallelFor(pool, groups, [&](int32_t g) {
+        ZoneMatch match = MatchRowGroup(predicate, table, g);
+        if (match == ZoneMatch::kNone) {
+            return;
+        }
+        if (match == ZoneMatch::kAll) {
+            statuses[g] = table.DecodeRowGroup(g, &chunks[g]);
+            return;
+        }
+        Table decoded(table.Width());
+        statuses[g] = table.DecodeRowGroup(g, &decoded);
+        if (!statuses[g].ok()) {
+            return;
+        }
+        absl::StatusOr<Bitmap> selected =
+            EvaluatePredicate(predicate, decoded);
+        statuses[g] = selected.ok()
+            ? chunks[g].AppendRows(decoded, selected->SetIndices())
+            : selected.status();
+    });
+    for (const absl::Status& status : statuses) {
+        RETURN_IF_ERROR(status);
+    }
+
+    std::vector<const Table*> chunk_pointers;
+    for (const Table& chunk : chunks) {
+        chunk_pointers.push_back(&chunk);
+    }
+    RETURN_IF_ERROR(ConcatenateTables(pool, chunk_pointers, result));
+    return CheckMemoryBudget(result->Arena().get());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace rdss
+
+#endif  // RDSS_COMPRESSED_TABLE_H_
@@ -0,0 +1,111 @@
+// Copyright 2021 The RDSS Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RDSS_CURSOR_H_
+#define RDSS_CURSOR_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+
+#include <absl/container/btree_map.h>
+#include <absl/container/node_hash_map.h>
+#include <absl/status/statusor.h>
+
+#include "ast.hpp"
+#include "macros.hpp"
+#include "pipeline.hpp"
+#include "table.hpp"
+
+namespace rdss {
+
+////////////////////////////////////////////////////////////////////////////////
+
+// The tables a pipeline scans, owned by the cursor reading from it so that
+// the pipeline stays valid after the interpreter drops or replaces them.
+// Copies share column buffers, so holding these costs no tuple copies.
+struct PipelineInputs {
+    absl::btree_map<RelName, Table> variables;
+    absl::node_hash_map<Relation*, Table> materialized;
+};
+
+// Iterates over the result of a query one batch at a time. A cursor either
+// walks a result that has already been computed, handing out slices of its
+// buffers without copying them, or pulls batches from a pipeline, in which
+// case the first rows are available before the rest of the result has been
+// computed and the result is never materialized.
+//
+//     ASSIGN_OR_RETURN(Cursor cursor, interpreter.Open(rel));
+//     while (true) {
+//         ASSIGN_OR_RETURN(bool more, cursor.Next());
+//         if (!more) { break; }
+//         TableSlice batch = cursor.Batch();
+//         ...
+//     }
+class Cursor {
+public:
+    // Iterates over a stored result.
+    explicit Cursor(Table table_)
+        : table(std::move(table_))
+        , op()
+        , inputs()
+        , begin(0)
+        , end(0) {}
+
+    // Iterates over the output of `op_`, which reads only from `inputs_`.
+    Cursor(std::unique_ptr<Operator> op_,
+           std::unique_ptr<PipelineInputs> inputs_)
+        : table(op_->Width())
+        , op(std::move(op_))
+        , inputs(std::move(inputs_))
+        , begin(0)
+        , end(0) {}
+
+    // Advances to the next nonempty batch of at most `kBatchSize` tuples.
+    // Returns false once the result is exhausted.
+    absl::StatusOr<bool> Next() {
+        if (op != nullptr) {
+            ASSIGN_OR_RETURN(bool more, op->Next(&table));
+            begin = 0;
+            end = table.NumberOfTuples();
+            return more;
+        }
+        begin = end;
+        end = std::min(table.NumberOfTuples(), begin + kBatchSize);
+        return begin < end;
+    }
+
+    // The current batch, which stays valid until the next call to `Next`.
+    TableSlice Batch() const {
+        return TableSlice(&table, begin, end);
+    }
+
+    int32_t Width() const {
+        return table.Width();
+    }
+
+private:
+    // The stored result, or the buffer that pipeline batches are pulled into.
+    Table table;
+    std::unique_ptr<Operator> op;
+    std::unique_ptr<PipelineInputs> inputs;
+    int32_t begin;
+    int32_t end;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace rdss
+
+#endif  // RDSS_CURSOR_H_
@@ -0,0 +1,218 @@
+// Copyright 2021 The RDSS Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RDSS_DELIMITED_TEXT_H_
+#define RDSS_DELIMITED_TEXT_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <absl/strings/str_format.h>
+#include <absl/strings/string_view.h>
+
+#include "filesystem/filesystem.hpp"
+#include "macros.hpp"
+#include "morsel.hpp"
+#include "statistics.hpp"
+#include "table.hpp"
+#include "thread_pool.hpp"
+
+namespace rdss {
+
+////////////////////////////////////////////////////////////////////////////////
+
+struct DelimitedTextOptions {
+    // ',' for CSV, '\t' for TSV.
+    char delimiter = ',';
+
+    // Whether the first line names the columns and should be skipped.
+    bool header = false;
+
+    // When set, chunks of the input are parsed concurrently.
+    ThreadPool* thread_pool = nullptr;
+
+    // The approximate number of bytes parsed as one unit of work.
+    int64_t chunk_size = int64_t(1) << 22;
+
+    // When set, brought up to date with the loaded table once the text has
+    // been parsed (see `TableStatistics::Update`).
+    TableStatistics* statistics = nullptr;
+};
+
+namespace internal {
+
+// Parses the lines in `[begin, end)`, which must start at the beginning of a
+// line, into `result`. Each line must hold exactly `result->Width()` integers
+// separated by `delimiter`; empty lines are skipped, and a line may end in
+// "\r\n", or in "\r" at the end of the input. On error, `*error_position`
+// is set to where parsing stopped.
+inline absl::Status ParseDelimitedChunk(const char* begin,
+                                        const char* end,
+                                        char delimiter,
+                                        Table* result,
+                                        const char** error_position) {
+    int32_t width = result->Width();
+    result->Reserve(std::count(begin, end, '\n') + 1);
+    std::vector<Value> tuple(width);
+    const char* p = begin;
+    while (p < end) {
+        if (*p == '\n') {
+            p++;
+            continue;
+        }
+        if ((*p == '\r') && ((p + 1 == end) || (p[1] == '\n'))) {
+            p++;
+            continue;
+        }
+        for (int32_t k = 0; k < width; k++) {
+            // The magnitude saturates just above the range of `Value`, so
+            // that leading zeros are accepted and the range is checked once
+            // per field rather than once per digit.
+            bool negative = (p < end) && (*p == '-');
+            p += ((p < end) && ((*p == '-') || (*p == '+')));
+            const char* digits = p;
+            uint64_t magnitude = 0;
+            while ((p < end) && (uint8_t(*p - '0') < 10)) {
+                magnitude = std::min<uint64_t>(
+                    magnitude * 10 + uint8_t(*p - '0'), uint64_t(1) << 32);
+                p++;
+            }
+            if (p == digits) {
+                *error_position = p;
+                return absl::InvalidArgumentError("expected an integer");
+            }
+            int64_t value = negative ? -int64_t(magnitude) : magnitude;
+            if ((value < std::numeric_limits<Value>::min())
+                || (value > std::numeric_limits<Value>::max())) {
+                *error_position = digits;
+                return absl::InvalidArgumentError("integer out of range");
+            }
+            tuple[k] = Value(value);
+
+            bool last = (k + 1 == width);
+            p += (last && (p < end) && (*p == '\r'));
+            if ((p == end) || (*p == '\n')) {
+                if (!last) {
+                    *error_position = p;
+                    return absl::InvalidArgumentError("too few fields");
+                }
+            } else if (last || (*p != delimiter)) {
+                *error_position = p;
+                return absl::InvalidArgumentError(
+                    last ? "too many fields"
+                         : absl::StrFormat("expected '%c'", delimiter));
+            }
+            p += (p < end);
+        }
+        RETURN_IF_ERROR(result->InsertTuple(tuple));
+    }
+    return absl::OkStatus();
+}
+
+}  // namespace internal
+
+// Appends the tuples of the delimited text `text` to `result`. The text is
+// split into chunks at line boundaries, the chunks are parsed into tables of
+// their own (concurrently when a pool is given), and the tables are then
+// concatenated in order, so the tuples keep the order of their lines.
+inline absl::Status ParseDelimitedText(absl::string_view text,
+                                       const DelimitedTextOptions& options,
+                                       Table* result) {
+    if (result->Width() == 0) {
+        return absl::InvalidArgumentError(
+            "cannot load delimited text into a table with no columns");
+    }
+    const char* begin = text.data();
+    const char* end = text.data() + text.size();
+    if (options.header) {
+        const char* newline =
+            static_cast<const char*>(std::memchr(begin, '\n', end - begin));
+        begin = (newline == nullptr) ? end : newline + 1;
+    }
+
+    std::vector<const char*> boundaries = {begin};
+    while (boundaries.back() < end) {
+        const char* next = boundaries.back()
+            + std::min<int64_t>(std::max<int64_t>(options.chunk_size, 1),
+                                end - boundaries.back());
+        if (next < end) {
+            const char* newline =
+                static_cast<const char*>(std::memchr(next, '\n', end - next));
+            next = (newline == nullptr) ? end : newline + 1;
+        }
+        boundaries.push_back(next);
+    }
+
+    int32_t num_chunks = boundaries.size() - 1;
+    std::vector<Table> chunks;
+    chunks.reserve(num_chunks);
+    for (int32_t c = 0; c < num_chunks; c++) {
+        chunks.emplace_back(result->Width(), result->Arena());
+    }
+    std::vector<absl::Status> statuses(num_chunks);
+    std::vector<const char*> error_positions(num_chunks);
+    ParallelFor(options.thread_pool, num_chunks, [&](int32_t c) {
+        statuses[c] = internal::ParseDelimitedChunk(
+            boundaries[c], boundaries[c + 1], options.delimiter,
+            &chunks[c], &error_positions[c]);
+    });
+
+    int64_t total = result->NumberOfTuples();
+    for (int32_t c = 0; c < num_chunks; c++) {
+        if (!statuses[c].ok()) {
+            const char* position = error_positions[c];
+            int64_t line = std::count(text.data(), position, '\n') + 1;
+            return absl::InvalidArgumentError(absl::StrFormat(
+                "line %d: %s", line, statuses[c].message()));
+        }
+        total += chunks[c].NumberOfTuples();
+    }
+    if (total > std::numeric_limits<int32_t>::max()) {
+        return absl::ResourceExhaustedError(
+            "delimited text holds too many tuples for a table");
+    }
+
+    std::vector<const Table*> chunk_pointers;
+    for (const Table& chunk : chunks) {
+        chunk_pointers.push_back(&chunk);
+    }
+    RETURN_IF_ERROR(
+        ConcatenateTables(options.thread_pool, chunk_pointers, result));
+    if (options.statistics != nullptr) {
+        RETURN_IF_ERROR(
+            options.statistics->Update(*result, options.thread_pool));
+    }
+    return CheckMemoryBudget(result->Arena().get());
+}
+
+// Appends the tuples of the delimited text file at `path` to `result`.
+inline absl::Status LoadDelimitedFile(const std::filesystem::path& path,
+                                      const DelimitedTextOptions& options,
+                                      Table* result) {
+    ASSIGN_OR_RETURN(std::string contents, GetFileContents(path));
+    return ParseDelimitedText(contents, options, result);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace rdss
+
+#endif  // RDSS_DELIMITED_TEXT_H_
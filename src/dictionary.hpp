@@ -0,0 +1,143 @@
+// Copyright 2021 The RDSS Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RDSS_DICTIONARY_H_
+#define RDSS_DICTIONARY_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <absl/base/thread_annotations.h>
+#include <absl/container/flat_hash_map.h>
+#include <absl/strings/string_view.h>
+#include <absl/synchronization/mutex.h>
+#include <absl/types/optional.h>
+
+#include "logging/logging.hpp"
+
+namespace rdss {
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Whether `string` matches the SQL LIKE pattern `pattern`, in which `%`
+// matches any sequence of characters and `_` matches any single character.
+inline bool MatchesLikePattern(absl::string_view string,
+                               absl::string_view pattern) {
+    // Greedy matching with backtracking to the most recent `%`, which is
+    // linear in the common cases and never worse than quadratic.
+    size_t s = 0;
+    size_t p = 0;
+    size_t star_pattern = absl::string_view::npos;
+    size_t star_string = 0;
+    while (s < string.size()) {
+        if ((p < pattern.size())
+            && ((pattern[p] == '_') || (pattern[p] == string[s]))) {
+            s++;
+            p++;
+        } else if ((p < pattern.size()) && (pattern[p] == '%')) {
+            star_pattern = p++;
+            star_string = s;
+        } else if (star_pattern != absl::string_view::npos) {
+            p = star_pattern + 1;
+            s = ++star_string;
+        } else {
+            return false;
+        }
+    }
+    while ((p < pattern.size()) && (pattern[p] == '%')) {
+        p++;
+    }
+    return p == pattern.size();
+}
+
+// Assigns the distinct strings of a column consecutive integer codes, so that
+// the column can be stored, joined and compared for equality as integers.
+// Columns that are meant to be joined must share a dictionary.
+//
+// A dictionary is filled with `Encode` before it is shared; once shared, it
+// may be read by any number of threads at once.
+class StringDictionary {
+public:
+    StringDictionary() = default;
+
+    StringDictionary(const StringDictionary&) = delete;
+    StringDictionary& operator=(const StringDictionary&) = delete;
+
+    // Returns the code of `string`, assigning it the next code if it has
+    // none yet.
+    int32_t Encode(absl::string_view string) {
+        auto [it, inserted] = codes.try_emplace(string, strings.size());
+        if (inserted) {
+            strings.emplace_back(string);
+            absl::MutexLock lock(&mutex);
+            like_matches.clear();
+        }
+        return it->second;
+    }
+
+    absl::optional<int32_t> Find(absl::string_view string) const {
+        auto it = codes.find(string);
+        if (it == codes.end()) {
+            return absl::nullopt;
+        }
+        return it->second;
+    }
+
+    const std::string& Decode(int32_t code) const {
+        RDSS_CHECK_GE(code, 0);
+        RDSS_CHECK_LT(code, strings.size());
+        return strings[code];
+    }
+
+    int32_t Size() const {
+        return strings.size();
+    }
+
+    // Returns, for every code, whether its string matches the LIKE pattern
+    // `pattern`. Each pattern is matched against each distinct string once;
+    // the result is cached and shared by every later query for the pattern.
+    std::shared_ptr<const std::vector<bool>> MatchLike(
+        const std::string& pattern) const {
+        {
+            absl::MutexLock lock(&mutex);
+            if (like_matches.contains(pattern)) {
+                return like_matches.at(pattern);
+            }
+        }
+        auto matches = std::make_shared<std::vector<bool>>(strings.size());
+        for (int32_t code = 0; code < strings.size(); code++) {
+            (*matches)[code] = MatchesLikePattern(strings[code], pattern);
+        }
+        absl::MutexLock lock(&mutex);
+        return like_matches.try_emplace(pattern, std::move(matches))
+            .first->second;
+    }
+
+private:
+    std::vector<std::string> strings;
+    absl::flat_hash_map<std::string, int32_t> codes;
+
+    mutable absl::Mutex mutex;
+    mutable absl::flat_hash_map<std::string,
+                                std::shared_ptr<const std::vector<bool>>>
+        like_matches ABSL_GUARDED_BY(mutex);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace rdss
+
+#endif  // RDSS_DICTIONARY_H_
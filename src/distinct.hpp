@@ -0,0 +1,210 @@
+// Copyright 2021 The RDSS Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RDSS_DISTINCT_H_
+#define RDSS_DISTINCT_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <absl/container/flat_hash_set.h>
+#include <absl/status/status.h>
+
+#include "arena.hpp"
+#include "macros.hpp"
+#include "morsel.hpp"
+#include "table.hpp"
+#include "thread_pool.hpp"
+
+namespace rdss {
+
+////////////////////////////////////////////////////////////////////////////////
+
+// The number of tuples `Distinct` aims to put in one partition, so that the
+// hash set deduplicating a partition stays in the L2 cache.
+constexpr int32_t kDistinctPartitionSize = 8192;
+
+// The most hash bits `Distinct` partitions on. Beyond 2^10 partitions, the
+// scatter writes to too many pages at once and start missing the TLB.
+constexpr int32_t kMaxDistinctRadixBits = 10;
+
+namespace internal {
+
+inline uint64_t MixRowHash(uint64_t hash, Value value) {
+    return (hash ^ uint32_t(value)) * 0x9e3779b97f4a7c15;
+}
+
+// The finalizer of MurmurHash3, which spreads every input bit over the top
+// bits that partitions are chosen by.
+inline uint64_t FinalizeRowHash(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccd;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// Hashes and compares rows of a table by index, with the hashes computed
+// ahead of time.
+struct RowIndexHash {
+    const uint64_t* hashes;
+
+    size_t operator()(int32_t row) const {
+        return hashes[row];
+    }
+};
+
+struct RowIndexEq {
+    const std::vector<const Value*>* columns;
+
+    bool operator()(int32_t lhs, int32_t rhs) const {
+        for (const Value* column : *columns) {
+            if (column[lhs] != column[rhs]) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+}  // namespace internal
+
+// Appends every distinct tuple of `input` to `result` once. Tuples with a
+// multiplicity of zero are skipped, and the result has no multiplicities.
+//
+// The tuples are radix-partitioned on the top bits of their hash into
+// partitions of about `kDistinctPartitionSize` tuples, and each partition is
+// deduplicated with a hash set of its own. When a pool is given, the hashing,
+// the partitioning and the partitions are all spread over it. The result is
+// ordered by partition and then by first occurrence in `input`, which does
+// not depend on the pool.
+inline absl::Status Distinct(const Table& input,
+                             ThreadPool* pool,
+                             Table* result) {
+    if (input.Width() != result->Width()) {
+        return absl::InternalError("given table does not match table width");
+    }
+    int32_t size = input.NumberOfTuples();
+    std::vector<const Value*> columns;
+    for (int32_t k = 0; k < input.Width(); k++) {
+        columns.push_back(input.Column(k).data());
+    }
+
+    int32_t bits = 0;
+    while ((bits < kMaxDistinctRadixBits)
+           && ((int64_t(size) >> bits) > kDistinctPartitionSize)) {
+        bits++;
+    }
+    int32_t num_partitions = 1 << bits;
+    auto partition_of = [bits](uint64_t hash) -> int32_t {
+        return (bits == 0) ? 0 : (hash >> (64 - bits));
+    };
+
+    // Each task hashes and scatters a contiguous range of rows. There are a
+    // few tasks per thread rather than one per morsel, which keeps the
+    // per-task histograms small.
+    int32_t num_tasks = 1;
+    if (pool != nullptr) {
+        num_tasks = std::clamp<int32_t>(
+            (size + kDefaultMorselSize - 1) / kDefaultMorselSize,
+            1, 4 * pool->NumThreads());
+    }
+    auto task_begin = [&](int32_t t) -> int32_t {
+        return int64_t(size) * t / num_tasks;
+    };
+
+    std::vector<uint64_t> hashes(size);
+    std::vector<int32_t> counts(num_tasks * num_partitions, 0);
+    ParallelFor(pool, num_tasks, [&](int32_t t) {
+        int32_t begin = task_begin(t);
+        int32_t end = task_begin(t + 1);
+        std::fill(hashes.begin() + begin, hashes.begin() + end, 0);
+        for (const Value* column : columns) {
+            for (int32_t i = begin; i < end; i++) {
+                hashes[i] = internal::MixRowHash(hashes[i], column[i]);
+            }
+        }
+        int32_t* histogram = counts.data() + t * num_partitions;
+        for (int32_t i = begin; i < end; i++) {
+            hashes[i] = internal::FinalizeRowHash(hashes[i]);
+            if (input.Multiplicity(i) != 0) {
+                histogram[partition_of(hashes[i])]++;
+            }
+        }
+    });
+
+    // Within a partition, the rows of earlier tasks come first.
+    std::vector<int32_t> partition_begin(num_partitions + 1);
+    std::vector<int32_t> offsets(num_tasks * num_partitions);
+    int32_t total = 0;
+    for (int32_t p = 0; p < num_partitions; p++) {
+        partition_begin[p] = total;
+        for (int32_t t = 0; t < num_tasks; t++) {
+            offsets[t * num_partitions + p] = total;
+            total += counts[t * num_partitions + p];
+        }
+    }
+    partition_begin[num_partitions] = total;
+
+    std::vector<int32_t> rows(total);
+    ParallelFor(pool, num_tasks, [&](int32_t t) {
+        int32_t* cursor = offsets.data() + t * num_partitions;
+        for (int32_t i = task_begin(t); i < task_begin(t + 1); i++) {
+            if (input.Multiplicity(i) != 0) {
+                rows[cursor[partition_of(hashes[i])]++] = i;
+            }
+        }
+    });
+
+    std::vector<Table> chunks;
+    chunks.reserve(num_partitions);
+    for (int32_t p = 0; p < num_partitions; p++) {
+        chunks.emplace_back(result->Width(), result->Arena());
+    }
+    ParallelFor(pool, num_partitions, [&](int32_t p) {
+        absl::flat_hash_set<int32_t,
+                            internal::RowIndexHash,
+                            internal::RowIndexEq>
+            seen(partition_begin[p + 1] - partition_begin[p],
+                 internal::RowIndexHash { hashes.data() },
+                 internal::RowIndexEq { &columns });
+        std::vector<int32_t> kept;
+        for (int32_t j = partition_begin[p]; j < partition_begin[p + 1]; j++) {
+            if (seen.insert(rows[j]).second) {
+                kept.push_back(rows[j]);
+            }
+        }
+        std::vector<Value*> destination = chunks[p].Extend(kept.size());
+        for (int32_t k = 0; k < columns.size(); k++) {
+            for (int32_t j = 0; j < kept.size(); j++) {
+                destination[k][j] = columns[k][kept[j]];
+            }
+        }
+    });
+
+    std::vector<const Table*> chunk_pointers;
+    for (const Table& chunk : chunks) {
+        chunk_pointers.push_back(&chunk);
+    }
+    RETURN_IF_ERROR(ConcatenateTables(pool, chunk_pointers, result));
+    return CheckMemoryBudget(result->Arena().get());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace rdss
+
+#endif  // RDSS_DISTINCT_H_
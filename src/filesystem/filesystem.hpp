@@ -18,6 +18,8 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <string>
 #include <filesystem>
 
@@ -57,17 +59,35 @@ absl::StatusOr<std::string> GetFileContents(
         return ErrNoToStatusWithFilename(errno, file_name);
     }
 
-    char buf[4096];
-    while (ssize_t n = read(fd, buf, sizeof(buf))) {
+    // Read straight into the result, sized up front from the file size so
+    // that large files are read in a few large reads with no reallocation.
+    // Files that report no size (pipes, /proc) grow the buffer as they go.
+    struct stat info;
+    size_t capacity = 1 << 16;
+    if ((fstat(fd, &info) == 0) && (info.st_size > 0)) {
+        capacity = static_cast<size_t>(info.st_size) + 1;
+    }
+    result.resize(capacity);
+    size_t size = 0;
+    while (true) {
+        if (size == result.size()) {
+            result.resize(2 * result.size());
+        }
+        ssize_t n = read(fd, &result[size], result.size() - size);
+        if (n == 0) {
+            break;
+        }
         if (n < 0) {
-            if (errno == EAGAIN) {
+            if ((errno == EAGAIN) || (errno == EINTR)) {
                 continue;
             }
+            int read_errno = errno;
             close(fd);
-            return ErrNoToStatusWithFilename(errno, file_name);
+            return ErrNoToStatusWithFilename(read_errno, file_name);
         }
-        result.append(buf, n);
+        size += n;
     }
+    result.resize(size);
 
     if (close(fd) != 0) {
         return ErrNoToStatusWithFilename(errno, file_name);
@@ -0,0 +1,615 @@
+// Copyright 2021 The RDSS Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RDSS_FIXPOINT_H_
+#define RDSS_FIXPOINT_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <absl/container/btree_map.h>
+#include <absl/container/btree_set.h>
+#include <absl/container/flat_hash_map.h>
+#include <absl/container/flat_hash_set.h>
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <absl/strings/str_format.h>
+#include <absl/types/optional.h>
+#include <absl/types/span.h>
+
+#include "arena.hpp"
+#include "ast.hpp"
+#include "hash_index.hpp"
+#include "interpreter.hpp"
+#include "macros.hpp"
+#include "table.hpp"
+
+namespace rdss {
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace internal {
+
+// Adds the name of every relation referenced from `rel` to `names`.
+inline void CollectReferences(Relation* rel, absl::btree_set<RelName>* names) {
+    if (auto r = DynamicCast<Relation, RelationReference>(rel)) {
+        names->insert(r.value()->name);
+    }
+    for (Relation* child : rel->Children()) {
+        CollectReferences(child, names);
+    }
+}
+
+inline RelName OldName(const RelName& name) {
+    return RelName(name.ToString() + "@old");
+}
+
+inline RelName DeltaName(const RelName& name) {
+    return RelName(name.ToString() + "@delta");
+}
+
+// Builds the plans that semi-naive evaluation runs in each round of a
+// recursive loop. For a set of recursive relations, each bound under its own
+// name to its current contents `T`, under `OldName` to its contents `T_old`
+// before the last round and under `DeltaName` to the tuples `T - T_old` that
+// the last round added, the delta plan of `e` computes a superset of
+// `e(T) - e(T_old)` that is contained in `e(T)`. Only subplans that depend on
+// a recursive relation are differentiated; the others are replaced by
+// references to `constants`, which the caller evaluates once before the loop.
+// A difference whose left-hand side is recursive is not differentiated but
+// evaluated in full in every round.
+class Differentiator {
+public:
+    explicit Differentiator(const absl::btree_set<RelName>& recursive_)
+        : recursive(recursive_)
+        , factory()
+        , constants()
+        , constant_references()
+        , old_names()
+        , memo() {}
+
+    // Returns the delta plan of `rel`, or null if `rel` does not depend on a
+    // recursive relation and so never changes.
+    absl::StatusOr<Relation*> Delta(Relation* rel) {
+        if (!IsRecursive(rel)) {
+            return nullptr;
+        }
+        if (auto r = DynamicCast<Relation, RelationReference>(rel)) {
+            return Reference(DeltaName(r.value()->name), rel->Arity());
+        } else if (auto r = DynamicCast<Relation, RelationJoin>(rel)) {
+            // d(L ⋈ R) = dL ⋈ R ∪ L_old ⋈ dR, and likewise for semijoins.
+            ASSIGN_OR_RETURN(Relation* lhs_delta, Delta(r.value()->lhs));
+            ASSIGN_OR_RETURN(Relation* rhs_delta, Delta(r.value()->rhs));
+            Relation* result = nullptr;
+            if (lhs_delta != nullptr) {
+                result = factory.Make<RelationJoin>(
+                    lhs_delta, Rename(r.value()->rhs, false),
+                    r.value()->attributes);
+            }
+            if (rhs_delta != nullptr) {
+                result = Union(result, factory.Make<RelationJoin>(
+                    Rename(r.value()->lhs, true), rhs_delta,
+                    r.value()->attributes));
+            }
+            return result;
+        } else if (auto r = DynamicCast<Relation, RelationMultiJoin>(rel)) {
+            const std::vector<Relation*>& inputs = r.value()->inputs;
+            Relation* result = nullptr;
+            for (int32_t i = 0; i < inputs.size(); i++) {
+                ASSIGN_OR_RETURN(Relation* input_delta, Delta(inputs[i]));
+                if (input_delta == nullptr) {
+                    continue;
+                }
+                std::vector<Relation*> term;
+                for (int32_t j = 0; j < inputs.size(); j++) {
+                    term.push_back((j == i) ? input_delta
+                                            : Rename(inputs[j], j > i));
+                }
+                result = Union(result, factory.Make<RelationMultiJoin>(
+                    term, r.value()->variables, r.value()->variable_order));
+            }
+            return result;
+        } else if (auto r = DynamicCast<Relation, RelationSemijoin>(rel)) {
+            ASSIGN_OR_RETURN(Relation* lhs_delta, Delta(r.value()->lhs));
+            ASSIGN_OR_RETURN(Relation* rhs_delta, Delta(r.value()->rhs));
+            Relation* result = nullptr;
+            if (lhs_delta != nullptr) {
+                result = factory.Make<RelationSemijoin>(
+                    lhs_delta, Rename(r.value()->rhs, false),
+                    r.value()->attributes);
+            }
+            if (rhs_delta != nullptr) {
+                result = Union(result, factory.Make<RelationSemijoin>(
+                    Rename(r.value()->lhs, true), rhs_delta,
+                    r.value()->attributes));
+            }
+            return result;
+        } else if (auto r = DynamicCast<Relation, RelationUnion>(rel)) {
+            ASSIGN_OR_RETURN(Relation* lhs_delta, Delta(r.value()->lhs));
+            ASSIGN_OR_RETURN(Relation* rhs_delta, Delta(r.value()->rhs));
+            return Union(lhs_delta, rhs_delta);
+        } else if (auto r = DynamicCast<Relation, RelationDistinct>(rel)) {
+            ASSIGN_OR_RETURN(Relation* delta, Delta(r.value()->rel));
+            return factory.Make<RelationDistinct>(delta);
+        } else if (auto r = DynamicCast<Relation, RelationDifference>(rel)) {
+            if (IsRecursive(r.value()->rhs)) {
+                return absl::FailedPreconditionError(absl::StrFormat(
+                    "%s negates a relation defined in the same loop, so the "
+                    "loop is not stratified", rel->ToString()));
+            }
+            // Difference subtracts occurrences, so new occurrences of a
+            // tuple already in L can add it to L - R even though R holds
+            // it: {7, 7} - {7} = {7}, while {7} - {7} is empty. The rule
+            // d(L - R) = dL - R only holds for sets, so the difference is
+            // recomputed in full every round instead.
+            return Rename(rel, false);
+        } else if (auto r = DynamicCast<Relation, RelationSelect>(rel)) {
+            ASSIGN_OR_RETURN(Relation* delta, Delta(r.value()->rel));
+            return factory.Make<RelationSelect>(r.value()->predicate, delta);
+        } else if (auto r = DynamicCast<Relation, RelationMap>(rel)) {
+            return absl::UnimplementedError(
+                "semi-naive evaluation cannot support Map");
+        } else if (auto r = DynamicCast<Relation, RelationView>(rel)) {
+            ASSIGN_OR_RETURN(Relation* delta, Delta(r.value()->rel.rel));
+            return factory.Make<RelationView>(
+                Viewed<Relation*>(r.value()->rel.perm, delta));
+        }
+        return absl::InternalError(
+            "If this is reached, a new relation op has been added but no case "
+            "was added to Differentiator::Delta. Please add one.");
+    }
+
+    // The subplans that `Delta` replaced by references, by the names it
+    // gave them.
+    const std::vector<std::pair<RelName, Relation*>>& Constants() const {
+        return constants;
+    }
+
+    // The recursive relations whose old contents the delta plans refer to.
+    // Only nonlinear plans, which join a recursive relation with itself,
+    // need them.
+    const absl::btree_set<RelName>& OldNames() const {
+        return old_names;
+    }
+
+private:
+    bool IsRecursive(Relation* rel) {
+        auto it = memo.find(rel);
+        if (it != memo.end()) {
+            return it->second;
+        }
+        bool result = false;
+        if (auto r = DynamicCast<Relation, RelationReference>(rel)) {
+            result = recursive.contains(r.value()->name);
+        }
+        for (Relation* child : rel->Children()) {
+            result |= IsRecursive(child);
+        }
+        memo.insert_or_assign(rel, result);
+        return result;
+    }
+
+    Relation* Reference(const RelName& name, int32_t arity) {
+        return factory.Make<RelationReference>(name, arity);
+    }
+
+    Relation* Union(Relation* lhs, Relation* rhs) {
+        if (lhs == nullptr) {
+            return rhs;
+        }
+        if (rhs == nullptr) {
+            return lhs;
+        }
+        return factory.Make<RelationUnion>(lhs, rhs);
+    }
+
+    // Returns `rel` with references to recursive relations redirected to
+    // their old contents if `old` is set, and with every subplan that does
+    // not depend on a recursive relation replaced by a constant.
+    Relation* Rename(Relation* rel, bool old) {
+        if (!IsRecursive(rel)) {
+            auto [it, inserted] = constant_references.try_emplace(rel);
+            if (inserted) {
+                RelName name(absl::StrFormat("@constant%d", constants.size()));
+                constants.emplace_back(name, rel);
+                it->second = Reference(name, rel->Arity());
+            }
+            return it->second;
+        }
+        if (auto r = DynamicCast<Relation, RelationReference>(rel)) {
+            if (!old) {
+                return rel;
+            }
+            old_names.insert(r.value()->name);
+            return Reference(OldName(r.value()->name), rel->Arity());
+        } else if (auto r = DynamicCast<Relation, RelationJoin>(rel)) {
+            return factory.Make<RelationJoin>(
+                Rename(r.value()->lhs, old), Rename(r.value()->rhs, old),
+                r.value()->attributes);
+        } else if (auto r = DynamicCast<Relation, RelationMultiJoin>(rel)) {
+            std::vector<Relation*> inputs;
+            for (Relation* input : r.value()->inputs) {
+                inputs.push_back(Rename(input, old));
+            }
+            return factory.Make<RelationMultiJoin>(
+                inputs, r.value()->variables, r.value()->variable_order);
+        } else if (auto r = DynamicCast<Relation, RelationSemijoin>(rel)) {
+            return factory.Make<RelationSemijoin>(
+                Rename(r.value()->lhs, old), Rename(r.value()->rhs, old),
+                r.value()->attributes);
+        } else if (auto r = DynamicCast<Relation, RelationUnion>(rel)) {
+            return factory.Make<RelationUnion>(
+                Rename(r.value()->lhs, old), Rename(r.value()->rhs, old));
+        } else if (auto r = DynamicCast<Relation, RelationDistinct>(rel)) {
+            return factory.Make<RelationDistinct>(Rename(r.value()->rel, old));
+        } else if (auto r = DynamicCast<Relation, RelationDifference>(rel)) {
+            return factory.Make<RelationDifference>(
+                Rename(r.value()->lhs, old), Rename(r.value()->rhs, old));
+        } else if (auto r = DynamicCast<Relation, RelationSelect>(rel)) {
+            return factory.Make<RelationSelect>(
+                r.value()->predicate, Rename(r.value()->rel, old));
+        } else if (auto r = DynamicCast<Relation, RelationMap>(rel)) {
+            return factory.Make<RelationMap>(
+                r.value()->function, Rename(r.value()->rel, old));
+        } else if (auto r = DynamicCast<Relation, RelationView>(rel)) {
+            return factory.Make<RelationView>(Viewed<Relation*>(
+                r.value()->rel.perm, Rename(r.value()->rel.rel, old)));
+        }
+        RDSS_CHECK(false)
+            << "If this is reached, a new relation op has been added but no "
+            << "case was added to Differentiator::Rename. Please add one.";
+        return nullptr;
+    }
+
+    absl::btree_set<RelName> recursive;
+    RelationFactory factory;
+    std::vector<std::pair<RelName, Relation*>> constants;
+    absl::flat_hash_map<Relation*, Relation*> constant_references;
+    absl::btree_set<RelName> old_names;
+    absl::flat_hash_map<Relation*, bool> memo;
+};
+
+}  // namespace internal
+
+// Executes `RAction` programs against a set of named relations.
+//
+// `RSeq` runs its actions in order. `RUnionWith` adds the tuples of a
+// relation to a named relation, skipping tuples it already contains. `RFor`
+// runs its body once for each tuple of a relation, with its variable bound to
+// a relation holding just that tuple. `RReturn` ends the program with the
+// value of a relation.
+//
+// A run of consecutive `RUnionWith` actions that refer to their own targets,
+// or to the targets of later actions in the run, is a recursive loop and is
+// repeated until no action adds a tuple. Loops are evaluated semi-naively:
+// the first round evaluates each action in full, and later rounds evaluate
+// only the change to each action caused by the tuples the previous round
+// added, so the cost of a round is proportional to the new tuples rather
+// than to the whole relation. The parts of a loop that do not depend on its
+// targets are evaluated once, before the first round, and every round of a
+// loop runs on the same `Interpreter`, which keeps their results and the
+// sort orders and hash indexes built over them from one round to the next.
+//
+// Each run is charged against a single memory budget, that of
+// `options.arena` or else `options.memory_budget`: the relations it
+// evaluates, the tuples it adds to its targets and the sets it keeps to
+// recognize them all count towards it, however many rounds they span. Each
+// evaluation allocates from an arena of its own that charges the run's, so
+// its memory is given back once its results are dropped.
+class ActionInterpreter {
+public:
+    ActionInterpreter(const absl::btree_map<RelName, Table>& variables_,
+                      InterpreterOptions options_ = InterpreterOptions())
+        : variables(variables_)
+        , options(options_)
+        , arena()
+        , facts()
+        , returned()
+        , loop_interpreter(nullptr) {}
+
+    // Runs `action`. Returns the value given to the first `RReturn` that is
+    // reached, or nothing if the program finishes without returning.
+    absl::StatusOr<absl::optional<Table>> Run(RAction* action) {
+        arena = (options.arena != nullptr)
+            ? options.arena
+            : std::make_shared<MemoryArena>(options.memory_budget);
+        // The sets of earlier runs belong to their arenas; they are rebuilt
+        // from the targets when next needed.
+        facts.clear();
+        returned.reset();
+        RETURN_IF_ERROR(Execute(action));
+        return returned;
+    }
+
+    absl::optional<Table> Lookup(const RelName& name) const {
+        if (variables.contains(name)) {
+            return variables.at(name);
+        }
+        return absl::nullopt;
+    }
+
+private:
+    using Fact = std::vector<Value, ArenaAllocator<Value>>;
+    using TupleSet =
+        absl::flat_hash_set<Fact, KeyHash, KeyEq, ArenaAllocator<Fact>>;
+
+    absl::Status Execute(RAction* action);
+
+    absl::Status ExecuteSequence(absl::Span<RAction* const> actions);
+
+    // Runs the given `RUnionWith` actions to a fixpoint.
+    absl::Status ExecuteLoop(absl::Span<RUnionWith* const> loop);
+
+    absl::StatusOr<Table> Evaluate(Relation* rel);
+
+    // Adds the tuples of `candidates` that the relation `name` does not
+    // contain yet to it, and returns them.
+    Table AddFacts(const RelName& name, const Table& candidates);
+
+    // Binds `name` to `table`, replacing any earlier binding.
+    void Bind(const RelName& name, Table table) {
+        facts.erase(name);
+        if (loop_interpreter != nullptr) {
+            loop_interpreter->Bind(name, table);
+        }
+        variables.insert_or_assign(name, std::move(table));
+    }
+
+    void Unbind(const RelName& name) {
+        facts.erase(name);
+        variables.erase(name);
+    }
+
+    absl::btree_map<RelName, Table> variables;
+    InterpreterOptions options;
+    // The arena of the current run.
+    std::shared_ptr<MemoryArena> arena;
+    // The set of tuples in each relation that has been the target of an
+    // `RUnionWith`, kept up to date so that adding tuples does not rescan
+    // the relation.
+    absl::btree_map<RelName, TupleSet> facts;
+    absl::optional<Table> returned;
+    // The interpreter that evaluates the rounds of the current loop, if any.
+    Interpreter* loop_interpreter;
+};
+
+inline absl::Status ActionInterpreter::Execute(RAction* action) {
+    if (auto a = DynamicCast<RAction, RSeq>(action)) {
+        return ExecuteSequence(a.value()->body);
+    } else if (auto a = DynamicCast<RAction, RUnionWith>(action)) {
+        RUnionWith* loop[] = {a.value()};
+        return ExecuteLoop(loop);
+    } else if (auto a = DynamicCast<RAction, RFor>(action)) {
+        RFor* for_action = a.value();
+        ASSIGN_OR_RETURN(Table tuples, Evaluate(for_action->relation));
+        absl::optional<Table> shadowed = Lookup(for_action->variable);
+        for (int32_t i = 0; (i < tuples.NumberOfTuples()) && !returned; i++) {
+            Table binding(tuples.Width());
+            RETURN_IF_ERROR(binding.AppendRange(tuples, i, i + 1));
+            Bind(for_action->variable, std::move(binding));
+            RETURN_IF_ERROR(ExecuteSequence(for_action->body));
+        }
+        if (shadowed) {
+            Bind(for_action->variable, std::move(*shadowed));
+        } else {
+            Unbind(for_action->variable);
+        }
+        return absl::OkStatus();
+    } else if (auto a = DynamicCast<RAction, RReturn>(action)) {
+        ASSIGN_OR_RETURN(returned, Evaluate(a.value()->relation));
+        return absl::OkStatus();
+    }
+    return absl::InternalError(
+        "If this is reached, a new action has been added but no case "
+        "was added to ActionInterpreter. Please add one.");
+}
+
+inline absl::Status ActionInterpreter::ExecuteSequence(
+    absl::Span<RAction* const> actions) {
+    int32_t i = 0;
+    while ((i < actions.size()) && !returned) {
+        auto first = DynamicCast<RAction, RUnionWith>(actions[i]);
+        if (!first) {
+            RETURN_IF_ERROR(Execute(actions[i]));
+            i++;
+            continue;
+        }
+
+        // Gather the run of union actions starting here, then grow the loop
+        // until no action in it refers to the target of a later action.
+        std::vector<RUnionWith*> run;
+        for (int32_t j = i; j < actions.size(); j++) {
+            auto action = DynamicCast<RAction, RUnionWith>(actions[j]);
+            if (!action) {
+                break;
+            }
+            run.push_back(action.value());
+        }
+        int32_t end = 1;
+        for (int32_t k = 0; k < end; k++) {
+            absl::btree_set<RelName> names;
+            internal::CollectReferences(run[k]->relation, &names);
+            for (int32_t m = k; m < run.size(); m++) {
+                if (names.contains(run[m]->name)) {
+                    end = std::max(end, m + 1);
+                }
+            }
+        }
+        RETURN_IF_ERROR(
+            ExecuteLoop(absl::MakeConstSpan(run).subspan(0, end)));
+        i += end;
+    }
+    return absl::OkStatus();
+}
+
+inline absl::Status ActionInterpreter::ExecuteLoop(
+    absl::Span<RUnionWith* const> loop) {
+    absl::btree_set<RelName> targets;
+    for (RUnionWith* action : loop) {
+        targets.insert(action->name);
+        if (!variables.contains(action->name)) {
+            Bind(action->name, Table(action->relation->Arity(), arena));
+        }
+        const Table& target = variables.at(action->name);
+        if (target.Width() != action->relation->Arity()) {
+            return absl::InvalidArgumentError(absl::StrFormat(
+                "cannot add tuples of %s to %s, which has a different arity",
+                action->relation->ToString(), action->name.ToString()));
+        }
+        // Move the target into the arena, so that what the loop adds to it
+        // is charged to the run.
+        if (target.Arena() != arena) {
+            Table copy(target.Width(), arena);
+            RETURN_IF_ERROR(copy.Append(target));
+            copy.SetDictionaries(target.Dictionaries());
+            Bind(action->name, std::move(copy));
+        }
+    }
+
+    internal::Differentiator differentiator(targets);
+    std::vector<Relation*> delta_plans;
+    for (RUnionWith* action : loop) {
+        ASSIGN_OR_RETURN(Relation* delta,
+                         differentiator.Delta(action->relation));
+        delta_plans.push_back(delta);
+    }
+
+    InterpreterOptions loop_options = options;
+    loop_options.arena = arena;
+    Interpreter interpreter(variables, loop_options);
+    loop_interpreter = &interpreter;
+
+    // Evaluates `plans` and adds what they produce to their targets,
+    // returning whether anything was added. The deltas (and, where the delta
+    // plans need them, the old contents) of every target are rebound to what
+    // this round added (and saw).
+    auto round = [&](absl::Span<Relation* const> plans)
+        -> absl::StatusOr<bool> {
+        absl::btree_map<RelName, Table> candidates;
+        for (int32_t i = 0; i < loop.size(); i++) {
+            if (plans[i] == nullptr) {
+                continue;
+            }
+            ASSIGN_OR_RETURN(Table result, Evaluate(plans[i]));
+            auto [it, inserted] =
+                candidates.try_emplace(loop[i]->name, std::move(result));
+            if (!inserted) {
+                RETURN_IF_ERROR(it->second.Append(result));
+            }
+        }
+        bool changed = false;
+        for (const RelName& name : targets) {
+            if (differentiator.OldNames().contains(name)) {
+                Bind(internal::OldName(name), variables.at(name));
+            }
+            Table added(variables.at(name).Width());
+            if (candidates.contains(name)) {
+                added = AddFacts(name, candidates.at(name));
+                interpreter.Bind(name, variables.at(name));
+            }
+            changed |= (added.NumberOfTuples() > 0);
+            Bind(internal::DeltaName(name), std::move(added));
+        }
+        RETURN_IF_ERROR(arena->CheckBudget());
+        return changed;
+    };
+
+    std::vector<Relation*> plans;
+    for (RUnionWith* action : loop) {
+        plans.push_back(action->relation);
+    }
+    absl::StatusOr<bool> changed = round(plans);
+    for (const auto& [name, rel] : differentiator.Constants()) {
+        if (!changed.ok()) {
+            break;
+        }
+        absl::StatusOr<Table> constant = Evaluate(rel);
+        if (!constant.ok()) {
+            changed = constant.status();
+            break;
+        }
+        Bind(name, std::move(*constant));
+    }
+
+    absl::Status status = changed.status();
+    while (status.ok() && *changed) {
+        changed = round(delta_plans);
+        status = changed.status();
+    }
+    loop_interpreter = nullptr;
+
+    for (const RelName& name : targets) {
+        Unbind(internal::OldName(name));
+        Unbind(internal::DeltaName(name));
+    }
+    for (const auto& [name, rel] : differentiator.Constants()) {
+        Unbind(name);
+    }
+    return status;
+}
+
+inline absl::StatusOr<Table> ActionInterpreter::Evaluate(Relation* rel) {
+    absl::btree_set<RelName> names;
+    internal::CollectReferences(rel, &names);
+    for (const RelName& name : names) {
+        if (!variables.contains(name)) {
+            return absl::NotFoundError(absl::StrFormat(
+                "no table named %s", name.ToString()));
+        }
+    }
+    if (loop_interpreter != nullptr) {
+        RETURN_IF_ERROR(loop_interpreter->Interpret(rel));
+        return loop_interpreter->Lookup(rel).value();
+    }
+    InterpreterOptions query_options = options;
+    query_options.arena = arena;
+    Interpreter interpreter(variables, query_options);
+    RETURN_IF_ERROR(interpreter.Interpret(rel));
+    return interpreter.Lookup(rel).value();
+}
+
+inline Table ActionInterpreter::AddFacts(const RelName& name,
+                                         const Table& candidates) {
+    Table& table = variables.at(name);
+    ArenaAllocator<Value> allocator(arena);
+    auto [it, inserted] = facts.try_emplace(
+        name, 0, KeyHash(), KeyEq(), ArenaAllocator<Fact>(arena));
+    TupleSet& present = it->second;
+    if (inserted) {
+        for (int32_t i = 0; i < table.NumberOfTuples(); i++) {
+            Tuple tuple = table.GetTuple(i);
+            present.emplace(tuple.begin(), tuple.end(), allocator);
+        }
+    }
+
+    std::vector<int32_t> rows;
+    for (int32_t i = 0; i < candidates.NumberOfTuples(); i++) {
+        Tuple tuple = candidates.GetTuple(i);
+        if (present.emplace(tuple.begin(), tuple.end(), allocator).second) {
+            rows.push_back(i);
+        }
+    }
+    Table added(table.Width(), arena);
+    RDSS_CHECK_OK(added.AppendRows(candidates, rows));
+    RDSS_CHECK_OK(table.Append(added));
+    return added;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace rdss
+
+#endif  // RDSS_FIXPOINT_H_
@@ -0,0 +1,93 @@
+// Copyright 2021 The RDSS Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RDSS_HASH_CONS_H_
+#define RDSS_HASH_CONS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <typeindex>
+#include <typeinfo>
+#include <vector>
+
+#include <absl/container/flat_hash_set.h>
+#include <absl/hash/hash.h>
+
+namespace rdss {
+
+////////////////////////////////////////////////////////////////////////////////
+
+// The canonical nodes of a DAG, one for every distinct structure. A node type
+// `Node` provides `Children()`, the nodes it is built from; `ParameterHash()`
+// and `SameParameters(other)`, which hash and compare everything else about
+// it for an `other` of the same dynamic type; and a `structural_hash` field.
+//
+// Nodes are interned bottom-up, so the children of a new node are already
+// canonical and two nodes are structurally equal exactly when they have the
+// same type, the same parameters and the same children by pointer. Each
+// structural hash is computed once, from the hashes of the children.
+template<typename Node>
+class HashConsSet {
+public:
+    // Returns the canonical node equal to `node`. If there is none, `node`
+    // becomes canonical and is moved to `owned`.
+    template<typename T>
+    T* Intern(std::unique_ptr<T> node,
+              std::vector<std::unique_ptr<Node>>* owned) {
+        size_t hash = absl::HashOf(std::type_index(typeid(*node)),
+                                   node->ParameterHash());
+        for (const Node* child : node->Children()) {
+            hash = absl::HashOf(hash, child->structural_hash);
+        }
+        node->structural_hash = hash;
+
+        auto it = canonical.find(node.get());
+        if (it != canonical.end()) {
+            return static_cast<T*>(*it);
+        }
+        T* ptr = node.get();
+        canonical.insert(ptr);
+        owned->push_back(std::move(node));
+        return ptr;
+    }
+
+    int64_t size() const {
+        return canonical.size();
+    }
+
+private:
+    struct Hash {
+        size_t operator()(const Node* node) const {
+            return node->structural_hash;
+        }
+    };
+
+    struct Eq {
+        bool operator()(const Node* x, const Node* y) const {
+            return (x->structural_hash == y->structural_hash)
+                && (typeid(*x) == typeid(*y))
+                && x->SameParameters(*y)
+                && (x->Children() == y->Children());
+        }
+    };
+
+    absl::flat_hash_set<Node*, Hash, Eq> canonical;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace rdss
+
+#endif  // RDSS_HASH_CONS_H_
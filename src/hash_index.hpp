@@ -0,0 +1,158 @@
+// Copyright 2021 The RDSS Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RDSS_HASH_INDEX_H_
+#define RDSS_HASH_INDEX_H_
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <absl/container/flat_hash_map.h>
+#include <absl/container/inlined_vector.h>
+#include <absl/hash/hash.h>
+#include <absl/types/span.h>
+
+#include "arena.hpp"
+#include "attr.hpp"
+#include "table.hpp"
+
+namespace rdss {
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Hash and equality functors over keys that allow a `Tuple`-keyed hash table
+// to be probed with any contiguous run of values, so that lookups never need
+// to allocate a `Tuple`.
+struct KeyHash {
+    using is_transparent = void;
+
+    size_t operator()(absl::Span<const Value> key) const {
+        return absl::Hash<absl::Span<const Value>>()(key);
+    }
+};
+
+struct KeyEq {
+    using is_transparent = void;
+
+    bool operator()(absl::Span<const Value> x,
+                    absl::Span<const Value> y) const {
+        return x == y;
+    }
+};
+
+// Gathered key values. Keys are rarely wider than a handful of attributes, so
+// this stays on the stack in practice.
+using Key = absl::InlinedVector<Value, 8>;
+
+inline void GatherKey(const TupleView& tuple,
+                      absl::Span<const Attr> attrs,
+                      Key* key) {
+    key->clear();
+    for (Attr attr : attrs) {
+        key->push_back(tuple[attr]);
+    }
+}
+
+// An index from the values of some key attributes of a `Table` to the rows
+// that hold those values. Rows with equal keys are chained together, so
+// building the index allocates once per distinct key rather than once per row.
+//
+// The indexed table must outlive the index and must not be modified while the
+// index is in use. The index allocates from `arena` if one is given.
+class HashIndex {
+public:
+    HashIndex(const Table* table_,
+              absl::Span<const Attr> key_,
+              std::shared_ptr<MemoryArena> arena = nullptr)
+        : table(table_)
+        , key(key_.begin(), key_.end())
+        , heads(ArenaAllocator<std::pair<const IndexKey, int32_t>>(arena))
+        , next(ArenaAllocator<int32_t>(arena)) {
+        int32_t n = table->NumberOfTuples();
+        next.resize(n, -1);
+        heads.reserve(n);
+        Key buffer;
+        ArenaAllocator<Value> allocator(arena);
+        // Insert in reverse so that chains list rows in ascending order.
+        for (int32_t i = n - 1; i >= 0; i--) {
+            GatherKey(table->GetTupleView(i), key, &buffer);
+            auto [it, inserted] = heads.try_emplace(
+                IndexKey(buffer.begin(), buffer.end(), allocator), i);
+            if (!inserted) {
+                next[i] = it->second;
+                it->second = i;
+            }
+        }
+    }
+
+    const Table& GetTable() const {
+        return *table;
+    }
+
+    absl::Span<const Attr> KeyAttrs() const {
+        return key;
+    }
+
+    int32_t NumberOfKeys() const {
+        return heads.size();
+    }
+
+    // Returns the first row whose key equals `probe_key`, or -1 if there is
+    // none. Use `NextMatch` to walk the remaining rows with the same key.
+    int32_t FirstMatch(absl::Span<const Value> probe_key) const {
+        auto it = heads.find(probe_key);
+        if (it == heads.end()) {
+            return -1;
+        }
+        return it->second;
+    }
+
+    int32_t NextMatch(int32_t row) const {
+        return next[row];
+    }
+
+    bool Contains(absl::Span<const Value> probe_key) const {
+        return heads.contains(probe_key);
+    }
+
+    // Calls `callback` with the index of every indexed row whose key equals
+    // the values of `probe_attrs` in `probe`.
+    template<typename F>
+    void ForEachMatch(const TupleView& probe,
+                      absl::Span<const Attr> probe_attrs,
+                      F callback) const {
+        Key buffer;
+        GatherKey(probe, probe_attrs, &buffer);
+        for (int32_t row = FirstMatch(buffer); row != -1; row = next[row]) {
+            callback(row);
+        }
+    }
+
+private:
+    using IndexKey = std::vector<Value, ArenaAllocator<Value>>;
+
+    const Table* table;
+    std::vector<Attr> key;
+    absl::flat_hash_map<
+        IndexKey, int32_t, KeyHash, KeyEq,
+        ArenaAllocator<std::pair<const IndexKey, int32_t>>> heads;
+    std::vector<int32_t, ArenaAllocator<int32_t>> next;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace rdss
+
+#endif  // RDSS_HASH_INDEX_H_
@@ -0,0 +1,529 @@
+// Copyright 2021 The RDSS Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RDSS_INCREMENTAL_H_
+#define RDSS_INCREMENTAL_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <absl/container/btree_map.h>
+#include <absl/container/flat_hash_map.h>
+#include <absl/container/flat_hash_set.h>
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <absl/strings/str_format.h>
+#include <absl/types/span.h>
+
+#include "ast.hpp"
+#include "hash_index.hpp"
+#include "join_layout.hpp"
+#include "macros.hpp"
+#include "pipeline.hpp"
+#include "selection.hpp"
+#include "table.hpp"
+
+namespace rdss {
+
+////////////////////////////////////////////////////////////////////////////////
+
+// A multiset of tuples in which every tuple has a signed weight (a Z-set).
+// Positive weights are insertions or multiplicities, negative weights are
+// deletions, and tuples whose weight reaches zero are dropped.
+class ZSet {
+public:
+    using Map = absl::flat_hash_map<Tuple, int64_t, KeyHash, KeyEq>;
+
+    explicit ZSet(int32_t width_) : width(width_), entries() {}
+
+    void Add(absl::Span<const Value> tuple, int64_t weight) {
+        RDSS_DCHECK_EQ(tuple.size(), width);
+        if (weight == 0) {
+            return;
+        }
+        auto it = entries.find(tuple);
+        if (it == entries.end()) {
+            entries.emplace(Tuple(tuple.begin(), tuple.end()), weight);
+        } else if ((it->second += weight) == 0) {
+            entries.erase(it);
+        }
+    }
+
+    // Adds every tuple of `table` with the given weight.
+    void AddTable(const Table& table, int64_t weight) {
+        Tuple buffer;
+        for (int32_t i = 0; i < table.NumberOfTuples(); i++) {
+            buffer = table.GetTuple(i);
+            Add(buffer, weight);
+        }
+    }
+
+    void AddZSet(const ZSet& other) {
+        for (const auto& [tuple, weight] : other.entries) {
+            Add(tuple, weight);
+        }
+    }
+
+    int64_t Weight(absl::Span<const Value> tuple) const {
+        auto it = entries.find(tuple);
+        return (it == entries.end()) ? 0 : it->second;
+    }
+
+    // Splits the Z-set into a table of its distinct tuples and their weights,
+    // in the same order.
+    void Split(Table* tuples, std::vector<int64_t>* weights) const {
+        for (const auto& [tuple, weight] : entries) {
+            RDSS_CHECK_OK(tuples->InsertTuple(tuple));
+            weights->push_back(weight);
+        }
+    }
+
+    // Returns the multiset as a table, repeating each tuple as many times as
+    // its weight. Fails if any weight is negative.
+    absl::StatusOr<Table> ToTable() const {
+        Table result(width);
+        for (const auto& [tuple, weight] : entries) {
+            if (weight < 0) {
+                return absl::FailedPreconditionError(
+                    "Z-set has a tuple with negative weight");
+            }
+            for (int64_t k = 0; k < weight; k++) {
+                RETURN_IF_ERROR(result.InsertTuple(tuple));
+            }
+        }
+        return result;
+    }
+
+    const Map& Entries() const {
+        return entries;
+    }
+
+    bool Empty() const {
+        return entries.empty();
+    }
+
+    int32_t Width() const {
+        return width;
+    }
+
+private:
+    int32_t width;
+    Map entries;
+};
+
+namespace internal {
+
+// A Z-set grouped by the values of some of its attributes, together with the
+// total weight of each group.
+class IndexedZSet {
+public:
+    explicit IndexedZSet(absl::Span<const Attr> key_)
+        : key(key_.begin(), key_.end()), groups(), key_weights() {}
+
+    void Add(absl::Span<const Value> tuple, int64_t weight) {
+        Tuple group_key = KeyOf(tuple);
+        ZSet::Map& group = groups[group_key];
+        auto it = group.find(tuple);
+        if (it == group.end()) {
+            group.emplace(Tuple(tuple.begin(), tuple.end()), weight);
+        } else if ((it->second += weight) == 0) {
+            group.erase(it);
+        }
+        if (group.empty()) {
+            groups.erase(group_key);
+        }
+        if ((key_weights[group_key] += weight) == 0) {
+            key_weights.erase(group_key);
+        }
+    }
+
+    // Returns the tuples whose key is `group_key`, or null if there are none.
+    const ZSet::Map* Group(absl::Span<const Value> group_key) const {
+        auto it = groups.find(group_key);
+        return (it == groups.end()) ? nullptr : &it->second;
+    }
+
+    int64_t KeyWeight(absl::Span<const Value> group_key) const {
+        auto it = key_weights.find(group_key);
+        return (it == key_weights.end()) ? 0 : it->second;
+    }
+
+    Tuple KeyOf(absl::Span<const Value> tuple) const {
+        Tuple result;
+        for (Attr attr : key) {
+            result.push_back(tuple[attr]);
+        }
+        return result;
+    }
+
+private:
+    std::vector<Attr> key;
+    absl::flat_hash_map<Tuple, ZSet::Map, KeyHash, KeyEq> groups;
+    absl::flat_hash_map<Tuple, int64_t, KeyHash, KeyEq> key_weights;
+};
+
+}  // namespace internal
+
+// Maintains the result of a plan under changes to its base relations. Each
+// call to `Update` takes signed changes to named base relations and pushes
+// them through the plan as Z-sets, so the work done is proportional to the
+// size of the changes and of the state they touch rather than to the size of
+// the relations.
+//
+// Select, View and Union are linear and keep no state. Join keeps both inputs
+// indexed on their join keys and applies the delta rule
+// d(L ⋈ R) = dL ⋈ R + (L + dL) ⋈ dR. Semijoin keeps its left-hand side
+// indexed and the total weight of every key on its right-hand side; a change
+// on the right only produces output for the keys whose presence it flips.
+// Difference keeps the weight of every tuple on both sides and, for each
+// tuple a change touches, produces the change to max(0, L - R). Distinct
+// keeps the weight of every input tuple and only produces output for the
+// tuples whose presence a change flips.
+//
+// Each of these operators gives every tuple the same number of occurrences
+// as `Interpreter` does: Join multiplies them, Union adds them, Semijoin
+// keeps those of the left-hand side, Difference subtracts them, and Distinct
+// keeps one. MultiJoin and Map are not supported.
+//
+// Z-sets hold the codes of string columns. LIKE predicates match them
+// against the dictionaries of the base relations, which are taken from
+// `variables`; nothing else is read from its tables.
+//
+// Whether an update can be applied only depends on the plan and on the
+// widths of the changes, which are all checked before any state is touched,
+// so a failed update leaves the interpreter as it was.
+class IncrementalInterpreter {
+public:
+    // Fails if the plan has a node that cannot be maintained incrementally,
+    // or a selection that cannot be evaluated on its input, such as LIKE on
+    // a column that has no dictionary in `variables`.
+    static absl::StatusOr<IncrementalInterpreter> Create(
+        Relation* output,
+        const absl::btree_map<RelName, Table>& variables = {});
+
+    // Applies `changes` to the named base relations and returns the
+    // resulting change to the output. The first call should insert the
+    // initial contents of every base relation. Relations that the plan does
+    // not refer to are ignored. Fails, without changing anything, if a
+    // change does not have the arity of the relation it changes.
+    absl::StatusOr<ZSet> Update(const absl::btree_map<RelName, ZSet>& changes) {
+        for (Relation* node : nodes) {
+            auto r = DynamicCast<Relation, RelationReference>(node);
+            if (r && changes.contains(r.value()->name)
+                && (changes.at(r.value()->name).Width() != node->Arity())) {
+                return absl::InvalidArgumentError(absl::StrFormat(
+                    "change to %s does not match its arity",
+                    r.value()->name.ToString()));
+            }
+        }
+
+        absl::flat_hash_map<Relation*, ZSet> deltas;
+        for (Relation* node : nodes) {
+            ZSet delta(node->Arity());
+            RETURN_IF_ERROR(Propagate(node, changes, deltas, &delta));
+            deltas.insert_or_assign(node, std::move(delta));
+        }
+        current.AddZSet(deltas.at(output));
+        return deltas.at(output);
+    }
+
+    // The contents of the output after every update so far.
+    const ZSet& Current() const {
+        return current;
+    }
+
+private:
+    explicit IncrementalInterpreter(Relation* output_)
+        : output(output_), current(output_->Arity()) {}
+
+    void CollectNodes(Relation* rel, absl::flat_hash_set<Relation*>* visited) {
+        if (!visited->insert(rel).second) {
+            return;
+        }
+        for (Relation* child : rel->Children()) {
+            CollectNodes(child, visited);
+        }
+        nodes.push_back(rel);
+    }
+
+    internal::IndexedZSet& State(
+        absl::flat_hash_map<Relation*, internal::IndexedZSet>* states,
+        Relation* node,
+        absl::Span<const Attr> key) {
+        return states->try_emplace(node, key).first->second;
+    }
+
+    absl::Status Propagate(Relation* input,
+                           const absl::btree_map<RelName, ZSet>& changes,
+                           const absl::flat_hash_map<Relation*, ZSet>& deltas,
+                           ZSet* result);
+
+    // Fails for the nodes that `Propagate` could not evaluate.
+    absl::Status Validate(Relation* node);
+
+    // Computes the change to the semijoin of `lhs_state` by `rhs_state`, and
+    // applies the input changes to them.
+    void PropagateMembership(const ZSet& lhs_delta,
+                             const ZSet& rhs_delta,
+                             internal::IndexedZSet* lhs_state,
+                             internal::IndexedZSet* rhs_state,
+                             ZSet* result);
+
+    Relation* output;
+    // Every node of the plan, each after the nodes it depends on.
+    std::vector<Relation*> nodes;
+    absl::flat_hash_map<Relation*, internal::IndexedZSet> lhs_states;
+    absl::flat_hash_map<Relation*, internal::IndexedZSet> rhs_states;
+    // The dictionaries of the input of each Select.
+    absl::flat_hash_map<
+        Relation*, std::vector<std::shared_ptr<const StringDictionary>>>
+        select_dictionaries;
+    ZSet current;
+};
+
+inline absl::StatusOr<IncrementalInterpreter> IncrementalInterpreter::Create(
+    Relation* output,
+    const absl::btree_map<RelName, Table>& variables) {
+    IncrementalInterpreter result(output);
+    absl::flat_hash_set<Relation*> visited;
+    result.CollectNodes(output, &visited);
+    for (Relation* node : result.nodes) {
+        if (auto r = DynamicCast<Relation, RelationSelect>(node)) {
+            result.select_dictionaries.try_emplace(
+                node, PlanDictionaries(r.value()->rel, variables));
+        }
+        RETURN_IF_ERROR(result.Validate(node));
+    }
+    return result;
+}
+
+inline absl::Status IncrementalInterpreter::Validate(Relation* node) {
+    if (auto r = DynamicCast<Relation, RelationMultiJoin>(node)) {
+        return absl::UnimplementedError(
+            "IncrementalInterpreter does not yet support MultiJoin");
+    } else if (auto r = DynamicCast<Relation, RelationMap>(node)) {
+        return absl::UnimplementedError(
+            "IncrementalInterpreter cannot support Map");
+    } else if (auto r = DynamicCast<Relation, RelationSelect>(node)) {
+        // Predicates only fail on the types of their columns, which an
+        // empty input with the same dictionaries already has.
+        Table empty(node->Arity());
+        empty.SetDictionaries(select_dictionaries.at(node));
+        return EvaluatePredicate(r.value()->predicate, empty).status();
+    }
+    return absl::OkStatus();
+}
+
+inline void IncrementalInterpreter::PropagateMembership(
+    const ZSet& lhs_delta,
+    const ZSet& rhs_delta,
+    internal::IndexedZSet* lhs_state,
+    internal::IndexedZSet* rhs_state,
+    ZSet* result) {
+    auto present = [&](absl::Span<const Value> key) {
+        return rhs_state->KeyWeight(key) > 0;
+    };
+
+    // Keys whose presence flips add or remove every old left-hand tuple with
+    // that key.
+    absl::flat_hash_map<Tuple, bool, KeyHash, KeyEq> was_present;
+    for (const auto& [tuple, weight] : rhs_delta.Entries()) {
+        Tuple key = rhs_state->KeyOf(tuple);
+        if (!was_present.contains(key)) {
+            was_present.emplace(key, present(key));
+        }
+    }
+    for (const auto& [tuple, weight] : rhs_delta.Entries()) {
+        rhs_state->Add(tuple, weight);
+    }
+    for (const auto& [key, before] : was_present) {
+        bool after = present(key);
+        const ZSet::Map* group = lhs_state->Group(key);
+        if ((before == after) || (group == nullptr)) {
+            continue;
+        }
+        for (const auto& [tuple, weight] : *group) {
+            result->Add(tuple, after ? weight : -weight);
+        }
+    }
+
+    // New left-hand tuples are checked against the new right-hand side.
+    for (const auto& [tuple, weight] : lhs_delta.Entries()) {
+        if (present(lhs_state->KeyOf(tuple))) {
+            result->Add(tuple, weight);
+        }
+        lhs_state->Add(tuple, weight);
+    }
+}
+
+inline absl::Status IncrementalInterpreter::Propagate(
+    Relation* input,
+    const absl::btree_map<RelName, ZSet>& changes,
+    const absl::flat_hash_map<Relation*, ZSet>& deltas,
+    ZSet* result) {
+    if (auto r = DynamicCast<Relation, RelationReference>(input)) {
+        if (changes.contains(r.value()->name)) {
+            result->AddZSet(changes.at(r.value()->name));
+        }
+    } else if (auto r = DynamicCast<Relation, RelationJoin>(input)) {
+        const ZSet& lhs_delta = deltas.at(r.value()->lhs);
+        const ZSet& rhs_delta = deltas.at(r.value()->rhs);
+        JoinLayout layout(r.value()->attributes, rhs_delta.Width());
+        internal::IndexedZSet& lhs_state =
+            State(&lhs_states, input, layout.lhs_key);
+        internal::IndexedZSet& rhs_state =
+            State(&rhs_states, input, layout.rhs_key);
+
+        Tuple buffer;
+        auto emit = [&](const Tuple& lhs_tuple,
+                        const Tuple& rhs_tuple,
+                        int64_t weight) {
+            buffer = lhs_tuple;
+            for (Attr k : layout.rhs_included) {
+                buffer.push_back(rhs_tuple[k]);
+            }
+            result->Add(buffer, weight);
+        };
+
+        // dL ⋈ R, against the old right-hand side.
+        for (const auto& [lhs_tuple, lhs_weight] : lhs_delta.Entries()) {
+            const ZSet::Map* group =
+                rhs_state.Group(lhs_state.KeyOf(lhs_tuple));
+            if (group == nullptr) {
+                continue;
+            }
+            for (const auto& [rhs_tuple, rhs_weight] : *group) {
+                emit(lhs_tuple, rhs_tuple, lhs_weight * rhs_weight);
+            }
+        }
+        for (const auto& [lhs_tuple, lhs_weight] : lhs_delta.Entries()) {
+            lhs_state.Add(lhs_tuple, lhs_weight);
+        }
+
+        // (L + dL) ⋈ dR.
+        for (const auto& [rhs_tuple, rhs_weight] : rhs_delta.Entries()) {
+            const ZSet::Map* group =
+                lhs_state.Group(rhs_state.KeyOf(rhs_tuple));
+            if (group == nullptr) {
+                continue;
+            }
+            for (const auto& [lhs_tuple, lhs_weight] : *group) {
+                emit(lhs_tuple, rhs_tuple, lhs_weight * rhs_weight);
+            }
+        }
+        for (const auto& [rhs_tuple, rhs_weight] : rhs_delta.Entries()) {
+            rhs_state.Add(rhs_tuple, rhs_weight);
+        }
+    } else if (auto r = DynamicCast<Relation, RelationMultiJoin>(input)) {
+        return absl::UnimplementedError(
+            "IncrementalInterpreter does not yet support MultiJoin");
+    } else if (auto r = DynamicCast<Relation, RelationSemijoin>(input)) {
+        const ZSet& lhs_delta = deltas.at(r.value()->lhs);
+        const ZSet& rhs_delta = deltas.at(r.value()->rhs);
+        JoinLayout layout(r.value()->attributes, rhs_delta.Width());
+        PropagateMembership(lhs_delta, rhs_delta,
+                            &State(&lhs_states, input, layout.lhs_key),
+                            &State(&rhs_states, input, layout.rhs_key),
+                            result);
+    } else if (auto r = DynamicCast<Relation, RelationUnion>(input)) {
+        result->AddZSet(deltas.at(r.value()->lhs));
+        result->AddZSet(deltas.at(r.value()->rhs));
+    } else if (auto r = DynamicCast<Relation, RelationDistinct>(input)) {
+        std::vector<Attr> all_attrs;
+        for (int32_t k = 0; k < input->Arity(); k++) {
+            all_attrs.push_back(k);
+        }
+        internal::IndexedZSet& state = State(&lhs_states, input, all_attrs);
+        for (const auto& [tuple, weight] :
+                 deltas.at(r.value()->rel).Entries()) {
+            bool before = state.KeyWeight(tuple) > 0;
+            state.Add(tuple, weight);
+            bool after = state.KeyWeight(tuple) > 0;
+            if (before != after) {
+                result->Add(tuple, after ? 1 : -1);
+            }
+        }
+    } else if (auto r = DynamicCast<Relation, RelationDifference>(input)) {
+        const ZSet& lhs_delta = deltas.at(r.value()->lhs);
+        const ZSet& rhs_delta = deltas.at(r.value()->rhs);
+        std::vector<Attr> all_attrs;
+        for (int32_t k = 0; k < input->Arity(); k++) {
+            all_attrs.push_back(k);
+        }
+        internal::IndexedZSet& lhs_state =
+            State(&lhs_states, input, all_attrs);
+        internal::IndexedZSet& rhs_state =
+            State(&rhs_states, input, all_attrs);
+        // A tuple occurs max(0, L - R) times, so only the tuples a change
+        // touches can change their number of occurrences.
+        auto occurrences = [&](absl::Span<const Value> tuple) {
+            return std::max<int64_t>(
+                0, lhs_state.KeyWeight(tuple) - rhs_state.KeyWeight(tuple));
+        };
+        absl::flat_hash_map<Tuple, int64_t, KeyHash, KeyEq> before;
+        for (const ZSet* delta : {&lhs_delta, &rhs_delta}) {
+            for (const auto& [tuple, weight] : delta->Entries()) {
+                before.try_emplace(tuple, occurrences(tuple));
+            }
+        }
+        for (const auto& [tuple, weight] : lhs_delta.Entries()) {
+            lhs_state.Add(tuple, weight);
+        }
+        for (const auto& [tuple, weight] : rhs_delta.Entries()) {
+            rhs_state.Add(tuple, weight);
+        }
+        for (const auto& [tuple, weight] : before) {
+            result->Add(tuple, occurrences(tuple) - weight);
+        }
+    } else if (auto r = DynamicCast<Relation, RelationSelect>(input)) {
+        const ZSet& delta = deltas.at(r.value()->rel);
+        Table tuples(delta.Width());
+        std::vector<int64_t> weights;
+        delta.Split(&tuples, &weights);
+        tuples.SetDictionaries(select_dictionaries.at(input));
+        ASSIGN_OR_RETURN(Bitmap selected,
+                         EvaluatePredicate(r.value()->predicate, tuples));
+        for (int32_t i : selected.SetIndices()) {
+            result->Add(tuples.GetTuple(i), weights[i]);
+        }
+    } else if (auto r = DynamicCast<Relation, RelationMap>(input)) {
+        return absl::UnimplementedError(
+            "IncrementalInterpreter cannot support Map");
+    } else if (auto r = DynamicCast<Relation, RelationView>(input)) {
+        const AttrPartialPermutation& perm = r.value()->rel.perm;
+        Tuple buffer(input->Arity());
+        for (const auto& [tuple, weight] :
+                 deltas.at(r.value()->rel.rel).Entries()) {
+            for (int32_t j = 0; j < perm.size(); j++) {
+                if (perm[j]) {
+                    buffer[*perm[j]] = tuple[j];
+                }
+            }
+            result->Add(buffer, weight);
+        }
+    } else {
+        return absl::InternalError(
+            "If this is reached, a new relation op has been added but no case "
+            "was added to IncrementalInterpreter. Please add one.");
+    }
+    return absl::OkStatus();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace rdss
+
+#endif  // RDSS_INCREMENTAL_H_
@@ -15,8 +15,11 @@
 #ifndef RDSS_INTERPRETER_H_
 #define RDSS_INTERPRETER_H_
 
+#include <atomic>
 #include <cstdint>
 #include <functional>
+#include <memory>
+#include <numeric>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -24,62 +27,38 @@
 #include <absl/container/btree_map.h>
 #include <absl/container/flat_hash_map.h>
 #include <absl/container/flat_hash_set.h>
+#include <absl/container/node_hash_map.h>
 #include <absl/memory/memory.h>
 #include <absl/status/status.h>
 #include <absl/status/statusor.h>
 #include <absl/strings/str_cat.h>
 #include <absl/strings/str_format.h>
 #include <absl/strings/str_join.h>
+#include <absl/synchronization/mutex.h>
 #include <absl/types/optional.h>
 
+#include "arena.hpp"
 #include "ast.hpp"
+#include "bag.hpp"
+#include "compressed_table.hpp"
+#include "cursor.hpp"
+#include "distinct.hpp"
+#include "hash_index.hpp"
+#include "join_layout.hpp"
+#include "leapfrog.hpp"
 #include "macros.hpp"
+#include "morsel.hpp"
+#include "packed_table.hpp"
+#include "pipeline.hpp"
+#include "radix_sort.hpp"
+#include "selection.hpp"
+#include "table.hpp"
+#include "thread_pool.hpp"
 
 namespace rdss {
 
-using Value = int32_t;
-
-using Tuple = std::vector<Value>;
-
-class Table {
-public:
-    Table(int32_t width_) : width(width_), values() {}
-
-    Tuple GetTuple(int32_t index) const {
-        Tuple result;
-        for (int32_t i = 0; i < width; i++) {
-            result.push_back(values.at(index * width + i));
-        }
-        return result;
-    }
-
-    absl::Status InsertTuple(absl::Span<const Value> tuple) {
-        if (tuple.size() != width) {
-            return absl::InternalError(
-                "given tuple does not match table width");
-        }
-        for (const Value& val : tuple) {
-            values.push_back(val);
-        }
-        return absl::OkStatus();
-    }
-
-    int32_t NumberOfTuples() const {
-        RDSS_CHECK_EQ(values.size() % width, 0);
-        return values.size() / width;
-    }
-
-    int32_t Width() const {
-        return width;
-    }
-
-private:
-    int32_t width;
-    std::vector<Value> values;
-};
-
 bool InterpretPredicate(Predicate* predicate,
-                        const Tuple& tuple) {
+                        const TupleView& tuple) {
     if (auto p = DynamicCast<Predicate, PredicateAnd>(predicate)) {
         bool result = true;
         for (Predicate* child : p.value()->children) {
@@ -95,7 +74,15 @@ bool InterpretPredicate(Predicate* predicate,
     } else if (auto p = DynamicCast<Predicate, PredicateNot>(predicate)) {
         return !InterpretPredicate(p.value()->pred, tuple);
     } else if (auto p = DynamicCast<Predicate, PredicateLike>(predicate)) {
-        RDSS_CHECK(false) << "InterpretPredicate does not yet support LIKE";
+        const StringDictionary* dictionary =
+            tuple.Dictionary(p.value()->attr);
+        RDSS_CHECK(dictionary != nullptr)
+            << "LIKE on attr" << p.value()->attr
+            << ", which is not a string column";
+        Value code = tuple[p.value()->attr];
+        std::shared_ptr<const std::vector<bool>> matches =
+            dictionary->MatchLike(p.value()->string);
+        return (uint32_t(code) < matches->size()) && (*matches)[code];
     } else if (auto p = DynamicCast<Predicate, PredicateLessThan>(predicate)) {
         return tuple[p.value()->attr] < p.value()->integer;
     } else if (auto p = DynamicCast<Predicate, PredicateEquals>(predicate)) {
@@ -107,174 +94,1135 @@ bool InterpretPredicate(Predicate* predicate,
     }
 }
 
+// Evaluates an equijoin by building a `HashIndex` over the smaller input and
+// probing it with every tuple of the larger one. The output layout does not
+// depend on which side is built: all attributes of `lhs`, followed by the
+// attributes of `rhs` that are not join keys. The probe side is split into
+// morsels by `executor`.
+//
+// An index of either input on its join key that already exists may be given
+// as `lhs_index` or `rhs_index`. It is probed instead of building one, since
+// probing it costs time proportional to the other input only; when both are
+// given, the larger input's index is probed.
+absl::Status HashJoin(const Table& lhs,
+                      const Table& rhs,
+                      const JoinOn& join_on,
+                      Table* result,
+                      const MorselExecutor& executor = MorselExecutor(),
+                      const HashIndex* lhs_index = nullptr,
+                      const HashIndex* rhs_index = nullptr) {
+    JoinLayout layout(join_on, rhs.Width());
+
+    bool rhs_larger = (rhs.NumberOfTuples() >= lhs.NumberOfTuples());
+    bool index_rhs = (rhs_index != nullptr)
+        ? ((lhs_index == nullptr) || rhs_larger)
+        : ((lhs_index == nullptr) && (rhs.NumberOfTuples()
+                                      <= lhs.NumberOfTuples()));
+    absl::optional<HashIndex> built;
+    if (index_rhs) {
+        if (rhs_index == nullptr) {
+            rhs_index = &built.emplace(&rhs, layout.rhs_key, result->Arena());
+        }
+        const HashIndex& index = *rhs_index;
+        auto probe = [&](int32_t begin, int32_t end, Table* chunk) {
+            Tuple buffer;
+            buffer.reserve(chunk->Width());
+            for (int32_t i = begin; i < end; i++) {
+                TupleView lhs_tuple = lhs.GetTupleView(i);
+                absl::Status status = absl::OkStatus();
+                index.ForEachMatch(lhs_tuple, layout.lhs_key, [&](int32_t j) {
+                    if (status.ok()) {
+                        status = InsertJoinedTuple(
+                            lhs_tuple, rhs.GetTupleView(j), layout,
+                            &buffer, chunk);
+                    }
+                });
+                RETURN_IF_ERROR(status);
+            }
+            return absl::OkStatus();
+        };
+        return executor.Run(lhs.NumberOfTuples(), probe, result);
+    } else {
+        if (lhs_index == nullptr) {
+            lhs_index = &built.emplace(&lhs, layout.lhs_key, result->Arena());
+        }
+        const HashIndex& index = *lhs_index;
+        auto probe = [&](int32_t begin, int32_t end, Table* chunk) {
+            Tuple buffer;
+            buffer.reserve(chunk->Width());
+            for (int32_t j = begin; j < end; j++) {
+                TupleView rhs_tuple = rhs.GetTupleView(j);
+                absl::Status status = absl::OkStatus();
+                index.ForEachMatch(rhs_tuple, layout.rhs_key, [&](int32_t i) {
+                    if (status.ok()) {
+                        status = InsertJoinedTuple(
+                            lhs.GetTupleView(i), rhs_tuple, layout,
+                            &buffer, chunk);
+                    }
+                });
+                RETURN_IF_ERROR(status);
+            }
+            return absl::OkStatus();
+        };
+        return executor.Run(rhs.NumberOfTuples(), probe, result);
+    }
+}
+
+// Keeps the tuples of `lhs` that agree with at least one tuple of `rhs` on
+// the attributes in `join_on`. An existing index of `rhs` on its join key
+// may be given as `rhs_index`, which is then probed instead of building one.
+absl::Status HashSemijoin(const Table& lhs,
+                          const Table& rhs,
+                          const JoinOn& join_on,
+                          Table* result,
+                          const MorselExecutor& executor = MorselExecutor(),
+                          const HashIndex* rhs_index = nullptr) {
+    JoinLayout layout(join_on, rhs.Width());
+    absl::optional<HashIndex> built;
+    if (rhs_index == nullptr) {
+        rhs_index = &built.emplace(&rhs, layout.rhs_key, result->Arena());
+    }
+    const HashIndex& index = *rhs_index;
+    auto probe = [&](int32_t begin, int32_t end, Table* chunk) {
+        Key buffer;
+        std::vector<int32_t> rows;
+        for (int32_t i = begin; i < end; i++) {
+            GatherKey(lhs.GetTupleView(i), layout.lhs_key, &buffer);
+            if (index.Contains(buffer)) {
+                rows.push_back(i);
+            }
+        }
+        return chunk->AppendRows(lhs, rows);
+    };
+    return executor.Run(lhs.NumberOfTuples(), probe, result);
+}
+
+// Bag difference of tables without multiplicities: every tuple occurs in the
+// result as many times as it occurs in `lhs` minus the number of times it
+// occurs in `rhs`, if that is positive, as in `BagDifference`. Each row of
+// `rhs` cancels one equal row of `lhs`; which of several equal rows survive
+// depends on how morsels are scheduled, but not how many.
+absl::Status HashDifference(const Table& lhs,
+                            const Table& rhs,
+                            Table* result,
+                            const MorselExecutor& executor = MorselExecutor()) {
+    std::vector<Attr> all_attrs;
+    for (int32_t k = 0; k < rhs.Width(); k++) {
+        all_attrs.push_back(k);
+    }
+    HashIndex index(&rhs, all_attrs, result->Arena());
+    // The number of occurrences of each tuple of `rhs` not yet cancelled,
+    // held at the first row of its chain in `index`.
+    std::vector<std::atomic<int64_t>> remaining(rhs.NumberOfTuples());
+    Key buffer;
+    for (int32_t j = 0; j < rhs.NumberOfTuples(); j++) {
+        GatherKey(rhs.GetTupleView(j), all_attrs, &buffer);
+        remaining[index.FirstMatch(buffer)].fetch_add(
+            1, std::memory_order_relaxed);
+    }
+    auto probe = [&](int32_t begin, int32_t end, Table* chunk) {
+        Key buffer;
+        std::vector<int32_t> rows;
+        for (int32_t i = begin; i < end; i++) {
+            GatherKey(lhs.GetTupleView(i), all_attrs, &buffer);
+            int32_t head = index.FirstMatch(buffer);
+            if ((head == -1)
+                || (remaining[head].fetch_sub(
+                        1, std::memory_order_relaxed) <= 0)) {
+                rows.push_back(i);
+            }
+        }
+        return chunk->AppendRows(lhs, rows);
+    };
+    return executor.Run(lhs.NumberOfTuples(), probe, result);
+}
+
+// Evaluates an equijoin by merging the inputs in the orders `lhs_order` and
+// `rhs_order`, which must sort them on their join keys. Produces the same
+// output layout as `HashJoin`.
+absl::Status MergeJoin(const Table& lhs,
+                       absl::Span<const int32_t> lhs_order,
+                       const Table& rhs,
+                       absl::Span<const int32_t> rhs_order,
+                       const JoinOn& join_on,
+                       Table* result) {
+    JoinLayout layout(join_on, rhs.Width());
+    Tuple buffer;
+    buffer.reserve(result->Width());
+
+    size_t i = 0;
+    size_t j = 0;
+    while ((i < lhs_order.size()) && (j < rhs_order.size())) {
+        TupleView lhs_tuple = lhs.GetTupleView(lhs_order[i]);
+        TupleView rhs_tuple = rhs.GetTupleView(rhs_order[j]);
+        int32_t comparison = CompareKeys(
+            lhs_tuple, layout.lhs_key, rhs_tuple, layout.rhs_key);
+        if (comparison < 0) {
+            i++;
+        } else if (comparison > 0) {
+            j++;
+        } else {
+            size_t j_end = j + 1;
+            while ((j_end < rhs_order.size())
+                   && (CompareKeys(rhs.GetTupleView(rhs_order[j_end]),
+                                   layout.rhs_key,
+                                   rhs_tuple,
+                                   layout.rhs_key) == 0)) {
+                j_end++;
+            }
+            for (; i < lhs_order.size(); i++) {
+                lhs_tuple = lhs.GetTupleView(lhs_order[i]);
+                if (CompareKeys(lhs_tuple, layout.lhs_key,
+                                rhs_tuple, layout.rhs_key) != 0) {
+                    break;
+                }
+                for (size_t k = j; k < j_end; k++) {
+                    RETURN_IF_ERROR(InsertJoinedTuple(
+                        lhs_tuple, rhs.GetTupleView(rhs_order[k]), layout,
+                        &buffer, result));
+                }
+            }
+            j = j_end;
+        }
+    }
+
+    return absl::OkStatus();
+}
+
+// Sort-based counterpart of `HashSemijoin`. The orders must sort the inputs
+// on their join keys.
+absl::Status MergeSemijoin(const Table& lhs,
+                           absl::Span<const int32_t> lhs_order,
+                           const Table& rhs,
+                           absl::Span<const int32_t> rhs_order,
+                           const JoinOn& join_on,
+                           Table* result) {
+    JoinLayout layout(join_on, rhs.Width());
+    size_t j = 0;
+    for (int32_t row : lhs_order) {
+        TupleView tuple = lhs.GetTupleView(row);
+        int32_t comparison = 1;
+        while ((j < rhs_order.size())
+               && ((comparison = CompareKeys(
+                        tuple, layout.lhs_key,
+                        rhs.GetTupleView(rhs_order[j]), layout.rhs_key)) > 0)) {
+            j++;
+        }
+        if (j == rhs_order.size()) {
+            break;
+        }
+        if (comparison == 0) {
+            RETURN_IF_ERROR(result->InsertTupleView(tuple));
+        }
+    }
+    return absl::OkStatus();
+}
+
+// Sort-based counterpart of `HashDifference`. The orders must sort the inputs
+// on all of their attributes.
+absl::Status MergeDifference(const Table& lhs,
+                             absl::Span<const int32_t> lhs_order,
+                             const Table& rhs,
+                             absl::Span<const int32_t> rhs_order,
+                             Table* result) {
+    std::vector<Attr> all_attrs;
+    for (int32_t k = 0; k < lhs.Width(); k++) {
+        all_attrs.push_back(k);
+    }
+    size_t j = 0;
+    for (int32_t row : lhs_order) {
+        TupleView tuple = lhs.GetTupleView(row);
+        int32_t comparison = 1;
+        while ((j < rhs_order.size())
+               && ((comparison = CompareKeys(
+                        tuple, all_attrs,
+                        rhs.GetTupleView(rhs_order[j]), all_attrs)) > 0)) {
+            j++;
+        }
+        if ((j == rhs_order.size()) || (comparison != 0)) {
+            RETURN_IF_ERROR(result->InsertTupleView(tuple));
+        } else {
+            // This row of `rhs` cancels `tuple`; the next equal one, if any,
+            // cancels the next equal row of `lhs`.
+            j++;
+        }
+    }
+    return absl::OkStatus();
+}
+
+// How the interpreter evaluates Join, Semijoin and Difference nodes.
+enum class JoinAlgorithm {
+    // Merge when both inputs are already sorted on their keys (either
+    // physically, or because an earlier operator sorted them on the same key),
+    // and hash otherwise.
+    kAuto,
+    kHash,
+    kSortMerge,
+};
+
+// How the interpreter moves tuples between the operators of a plan.
+enum class ExecutionModel {
+    // Every node is evaluated into a complete `Table` before its consumers
+    // run. Honors per-node join algorithms and runs operators over morsels.
+    kMaterialize,
+    // The plan is evaluated by a pipeline of batch-at-a-time operators (see
+    // `BuildPipeline`), so only the inputs that an operator cannot stream are
+    // ever materialized. Only the result of the node passed to `Interpret`
+    // is kept.
+    kPipeline,
+};
+
+struct InterpreterOptions {
+    ExecutionModel execution = ExecutionModel::kMaterialize;
+
+    // Operators split their inputs into morsels and run them on this pool.
+    // When null, everything runs on the calling thread.
+    ThreadPool* thread_pool = nullptr;
+
+    // The number of input tuples in each morsel. Inputs no larger than this
+    // are processed on the calling thread.
+    int32_t morsel_size = kDefaultMorselSize;
+
+    // When set, the result of an intermediate node is dropped as soon as
+    // every node reading it has been evaluated, and only the result of the
+    // node passed to `Interpret` is kept. Peak memory is then bounded by the
+    // results that are live at the same time instead of by the whole plan.
+    bool release_intermediates = false;
+
+    // The number of bytes each call to `Interpret` or `Open` may allocate for
+    // intermediate and final results and for the hash tables it builds. A
+    // query that exceeds it fails with `absl::ResourceExhaustedError`; the
+    // budget is checked after every morsel and batch and every
+    // `kTuplesPerBudgetCheck` tuples a join produces, so it can be overshot
+    // by about one morsel's worth of input.
+    int64_t memory_budget = MemoryArena::kUnlimited;
+
+    // When set, the arena of every call charges this one, and `memory_budget`
+    // is ignored: the calls are charged against the budget of this arena,
+    // together with everything else its owner allocates from it, but each
+    // call still gives its memory back once its results are dropped.
+    std::shared_ptr<MemoryArena> arena = nullptr;
+
+    // When set, Union stores each distinct tuple of its inputs once, with
+    // its multiplicity, instead of appending its inputs. Inputs that have
+    // multiplicities are always combined this way. Only the materializing
+    // model supports multiplicities.
+    bool count_duplicates = false;
+};
+
 class Interpreter {
 public:
-    Interpreter(const absl::btree_map<RelName, Table>& variables_)
-        : variables(variables_) {}
+    // Tables share their column buffers when copied, so the base relations in
+    // `variables_` are not copied, either here or when a reference to them is
+    // evaluated, and any number of interpreters can read them at once.
+    //
+    // Everything a call computes is allocated from an arena of that call,
+    // which is freed in bulk once every result allocated from it is gone.
+    Interpreter(const absl::btree_map<RelName, Table>& variables_,
+                InterpreterOptions options_ = InterpreterOptions())
+        : variables(variables_)
+        , options(options_)
+        , executor(options_.thread_pool, options_.morsel_size)
+        , arena() {}
 
+    // Evaluates `input` and every node it depends on. Plans are DAGs: each
+    // node is evaluated once, however many consumers it has, and nodes whose
+    // results are already known (from this or an earlier call) are not
+    // evaluated again. Nodes that do not depend on each other run
+    // concurrently when a thread pool is given.
     absl::Status Interpret(Relation* input);
 
+    // Returns a cursor over the result of `input`. A stored result is read
+    // in place. Otherwise, in pipelined mode, the nodes `input` depends on
+    // are evaluated and `input` itself is streamed from its pipeline as the
+    // cursor is advanced, without being stored; in materializing mode, the
+    // result is computed and stored first. The cursor does not refer to the
+    // interpreter and may outlive it.
+    absl::StatusOr<Cursor> Open(Relation* input);
+
     absl::optional<Table> Lookup(Relation* input) {
+        absl::MutexLock lock(&mutex);
         if (context.contains(input)) {
             return context.at(input);
         }
         return absl::nullopt;
     }
 
+    // Makes `table` the value of references to `name`, replacing any earlier
+    // value. The stored results that depend on `name` are dropped, together
+    // with the orders and indexes built over them; all others are kept, so a
+    // caller that evaluates a plan repeatedly while rebinding some of its
+    // inputs only recomputes what reads them.
+    void Bind(const RelName& name, Table table);
+
+    // Chooses the algorithm used for the given Join, Semijoin or Difference
+    // node. Nodes default to `JoinAlgorithm::kAuto`.
+    void SetJoinAlgorithm(Relation* rel, JoinAlgorithm algorithm) {
+        algorithms.insert_or_assign(rel, algorithm);
+    }
+
+    // Makes `table` the value of references to `name`. Selections applied
+    // directly to such a reference scan the row groups of `table` that its
+    // zone maps do not rule out; any other use decompresses it first.
+    void AddCompressedTable(const RelName& name,
+                            std::shared_ptr<const CompressedTable> table) {
+        stored_dictionaries.insert_or_assign(
+            name,
+            std::vector<std::shared_ptr<const StringDictionary>>(
+                table->Width()));
+        compressed.insert_or_assign(name, std::move(table));
+    }
+
+    // Makes `table` the value of references to `name`. Selections applied
+    // directly to such a reference, and semijoins whose left-hand side it
+    // is, read `table` block by block without unpacking it; any other use
+    // unpacks it first.
+    void AddPackedTable(const RelName& name,
+                        std::shared_ptr<const PackedTable> table) {
+        stored_dictionaries.insert_or_assign(name, table->Dictionaries());
+        packed.insert_or_assign(name, std::move(table));
+    }
+
 private:
+    // Appends the nodes reachable from `rel` that have no result yet to
+    // `pending`, each once, with every node after the nodes it depends on.
+    void CollectPendingNodes(Relation* rel,
+                             absl::flat_hash_set<Relation*>* visited,
+                             std::vector<Relation*>* pending);
+
+    // Whether `rel` is a reference to a compressed or packed table.
+    bool IsCompressedReference(Relation* rel) const;
+
+    // Whether `rel` is evaluated by reading a compressed or packed table in
+    // place: a selection over a reference to one, or a semijoin whose
+    // left-hand side is a reference to a packed table.
+    bool IsCompressedScan(Relation* rel) const;
+
+    // The children of `rel` that must have results before it is evaluated:
+    // all of them, except the reference that a compressed scan reads in
+    // place.
+    std::vector<Relation*> EvaluatedChildren(Relation* rel) const;
+
+    // Gives a new call the arena it allocates from. Results of earlier calls
+    // keep their own arenas alive, but are not charged to the new one.
+    void StartQuery() {
+        arena = (options.arena != nullptr)
+            ? std::make_shared<MemoryArena>(MemoryArena::kUnlimited,
+                                            options.arena)
+            : std::make_shared<MemoryArena>(options.memory_budget);
+        absl::MutexLock lock(&mutex);
+        stored_by_call.clear();
+    }
+
+    // Evaluates a single node, whose children must already have results.
+    absl::Status InterpretNode(Relation* input);
+
+    // Evaluates the pending nodes in pipelined mode. When `materialize_input`
+    // is false, every node that `input` depends on is evaluated but `input`
+    // itself is left for the caller to stream, and the results it reads are
+    // left for the caller to release with `ReleaseRemainingUses`.
+    absl::Status InterpretPipelined(Relation* input,
+                                    absl::Span<Relation* const> pending,
+                                    bool materialize_input);
+
+    // Appends to `inputs` the nodes of `units` that a pipeline over `rel`
+    // would scan, without descending past them or past nodes that already
+    // have results.
+    void CollectPipelineInputs(Relation* rel,
+                               const absl::flat_hash_set<Relation*>& units,
+                               absl::flat_hash_set<Relation*>* visited,
+                               std::vector<Relation*>* inputs);
+
+    // Records that every node in `inputs[n]` is read by node `n`, so that it
+    // can be released once all such nodes are done. `output` is never
+    // released.
+    void TrackUses(
+        Relation* output,
+        const absl::flat_hash_map<Relation*, std::vector<Relation*>>& inputs);
+
+    // Marks one use of each of `inputs` as done, dropping the results that
+    // have no uses left.
+    void ReleaseUses(absl::Span<Relation* const> inputs);
+
+    // Drops every result that still has uses left.
+    void ReleaseRemainingUses();
+
+    // Drops the result of `rel` and everything built over it.
+    void DropResult(Relation* rel) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex) {
+        context.erase(rel);
+        sort_orders.erase(rel);
+        hash_indexes.erase(rel);
+    }
+
+    // Whether `rel` reads a reference to `name`, memoized in `memo`.
+    static bool DependsOn(Relation* rel,
+                          const RelName& name,
+                          absl::flat_hash_map<Relation*, bool>* memo);
+
+    bool HasResult(Relation* rel) {
+        absl::MutexLock lock(&mutex);
+        return context.contains(rel);
+    }
+
+    // Results are never replaced or erased while a plan is being evaluated,
+    // so the returned pointer stays valid while other nodes store theirs.
+    const Table* Result(Relation* rel) {
+        absl::MutexLock lock(&mutex);
+        return &context.at(rel);
+    }
+
+    // Also attaches the dictionaries of `rel`'s string columns to `table`.
+    void StoreResult(Relation* rel, Table table) {
+        absl::flat_hash_map<Relation*, const Table*> materialized;
+        {
+            absl::MutexLock lock(&mutex);
+            for (Relation* child : rel->Children()) {
+                if (context.contains(child)) {
+                    materialized[child] = &context.at(child);
+                }
+            }
+        }
+        table.SetDictionaries(PlanDictionaries(
+            rel, variables, materialized, stored_dictionaries));
+        absl::MutexLock lock(&mutex);
+        context.insert_or_assign(rel, std::move(table));
+        stored_by_call.insert(rel);
+    }
+
+    bool UseSortMerge(Relation* node,
+                      Relation* lhs,
+                      absl::Span<const Attr> lhs_key,
+                      Relation* rhs,
+                      absl::Span<const Attr> rhs_key);
+
+    bool IsSorted(Relation* rel, absl::Span<const Attr> key);
+
+    // Returns the order that sorts the result of `rel` on `key`. Orders are
+    // cached, so an input consumed by several sort-based operators on the
+    // same key is only sorted once.
+    std::shared_ptr<const Permutation> SortOrder(Relation* rel,
+                                                 absl::Span<const Attr> key);
+
+    // Returns an index of the result of `rel` on `key` if that result was
+    // stored by an earlier call, and null otherwise. A result that outlives
+    // its call is likely to be read again by later ones, as the inputs of a
+    // fixpoint loop that no round changes are, so it is indexed once and
+    // the index is cached with it; results of the current call are indexed
+    // by the operator reading them, and only if it needs to.
+    std::shared_ptr<const HashIndex> ReusedIndex(Relation* rel,
+                                                 absl::Span<const Attr> key);
+
     absl::btree_map<RelName, Table> variables;
-    absl::btree_map<Relation*, Table> context;
+    InterpreterOptions options;
+    MorselExecutor executor;
+    std::shared_ptr<MemoryArena> arena;
+    absl::flat_hash_map<Relation*, JoinAlgorithm> algorithms;
+    absl::btree_map<RelName, std::shared_ptr<const CompressedTable>>
+        compressed;
+    absl::btree_map<RelName, std::shared_ptr<const PackedTable>> packed;
+    // The dictionaries of the compressed and packed tables, whose
+    // references are not always evaluated.
+    absl::btree_map<
+        RelName, std::vector<std::shared_ptr<const StringDictionary>>>
+        stored_dictionaries;
+
+    absl::Mutex mutex;
+    absl::node_hash_map<Relation*, Table> context ABSL_GUARDED_BY(mutex);
+    absl::flat_hash_map<Relation*, int32_t> remaining_uses
+        ABSL_GUARDED_BY(mutex);
+    absl::flat_hash_map<
+        Relation*,
+        absl::flat_hash_map<std::vector<Attr>,
+                            std::shared_ptr<const Permutation>>> sort_orders
+        ABSL_GUARDED_BY(mutex);
+    absl::flat_hash_map<
+        Relation*,
+        absl::flat_hash_map<std::vector<Attr>,
+                            std::shared_ptr<const HashIndex>>> hash_indexes
+        ABSL_GUARDED_BY(mutex);
+    // The results stored by the current call.
+    absl::flat_hash_set<Relation*> stored_by_call ABSL_GUARDED_BY(mutex);
 };
 
+void Interpreter::CollectPendingNodes(Relation* rel,
+                                      absl::flat_hash_set<Relation*>* visited,
+                                      std::vector<Relation*>* pending) {
+    if (!visited->insert(rel).second || HasResult(rel)) {
+        return;
+    }
+    for (Relation* child : EvaluatedChildren(rel)) {
+        CollectPendingNodes(child, visited, pending);
+    }
+    pending->push_back(rel);
+}
+
+bool Interpreter::IsCompressedReference(Relation* rel) const {
+    if (auto r = DynamicCast<Relation, RelationReference>(rel)) {
+        return compressed.contains(r.value()->name)
+            || packed.contains(r.value()->name);
+    }
+    return false;
+}
+
+bool Interpreter::IsCompressedScan(Relation* rel) const {
+    if (auto r = DynamicCast<Relation, RelationSelect>(rel)) {
+        return IsCompressedReference(r.value()->rel);
+    } else if (auto r = DynamicCast<Relation, RelationSemijoin>(rel)) {
+        auto lhs = DynamicCast<Relation, RelationReference>(r.value()->lhs);
+        return lhs.has_value() && packed.contains(lhs.value()->name)
+            && (r.value()->rhs != r.value()->lhs);
+    }
+    return false;
+}
+
+std::vector<Relation*> Interpreter::EvaluatedChildren(Relation* rel) const {
+    if (auto r = DynamicCast<Relation, RelationSelect>(rel)) {
+        if (IsCompressedScan(rel)) {
+            return {};
+        }
+    } else if (auto r = DynamicCast<Relation, RelationSemijoin>(rel)) {
+        if (IsCompressedScan(rel)) {
+            return {r.value()->rhs};
+        }
+    }
+    return rel->Children();
+}
+
+void Interpreter::CollectPipelineInputs(
+    Relation* rel,
+    const absl::flat_hash_set<Relation*>& units,
+    absl::flat_hash_set<Relation*>* visited,
+    std::vector<Relation*>* inputs) {
+    if (!visited->insert(rel).second) {
+        return;
+    }
+    if (units.contains(rel)) {
+        inputs->push_back(rel);
+        return;
+    }
+    if (HasResult(rel)) {
+        return;
+    }
+    for (Relation* child : rel->Children()) {
+        CollectPipelineInputs(child, units, visited, inputs);
+    }
+}
+
+void Interpreter::TrackUses(
+    Relation* output,
+    const absl::flat_hash_map<Relation*, std::vector<Relation*>>& inputs) {
+    absl::MutexLock lock(&mutex);
+    remaining_uses.clear();
+    for (const auto& [node, node_inputs] : inputs) {
+        for (Relation* rel : node_inputs) {
+            if (rel != output) {
+                remaining_uses[rel]++;
+            }
+        }
+    }
+}
+
+void Interpreter::ReleaseRemainingUses() {
+    absl::MutexLock lock(&mutex);
+    for (const auto& [rel, uses] : remaining_uses) {
+        DropResult(rel);
+    }
+    remaining_uses.clear();
+}
+
+void Interpreter::ReleaseUses(absl::Span<Relation* const> inputs) {
+    absl::MutexLock lock(&mutex);
+    for (Relation* rel : inputs) {
+        if (!remaining_uses.contains(rel)) {
+            continue;
+        }
+        if (--remaining_uses.at(rel) == 0) {
+            remaining_uses.erase(rel);
+            DropResult(rel);
+        }
+    }
+}
+
+void Interpreter::Bind(const RelName& name, Table table) {
+    variables.insert_or_assign(name, std::move(table));
+    absl::flat_hash_map<Relation*, bool> memo;
+    absl::MutexLock lock(&mutex);
+    std::vector<Relation*> stale;
+    for (const auto& [rel, result] : context) {
+        if (DependsOn(rel, name, &memo)) {
+            stale.push_back(rel);
+        }
+    }
+    for (Relation* rel : stale) {
+        DropResult(rel);
+    }
+}
+
+bool Interpreter::DependsOn(Relation* rel,
+                            const RelName& name,
+                            absl::flat_hash_map<Relation*, bool>* memo) {
+    if (memo->contains(rel)) {
+        return memo->at(rel);
+    }
+    bool depends = false;
+    if (auto r = DynamicCast<Relation, RelationReference>(rel)) {
+        depends = (r.value()->name == name);
+    }
+    for (Relation* child : rel->Children()) {
+        depends = depends || DependsOn(child, name, memo);
+    }
+    memo->insert_or_assign(rel, depends);
+    return depends;
+}
+
+bool Interpreter::UseSortMerge(Relation* node,
+                               Relation* lhs,
+                               absl::Span<const Attr> lhs_key,
+                               Relation* rhs,
+                               absl::Span<const Attr> rhs_key) {
+    JoinAlgorithm algorithm = JoinAlgorithm::kAuto;
+    if (algorithms.contains(node)) {
+        algorithm = algorithms.at(node);
+    }
+    switch (algorithm) {
+        case JoinAlgorithm::kHash:
+            return false;
+        case JoinAlgorithm::kSortMerge:
+            return true;
+        case JoinAlgorithm::kAuto:
+            return IsSorted(lhs, lhs_key) && IsSorted(rhs, rhs_key);
+    }
+    return false;
+}
+
+bool Interpreter::IsSorted(Relation* rel, absl::Span<const Attr> key) {
+    {
+        absl::MutexLock lock(&mutex);
+        if (sort_orders.contains(rel)
+            && sort_orders.at(rel).contains(
+                std::vector<Attr>(key.begin(), key.end()))) {
+            return true;
+        }
+    }
+    return IsSortedOn(*Result(rel), key);
+}
+
+std::shared_ptr<const Permutation> Interpreter::SortOrder(
+    Relation* rel, absl::Span<const Attr> key) {
+    std::vector<Attr> key_vec(key.begin(), key.end());
+    {
+        absl::MutexLock lock(&mutex);
+        if (sort_orders[rel].contains(key_vec)) {
+            return sort_orders[rel].at(key_vec);
+        }
+    }
+
+    // Sort without holding the lock; if another node sorts the same input
+    // concurrently, the first order stored wins.
+    const Table& table = *Result(rel);
+    std::shared_ptr<const Permutation> order;
+    if (IsSortedOn(table, key)) {
+        Permutation identity(table.NumberOfTuples());
+        std::iota(identity.begin(), identity.end(), 0);
+        order = std::make_shared<const Permutation>(std::move(identity));
+    } else {
+        order = std::make_shared<const Permutation>(
+            RadixSortPermutation(table, key));
+    }
+
+    absl::MutexLock lock(&mutex);
+    return sort_orders[rel].try_emplace(key_vec, order).first->second;
+}
+
+std::shared_ptr<const HashIndex> Interpreter::ReusedIndex(
+    Relation* rel, absl::Span<const Attr> key) {
+    std::vector<Attr> key_vec(key.begin(), key.end());
+    {
+        absl::MutexLock lock(&mutex);
+        if (stored_by_call.contains(rel)) {
+            return nullptr;
+        }
+        if (hash_indexes[rel].contains(key_vec)) {
+            return hash_indexes[rel].at(key_vec);
+        }
+    }
+
+    // As with sort orders, the first index stored wins.
+    auto index = std::make_shared<const HashIndex>(Result(rel), key, arena);
+
+    absl::MutexLock lock(&mutex);
+    return hash_indexes[rel].try_emplace(key_vec, index).first->second;
+}
+
 absl::Status Interpreter::Interpret(Relation* input) {
-    if (auto r = DynamicCast<Relation, RelationReference>(input)) {
-        context.insert_or_assign(input, variables.at(r.value()->name));
-    } else if (auto r = DynamicCast<Relation, RelationJoin>(input)) {
-        RETURN_IF_ERROR(Interpret(r.value()->lhs));
-        RETURN_IF_ERROR(Interpret(r.value()->rhs));
-
-        auto lhs = &context.at(r.value()->lhs);
-        auto rhs = &context.at(r.value()->rhs);
-        Table result(r.value()->Arity());
-        for (int32_t i = 0; i < lhs->NumberOfTuples(); i++) {
-            for (int32_t j = 0; j < rhs->NumberOfTuples(); j++) {
-                auto lhs_tuple = lhs->GetTuple(i);
-                auto rhs_tuple = rhs->GetTuple(j);
-                bool add = true;
-                absl::flat_hash_set<Attr> rhs_nonincluded;
-                for (const auto& [x, y] : r.value()->attributes) {
-                    if (lhs_tuple[x] != rhs_tuple[y]) {
-                        add = false;
-                        break;
-                    }
-                    rhs_nonincluded.insert(y);
-                }
-                if (add) {
-                    Tuple result_tuple;
-                    for (Value value : lhs_tuple) {
-                        result_tuple.push_back(value);
-                    }
-                    for (int32_t k = 0; k < rhs->Width(); k++) {
-                        if (!rhs_nonincluded.contains(k)) {
-                            result_tuple.push_back(rhs_tuple[k]);
-                        }
-                    }
-                    RETURN_IF_ERROR(result.InsertTuple(result_tuple));
-                }
+    StartQuery();
+    absl::flat_hash_set<Relation*> visited;
+    std::vector<Relation*> pending;
+    CollectPendingNodes(input, &visited, &pending);
+
+    if (options.execution == ExecutionModel::kPipeline) {
+        return InterpretPipelined(input, pending, /*materialize_input=*/true);
+    }
+
+    // Group nodes into levels, where each node is one level above the
+    // highest of its pending children; the nodes of a level are independent.
+    absl::flat_hash_map<Relation*, int32_t> level_of;
+    std::vector<std::vector<Relation*>> levels;
+    for (Relation* node : pending) {
+        int32_t level = 0;
+        for (Relation* child : node->Children()) {
+            if (level_of.contains(child)) {
+                level = std::max(level, level_of.at(child) + 1);
             }
         }
-        context.insert_or_assign(input, result);
-    } else if (auto r = DynamicCast<Relation, RelationSemijoin>(input)) {
-        RETURN_IF_ERROR(Interpret(r.value()->lhs));
-        RETURN_IF_ERROR(Interpret(r.value()->rhs));
-
-        auto lhs = &context.at(r.value()->lhs);
-        auto rhs = &context.at(r.value()->rhs);
-        absl::flat_hash_set<Tuple> restricted_rhs;
-        Table result(r.value()->Arity());
-        for (int32_t i = 0; i < rhs->NumberOfTuples(); i++) {
-            auto tuple = rhs->GetTuple(i);
-            Tuple restricted_tuple;
-            for (const auto& [x, y] : r.value()->attributes) {
-                restricted_tuple.push_back(tuple[y]);
+        level_of[node] = level;
+        if (levels.size() <= level) {
+            levels.resize(level + 1);
+        }
+        levels[level].push_back(node);
+    }
+
+    // The distinct pending children of each node are the results it reads.
+    absl::flat_hash_map<Relation*, std::vector<Relation*>> inputs;
+    if (options.release_intermediates) {
+        for (Relation* node : pending) {
+            absl::flat_hash_set<Relation*> seen;
+            inputs[node];
+            for (Relation* child : node->Children()) {
+                if (level_of.contains(child) && seen.insert(child).second) {
+                    inputs[node].push_back(child);
+                }
             }
-            restricted_rhs.insert(restricted_tuple);
         }
-        for (int32_t i = 0; i < lhs->NumberOfTuples(); i++) {
-            auto tuple = lhs->GetTuple(i);
-            Tuple restricted_tuple;
-            for (const auto& [x, y] : r.value()->attributes) {
-                restricted_tuple.push_back(tuple[x]);
+        TrackUses(input, inputs);
+    }
+
+    for (const std::vector<Relation*>& level : levels) {
+        std::vector<absl::Status> statuses(level.size());
+        ParallelFor(options.thread_pool, level.size(), [&](int32_t i) {
+            statuses[i] = InterpretNode(level[i]);
+            if (statuses[i].ok() && options.release_intermediates) {
+                ReleaseUses(inputs.at(level[i]));
             }
-            if (restricted_rhs.contains(restricted_tuple)) {
-                RETURN_IF_ERROR(result.InsertTuple(tuple));
+        });
+        for (const absl::Status& status : statuses) {
+            RETURN_IF_ERROR(status);
+        }
+    }
+
+    return absl::OkStatus();
+}
+
+absl::StatusOr<Cursor> Interpreter::Open(Relation* input) {
+    if (!HasResult(input)
+        && ((options.execution == ExecutionModel::kMaterialize)
+            || IsCompressedReference(input) || IsCompressedScan(input))) {
+        RETURN_IF_ERROR(Interpret(input));
+    }
+    if (HasResult(input)) {
+        return Cursor(*Result(input));
+    }
+
+    StartQuery();
+    absl::flat_hash_set<Relation*> visited;
+    std::vector<Relation*> pending;
+    CollectPendingNodes(input, &visited, &pending);
+    RETURN_IF_ERROR(InterpretPipelined(input, pending,
+                                       /*materialize_input=*/false));
+
+    auto inputs = absl::make_unique<PipelineInputs>();
+    inputs->variables = variables;
+    {
+        absl::MutexLock lock(&mutex);
+        for (const auto& [rel, table] : context) {
+            inputs->materialized.insert_or_assign(rel, table);
+        }
+    }
+    if (options.release_intermediates) {
+        ReleaseRemainingUses();
+    }
+
+    absl::flat_hash_map<Relation*, const Table*> materialized;
+    for (const auto& [rel, table] : inputs->materialized) {
+        materialized[rel] = &table;
+    }
+
+    ASSIGN_OR_RETURN(
+        std::unique_ptr<Operator> op,
+        BuildPipeline(input, inputs->variables, materialized, arena));
+    return Cursor(std::move(op), std::move(inputs));
+}
+
+absl::Status Interpreter::InterpretPipelined(
+    Relation* input,
+    absl::Span<Relation* const> pending,
+    bool materialize_input) {
+    if (options.count_duplicates) {
+        return absl::UnimplementedError(
+            "pipelines do not support counting duplicates");
+    }
+
+    // A node consumed more than once is materialized once and then scanned
+    // by each of its consumers, instead of being recomputed by each of them.
+    // Compressed tables and the scans over them are evaluated on their own
+    // and scanned by their consumers, since pipelines cannot read them; the
+    // other inputs of those scans are materialized for them.
+    absl::flat_hash_map<Relation*, int32_t> consumers;
+    absl::flat_hash_set<Relation*> scan_inputs;
+    for (Relation* node : pending) {
+        for (Relation* child : node->Children()) {
+            consumers[child]++;
+        }
+        if (IsCompressedScan(node)) {
+            for (Relation* child : EvaluatedChildren(node)) {
+                scan_inputs.insert(child);
             }
         }
-        context.insert_or_assign(input, result);
-    } else if (auto r = DynamicCast<Relation, RelationUnion>(input)) {
-        RETURN_IF_ERROR(Interpret(r.value()->lhs));
-        RETURN_IF_ERROR(Interpret(r.value()->rhs));
+    }
 
-        auto lhs = &context.at(r.value()->lhs);
-        auto rhs = &context.at(r.value()->rhs);
+    std::vector<Relation*> units;
+    for (Relation* node : pending) {
+        if ((node == input) || (consumers[node] > 1)
+            || scan_inputs.contains(node)
+            || IsCompressedReference(node) || IsCompressedScan(node)) {
+            units.push_back(node);
+        }
+    }
+
+    // The materialized nodes that each unit's pipeline scans.
+    absl::flat_hash_map<Relation*, std::vector<Relation*>> inputs;
+    if (options.release_intermediates) {
+        absl::flat_hash_set<Relation*> unit_set(units.begin(), units.end());
+        for (Relation* unit : units) {
+            absl::flat_hash_set<Relation*> visited;
+            inputs[unit];
+            for (Relation* child : unit->Children()) {
+                CollectPipelineInputs(
+                    child, unit_set, &visited, &inputs[unit]);
+            }
+        }
+        TrackUses(input, inputs);
+    }
 
-        Table result(r.value()->Arity());
-        for (int32_t i = 0; i < lhs->NumberOfTuples(); i++) {
-            RETURN_IF_ERROR(result.InsertTuple(lhs->GetTuple(i)));
+    for (Relation* unit : units) {
+        if ((unit == input) && !materialize_input) {
+            continue;
         }
-        for (int32_t i = 0; i < rhs->NumberOfTuples(); i++) {
-            RETURN_IF_ERROR(result.InsertTuple(rhs->GetTuple(i)));
+        if (IsCompressedReference(unit) || IsCompressedScan(unit)) {
+            RETURN_IF_ERROR(InterpretNode(unit));
+            if (options.release_intermediates) {
+                ReleaseUses(inputs.at(unit));
+            }
+            continue;
         }
+        absl::flat_hash_map<Relation*, const Table*> materialized;
+        {
+            absl::MutexLock lock(&mutex);
+            for (const auto& [rel, table] : context) {
+                materialized[rel] = &table;
+            }
+        }
+        ASSIGN_OR_RETURN(
+            std::unique_ptr<Operator> op,
+            BuildPipeline(unit, variables, materialized, arena));
+        Table result(unit->Arity(), arena);
+        RETURN_IF_ERROR(DrainOperator(op.get(), &result));
+        StoreResult(unit, std::move(result));
+        if (options.release_intermediates) {
+            ReleaseUses(inputs.at(unit));
+        }
+    }
 
-        context.insert_or_assign(input, result);
-    } else if (auto r = DynamicCast<Relation, RelationDifference>(input)) {
-        RETURN_IF_ERROR(Interpret(r.value()->lhs));
-        RETURN_IF_ERROR(Interpret(r.value()->rhs));
+    return absl::OkStatus();
+}
 
-        auto lhs = &context.at(r.value()->lhs);
-        auto rhs = &context.at(r.value()->rhs);
+absl::Status Interpreter::InterpretNode(Relation* input) {
+    if (auto r = DynamicCast<Relation, RelationReference>(input)) {
+        if (compressed.contains(r.value()->name)) {
+            Table result(r.value()->Arity(), arena);
+            RETURN_IF_ERROR(
+                compressed.at(r.value()->name)->Decompress(&result));
+            StoreResult(input, std::move(result));
+        } else if (packed.contains(r.value()->name)) {
+            Table result(r.value()->Arity(), arena);
+            RETURN_IF_ERROR(packed.at(r.value()->name)->Unpack(&result));
+            StoreResult(input, std::move(result));
+        } else {
+            StoreResult(input, variables.at(r.value()->name));
+        }
+    } else if (auto r = DynamicCast<Relation, RelationJoin>(input)) {
+        auto lhs = Result(r.value()->lhs);
+        auto rhs = Result(r.value()->rhs);
 
+        JoinLayout layout(r.value()->attributes, rhs->Width());
+        Table result(r.value()->Arity(), arena);
+        if (UseSortMerge(input, r.value()->lhs, layout.lhs_key,
+                         r.value()->rhs, layout.rhs_key)) {
+            auto lhs_order = SortOrder(r.value()->lhs, layout.lhs_key);
+            auto rhs_order = SortOrder(r.value()->rhs, layout.rhs_key);
+            RETURN_IF_ERROR(MergeJoin(*lhs, *lhs_order, *rhs, *rhs_order,
+                                      r.value()->attributes, &result));
+        } else {
+            auto lhs_index = ReusedIndex(r.value()->lhs, layout.lhs_key);
+            auto rhs_index = ReusedIndex(r.value()->rhs, layout.rhs_key);
+            RETURN_IF_ERROR(
+                HashJoin(*lhs, *rhs, r.value()->attributes, &result,
+                         executor, lhs_index.get(), rhs_index.get()));
+        }
+        StoreResult(input, std::move(result));
+    } else if (auto r = DynamicCast<Relation, RelationMultiJoin>(input)) {
+        std::vector<const Table*> inputs;
+        for (Relation* rel : r.value()->inputs) {
+            inputs.push_back(Result(rel));
+        }
 
-        absl::flat_hash_set<std::vector<Value>> tuples_in_rhs;
-        for (int32_t i = 0; i < rhs->NumberOfTuples(); i++) {
-            tuples_in_rhs.insert(rhs->GetTuple(i));
+        for (const Table* table : inputs) {
+            if (table->HasMultiplicities()) {
+                return absl::UnimplementedError(
+                    "MultiJoin does not support tables with multiplicities");
+            }
         }
 
-        Table result(r.value()->Arity());
-        for (int32_t i = 0; i < lhs->NumberOfTuples(); i++) {
-            auto tuple = lhs->GetTuple(i);
-            if (!tuples_in_rhs.contains(tuple)) {
-                RETURN_IF_ERROR(result.InsertTuple(tuple));
+        Table result(r.value()->Arity(), arena);
+        RETURN_IF_ERROR(LeapfrogTriejoin(inputs,
+                                         r.value()->variables,
+                                         r.value()->VariableOrder(),
+                                         &result));
+        StoreResult(input, std::move(result));
+    } else if (auto r = DynamicCast<Relation, RelationSemijoin>(input)) {
+        Table result(r.value()->Arity(), arena);
+        if (IsCompressedScan(input)) {
+            auto ref = DynamicCast<Relation, RelationReference>(r.value()->lhs);
+            RETURN_IF_ERROR(SemijoinPacked(
+                *packed.at(ref.value()->name), *Result(r.value()->rhs),
+                r.value()->attributes, &result, executor));
+        } else {
+            auto lhs = Result(r.value()->lhs);
+            auto rhs = Result(r.value()->rhs);
+            JoinLayout layout(r.value()->attributes, rhs->Width());
+            if (UseSortMerge(input, r.value()->lhs, layout.lhs_key,
+                             r.value()->rhs, layout.rhs_key)) {
+                auto lhs_order = SortOrder(r.value()->lhs, layout.lhs_key);
+                auto rhs_order = SortOrder(r.value()->rhs, layout.rhs_key);
+                RETURN_IF_ERROR(
+                    MergeSemijoin(*lhs, *lhs_order, *rhs, *rhs_order,
+                                  r.value()->attributes, &result));
+            } else {
+                auto rhs_index = ReusedIndex(r.value()->rhs, layout.rhs_key);
+                RETURN_IF_ERROR(
+                    HashSemijoin(*lhs, *rhs, r.value()->attributes, &result,
+                                 executor, rhs_index.get()));
             }
         }
+        StoreResult(input, std::move(result));
+    } else if (auto r = DynamicCast<Relation, RelationUnion>(input)) {
+        auto lhs = Result(r.value()->lhs);
+        auto rhs = Result(r.value()->rhs);
 
-        context.insert_or_assign(input, result);
-    } else if (auto r = DynamicCast<Relation, RelationSelect>(input)) {
-        RETURN_IF_ERROR(Interpret(r.value()->rel));
+        Table result(r.value()->Arity(), arena);
+        if (options.count_duplicates || lhs->HasMultiplicities()
+            || rhs->HasMultiplicities()) {
+            RETURN_IF_ERROR(Consolidate({lhs, rhs}, &result));
+        } else {
+            RETURN_IF_ERROR(
+                ConcatenateTables(options.thread_pool, {lhs, rhs}, &result));
+        }
 
-        auto predicate = r.value()->predicate;
-        auto rel = &context.at(r.value()->rel);
+        StoreResult(input, std::move(result));
+    } else if (auto r = DynamicCast<Relation, RelationDistinct>(input)) {
+        auto rel = Result(r.value()->rel);
 
-        Table result(r.value()->Arity());
-        for (int32_t i = 0; i < rel->NumberOfTuples(); i++) {
-            auto tuple = rel->GetTuple(i);
-            if (InterpretPredicate(predicate, tuple)) {
-                RETURN_IF_ERROR(result.InsertTuple(tuple));
-            }
+        Table result(r.value()->Arity(), arena);
+        RETURN_IF_ERROR(Distinct(*rel, options.thread_pool, &result));
+
+        StoreResult(input, std::move(result));
+    } else if (auto r = DynamicCast<Relation, RelationDifference>(input)) {
+        auto lhs = Result(r.value()->lhs);
+        auto rhs = Result(r.value()->rhs);
+
+        std::vector<Attr> all_attrs;
+        for (int32_t k = 0; k < lhs->Width(); k++) {
+            all_attrs.push_back(k);
+        }
+        Table result(r.value()->Arity(), arena);
+        // Every algorithm subtracts occurrences, so the result does not
+        // depend on whether the inputs count their duplicates.
+        if (lhs->HasMultiplicities() || rhs->HasMultiplicities()) {
+            RETURN_IF_ERROR(BagDifference(*lhs, *rhs, &result));
+        } else if (UseSortMerge(input, r.value()->lhs, all_attrs,
+                                r.value()->rhs, all_attrs)) {
+            auto lhs_order = SortOrder(r.value()->lhs, all_attrs);
+            auto rhs_order = SortOrder(r.value()->rhs, all_attrs);
+            RETURN_IF_ERROR(MergeDifference(*lhs, *lhs_order,
+                                            *rhs, *rhs_order, &result));
+        } else {
+            RETURN_IF_ERROR(HashDifference(*lhs, *rhs, &result, executor));
+        }
+
+        StoreResult(input, std::move(result));
+    } else if (auto r = DynamicCast<Relation, RelationSelect>(input)) {
+        auto predicate = r.value()->predicate;
+        Table result(r.value()->Arity(), arena);
+        auto ref = DynamicCast<Relation, RelationReference>(r.value()->rel);
+        if (IsCompressedScan(input) && compressed.contains(ref.value()->name)) {
+            RETURN_IF_ERROR(SelectCompressed(
+                predicate, *compressed.at(ref.value()->name),
+                options.thread_pool, &result));
+        } else if (IsCompressedScan(input)) {
+            RETURN_IF_ERROR(SelectPacked(
+                predicate, *packed.at(ref.value()->name), &result, executor));
+        } else {
+            auto rel = Result(r.value()->rel);
+            auto select = [&](int32_t begin, int32_t end, Table* chunk) {
+                ASSIGN_OR_RETURN(
+                    Bitmap selected,
+                    EvaluatePredicate(predicate, *rel, begin, end));
+                return chunk->AppendRows(*rel, selected.SetIndices(begin));
+            };
+            RETURN_IF_ERROR(
+                executor.Run(rel->NumberOfTuples(), select, &result));
         }
 
-        context.insert_or_assign(input, result);
+        StoreResult(input, std::move(result));
     } else if (auto r = DynamicCast<Relation, RelationMap>(input)) {
         return absl::InternalError("Interpreter cannot support Map");
     } else if (auto r = DynamicCast<Relation, RelationView>(input)) {
-        RETURN_IF_ERROR(Interpret(r.value()->rel.rel));
-
         auto perm = r.value()->rel.perm;
-        auto rel = &context.at(r.value()->rel.rel);
-
-        Table result(r.value()->Arity());
-        for (int32_t i = 0; i < rel->NumberOfTuples(); i++) {
-            Tuple input_tuple = rel->GetTuple(i);
-            Tuple output_tuple;
-            output_tuple.resize(result.Width(), Value());
-            int32_t j = 0;
-            for (absl::optional<Attr> attr_maybe : perm) {
-                if (attr_maybe) {
-                    output_tuple[*attr_maybe] = input_tuple[j];
+        auto rel = Result(r.value()->rel.rel);
+
+        Table result(r.value()->Arity(), arena);
+        auto view = [&](int32_t begin, int32_t end, Table* chunk) {
+            int32_t start = chunk->NumberOfTuples();
+            if (rel->HasMultiplicities()) {
+                chunk->AddMultiplicities();
+            }
+            std::vector<Value*> destination = chunk->Extend(end - begin);
+            if (rel->HasMultiplicities()) {
+                absl::Span<const int64_t> source =
+                    rel->Multiplicities().subspan(begin, end - begin);
+                std::copy(source.begin(), source.end(),
+                          chunk->MutableMultiplicities().data() + start);
+            }
+            for (int32_t j = 0; j < perm.size(); j++) {
+                if (perm[j]) {
+                    absl::Span<const Value> source =
+                        rel->Column(j).subspan(begin, end - begin);
+                    std::copy(source.begin(), source.end(),
+                              destination[*perm[j]]);
                 }
-                j++;
             }
-            RETURN_IF_ERROR(result.InsertTuple(output_tuple));
-        }
+            return absl::OkStatus();
+        };
+        RETURN_IF_ERROR(executor.Run(rel->NumberOfTuples(), view, &result));
 
-        context.insert_or_assign(input, result);
+        StoreResult(input, std::move(result));
     } else {
         return absl::InternalError(
             "If this is reached, a new relation op has been added but no case "
             "was added to the interpreter. Please add one.");
     }
 
-    return absl::OkStatus();
+    return arena->CheckBudget();
 }
 
 }  // namespace rdss
@@ -0,0 +1,87 @@
+// Copyright 2021 The RDSS Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RDSS_JOIN_LAYOUT_H_
+#define RDSS_JOIN_LAYOUT_H_
+
+#include <cstdint>
+#include <vector>
+
+#include <absl/container/flat_hash_set.h>
+#include <absl/status/status.h>
+
+#include "ast.hpp"
+#include "arena.hpp"
+#include "attr.hpp"
+#include "macros.hpp"
+#include "table.hpp"
+
+namespace rdss {
+
+////////////////////////////////////////////////////////////////////////////////
+
+// The attributes a join or semijoin compares, split by side, together with
+// the attributes of the right-hand side that survive into a join's output.
+struct JoinLayout {
+    std::vector<Attr> lhs_key;
+    std::vector<Attr> rhs_key;
+    std::vector<Attr> rhs_included;
+
+    JoinLayout(const JoinOn& join_on, int32_t rhs_width) {
+        absl::flat_hash_set<Attr> rhs_nonincluded;
+        for (const auto& [x, y] : join_on) {
+            lhs_key.push_back(x);
+            rhs_key.push_back(y);
+            rhs_nonincluded.insert(y);
+        }
+        for (int32_t k = 0; k < rhs_width; k++) {
+            if (!rhs_nonincluded.contains(k)) {
+                rhs_included.push_back(k);
+            }
+        }
+    }
+};
+
+// Inserts the join of two matching tuples into `result`, using `buffer` as
+// scratch space so that no allocation happens per output tuple. The joined
+// tuple occurs as many times as the pairs of occurrences of its parts.
+//
+// A single key can match any number of tuples, so the memory budget of
+// `result` is checked every `kTuplesPerBudgetCheck` insertions rather than
+// left to the end of the morsel.
+inline absl::Status InsertJoinedTuple(const TupleView& lhs_tuple,
+                                      const TupleView& rhs_tuple,
+                                      const JoinLayout& layout,
+                                      Tuple* buffer,
+                                      Table* result) {
+    buffer->clear();
+    for (int32_t k = 0; k < lhs_tuple.size(); k++) {
+        buffer->push_back(lhs_tuple[k]);
+    }
+    for (Attr k : layout.rhs_included) {
+        buffer->push_back(rhs_tuple[k]);
+    }
+    RETURN_IF_ERROR(result->InsertTuple(
+        *buffer, lhs_tuple.Multiplicity() * rhs_tuple.Multiplicity()));
+    if (result->NumberOfTuples() % kTuplesPerBudgetCheck == 0) {
+        return CheckMemoryBudget(result->Arena().get());
+    }
+    return absl::OkStatus();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace rdss
+
+#endif  // RDSS_JOIN_LAYOUT_H_
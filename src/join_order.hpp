@@ -0,0 +1,443 @@
+// Copyright 2021 The RDSS Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RDSS_JOIN_ORDER_H_
+#define RDSS_JOIN_ORDER_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include <absl/container/btree_map.h>
+#include <absl/container/btree_set.h>
+#include <absl/container/flat_hash_map.h>
+#include <absl/numeric/bits.h>
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <absl/strings/str_format.h>
+#include <absl/types/span.h>
+
+#include "ast.hpp"
+#include "macros.hpp"
+#include "statistics.hpp"
+
+namespace rdss {
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Connected sets of at most this many inputs are ordered exhaustively; larger
+// ones are ordered greedily.
+constexpr int32_t kMaxExhaustiveJoinInputs = 12;
+
+namespace internal {
+
+// The estimated result of joining a set of inputs.
+struct JoinEstimate {
+    double cardinality = 0.0;
+    // The estimated number of distinct values of every variable bound by the
+    // inputs.
+    absl::btree_map<int32_t, double> distinct;
+};
+
+// Estimates the join of two results, assuming that the values of each shared
+// variable on the side with fewer of them all occur on the other side. If
+// one side binds no variable that the other does not, the join is evaluated
+// as a semijoin and is no larger than the other side.
+inline JoinEstimate EstimateJoin(const JoinEstimate& lhs,
+                                 const JoinEstimate& rhs) {
+    JoinEstimate result;
+    result.cardinality = lhs.cardinality * rhs.cardinality;
+    result.distinct = lhs.distinct;
+    for (const auto& [variable, distinct] : rhs.distinct) {
+        auto [it, inserted] = result.distinct.try_emplace(variable, distinct);
+        if (!inserted) {
+            result.cardinality /= std::max({it->second, distinct, 1.0});
+            it->second = std::min(it->second, distinct);
+        }
+    }
+    if (result.distinct.size() == lhs.distinct.size()) {
+        result.cardinality = std::min(result.cardinality, lhs.cardinality);
+    }
+    if (result.distinct.size() == rhs.distinct.size()) {
+        result.cardinality = std::min(result.cardinality, rhs.cardinality);
+    }
+    for (auto& [variable, distinct] : result.distinct) {
+        distinct = std::min(distinct, result.cardinality);
+    }
+    return result;
+}
+
+// The best plan found for joining a connected set of inputs: the join of the
+// plans for `lhs` and `rhs`, which are both zero for a single input.
+struct JoinPlan {
+    JoinEstimate estimate;
+    // The sum of the estimated sizes of every join result in the plan.
+    double cost = 0.0;
+    uint64_t lhs = 0;
+    uint64_t rhs = 0;
+};
+
+// Finds a plan for every subset of the inputs `0..n-1`, which must form a
+// connected join graph and be numbered in breadth-first order, using the
+// DPccp algorithm of Moerkotte and Neumann: only pairs of disjoint connected
+// subsets that are connected to each other are considered, each once, so no
+// cross products are planned and no time is spent on pairs that would need
+// one.
+inline absl::flat_hash_map<uint64_t, JoinPlan> OrderJoinsExhaustively(
+    absl::Span<const uint64_t> neighbors,
+    absl::Span<const JoinEstimate> leaves) {
+    int32_t n = neighbors.size();
+    auto neighborhood = [&](uint64_t set) {
+        uint64_t result = 0;
+        for (uint64_t rest = set; rest != 0; rest &= rest - 1) {
+            result |= neighbors[absl::countr_zero(rest)];
+        }
+        return result & ~set;
+    };
+    // The inputs numbered at most `i`.
+    auto prefix = [](int32_t i) {
+        return (uint64_t(2) << i) - 1;
+    };
+
+    // Calls `emit` for every connected set that extends `set` with inputs
+    // outside `excluded`.
+    std::function<void(uint64_t, uint64_t,
+                       const std::function<void(uint64_t)>&)> extend =
+        [&](uint64_t set,
+            uint64_t excluded,
+            const std::function<void(uint64_t)>& emit) {
+            uint64_t candidates = neighborhood(set) & ~excluded;
+            for (uint64_t sub = candidates; sub != 0;
+                 sub = (sub - 1) & candidates) {
+                emit(set | sub);
+            }
+            for (uint64_t sub = candidates; sub != 0;
+                 sub = (sub - 1) & candidates) {
+                extend(set | sub, excluded | candidates, emit);
+            }
+        };
+
+    // Every connected set, paired with every connected set of higher-numbered
+    // inputs that it is connected to.
+    std::vector<std::pair<uint64_t, uint64_t>> pairs;
+    auto add_complements = [&](uint64_t lhs) {
+        uint64_t excluded = lhs | prefix(absl::countr_zero(lhs));
+        uint64_t candidates = neighborhood(lhs) & ~excluded;
+        for (int32_t i = n - 1; i >= 0; i--) {
+            if (((candidates >> i) & 1) == 0) {
+                continue;
+            }
+            uint64_t rhs = uint64_t(1) << i;
+            pairs.emplace_back(lhs, rhs);
+            extend(rhs, excluded | (prefix(i) & candidates),
+                   [&](uint64_t set) { pairs.emplace_back(lhs, set); });
+        }
+    };
+    for (int32_t i = n - 1; i >= 0; i--) {
+        uint64_t start = uint64_t(1) << i;
+        add_complements(start);
+        extend(start, prefix(i), add_complements);
+    }
+
+    // Smaller sets first, so that both halves of a pair have their final
+    // plans by the time the pair is considered.
+    std::stable_sort(pairs.begin(), pairs.end(),
+                     [](const auto& x, const auto& y) {
+                         return absl::popcount(x.first | x.second)
+                             < absl::popcount(y.first | y.second);
+                     });
+
+    absl::flat_hash_map<uint64_t, JoinPlan> plans;
+    for (int32_t i = 0; i < n; i++) {
+        plans[uint64_t(1) << i].estimate = leaves[i];
+    }
+    for (const auto& [lhs, rhs] : pairs) {
+        const JoinPlan& lhs_plan = plans.at(lhs);
+        const JoinPlan& rhs_plan = plans.at(rhs);
+        JoinEstimate estimate =
+            EstimateJoin(lhs_plan.estimate, rhs_plan.estimate);
+        double cost = lhs_plan.cost + rhs_plan.cost + estimate.cardinality;
+        auto [it, inserted] = plans.try_emplace(lhs | rhs);
+        if (inserted || (cost < it->second.cost)) {
+            it->second = JoinPlan { std::move(estimate), cost, lhs, rhs };
+        }
+    }
+    return plans;
+}
+
+// Plans a connected set of inputs by repeatedly joining the two connected
+// plans with the smallest estimated join, for sets too large to order
+// exhaustively.
+inline absl::flat_hash_map<uint64_t, JoinPlan> OrderJoinsGreedily(
+    absl::Span<const uint64_t> neighbors,
+    absl::Span<const JoinEstimate> leaves) {
+    absl::flat_hash_map<uint64_t, JoinPlan> plans;
+    std::vector<uint64_t> current;
+    for (int32_t i = 0; i < neighbors.size(); i++) {
+        plans[uint64_t(1) << i].estimate = leaves[i];
+        current.push_back(uint64_t(1) << i);
+    }
+    auto connected = [&](uint64_t x, uint64_t y) {
+        for (uint64_t rest = x; rest != 0; rest &= rest - 1) {
+            if ((neighbors[absl::countr_zero(rest)] & y) != 0) {
+                return true;
+            }
+        }
+        return false;
+    };
+    while (current.size() > 1) {
+        int32_t best_x = -1;
+        int32_t best_y = -1;
+        JoinEstimate best;
+        for (int32_t x = 0; x < current.size(); x++) {
+            for (int32_t y = x + 1; y < current.size(); y++) {
+                if (!connected(current[x], current[y])) {
+                    continue;
+                }
+                JoinEstimate estimate =
+                    EstimateJoin(plans.at(current[x]).estimate,
+                                 plans.at(current[y]).estimate);
+                if ((best_x < 0)
+                    || (estimate.cardinality < best.cardinality)) {
+                    best_x = x;
+                    best_y = y;
+                    best = std::move(estimate);
+                }
+            }
+        }
+        RDSS_CHECK_GE(best_x, 0) << "join graph is not connected";
+        uint64_t lhs = current[best_x];
+        uint64_t rhs = current[best_y];
+        double cost =
+            plans.at(lhs).cost + plans.at(rhs).cost + best.cardinality;
+        plans[lhs | rhs] = JoinPlan { std::move(best), cost, lhs, rhs };
+        current[best_x] = lhs | rhs;
+        current.erase(current.begin() + best_y);
+    }
+    return plans;
+}
+
+// A relation together with the variable bound by each of its attributes.
+struct BoundRelation {
+    Relation* rel;
+    std::vector<int32_t> layout;
+    JoinEstimate estimate;
+};
+
+// Joins two relations on the variables they share. If one of them binds no
+// other variables, it only filters the other, and a semijoin is used.
+inline BoundRelation JoinBound(RelationFactory* factory,
+                               const BoundRelation& lhs,
+                               const BoundRelation& rhs) {
+    absl::flat_hash_map<int32_t, Attr> lhs_attrs;
+    for (Attr k = 0; k < lhs.layout.size(); k++) {
+        lhs_attrs[lhs.layout[k]] = k;
+    }
+    JoinOn join_on;
+    std::vector<int32_t> rhs_only;
+    for (Attr k = 0; k < rhs.layout.size(); k++) {
+        if (lhs_attrs.contains(rhs.layout[k])) {
+            join_on.emplace(lhs_attrs.at(rhs.layout[k]), k);
+        } else {
+            rhs_only.push_back(rhs.layout[k]);
+        }
+    }
+
+    BoundRelation result;
+    result.estimate = EstimateJoin(lhs.estimate, rhs.estimate);
+    if (rhs_only.empty()) {
+        result.rel = factory->Make<RelationSemijoin>(lhs.rel, rhs.rel, join_on);
+        result.layout = lhs.layout;
+    } else if (join_on.size() == lhs.layout.size()) {
+        JoinOn flipped;
+        for (const auto& [x, y] : join_on) {
+            flipped.emplace(y, x);
+        }
+        result.rel = factory->Make<RelationSemijoin>(rhs.rel, lhs.rel, flipped);
+        result.layout = rhs.layout;
+    } else {
+        result.rel = factory->Make<RelationJoin>(lhs.rel, rhs.rel, join_on);
+        result.layout = lhs.layout;
+        result.layout.insert(result.layout.end(),
+                             rhs_only.begin(), rhs_only.end());
+    }
+    return result;
+}
+
+}  // namespace internal
+
+// Chooses the order in which to evaluate `join` as a tree of binary joins, and
+// returns a plan, made with `factory`, that has the same attributes as
+// `join`. `statistics[i]` describes the result of input `i`.
+//
+// Plans are costed by the total estimated size of their intermediate results,
+// where the size of a join is estimated from the sizes and distinct counts of
+// its inputs. Inputs that share no variable with the rest of the plan are
+// cross-joined last, smallest first. Joins with an input that binds no new
+// variable are evaluated as semijoins.
+//
+// `RelationMultiJoin` treats its inputs as sets, while binary joins pair up
+// every occurrence of their inputs' tuples. Unless `inputs_are_sets` promises
+// that no input holds a tuple twice, every input that is not already a
+// `RelationDistinct` is wrapped in one, so that the plan has the same result
+// as `join` whatever its inputs hold.
+inline absl::StatusOr<Relation*> OrderJoins(
+    RelationFactory* factory,
+    const RelationMultiJoin& join,
+    absl::Span<const TableStatistics* const> statistics,
+    bool inputs_are_sets = false) {
+    int32_t n = join.inputs.size();
+    if (n == 0) {
+        return absl::InvalidArgumentError("cannot order a join of nothing");
+    }
+    if (statistics.size() != n) {
+        return absl::InvalidArgumentError(
+            "every input of the join needs statistics");
+    }
+    std::vector<internal::JoinEstimate> leaves(n);
+    for (int32_t i = 0; i < n; i++) {
+        const std::vector<int32_t>& variables = join.variables.at(i);
+        if (statistics[i]->Width() != variables.size()) {
+            return absl::InvalidArgumentError(absl::StrFormat(
+                "statistics of input %d do not match its arity", i));
+        }
+        leaves[i].cardinality = statistics[i]->NumberOfTuples();
+        for (Attr k = 0; k < variables.size(); k++) {
+            double distinct = statistics[i]->Column(k).DistinctCount();
+            if (!leaves[i].distinct.try_emplace(variables[k], distinct)
+                    .second) {
+                return absl::UnimplementedError(absl::StrFormat(
+                    "input %d binds variable %d more than once",
+                    i, variables[k]));
+            }
+        }
+    }
+    std::vector<Relation*> inputs;
+    for (Relation* input : join.inputs) {
+        bool is_set = inputs_are_sets
+            || DynamicCast<Relation, RelationDistinct>(input).has_value();
+        inputs.push_back(is_set ? input
+                                : factory->Make<RelationDistinct>(input));
+    }
+    absl::btree_set<int32_t> bound;
+    for (const std::vector<int32_t>& variables : join.variables) {
+        bound.insert(variables.begin(), variables.end());
+    }
+    if (bound.size() != join.Arity()) {
+        return absl::InvalidArgumentError(
+            "every variable of the join must be bound by some input");
+    }
+
+    // Split the join graph into connected components, numbering the inputs
+    // of each in breadth-first order as DPccp requires.
+    std::vector<std::vector<int32_t>> components;
+    std::vector<bool> seen(n, false);
+    for (int32_t start = 0; start < n; start++) {
+        if (seen[start]) {
+            continue;
+        }
+        seen[start] = true;
+        components.push_back({start});
+        std::vector<int32_t>& component = components.back();
+        for (int32_t next = 0; next < component.size(); next++) {
+            int32_t i = component[next];
+            for (int32_t j = 0; j < n; j++) {
+                if (seen[j]) {
+                    continue;
+                }
+                for (const auto& [variable, distinct] : leaves[i].distinct) {
+                    if (leaves[j].distinct.contains(variable)) {
+                        seen[j] = true;
+                        component.push_back(j);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    std::vector<internal::BoundRelation> component_plans;
+    for (const std::vector<int32_t>& component : components) {
+        if (component.size() > 64) {
+            return absl::UnimplementedError(
+                "cannot order more than 64 connected inputs");
+        }
+        std::vector<uint64_t> neighbors(component.size(), 0);
+        std::vector<internal::JoinEstimate> component_leaves;
+        for (int32_t x = 0; x < component.size(); x++) {
+            component_leaves.push_back(leaves[component[x]]);
+            for (int32_t y = 0; y < component.size(); y++) {
+                if (x == y) {
+                    continue;
+                }
+                for (const auto& [variable, distinct] :
+                         leaves[component[x]].distinct) {
+                    if (leaves[component[y]].distinct.contains(variable)) {
+                        neighbors[x] |= uint64_t(1) << y;
+                    }
+                }
+            }
+        }
+
+        absl::flat_hash_map<uint64_t, internal::JoinPlan> plans =
+            (component.size() <= kMaxExhaustiveJoinInputs)
+            ? internal::OrderJoinsExhaustively(neighbors, component_leaves)
+            : internal::OrderJoinsGreedily(neighbors, component_leaves);
+
+        std::function<internal::BoundRelation(uint64_t)> build =
+            [&](uint64_t set) -> internal::BoundRelation {
+                const internal::JoinPlan& plan = plans.at(set);
+                if (plan.lhs == 0) {
+                    int32_t i = component[absl::countr_zero(set)];
+                    return internal::BoundRelation {
+                        inputs[i], join.variables[i], leaves[i] };
+                }
+                return internal::JoinBound(factory, build(plan.lhs),
+                                           build(plan.rhs));
+            };
+        uint64_t all = (component.size() == 64)
+            ? ~uint64_t(0)
+            : (uint64_t(1) << component.size()) - 1;
+        component_plans.push_back(build(all));
+    }
+
+    std::stable_sort(component_plans.begin(), component_plans.end(),
+                     [](const auto& x, const auto& y) {
+                         return x.estimate.cardinality
+                             < y.estimate.cardinality;
+                     });
+    internal::BoundRelation result = component_plans[0];
+    for (int32_t c = 1; c < component_plans.size(); c++) {
+        result = internal::JoinBound(factory, result, component_plans[c]);
+    }
+
+    AttrPartialPermutation perm;
+    bool identity = true;
+    for (Attr k = 0; k < result.layout.size(); k++) {
+        perm.push_back(result.layout[k]);
+        identity &= (result.layout[k] == k);
+    }
+    if (identity) {
+        return result.rel;
+    }
+    return factory->Make<RelationView>(Viewed<Relation*>(perm, result.rel));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace rdss
+
+#endif  // RDSS_JOIN_ORDER_H_
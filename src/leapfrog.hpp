@@ -0,0 +1,376 @@
+// Copyright 2021 The RDSS Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RDSS_LEAPFROG_H_
+#define RDSS_LEAPFROG_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <absl/container/flat_hash_map.h>
+#include <absl/status/status.h>
+#include <absl/strings/str_format.h>
+#include <absl/types/span.h>
+
+#include "arena.hpp"
+#include "attr.hpp"
+#include "macros.hpp"
+#include "radix_sort.hpp"
+#include "table.hpp"
+
+namespace rdss {
+
+////////////////////////////////////////////////////////////////////////////////
+
+// A relation stored as a trie for Leapfrog Triejoin: its distinct rows, sorted
+// lexicographically, with one column per trie level. Each level is bound to a
+// join variable, and levels follow the global variable order.
+class TrieIndex {
+public:
+    // Builds a trie over `table`, where attribute `j` is bound to the variable
+    // `variables[j]` and `position_of[v]` is the position of variable `v` in
+    // the global order. When several attributes are bound to the same
+    // variable, rows on which they disagree are dropped.
+    TrieIndex(const Table& table,
+              absl::Span<const int32_t> variables,
+              absl::Span<const int32_t> position_of)
+        : level_variables(), levels() {
+        absl::flat_hash_map<int32_t, Attr> representative;
+        for (int32_t j = 0; j < variables.size(); j++) {
+            if (representative.try_emplace(variables[j], j).second) {
+                level_variables.push_back(variables[j]);
+            }
+        }
+        std::sort(level_variables.begin(), level_variables.end(),
+                  [&](int32_t x, int32_t y) {
+                      return position_of[x] < position_of[y];
+                  });
+
+        int32_t depth = level_variables.size();
+        Table projected(depth);
+        projected.Reserve(table.NumberOfTuples());
+        Tuple buffer(depth);
+        for (int32_t i = 0; i < table.NumberOfTuples(); i++) {
+            TupleView tuple = table.GetTupleView(i);
+            bool consistent = true;
+            for (int32_t j = 0; j < variables.size(); j++) {
+                if (tuple[j] != tuple[representative.at(variables[j])]) {
+                    consistent = false;
+                    break;
+                }
+            }
+            if (!consistent) {
+                continue;
+            }
+            for (int32_t d = 0; d < depth; d++) {
+                buffer[d] = tuple[representative.at(level_variables[d])];
+            }
+            RDSS_CHECK_OK(projected.InsertTuple(buffer));
+        }
+
+        std::vector<Attr> all_levels;
+        for (int32_t d = 0; d < depth; d++) {
+            all_levels.push_back(d);
+        }
+        Permutation order = RadixSortPermutation(projected, all_levels);
+
+        levels.resize(depth);
+        for (int32_t k = 0; k < order.size(); k++) {
+            if ((k > 0) && (CompareKeys(projected.GetTupleView(order[k - 1]),
+                                        all_levels,
+                                        projected.GetTupleView(order[k]),
+                                        all_levels) == 0)) {
+                continue;
+            }
+            for (int32_t d = 0; d < depth; d++) {
+                levels[d].push_back(projected.Column(d)[order[k]]);
+            }
+        }
+    }
+
+    int32_t Depth() const {
+        return levels.size();
+    }
+
+    int32_t Size() const {
+        return levels.empty() ? 0 : levels[0].size();
+    }
+
+    int32_t VariableAt(int32_t level) const {
+        return level_variables[level];
+    }
+
+    absl::Span<const Value> Level(int32_t level) const {
+        return levels[level];
+    }
+
+private:
+    std::vector<int32_t> level_variables;
+    std::vector<std::vector<Value>> levels;
+};
+
+// The linear iterator interface of Leapfrog Triejoin over a `TrieIndex`. At
+// each level, the iterator ranges over the distinct keys that extend the keys
+// chosen at the levels above it.
+class TrieIterator {
+public:
+    explicit TrieIterator(const TrieIndex* trie_) : trie(trie_), stack() {}
+
+    // Descends to the first child of the current key, or to the first key of
+    // the root level if no level has been opened yet.
+    void Open() {
+        if (stack.empty()) {
+            stack.push_back(Frame { 0, trie->Size(), 0 });
+        } else {
+            const Frame& frame = stack.back();
+            stack.push_back(
+                Frame { frame.position, RunEnd(), frame.position });
+        }
+    }
+
+    // Returns to the parent level, restoring its position.
+    void Up() {
+        stack.pop_back();
+    }
+
+    // Moves to the next distinct key at the current level.
+    void Next() {
+        stack.back().position = RunEnd();
+    }
+
+    // Moves to the least key at the current level that is at least `value`.
+    // Uses a galloping search, so seeking a short distance is cheap.
+    void Seek(Value value) {
+        Frame& frame = stack.back();
+        frame.position = Gallop(frame.position, frame.end, [&](int32_t i) {
+            return Column()[i] < value;
+        });
+    }
+
+    bool AtEnd() const {
+        return stack.back().position == stack.back().end;
+    }
+
+    Value Key() const {
+        return Column()[stack.back().position];
+    }
+
+private:
+    // The rows `[begin, end)` share the keys of all levels above this one.
+    struct Frame {
+        int32_t begin;
+        int32_t end;
+        int32_t position;
+    };
+
+    absl::Span<const Value> Column() const {
+        return trie->Level(stack.size() - 1);
+    }
+
+    // Returns the end of the run of rows that share the current key.
+    int32_t RunEnd() const {
+        const Frame& frame = stack.back();
+        Value key = Key();
+        return Gallop(frame.position, frame.end, [&](int32_t i) {
+            return Column()[i] <= key;
+        });
+    }
+
+    // Returns the first index in `[begin, end)` for which `before` is false,
+    // given that `before` is true on a prefix of the range and false after.
+    template<typename F>
+    static int32_t Gallop(int32_t begin, int32_t end, F before) {
+        int32_t step = 1;
+        int32_t low = begin;
+        int32_t high = begin;
+        while ((high < end) && before(high)) {
+            low = high + 1;
+            high = std::min(end, high + step);
+            step *= 2;
+        }
+        while (low < high) {
+            int32_t middle = low + (high - low) / 2;
+            if (before(middle)) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        return low;
+    }
+
+    const TrieIndex* trie;
+    std::vector<Frame> stack;
+};
+
+namespace internal {
+
+class LeapfrogTriejoinState {
+public:
+    LeapfrogTriejoinState(std::vector<std::vector<TrieIterator*>> participants_,
+                          absl::Span<const Attr> variable_order_,
+                          Table* result_)
+        : participants(std::move(participants_))
+        , variable_order(variable_order_)
+        , binding(result_->Width())
+        , result(result_) {}
+
+    absl::Status Enumerate(int32_t depth) {
+        if (depth == variable_order.size()) {
+            RETURN_IF_ERROR(result->InsertTuple(binding));
+            if (result->NumberOfTuples() % kTuplesPerBudgetCheck == 0) {
+                return CheckMemoryBudget(result->Arena().get());
+            }
+            return absl::OkStatus();
+        }
+
+        std::vector<TrieIterator*> iterators = participants[depth];
+        for (TrieIterator* iterator : iterators) {
+            iterator->Open();
+        }
+        absl::Status status = Leapfrog(depth, &iterators);
+        for (TrieIterator* iterator : iterators) {
+            iterator->Up();
+        }
+        return status;
+    }
+
+private:
+    absl::Status Leapfrog(int32_t depth,
+                          std::vector<TrieIterator*>* iterators) {
+        for (TrieIterator* iterator : *iterators) {
+            if (iterator->AtEnd()) {
+                return absl::OkStatus();
+            }
+        }
+        std::sort(iterators->begin(), iterators->end(),
+                  [](TrieIterator* x, TrieIterator* y) {
+                      return x->Key() < y->Key();
+                  });
+
+        int32_t k = iterators->size();
+        int32_t p = 0;
+        while (true) {
+            TrieIterator* iterator = (*iterators)[p];
+            Value max_key = (*iterators)[(p + k - 1) % k]->Key();
+            if (iterator->Key() == max_key) {
+                binding[variable_order[depth]] = max_key;
+                RETURN_IF_ERROR(Enumerate(depth + 1));
+                iterator->Next();
+            } else {
+                iterator->Seek(max_key);
+            }
+            if (iterator->AtEnd()) {
+                return absl::OkStatus();
+            }
+            p = (p + 1) % k;
+        }
+    }
+
+    std::vector<std::vector<TrieIterator*>> participants;
+    absl::Span<const Attr> variable_order;
+    Tuple binding;
+    Table* result;
+};
+
+}  // namespace internal
+
+// Computes the natural join of `inputs` with Leapfrog Triejoin, binding
+// variables in `variable_order`. Attribute `j` of `inputs[i]` is bound to the
+// variable `variables[i][j]`, and attribute `v` of the result holds the value
+// of variable `v`. The running time is within a logarithmic factor of the
+// worst-case output size of the query (the AGM bound), which binary join plans
+// cannot guarantee on cyclic queries.
+inline absl::Status LeapfrogTriejoin(
+    absl::Span<const Table* const> inputs,
+    absl::Span<const std::vector<int32_t>> variables,
+    absl::Span<const Attr> variable_order,
+    Table* result) {
+    int32_t num_variables = variable_order.size();
+    if (result->Width() != num_variables) {
+        return absl::InvalidArgumentError(
+            "result width does not match the number of variables");
+    }
+    if (inputs.size() != variables.size()) {
+        return absl::InvalidArgumentError(
+            "every input must have a list of variables");
+    }
+
+    std::vector<int32_t> position_of(num_variables, -1);
+    for (int32_t i = 0; i < num_variables; i++) {
+        Attr v = variable_order[i];
+        if ((v < 0) || (v >= num_variables) || (position_of[v] != -1)) {
+            return absl::InvalidArgumentError(
+                "variable order is not a permutation of the variables");
+        }
+        position_of[v] = i;
+    }
+
+    for (int32_t i = 0; i < inputs.size(); i++) {
+        if (inputs[i]->Width() != variables[i].size()) {
+            return absl::InvalidArgumentError(absl::StrFormat(
+                "input %d does not match its list of variables", i));
+        }
+        for (int32_t v : variables[i]) {
+            if ((v < 0) || (v >= num_variables)) {
+                return absl::InvalidArgumentError(absl::StrFormat(
+                    "input %d refers to an unknown variable %d", i, v));
+            }
+        }
+    }
+
+    for (const Table* input : inputs) {
+        if (input->NumberOfTuples() == 0) {
+            return absl::OkStatus();
+        }
+    }
+
+    std::vector<TrieIndex> tries;
+    tries.reserve(inputs.size());
+    for (int32_t i = 0; i < inputs.size(); i++) {
+        tries.emplace_back(*inputs[i], variables[i], position_of);
+    }
+
+    std::vector<TrieIterator> iterators;
+    iterators.reserve(tries.size());
+    for (const TrieIndex& trie : tries) {
+        iterators.emplace_back(&trie);
+    }
+
+    std::vector<std::vector<TrieIterator*>> participants(num_variables);
+    for (int32_t i = 0; i < tries.size(); i++) {
+        for (int32_t level = 0; level < tries[i].Depth(); level++) {
+            participants[position_of[tries[i].VariableAt(level)]].push_back(
+                &iterators[i]);
+        }
+    }
+    for (int32_t depth = 0; depth < num_variables; depth++) {
+        if (participants[depth].empty()) {
+            return absl::InvalidArgumentError(absl::StrFormat(
+                "variable %d is not bound by any input",
+                variable_order[depth]));
+        }
+    }
+
+    internal::LeapfrogTriejoinState state(
+        std::move(participants), variable_order, result);
+    return state.Enumerate(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace rdss
+
+#endif  // RDSS_LEAPFROG_H_
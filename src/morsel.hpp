@@ -0,0 +1,149 @@
+// Copyright 2021 The RDSS Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RDSS_MORSEL_H_
+#define RDSS_MORSEL_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <absl/status/status.h>
+#include <absl/types/span.h>
+
+#include "arena.hpp"
+#include "macros.hpp"
+#include "table.hpp"
+#include "thread_pool.hpp"
+
+namespace rdss {
+
+////////////////////////////////////////////////////////////////////////////////
+
+constexpr int32_t kDefaultMorselSize = 16384;
+
+// Appends `chunks` to `result` in order. When a pool is given, the chunks are
+// copied into place concurrently.
+inline absl::Status ConcatenateTables(ThreadPool* pool,
+                                      absl::Span<const Table* const> chunks,
+                                      Table* result) {
+    std::vector<int32_t> offsets;
+    int32_t total = 0;
+    for (const Table* chunk : chunks) {
+        if (chunk->Width() != result->Width()) {
+            return absl::InternalError(
+                "given table does not match table width");
+        }
+        offsets.push_back(total);
+        total += chunk->NumberOfTuples();
+        if (chunk->HasMultiplicities()) {
+            result->AddMultiplicities();
+        }
+    }
+
+    int32_t start = result->NumberOfTuples();
+    std::vector<Value*> destination = result->Extend(total);
+    int64_t* multiplicities = result->HasMultiplicities()
+        ? result->MutableMultiplicities().data() + start
+        : nullptr;
+    ParallelFor(pool, chunks.size(), [&](int32_t c) {
+        for (int32_t k = 0; k < result->Width(); k++) {
+            absl::Span<const Value> source = chunks[c]->Column(k);
+            std::copy(source.begin(), source.end(),
+                      destination[k] + offsets[c]);
+        }
+        if (chunks[c]->HasMultiplicities()) {
+            absl::Span<const int64_t> source = chunks[c]->Multiplicities();
+            std::copy(source.begin(), source.end(),
+                      multiplicities + offsets[c]);
+        }
+    });
+    return absl::OkStatus();
+}
+
+// Runs operator loops over fixed-size ranges of input rows ("morsels"),
+// spreading the morsels over a thread pool when one is available. Each morsel
+// writes into its own output chunk and the chunks are concatenated in morsel
+// order, so the output does not depend on how morsels were scheduled.
+class MorselExecutor {
+public:
+    MorselExecutor() : pool(nullptr), morsel_size(kDefaultMorselSize) {}
+
+    MorselExecutor(ThreadPool* pool_, int32_t morsel_size_)
+        : pool(pool_), morsel_size(morsel_size_) {}
+
+    ThreadPool* Pool() const {
+        return pool;
+    }
+
+    // Calls `body(begin, end, chunk)` for consecutive ranges covering the rows
+    // `[0, size)` and appends every chunk to `result`. The body must only
+    // read shared state; everything it produces goes into `chunk`, which has
+    // the same width as `result` and allocates from the same arena.
+    //
+    // The memory budget of that arena is checked after every morsel, and no
+    // further morsels are started once it has been exceeded.
+    template<typename F>
+    absl::Status Run(int32_t size, F body, Table* result) const {
+        const MemoryArena* arena = result->Arena().get();
+        if ((pool == nullptr) || (size <= morsel_size)) {
+            for (int32_t begin = 0; begin < size; begin += morsel_size) {
+                int32_t end = std::min(size, begin + morsel_size);
+                RETURN_IF_ERROR(body(begin, end, result));
+                RETURN_IF_ERROR(CheckMemoryBudget(arena));
+            }
+            return absl::OkStatus();
+        }
+
+        int32_t num_morsels = (size + morsel_size - 1) / morsel_size;
+        // Each chunk gets buffers of its own: copies of one table would
+        // share them, and threads writing to the copies would race on the
+        // copy-on-write check.
+        std::vector<Table> chunks;
+        chunks.reserve(num_morsels);
+        for (int32_t m = 0; m < num_morsels; m++) {
+            chunks.emplace_back(result->Width(), result->Arena());
+        }
+        std::vector<absl::Status> statuses(num_morsels);
+        ParallelFor(pool, num_morsels, [&](int32_t m) {
+            statuses[m] = CheckMemoryBudget(arena);
+            if (!statuses[m].ok()) {
+                return;
+            }
+            int32_t begin = m * morsel_size;
+            int32_t end = std::min(size, begin + morsel_size);
+            statuses[m] = body(begin, end, &chunks[m]);
+        });
+        for (const absl::Status& status : statuses) {
+            RETURN_IF_ERROR(status);
+        }
+
+        std::vector<const Table*> chunk_pointers;
+        for (const Table& chunk : chunks) {
+            chunk_pointers.push_back(&chunk);
+        }
+        RETURN_IF_ERROR(ConcatenateTables(pool, chunk_pointers, result));
+        return CheckMemoryBudget(arena);
+    }
+
+private:
+    ThreadPool* pool;
+    int32_t morsel_size;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace rdss
+
+#endif  // RDSS_MORSEL_H_
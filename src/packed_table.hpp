@@ -0,0 +1,519 @@
+// Copyright 2021 The RDSS Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RDSS_PACKED_TABLE_H_
+#define RDSS_PACKED_TABLE_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <absl/types/optional.h>
+#include <absl/types/span.h>
+
+#include "ast.hpp"
+#include "hash_index.hpp"
+#include "join_layout.hpp"
+#include "macros.hpp"
+#include "morsel.hpp"
+#include "predicate.hpp"
+#include "selection.hpp"
+#include "table.hpp"
+
+namespace rdss {
+
+////////////////////////////////////////////////////////////////////////////////
+
+// The number of rows packed together, which also bounds how much a scan
+// decodes at once: a block of one column is 4 KiB once unpacked.
+constexpr int32_t kPackedBlockSize = 1024;
+
+// Packed values are interleaved over this many 32-bit lanes, so that a single
+// vector instruction unpacks one value of every lane (see `PackedTable`).
+constexpr int32_t kPackedLanes = 8;
+
+enum class PackedEncoding : uint8_t {
+    // Every value is stored as its difference from the block minimum.
+    kFrameOfReference = 0,
+    // Every value is stored as its difference from the value `kPackedLanes`
+    // rows before it, or from the block minimum for the first rows. Only
+    // used for blocks that are sorted.
+    kDelta = 1,
+};
+
+// Describes how one column of one block is stored, along with the smallest
+// and largest value in it.
+struct PackedBlock {
+    PackedEncoding encoding;
+    uint8_t bit_width;
+    Value min;
+    Value max;
+    // Where the packed words of the block start in the column's words. A
+    // block takes `bit_width * kPackedBlockSize / 32` words.
+    int64_t offset;
+};
+
+namespace internal {
+
+inline int32_t PackedBitWidth(uint32_t max_code) {
+    int32_t bits = 0;
+    while ((bits < 32) && ((max_code >> bits) != 0)) {
+        bits++;
+    }
+    return bits;
+}
+
+// Packs `kPackedBlockSize` codes of `bits` bits each. Code `r` goes to lane
+// `r % kPackedLanes`, and each lane holds its codes back to back, with lane
+// `l` of word `w` at `words[w * kPackedLanes + l]`.
+inline void PackLanes(const uint32_t* codes, int32_t bits, uint32_t* words) {
+    for (int32_t r = 0; (bits > 0) && (r < kPackedBlockSize); r++) {
+        int32_t bit = (r / kPackedLanes) * bits;
+        int32_t lane = r % kPackedLanes;
+        int32_t shift = bit % 32;
+        uint32_t* word = words + (bit / 32) * kPackedLanes + lane;
+        word[0] |= codes[r] << shift;
+        if (shift + bits > 32) {
+            word[kPackedLanes] |= codes[r] >> (32 - shift);
+        }
+    }
+}
+
+// The inverse of `PackLanes`. Every step reads the same word position and
+// shift in each lane, so the inner loops compile to plain vector shifts and
+// masks without any shuffling.
+inline void UnpackLanes(const uint32_t* words, int32_t bits, uint32_t* codes) {
+    if (bits == 0) {
+        std::fill(codes, codes + kPackedBlockSize, 0);
+        return;
+    }
+    uint32_t mask = (bits == 32) ? ~uint32_t(0) : (uint32_t(1) << bits) - 1;
+    for (int32_t i = 0; i < kPackedBlockSize / kPackedLanes; i++) {
+        int32_t bit = i * bits;
+        int32_t shift = bit % 32;
+        const uint32_t* low = words + (bit / 32) * kPackedLanes;
+        uint32_t* out = codes + i * kPackedLanes;
+        if (shift + bits > 32) {
+            const uint32_t* high = low + kPackedLanes;
+            for (int32_t l = 0; l < kPackedLanes; l++) {
+                out[l] = ((low[l] >> shift) | (high[l] << (32 - shift)))
+                    & mask;
+            }
+        } else {
+            for (int32_t l = 0; l < kPackedLanes; l++) {
+                out[l] = (low[l] >> shift) & mask;
+            }
+        }
+    }
+}
+
+}  // namespace internal
+
+// A table whose columns are compressed in memory, in blocks of
+// `kPackedBlockSize` rows, by frame-of-reference bit-packing: each value is
+// stored as its difference from the block minimum in as few bits as the
+// block needs. Sorted blocks are delta-encoded instead when that is smaller.
+// Most key columns need far fewer than 32 bits, so a packed table takes a
+// fraction of the memory of a `Table`.
+//
+// Scans read packed tables without unpacking them as a whole: blocks are
+// unpacked one at a time into buffers that stay in cache, comparisons are
+// evaluated on the packed codes, and the other columns are only decoded for
+// blocks that have matching rows (see `SelectPacked` and `SemijoinPacked`).
+//
+// A packed table is immutable and may be read by any number of threads.
+class PackedTable {
+public:
+    // Fails if `table` has multiplicities, which packed tables do not keep.
+    static absl::StatusOr<PackedTable> Pack(const Table& table);
+
+    int32_t Width() const {
+        return width;
+    }
+
+    int32_t NumberOfTuples() const {
+        return number_of_tuples;
+    }
+
+    int32_t NumberOfBlocks() const {
+        return (number_of_tuples + kPackedBlockSize - 1) / kPackedBlockSize;
+    }
+
+    int32_t BlockSize(int32_t block) const {
+        return std::min(kPackedBlockSize,
+                        number_of_tuples - block * kPackedBlockSize);
+    }
+
+    const PackedBlock& Block(int32_t block, Attr attr) const {
+        return blocks[block * width + attr];
+    }
+
+    // The number of bytes taken by the packed values.
+    int64_t PackedSize() const {
+        int64_t result = 0;
+        for (const std::vector<uint32_t>& column : words) {
+            result += column.size() * sizeof(uint32_t);
+        }
+        return result;
+    }
+
+    const std::vector<std::shared_ptr<const StringDictionary>>&
+    Dictionaries() const {
+        return dictionaries;
+    }
+
+    // Unpacks the codes of column `attr` of block `block` into `codes`, which
+    // must have room for `kPackedBlockSize` values. For frame-of-reference
+    // blocks, the codes are the values minus the block minimum.
+    void UnpackCodes(int32_t block, Attr attr, uint32_t* codes) const {
+        const PackedBlock& packed = Block(block, attr);
+        internal::UnpackLanes(words[attr].data() + packed.offset,
+                              packed.bit_width, codes);
+    }
+
+    // Decodes column `attr` of block `block` into `out`, which must have
+    // room for `kPackedBlockSize` values; only the first `BlockSize(block)`
+    // are meaningful.
+    void DecodeBlock(int32_t block, Attr attr, Value* out) const {
+        const PackedBlock& packed = Block(block, attr);
+        uint32_t* codes = reinterpret_cast<uint32_t*>(out);
+        UnpackCodes(block, attr, codes);
+        if (packed.encoding == PackedEncoding::kDelta) {
+            for (int32_t r = kPackedLanes; r < kPackedBlockSize; r++) {
+                codes[r] += codes[r - kPackedLanes];
+            }
+        }
+        uint32_t min = packed.min;
+        for (int32_t r = 0; r < kPackedBlockSize; r++) {
+            codes[r] += min;
+        }
+    }
+
+    // Appends rows `rows` of block `block`, given relative to the start of
+    // the block and in increasing order, to `result`.
+    absl::Status AppendBlockRows(int32_t block,
+                                 absl::Span<const int32_t> rows,
+                                 Table* result) const {
+        if (rows.empty()) {
+            return absl::OkStatus();
+        }
+        std::vector<Value*> destination = result->Extend(rows.size());
+        std::vector<Value> values(kPackedBlockSize);
+        for (int32_t k = 0; k < width; k++) {
+            DecodeBlock(block, k, values.data());
+            for (int32_t j = 0; j < rows.size(); j++) {
+                destination[k][j] = values[rows[j]];
+            }
+        }
+        return absl::OkStatus();
+    }
+
+    // Appends every tuple to `result`.
+    absl::Status Unpack(Table* result) const {
+        std::vector<int32_t> rows;
+        for (int32_t b = 0; b < NumberOfBlocks(); b++) {
+            rows.resize(BlockSize(b));
+            for (int32_t r = 0; r < rows.size(); r++) {
+                rows[r] = r;
+            }
+            RETURN_IF_ERROR(AppendBlockRows(b, rows, result));
+        }
+        return absl::OkStatus();
+    }
+
+private:
+    PackedTable(int32_t width_, int32_t number_of_tuples_)
+        : width(width_)
+        , number_of_tuples(number_of_tuples_)
+        , blocks()
+        , words(width_)
+        , dictionaries(width_) {}
+
+    int32_t width;
+    int32_t number_of_tuples;
+    // Row-major: the block of column `k` of block `b` is at `b * width + k`.
+    std::vector<PackedBlock> blocks;
+    std::vector<std::vector<uint32_t>> words;
+    std::vector<std::shared_ptr<const StringDictionary>> dictionaries;
+};
+
+inline absl::StatusOr<PackedTable> PackedTable::Pack(const Table& table) {
+    if (table.HasMultiplicities()) {
+        return absl::UnimplementedError(
+            "packed tables do not support tables with multiplicities");
+    }
+    PackedTable result(table.Width(), table.NumberOfTuples());
+    result.dictionaries = table.Dictionaries();
+    std::vector<uint32_t> codes(kPackedBlockSize);
+    std::vector<uint32_t> deltas(kPackedBlockSize);
+    for (int32_t b = 0; b < result.NumberOfBlocks(); b++) {
+        int32_t begin = b * kPackedBlockSize;
+        int32_t size = result.BlockSize(b);
+        for (int32_t k = 0; k < table.Width(); k++) {
+            absl::Span<const Value> values =
+                table.Column(k).subspan(begin, size);
+            PackedBlock block;
+            block.min = *std::min_element(values.begin(), values.end());
+            block.max = *std::max_element(values.begin(), values.end());
+            bool sorted = std::is_sorted(values.begin(), values.end());
+
+            // Padding repeats the last value, which keeps the block sorted
+            // and costs no extra bits either way.
+            auto padded = [&](int32_t r) -> uint32_t {
+                return values[std::min(r, size - 1)];
+            };
+            uint32_t max_delta = 0;
+            for (int32_t r = 0; r < kPackedBlockSize; r++) {
+                codes[r] = padded(r) - uint32_t(block.min);
+                deltas[r] = (r < kPackedLanes)
+                    ? codes[r]
+                    : padded(r) - padded(r - kPackedLanes);
+                max_delta = std::max(max_delta, deltas[r]);
+            }
+            int32_t frame_bits = internal::PackedBitWidth(
+                uint32_t(block.max) - uint32_t(block.min));
+            int32_t delta_bits = internal::PackedBitWidth(max_delta);
+            block.encoding = (sorted && (delta_bits < frame_bits))
+                ? PackedEncoding::kDelta
+                : PackedEncoding::kFrameOfReference;
+            block.bit_width = (block.encoding == PackedEncoding::kDelta)
+                ? delta_bits
+                : frame_bits;
+
+            std::vector<uint32_t>& column = result.words[k];
+            block.offset = column.size();
+            column.resize(column.size()
+                          + block.bit_width * kPackedBlockSize / 32, 0);
+            internal::PackLanes(
+                (block.encoding == PackedEncoding::kDelta)
+                    ? deltas.data()
+                    : codes.data(),
+                block.bit_width, column.data() + block.offset);
+            result.blocks.push_back(block);
+        }
+    }
+    return result;
+}
+
+namespace internal {
+
+// Evaluates `predicate` over the rows of block `block` of `table`. The
+// comparisons of frame-of-reference blocks are evaluated on their unpacked
+// codes, by translating the constant into the block's frame, and blocks
+// whose minimum and maximum decide a comparison are not unpacked at all.
+// Other predicates are evaluated over the decoded block, which is decoded
+// into `decoded` the first time one is met.
+inline absl::StatusOr<Bitmap> EvaluatePackedBlock(
+    Predicate* predicate,
+    const PackedTable& table,
+    int32_t block,
+    absl::optional<Table>* decoded) {
+    int32_t n = table.BlockSize(block);
+    std::vector<uint32_t> codes;
+    // Compares column `attr` against `constant`. The caller has ruled out
+    // that the block's range decides the comparison.
+    auto compare = [&](Attr attr, Value constant, bool less_than) {
+        const PackedBlock& packed = table.Block(block, attr);
+        codes.resize(kPackedBlockSize);
+        if ((packed.encoding == PackedEncoding::kFrameOfReference)
+            && (packed.bit_width < 32)) {
+            // Codes and the translated constant both fit in a `Value`.
+            table.UnpackCodes(block, attr, codes.data());
+            constant = Value(uint32_t(constant) - uint32_t(packed.min));
+        } else {
+            table.DecodeBlock(block, attr,
+                              reinterpret_cast<Value*>(codes.data()));
+        }
+        absl::Span<const Value> column(
+            reinterpret_cast<const Value*>(codes.data()), n);
+        Bitmap result(n, false);
+        if (less_than) {
+            CompareColumn<Comparison::kLessThan>(
+                column, constant, result.Words());
+        } else {
+            CompareColumn<Comparison::kEquals>(
+                column, constant, result.Words());
+        }
+        return result;
+    };
+
+    if (auto p = DynamicCast<Predicate, PredicateAnd>(predicate)) {
+        Bitmap result(n, true);
+        for (Predicate* child : p.value()->children) {
+            ASSIGN_OR_RETURN(
+                Bitmap child_bitmap,
+                EvaluatePackedBlock(child, table, block, decoded));
+            result.And(child_bitmap);
+        }
+        return result;
+    } else if (auto p = DynamicCast<Predicate, PredicateOr>(predicate)) {
+        Bitmap result(n, false);
+        for (Predicate* child : p.value()->children) {
+            ASSIGN_OR_RETURN(
+                Bitmap child_bitmap,
+                EvaluatePackedBlock(child, table, block, decoded));
+            result.Or(child_bitmap);
+        }
+        return result;
+    } else if (auto p = DynamicCast<Predicate, PredicateNot>(predicate)) {
+        ASSIGN_OR_RETURN(
+            Bitmap result,
+            EvaluatePackedBlock(p.value()->pred, table, block, decoded));
+        result.Not();
+        return result;
+    } else if (auto p = DynamicCast<Predicate, PredicateLessThan>(predicate)) {
+        const PackedBlock& packed = table.Block(block, p.value()->attr);
+        if (packed.max < p.value()->integer) {
+            return Bitmap(n, true);
+        }
+        if (packed.min >= p.value()->integer) {
+            return Bitmap(n, false);
+        }
+        return compare(p.value()->attr, p.value()->integer,
+                       /*less_than=*/true);
+    } else if (auto p = DynamicCast<Predicate, PredicateEquals>(predicate)) {
+        const PackedBlock& packed = table.Block(block, p.value()->attr);
+        if ((p.value()->integer < packed.min)
+            || (p.value()->integer > packed.max)) {
+            return Bitmap(n, false);
+        }
+        if (packed.min == packed.max) {
+            return Bitmap(n, true);
+        }
+        return compare(p.value()->attr, p.value()->integer,
+                       /*less_than=*/false);
+    }
+
+    if (!decoded->has_value()) {
+        decoded->emplace(table.Width());
+        (*decoded)->SetDictionaries(table.Dictionaries());
+        std::vector<int32_t> rows(n);
+        for (int32_t r = 0; r < n; r++) {
+            rows[r] = r;
+        }
+        RETURN_IF_ERROR(table.AppendBlockRows(block, rows, &decoded->value()));
+    }
+    return EvaluatePredicate(predicate, decoded->value());
+}
+
+// Calls `body(block, begin, end)` for every block overlapping the rows
+// `[begin, end)`, with the part of that range inside the block given
+// relative to the start of the block.
+template<typename F>
+absl::Status ForEachPackedBlock(int32_t begin, int32_t end, F body) {
+    for (int32_t b = begin / kPackedBlockSize;
+         b * kPackedBlockSize < end;
+         b++) {
+        int32_t block_begin = b * kPackedBlockSize;
+        RETURN_IF_ERROR(body(b,
+                             std::max(begin, block_begin) - block_begin,
+                             std::min(end, block_begin + kPackedBlockSize)
+                                 - block_begin));
+    }
+    return absl::OkStatus();
+}
+
+}  // namespace internal
+
+// Appends the tuples of `table` that satisfy `predicate` to `result`, in
+// order. The rows are split into morsels by `executor`.
+inline absl::Status SelectPacked(
+    Predicate* predicate,
+    const PackedTable& table,
+    Table* result,
+    const MorselExecutor& executor = MorselExecutor()) {
+    auto select = [&](int32_t begin, int32_t end, Table* chunk) {
+        return internal::ForEachPackedBlock(
+            begin, end, [&](int32_t block, int32_t lo, int32_t hi) {
+                absl::optional<Table> decoded;
+                ASSIGN_OR_RETURN(Bitmap selected,
+                                 internal::EvaluatePackedBlock(
+                                     predicate, table, block, &decoded));
+                std::vector<int32_t> rows;
+                for (int32_t r : selected.SetIndices()) {
+                    if ((r >= lo) && (r < hi)) {
+                        rows.push_back(r);
+                    }
+                }
+                return table.AppendBlockRows(block, rows, chunk);
+            });
+    };
+    return executor.Run(table.NumberOfTuples(), select, result);
+}
+
+// Keeps the tuples of `lhs` that agree with at least one tuple of `rhs` on
+// the attributes in `join_on`, in order. Blocks in which some key column lies
+// outside the range of the matching key column of `rhs` are skipped without
+// being unpacked; in the others, only the key columns are decoded to probe
+// `rhs`, and the rest of the columns only if some row matches.
+inline absl::Status SemijoinPacked(
+    const PackedTable& lhs,
+    const Table& rhs,
+    const JoinOn& join_on,
+    Table* result,
+    const MorselExecutor& executor = MorselExecutor()) {
+    if (rhs.NumberOfTuples() == 0) {
+        return absl::OkStatus();
+    }
+    JoinLayout layout(join_on, rhs.Width());
+    std::vector<Value> rhs_min;
+    std::vector<Value> rhs_max;
+    for (Attr attr : layout.rhs_key) {
+        absl::Span<const Value> column = rhs.Column(attr);
+        rhs_min.push_back(*std::min_element(column.begin(), column.end()));
+        rhs_max.push_back(*std::max_element(column.begin(), column.end()));
+    }
+    HashIndex index(&rhs, layout.rhs_key, result->Arena());
+
+    auto probe = [&](int32_t begin, int32_t end, Table* chunk) {
+        std::vector<std::vector<Value>> keys(
+            layout.lhs_key.size(), std::vector<Value>(kPackedBlockSize));
+        Key buffer(layout.lhs_key.size());
+        return internal::ForEachPackedBlock(
+            begin, end, [&](int32_t block, int32_t lo, int32_t hi) {
+                for (int32_t k = 0; k < layout.lhs_key.size(); k++) {
+                    const PackedBlock& packed =
+                        lhs.Block(block, layout.lhs_key[k]);
+                    if ((packed.max < rhs_min[k])
+                        || (packed.min > rhs_max[k])) {
+                        return absl::OkStatus();
+                    }
+                }
+                for (int32_t k = 0; k < layout.lhs_key.size(); k++) {
+                    lhs.DecodeBlock(block, layout.lhs_key[k],
+                                    keys[k].data());
+                }
+                std::vector<int32_t> rows;
+                for (int32_t r = lo; r < hi; r++) {
+                    for (int32_t k = 0; k < keys.size(); k++) {
+                        buffer[k] = keys[k][r];
+                    }
+                    if (index.Contains(buffer)) {
+                        rows.push_back(r);
+                    }
+                }
+                return lhs.AppendBlockRows(block, rows, chunk);
+            });
+    };
+    return executor.Run(lhs.NumberOfTuples(), probe, result);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace rdss
+
+#endif  // RDSS_PACKED_TABLE_H_
@@ -0,0 +1,646 @@
+// Copyright 2021 The RDSS Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RDSS_PIPELINE_H_
+#define RDSS_PIPELINE_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <absl/container/btree_map.h>
+#include <absl/container/flat_hash_map.h>
+#include <absl/memory/memory.h>
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <absl/strings/str_format.h>
+#include <absl/types/span.h>
+
+#include "arena.hpp"
+#include "ast.hpp"
+#include "distinct.hpp"
+#include "hash_index.hpp"
+#include "join_layout.hpp"
+#include "leapfrog.hpp"
+#include "macros.hpp"
+#include "selection.hpp"
+#include "table.hpp"
+
+namespace rdss {
+
+////////////////////////////////////////////////////////////////////////////////
+
+// The number of tuples operators aim to put in each batch. Batches this size
+// stay in cache while they move through a pipeline.
+constexpr int32_t kBatchSize = 1024;
+
+// A pull-based operator in a vectorized pipeline. Each call to `Next` produces
+// the next batch of the operator's output, so a chain of streaming operators
+// only ever holds a few batches in memory. Operators that cannot stream one
+// of their inputs (the build side of a join, for example) drain that input
+// into a `Table` the first time they are pulled.
+class Operator {
+public:
+    virtual ~Operator() = default;
+
+    // Replaces the contents of `batch` with the next, nonempty batch of
+    // output, of at most `kBatchSize` tuples. Returns false and leaves
+    // `batch` empty once the output is exhausted, and keeps doing so on
+    // later calls.
+    virtual absl::StatusOr<bool> Next(Table* batch) = 0;
+
+    virtual int32_t Width() const = 0;
+};
+
+// Pulls every remaining batch out of `op` and appends it to `result`,
+// stopping early if that exceeds the memory budget of `result`'s arena.
+inline absl::Status DrainOperator(Operator* op, Table* result) {
+    Table batch(op->Width());
+    while (true) {
+        ASSIGN_OR_RETURN(bool more, op->Next(&batch));
+        if (!more) {
+            return absl::OkStatus();
+        }
+        RETURN_IF_ERROR(result->Append(batch));
+        RETURN_IF_ERROR(CheckMemoryBudget(result->Arena().get()));
+    }
+}
+
+// Produces the tuples of a table that outlives the operator.
+class ScanOperator : public Operator {
+public:
+    explicit ScanOperator(const Table* table_) : table(table_), position(0) {}
+
+    absl::StatusOr<bool> Next(Table* batch) override {
+        batch->Clear();
+        if (position == table->NumberOfTuples()) {
+            return false;
+        }
+        int32_t end = std::min(table->NumberOfTuples(), position + kBatchSize);
+        RETURN_IF_ERROR(batch->AppendRange(*table, position, end));
+        position = end;
+        return true;
+    }
+
+    int32_t Width() const override {
+        return table->Width();
+    }
+
+private:
+    const Table* table;
+    int32_t position;
+};
+
+class SelectOperator : public Operator {
+public:
+    // `dictionaries_` are those of the columns `child_` produces, which LIKE
+    // predicates need.
+    SelectOperator(
+        std::unique_ptr<Operator> child_,
+        Predicate* predicate_,
+        std::vector<std::shared_ptr<const StringDictionary>> dictionaries_)
+        : child(std::move(child_))
+        , predicate(predicate_)
+        , dictionaries(std::move(dictionaries_))
+        , input(child->Width()) {}
+
+    absl::StatusOr<bool> Next(Table* batch) override {
+        batch->Clear();
+        while (batch->NumberOfTuples() == 0) {
+            ASSIGN_OR_RETURN(bool more, child->Next(&input));
+            if (!more) {
+                return false;
+            }
+            input.SetDictionaries(dictionaries);
+            ASSIGN_OR_RETURN(Bitmap selected,
+                             EvaluatePredicate(predicate, input));
+            RETURN_IF_ERROR(batch->AppendRows(input, selected.SetIndices()));
+        }
+        return true;
+    }
+
+    int32_t Width() const override {
+        return child->Width();
+    }
+
+private:
+    std::unique_ptr<Operator> child;
+    Predicate* predicate;
+    std::vector<std::shared_ptr<const StringDictionary>> dictionaries;
+    Table input;
+};
+
+class ViewOperator : public Operator {
+public:
+    ViewOperator(std::unique_ptr<Operator> child_,
+                 const AttrPartialPermutation& perm_,
+                 int32_t width_)
+        : child(std::move(child_))
+        , perm(perm_)
+        , width(width_)
+        , input(child->Width()) {}
+
+    absl::StatusOr<bool> Next(Table* batch) override {
+        batch->Clear();
+        ASSIGN_OR_RETURN(bool more, child->Next(&input));
+        if (!more) {
+            return false;
+        }
+        std::vector<Value*> destination =
+            batch->Extend(input.NumberOfTuples());
+        for (int32_t j = 0; j < perm.size(); j++) {
+            if (perm[j]) {
+                absl::Span<const Value> source = input.Column(j);
+                std::copy(source.begin(), source.end(),
+                          destination[*perm[j]]);
+            }
+        }
+        return true;
+    }
+
+    int32_t Width() const override {
+        return width;
+    }
+
+private:
+    std::unique_ptr<Operator> child;
+    AttrPartialPermutation perm;
+    int32_t width;
+    Table input;
+};
+
+class UnionOperator : public Operator {
+public:
+    UnionOperator(std::unique_ptr<Operator> lhs_,
+                  std::unique_ptr<Operator> rhs_)
+        : lhs(std::move(lhs_)), rhs(std::move(rhs_)), lhs_done(false) {}
+
+    absl::StatusOr<bool> Next(Table* batch) override {
+        if (!lhs_done) {
+            ASSIGN_OR_RETURN(bool more, lhs->Next(batch));
+            if (more) {
+                return true;
+            }
+            lhs_done = true;
+        }
+        return rhs->Next(batch);
+    }
+
+    int32_t Width() const override {
+        return lhs->Width();
+    }
+
+private:
+    std::unique_ptr<Operator> lhs;
+    std::unique_ptr<Operator> rhs;
+    bool lhs_done;
+};
+
+// Streams the tuples of `probe` whose key occurs in the key of `build`, for a
+// Semijoin, or, for a Difference (`anti`), the tuples of `probe` left once
+// every tuple of `build` has cancelled one equal tuple of `probe`, as in
+// `HashDifference`. `build` is drained into a `HashIndex` on the first pull.
+class MembershipOperator : public Operator {
+public:
+    MembershipOperator(std::unique_ptr<Operator> probe_,
+                       std::unique_ptr<Operator> build_,
+                       absl::Span<const Attr> probe_key_,
+                       absl::Span<const Attr> build_key_,
+                       bool anti_,
+                       std::shared_ptr<MemoryArena> arena_ = nullptr)
+        : probe(std::move(probe_))
+        , build(std::move(build_))
+        , probe_key(probe_key_.begin(), probe_key_.end())
+        , build_key(build_key_.begin(), build_key_.end())
+        , anti(anti_)
+        , input(probe->Width())
+        , build_table(build->Width(), arena_)
+        , index()
+        , remaining() {}
+
+    absl::StatusOr<bool> Next(Table* batch) override {
+        if (index == nullptr) {
+            RETURN_IF_ERROR(DrainOperator(build.get(), &build_table));
+            index = absl::make_unique<HashIndex>(
+                &build_table, build_key, build_table.Arena());
+        }
+
+        batch->Clear();
+        Key key;
+        std::vector<int32_t> rows;
+        while (batch->NumberOfTuples() == 0) {
+            ASSIGN_OR_RETURN(bool more, probe->Next(&input));
+            if (!more) {
+                return false;
+            }
+            rows.clear();
+            for (int32_t i = 0; i < input.NumberOfTuples(); i++) {
+                GatherKey(input.GetTupleView(i), probe_key, &key);
+                if (Keep(key)) {
+                    rows.push_back(i);
+                }
+            }
+            RETURN_IF_ERROR(batch->AppendRows(input, rows));
+        }
+        return true;
+    }
+
+    int32_t Width() const override {
+        return probe->Width();
+    }
+
+private:
+    bool Keep(absl::Span<const Value> key) {
+        int32_t head = index->FirstMatch(key);
+        if (!anti) {
+            return head != -1;
+        } else if (head == -1) {
+            return true;
+        }
+        auto [it, inserted] = remaining.try_emplace(head, 0);
+        if (inserted) {
+            for (int32_t row = head; row != -1; row = index->NextMatch(row)) {
+                it->second++;
+            }
+        }
+        if (it->second == 0) {
+            return true;
+        }
+        it->second--;
+        return false;
+    }
+
+    std::unique_ptr<Operator> probe;
+    std::unique_ptr<Operator> build;
+    std::vector<Attr> probe_key;
+    std::vector<Attr> build_key;
+    bool anti;
+    Table input;
+    Table build_table;
+    std::unique_ptr<HashIndex> index;
+    // For an anti-join, the number of tuples of `build` with each key that
+    // have not yet cancelled a tuple of `probe`, by the first row of the key.
+    absl::flat_hash_map<int32_t, int64_t> remaining;
+};
+
+// A hash join that streams its left-hand side and builds on its right-hand
+// side. A probe tuple may match many build tuples, so the operator remembers
+// where it stopped and resumes there, keeping every batch within
+// `kBatchSize` no matter how skewed the keys are.
+class HashJoinOperator : public Operator {
+public:
+    HashJoinOperator(std::unique_ptr<Operator> lhs_,
+                     std::unique_ptr<Operator> rhs_,
+                     const JoinOn& join_on,
+                     int32_t width_,
+                     std::shared_ptr<MemoryArena> arena_ = nullptr)
+        : lhs(std::move(lhs_))
+        , rhs(std::move(rhs_))
+        , layout(join_on, rhs->Width())
+        , width(width_)
+        , input(lhs->Width())
+        , build_table(rhs->Width(), arena_)
+        , index()
+        , row(0)
+        , match(-1) {}
+
+    absl::StatusOr<bool> Next(Table* batch) override {
+        if (index == nullptr) {
+            RETURN_IF_ERROR(DrainOperator(rhs.get(), &build_table));
+            index = absl::make_unique<HashIndex>(
+                &build_table, layout.rhs_key, build_table.Arena());
+        }
+
+        batch->Clear();
+        while (batch->NumberOfTuples() < kBatchSize) {
+            if (match != -1) {
+                RETURN_IF_ERROR(InsertJoinedTuple(
+                    input.GetTupleView(row), build_table.GetTupleView(match),
+                    layout, &buffer, batch));
+                match = index->NextMatch(match);
+                if (match == -1) {
+                    row++;
+                }
+            } else if (row == input.NumberOfTuples()) {
+                ASSIGN_OR_RETURN(bool more, lhs->Next(&input));
+                row = 0;
+                if (!more) {
+                    break;
+                }
+            } else {
+                GatherKey(input.GetTupleView(row), layout.lhs_key, &key);
+                match = index->FirstMatch(key);
+                if (match == -1) {
+                    row++;
+                }
+            }
+        }
+        return batch->NumberOfTuples() > 0;
+    }
+
+    int32_t Width() const override {
+        return width;
+    }
+
+private:
+    std::unique_ptr<Operator> lhs;
+    std::unique_ptr<Operator> rhs;
+    JoinLayout layout;
+    int32_t width;
+    Table input;
+    Table build_table;
+    std::unique_ptr<HashIndex> index;
+
+    // The next probe tuple to look up, and the next build tuple it matches
+    // (or -1 if it has not been looked up yet).
+    int32_t row;
+    int32_t match;
+
+    Key key;
+    Tuple buffer;
+};
+
+// Drains every input and evaluates Leapfrog Triejoin over them on the first
+// pull, then streams the result.
+class MultiJoinOperator : public Operator {
+public:
+    MultiJoinOperator(std::vector<std::unique_ptr<Operator>> inputs_,
+                      const std::vector<std::vector<int32_t>>& variables_,
+                      const AttrPermutation& variable_order_,
+                      std::shared_ptr<MemoryArena> arena_ = nullptr)
+        : inputs(std::move(inputs_))
+        , variables(variables_)
+        , variable_order(variable_order_)
+        , result(variable_order_.size(), arena_)
+        , scan() {}
+
+    absl::StatusOr<bool> Next(Table* batch) override {
+        if (scan == nullptr) {
+            std::vector<Table> tables;
+            for (const std::unique_ptr<Operator>& input : inputs) {
+                tables.emplace_back(input->Width(), result.Arena());
+                RETURN_IF_ERROR(DrainOperator(input.get(), &tables.back()));
+            }
+            std::vector<const Table*> table_pointers;
+            for (const Table& table : tables) {
+                table_pointers.push_back(&table);
+            }
+            RETURN_IF_ERROR(LeapfrogTriejoin(
+                table_pointers, variables, variable_order, &result));
+            RETURN_IF_ERROR(CheckMemoryBudget(result.Arena().get()));
+            scan = absl::make_unique<ScanOperator>(&result);
+        }
+        return scan->Next(batch);
+    }
+
+    int32_t Width() const override {
+        return result.Width();
+    }
+
+private:
+    std::vector<std::unique_ptr<Operator>> inputs;
+    std::vector<std::vector<int32_t>> variables;
+    AttrPermutation variable_order;
+    Table result;
+    std::unique_ptr<ScanOperator> scan;
+};
+
+// Drains its input and removes duplicates from it on the first pull, then
+// streams the distinct tuples.
+class DistinctOperator : public Operator {
+public:
+    explicit DistinctOperator(std::unique_ptr<Operator> child_,
+                              std::shared_ptr<MemoryArena> arena_ = nullptr)
+        : child(std::move(child_))
+        , result(child->Width(), arena_)
+        , scan() {}
+
+    absl::StatusOr<bool> Next(Table* batch) override {
+        if (scan == nullptr) {
+            Table input(child->Width(), result.Arena());
+            RETURN_IF_ERROR(DrainOperator(child.get(), &input));
+            RETURN_IF_ERROR(Distinct(input, nullptr, &result));
+            scan = absl::make_unique<ScanOperator>(&result);
+        }
+        return scan->Next(batch);
+    }
+
+    int32_t Width() const override {
+        return result.Width();
+    }
+
+private:
+    std::unique_ptr<Operator> child;
+    Table result;
+    std::unique_ptr<ScanOperator> scan;
+};
+
+// Returns the dictionaries of the columns of the result of `input`. A column
+// that is copied from a string column keeps its dictionary, and a column of a
+// Union only does if both sides agree on it. Nodes in `materialized` take
+// their dictionaries from the given tables. References take them from
+// `stored`, which holds those of tables kept outside `variables` (such as
+// packed tables) and takes precedence like those tables do, or else from
+// `variables`.
+inline std::vector<std::shared_ptr<const StringDictionary>> PlanDictionaries(
+    Relation* input,
+    const absl::btree_map<RelName, Table>& variables,
+    const absl::flat_hash_map<Relation*, const Table*>& materialized = {},
+    const absl::btree_map<
+        RelName, std::vector<std::shared_ptr<const StringDictionary>>>&
+        stored = {}) {
+    auto recurse = [&](Relation* rel) {
+        return PlanDictionaries(rel, variables, materialized, stored);
+    };
+    std::vector<std::shared_ptr<const StringDictionary>> result(
+        input->Arity());
+    if (materialized.contains(input)) {
+        return materialized.at(input)->Dictionaries();
+    } else if (auto r = DynamicCast<Relation, RelationReference>(input)) {
+        if (stored.contains(r.value()->name)) {
+            return stored.at(r.value()->name);
+        }
+        if (variables.contains(r.value()->name)) {
+            return variables.at(r.value()->name).Dictionaries();
+        }
+    } else if (auto r = DynamicCast<Relation, RelationJoin>(input)) {
+        auto lhs = recurse(r.value()->lhs);
+        auto rhs = recurse(r.value()->rhs);
+        JoinLayout layout(r.value()->attributes, rhs.size());
+        std::copy(lhs.begin(), lhs.end(), result.begin());
+        for (int32_t k = 0; k < layout.rhs_included.size(); k++) {
+            result[lhs.size() + k] = rhs[layout.rhs_included[k]];
+        }
+    } else if (auto r = DynamicCast<Relation, RelationMultiJoin>(input)) {
+        for (int32_t i = 0; i < r.value()->inputs.size(); i++) {
+            auto dictionaries = recurse(r.value()->inputs[i]);
+            for (int32_t k = 0; k < dictionaries.size(); k++) {
+                int32_t variable = r.value()->variables[i][k];
+                if (result[variable] == nullptr) {
+                    result[variable] = dictionaries[k];
+                }
+            }
+        }
+    } else if (auto r = DynamicCast<Relation, RelationSemijoin>(input)) {
+        return recurse(r.value()->lhs);
+    } else if (auto r = DynamicCast<Relation, RelationUnion>(input)) {
+        auto lhs = recurse(r.value()->lhs);
+        auto rhs = recurse(r.value()->rhs);
+        for (int32_t k = 0; k < result.size(); k++) {
+            if (lhs[k] == rhs[k]) {
+                result[k] = lhs[k];
+            }
+        }
+    } else if (auto r = DynamicCast<Relation, RelationDistinct>(input)) {
+        return recurse(r.value()->rel);
+    } else if (auto r = DynamicCast<Relation, RelationDifference>(input)) {
+        return recurse(r.value()->lhs);
+    } else if (auto r = DynamicCast<Relation, RelationSelect>(input)) {
+        return recurse(r.value()->rel);
+    } else if (auto r = DynamicCast<Relation, RelationMap>(input)) {
+        // The results of a function are integers.
+    } else if (auto r = DynamicCast<Relation, RelationView>(input)) {
+        auto dictionaries = recurse(r.value()->rel.rel);
+        const AttrPartialPermutation& perm = r.value()->rel.perm;
+        for (int32_t j = 0; j < perm.size(); j++) {
+            if (perm[j]) {
+                result[*perm[j]] = dictionaries[j];
+            }
+        }
+    } else {
+        RDSS_CHECK(false)
+            << "If this is reached, a new relation op has been added but no "
+            << "case was added to PlanDictionaries. Please add one.";
+    }
+    return result;
+}
+
+// Translates `input` into a tree of operators. References are scanned from
+// `variables`, and nodes in `materialized` are scanned from the given tables
+// instead of being evaluated again; both must outlive the returned operator.
+// Select, View, Union and the left-hand sides of Join, Semijoin and
+// Difference stream; the other inputs, including those of Distinct, are
+// materialized, in `arena` if one is given, when the operator consuming them
+// is first pulled.
+inline absl::StatusOr<std::unique_ptr<Operator>> BuildPipeline(
+    Relation* input,
+    const absl::btree_map<RelName, Table>& variables,
+    const absl::flat_hash_map<Relation*, const Table*>& materialized = {},
+    const std::shared_ptr<MemoryArena>& arena = nullptr) {
+    if (materialized.contains(input)) {
+        if (materialized.at(input)->HasMultiplicities()) {
+            return absl::UnimplementedError(
+                "pipelines do not support tables with multiplicities");
+        }
+        return std::unique_ptr<Operator>(
+            absl::make_unique<ScanOperator>(materialized.at(input)));
+    } else if (auto r = DynamicCast<Relation, RelationReference>(input)) {
+        if (!variables.contains(r.value()->name)) {
+            return absl::NotFoundError(absl::StrFormat(
+                "no table named %s", r.value()->name.ToString()));
+        }
+        if (variables.at(r.value()->name).HasMultiplicities()) {
+            return absl::UnimplementedError(
+                "pipelines do not support tables with multiplicities");
+        }
+        return std::unique_ptr<Operator>(
+            absl::make_unique<ScanOperator>(&variables.at(r.value()->name)));
+    } else if (auto r = DynamicCast<Relation, RelationJoin>(input)) {
+        ASSIGN_OR_RETURN(auto lhs,
+                         BuildPipeline(r.value()->lhs, variables,
+                                       materialized, arena));
+        ASSIGN_OR_RETURN(auto rhs,
+                         BuildPipeline(r.value()->rhs, variables,
+                                       materialized, arena));
+        return std::unique_ptr<Operator>(absl::make_unique<HashJoinOperator>(
+            std::move(lhs), std::move(rhs), r.value()->attributes,
+            r.value()->Arity(), arena));
+    } else if (auto r = DynamicCast<Relation, RelationMultiJoin>(input)) {
+        std::vector<std::unique_ptr<Operator>> inputs;
+        for (Relation* rel : r.value()->inputs) {
+            ASSIGN_OR_RETURN(auto op,
+                             BuildPipeline(rel, variables, materialized,
+                                           arena));
+            inputs.push_back(std::move(op));
+        }
+        return std::unique_ptr<Operator>(absl::make_unique<MultiJoinOperator>(
+            std::move(inputs), r.value()->variables,
+            r.value()->VariableOrder(), arena));
+    } else if (auto r = DynamicCast<Relation, RelationSemijoin>(input)) {
+        ASSIGN_OR_RETURN(auto lhs,
+                         BuildPipeline(r.value()->lhs, variables,
+                                       materialized, arena));
+        ASSIGN_OR_RETURN(auto rhs,
+                         BuildPipeline(r.value()->rhs, variables,
+                                       materialized, arena));
+        JoinLayout layout(r.value()->attributes, rhs->Width());
+        return std::unique_ptr<Operator>(absl::make_unique<MembershipOperator>(
+            std::move(lhs), std::move(rhs), layout.lhs_key, layout.rhs_key,
+            /*anti=*/false, arena));
+    } else if (auto r = DynamicCast<Relation, RelationUnion>(input)) {
+        ASSIGN_OR_RETURN(auto lhs,
+                         BuildPipeline(r.value()->lhs, variables,
+                                       materialized, arena));
+        ASSIGN_OR_RETURN(auto rhs,
+                         BuildPipeline(r.value()->rhs, variables,
+                                       materialized, arena));
+        return std::unique_ptr<Operator>(absl::make_unique<UnionOperator>(
+            std::move(lhs), std::move(rhs)));
+    } else if (auto r = DynamicCast<Relation, RelationDistinct>(input)) {
+        ASSIGN_OR_RETURN(auto rel,
+                         BuildPipeline(r.value()->rel, variables,
+                                       materialized, arena));
+        return std::unique_ptr<Operator>(absl::make_unique<DistinctOperator>(
+            std::move(rel), arena));
+    } else if (auto r = DynamicCast<Relation, RelationDifference>(input)) {
+        ASSIGN_OR_RETURN(auto lhs,
+                         BuildPipeline(r.value()->lhs, variables,
+                                       materialized, arena));
+        ASSIGN_OR_RETURN(auto rhs,
+                         BuildPipeline(r.value()->rhs, variables,
+                                       materialized, arena));
+        std::vector<Attr> all_attrs;
+        for (int32_t k = 0; k < lhs->Width(); k++) {
+            all_attrs.push_back(k);
+        }
+        return std::unique_ptr<Operator>(absl::make_unique<MembershipOperator>(
+            std::move(lhs), std::move(rhs), all_attrs, all_attrs,
+            /*anti=*/true, arena));
+    } else if (auto r = DynamicCast<Relation, RelationSelect>(input)) {
+        ASSIGN_OR_RETURN(auto rel,
+                         BuildPipeline(r.value()->rel, variables,
+                                       materialized, arena));
+        return std::unique_ptr<Operator>(absl::make_unique<SelectOperator>(
+            std::move(rel), r.value()->predicate,
+            PlanDictionaries(r.value()->rel, variables, materialized)));
+    } else if (auto r = DynamicCast<Relation, RelationMap>(input)) {
+        return absl::InternalError("Pipelines cannot support Map");
+    } else if (auto r = DynamicCast<Relation, RelationView>(input)) {
+        ASSIGN_OR_RETURN(auto rel,
+                         BuildPipeline(r.value()->rel.rel, variables,
+                                       materialized, arena));
+        return std::unique_ptr<Operator>(absl::make_unique<ViewOperator>(
+            std::move(rel), r.value()->rel.perm, r.value()->Arity()));
+    }
+    return absl::InternalError(
+        "If this is reached, a new relation op has been added but no case "
+        "was added to BuildPipeline. Please add one.");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace rdss
+
+#endif  // RDSS_PIPELINE_H_
@@ -19,12 +19,14 @@
 #include <string>
 #include <vector>
 
+#include <absl/hash/hash.h>
 #include <absl/memory/memory.h>
 #include <absl/strings/str_cat.h>
 #include <absl/strings/str_format.h>
 #include <absl/strings/str_join.h>
 
 #include "attr.hpp"
+#include "hash_cons.hpp"
 
 namespace rdss {
 
@@ -32,7 +34,16 @@ namespace rdss {
 
 struct Predicate {
     virtual std::string ToString() const = 0;
+    // The predicates this one is built from, in order.
+    virtual std::vector<Predicate*> Children() const = 0;
+    // Hashes and compares everything but the children, for predicates of the
+    // same kind.
+    virtual size_t ParameterHash() const = 0;
+    virtual bool SameParameters(const Predicate& other) const = 0;
     virtual ~Predicate() = default;
+
+    // A hash of the whole predicate, set by the factory that made it.
+    size_t structural_hash = 0;
 };
 
 struct PredicateAnd : public Predicate {
@@ -48,6 +59,18 @@ struct PredicateAnd : public Predicate {
         }
         return absl::StrCat("(", absl::StrJoin(child_strings, " && "), ")");
     }
+
+    std::vector<Predicate*> Children() const override {
+        return children;
+    }
+
+    size_t ParameterHash() const override {
+        return 0;
+    }
+
+    bool SameParameters(const Predicate& other) const override {
+        return true;
+    }
 };
 
 struct PredicateOr : public Predicate {
@@ -63,6 +86,18 @@ struct PredicateOr : public Predicate {
         }
         return absl::StrCat("(", absl::StrJoin(child_strings, " || "), ")");
     }
+
+    std::vector<Predicate*> Children() const override {
+        return children;
+    }
+
+    size_t ParameterHash() const override {
+        return 0;
+    }
+
+    bool SameParameters(const Predicate& other) const override {
+        return true;
+    }
 };
 
 struct PredicateNot : public Predicate {
@@ -74,6 +109,18 @@ struct PredicateNot : public Predicate {
     std::string ToString() const override {
         return absl::StrCat("!", pred->ToString());
     }
+
+    std::vector<Predicate*> Children() const override {
+        return {pred};
+    }
+
+    size_t ParameterHash() const override {
+        return 0;
+    }
+
+    bool SameParameters(const Predicate& other) const override {
+        return true;
+    }
 };
 
 struct PredicateLike : public Predicate {
@@ -86,6 +133,19 @@ struct PredicateLike : public Predicate {
     std::string ToString() const override {
         return absl::StrFormat("(attr%d LIKE \"%s\")", attr, string);
     }
+
+    std::vector<Predicate*> Children() const override {
+        return {};
+    }
+
+    size_t ParameterHash() const override {
+        return absl::HashOf(attr, string);
+    }
+
+    bool SameParameters(const Predicate& other) const override {
+        const auto& p = static_cast<const PredicateLike&>(other);
+        return (attr == p.attr) && (string == p.string);
+    }
 };
 
 struct PredicateLessThan : public Predicate {
@@ -98,6 +158,19 @@ struct PredicateLessThan : public Predicate {
     std::string ToString() const override {
         return absl::StrFormat("(attr%d < %d)", attr, integer);
     }
+
+    std::vector<Predicate*> Children() const override {
+        return {};
+    }
+
+    size_t ParameterHash() const override {
+        return absl::HashOf(attr, integer);
+    }
+
+    bool SameParameters(const Predicate& other) const override {
+        const auto& p = static_cast<const PredicateLessThan&>(other);
+        return (attr == p.attr) && (integer == p.integer);
+    }
 };
 
 struct PredicateEquals : public Predicate {
@@ -110,20 +183,35 @@ struct PredicateEquals : public Predicate {
     std::string ToString() const override {
         return absl::StrFormat("(attr%d ≡ %d)", attr, integer);
     }
+
+    std::vector<Predicate*> Children() const override {
+        return {};
+    }
+
+    size_t ParameterHash() const override {
+        return absl::HashOf(attr, integer);
+    }
+
+    bool SameParameters(const Predicate& other) const override {
+        const auto& p = static_cast<const PredicateEquals&>(other);
+        return (attr == p.attr) && (integer == p.integer);
+    }
 };
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// Makes each distinct predicate once: making a predicate structurally equal
+// to one made before returns the earlier one, so predicates can be compared
+// by pointer.
 struct PredicateFactory {
     std::vector<std::unique_ptr<Predicate>> predicates;
+    HashConsSet<Predicate> canonical;
 
     template<typename T, typename... Args>
     T* Make(Args&&... args) {
         std::unique_ptr<T> value =
             absl::make_unique<T>(std::forward<Args>(args)...);
-        T* ptr = value.get();
-        predicates.push_back(std::move(value));
-        return ptr;
+        return canonical.Intern(std::move(value), &predicates);
     }
 };
 
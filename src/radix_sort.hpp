@@ -0,0 +1,143 @@
+// Copyright 2021 The RDSS Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RDSS_RADIX_SORT_H_
+#define RDSS_RADIX_SORT_H_
+
+#include <array>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+#include <absl/types/span.h>
+
+#include "attr.hpp"
+#include "table.hpp"
+
+namespace rdss {
+
+////////////////////////////////////////////////////////////////////////////////
+
+using Permutation = std::vector<int32_t>;
+
+namespace internal {
+
+constexpr int32_t kRadixBits = 11;
+constexpr int32_t kRadixBuckets = 1 << kRadixBits;
+
+// Maps a `Value` to an unsigned integer with the same ordering.
+inline uint32_t RadixKey(Value value) {
+    return static_cast<uint32_t>(value) ^ 0x80000000u;
+}
+
+// Stably reorders `rows` by the value each row has in `column`, using three
+// passes of 11 bits each. Passes in which every row has the same digit are
+// skipped, so columns with a small range of values take fewer passes.
+inline void RadixSortByColumn(absl::Span<const Value> column,
+                              Permutation* rows,
+                              Permutation* row_scratch,
+                              std::vector<uint32_t>* keys,
+                              std::vector<uint32_t>* key_scratch) {
+    size_t n = rows->size();
+    keys->resize(n);
+    key_scratch->resize(n);
+    row_scratch->resize(n);
+    for (size_t i = 0; i < n; i++) {
+        (*keys)[i] = RadixKey(column[(*rows)[i]]);
+    }
+
+    std::array<size_t, kRadixBuckets> counts;
+    for (int32_t shift = 0; shift < 32; shift += kRadixBits) {
+        counts.fill(0);
+        for (uint32_t key : *keys) {
+            counts[(key >> shift) & (kRadixBuckets - 1)]++;
+        }
+        if (counts[((*keys)[0] >> shift) & (kRadixBuckets - 1)] == n) {
+            continue;
+        }
+        size_t offset = 0;
+        for (size_t& count : counts) {
+            size_t bucket_size = count;
+            count = offset;
+            offset += bucket_size;
+        }
+        for (size_t i = 0; i < n; i++) {
+            uint32_t key = (*keys)[i];
+            size_t position = counts[(key >> shift) & (kRadixBuckets - 1)]++;
+            (*key_scratch)[position] = key;
+            (*row_scratch)[position] = (*rows)[i];
+        }
+        keys->swap(*key_scratch);
+        rows->swap(*row_scratch);
+    }
+}
+
+}  // namespace internal
+
+// Returns the row indices of `table` ordered lexicographically by the values
+// of the attributes in `key`. The sort is stable, so rows with equal keys keep
+// their original relative order.
+inline Permutation RadixSortPermutation(const Table& table,
+                                        absl::Span<const Attr> key) {
+    Permutation rows(table.NumberOfTuples());
+    std::iota(rows.begin(), rows.end(), 0);
+    if (rows.empty()) {
+        return rows;
+    }
+
+    Permutation row_scratch;
+    std::vector<uint32_t> keys;
+    std::vector<uint32_t> key_scratch;
+    // LSD order: sort by the least significant attribute first.
+    for (auto it = key.rbegin(); it != key.rend(); it++) {
+        internal::RadixSortByColumn(
+            table.Column(*it), &rows, &row_scratch, &keys, &key_scratch);
+    }
+    return rows;
+}
+
+// Compares the `x_key` attributes of `x` with the `y_key` attributes of `y`
+// lexicographically, returning a negative, zero or positive number.
+inline int32_t CompareKeys(const TupleView& x,
+                           absl::Span<const Attr> x_key,
+                           const TupleView& y,
+                           absl::Span<const Attr> y_key) {
+    for (size_t i = 0; i < x_key.size(); i++) {
+        Value a = x[x_key[i]];
+        Value b = y[y_key[i]];
+        if (a != b) {
+            return a < b ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+// Returns true if the rows of `table` are already in ascending order of
+// `key`. This stops at the first out-of-order row, so it is cheap to call
+// on unsorted input.
+inline bool IsSortedOn(const Table& table, absl::Span<const Attr> key) {
+    for (int32_t i = 1; i < table.NumberOfTuples(); i++) {
+        if (CompareKeys(table.GetTupleView(i - 1), key,
+                        table.GetTupleView(i), key) > 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace rdss
+
+#endif  // RDSS_RADIX_SORT_H_
@@ -0,0 +1,622 @@
+// Copyright 2021 The RDSS Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RDSS_REWRITE_H_
+#define RDSS_REWRITE_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <absl/container/btree_set.h>
+#include <absl/container/flat_hash_map.h>
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <absl/types/optional.h>
+
+#include "ast.hpp"
+#include "join_layout.hpp"
+#include "macros.hpp"
+
+namespace rdss {
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace internal {
+
+// Adds the attributes `predicate` reads to `attrs`. Returns false if it
+// contains a kind of predicate the rewriter does not know.
+inline bool PredicateAttributes(Predicate* predicate,
+                                absl::btree_set<Attr>* attrs) {
+    if (auto p = DynamicCast<Predicate, PredicateAnd>(predicate)) {
+        for (Predicate* child : p.value()->children) {
+            if (!PredicateAttributes(child, attrs)) {
+                return false;
+            }
+        }
+        return true;
+    } else if (auto p = DynamicCast<Predicate, PredicateOr>(predicate)) {
+        for (Predicate* child : p.value()->children) {
+            if (!PredicateAttributes(child, attrs)) {
+                return false;
+            }
+        }
+        return true;
+    } else if (auto p = DynamicCast<Predicate, PredicateNot>(predicate)) {
+        return PredicateAttributes(p.value()->pred, attrs);
+    } else if (auto p = DynamicCast<Predicate, PredicateLike>(predicate)) {
+        attrs->insert(p.value()->attr);
+        return true;
+    } else if (auto p = DynamicCast<Predicate, PredicateLessThan>(predicate)) {
+        attrs->insert(p.value()->attr);
+        return true;
+    } else if (auto p = DynamicCast<Predicate, PredicateEquals>(predicate)) {
+        attrs->insert(p.value()->attr);
+        return true;
+    }
+    return false;
+}
+
+// Returns `predicate` with every attribute `k` replaced by `rename(k)`, or
+// nothing if some attribute has no replacement.
+inline absl::optional<Predicate*> RenamePredicate(
+    PredicateFactory* factory,
+    Predicate* predicate,
+    const std::function<absl::optional<Attr>(Attr)>& rename) {
+    absl::btree_set<Attr> attrs;
+    if (!PredicateAttributes(predicate, &attrs)) {
+        return absl::nullopt;
+    }
+    for (Attr k : attrs) {
+        if (!rename(k).has_value()) {
+            return absl::nullopt;
+        }
+    }
+    std::function<Predicate*(Predicate*)> go = [&](Predicate* p) -> Predicate* {
+        if (auto q = DynamicCast<Predicate, PredicateAnd>(p)) {
+            std::vector<Predicate*> children;
+            for (Predicate* child : q.value()->children) {
+                children.push_back(go(child));
+            }
+            return factory->Make<PredicateAnd>(children);
+        } else if (auto q = DynamicCast<Predicate, PredicateOr>(p)) {
+            std::vector<Predicate*> children;
+            for (Predicate* child : q.value()->children) {
+                children.push_back(go(child));
+            }
+            return factory->Make<PredicateOr>(children);
+        } else if (auto q = DynamicCast<Predicate, PredicateNot>(p)) {
+            return factory->Make<PredicateNot>(go(q.value()->pred));
+        } else if (auto q = DynamicCast<Predicate, PredicateLike>(p)) {
+            return factory->Make<PredicateLike>(
+                rename(q.value()->attr).value(), q.value()->string);
+        } else if (auto q = DynamicCast<Predicate, PredicateLessThan>(p)) {
+            return factory->Make<PredicateLessThan>(
+                rename(q.value()->attr).value(), q.value()->integer);
+        }
+        auto q = DynamicCast<Predicate, PredicateEquals>(p);
+        return factory->Make<PredicateEquals>(
+            rename(q.value()->attr).value(), q.value()->integer);
+    };
+    return go(predicate);
+}
+
+// Splits `predicate` into the predicates whose conjunction it is.
+inline void Conjuncts(Predicate* predicate, std::vector<Predicate*>* result) {
+    if (auto p = DynamicCast<Predicate, PredicateAnd>(predicate)) {
+        for (Predicate* child : p.value()->children) {
+            Conjuncts(child, result);
+        }
+    } else {
+        result->push_back(predicate);
+    }
+}
+
+inline Predicate* Conjunction(PredicateFactory* factory,
+                              const std::vector<Predicate*>& conjuncts) {
+    if (conjuncts.size() == 1) {
+        return conjuncts[0];
+    }
+    return factory->Make<PredicateAnd>(conjuncts);
+}
+
+inline bool IsIdentity(const AttrPartialPermutation& perm, int32_t arity) {
+    if (perm.size() != arity) {
+        return false;
+    }
+    for (Attr k = 0; k < perm.size(); k++) {
+        if (perm[k] != k) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The view of `rel` that keeps, in order, the attributes `k` with
+// `needed[k]`.
+inline AttrPartialPermutation Projection(const std::vector<bool>& needed) {
+    AttrPartialPermutation result;
+    Attr next = 0;
+    for (bool keep : needed) {
+        if (keep) {
+            result.push_back(next++);
+        } else {
+            result.push_back(absl::nullopt);
+        }
+    }
+    return result;
+}
+
+}  // namespace internal
+
+struct RewriteOptions {
+    // Rewrites that only hold when relations are sets are applied: a Join
+    // whose result is viewed down to the attributes of one side becomes a
+    // Semijoin, which differs from it only in how often each tuple occurs.
+    // `Codegen` stores every relation in a hash set, so this is safe for it;
+    // the interpreter keeps duplicates, so it is not safe there in general.
+    bool set_semantics = false;
+};
+
+// Rewrites plans into cheaper equivalent ones made with `relations` and
+// `predicates`, by applying the following rules until none applies anywhere:
+//
+//   - Stacked Selections are merged into one.
+//   - Selections move below Views, Unions, Distincts, the left-hand side of
+//     Differences, and Joins, Semijoins and MultiJoins. Conjuncts that read
+//     only join keys are applied to both sides of a join.
+//   - Stacked Views are merged into one and identity Views are dropped.
+//   - Views that drop attributes move below Unions, and below Joins and
+//     Semijoins as Views that drop the attributes of each input that are
+//     neither kept nor compared.
+//   - Under `RewriteOptions::set_semantics`, Joins viewed down to the
+//     attributes of one side become Semijoins.
+//
+// Plans are DAGs: every node is rewritten once however many consumers it
+// has, and nodes that no rule changes are returned as they are.
+class Rewriter {
+public:
+    Rewriter(RelationFactory* relations_,
+             PredicateFactory* predicates_,
+             RewriteOptions options_ = RewriteOptions())
+        : relations(relations_)
+        , predicates(predicates_)
+        , options(options_)
+        , memo() {}
+
+    // Returns a plan equivalent to `rel` that no rule applies to.
+    absl::StatusOr<Relation*> Rewrite(Relation* rel) {
+        if (memo.contains(rel)) {
+            return memo.at(rel);
+        }
+
+        std::vector<Relation*> children;
+        bool changed = false;
+        for (Relation* child : rel->Children()) {
+            ASSIGN_OR_RETURN(Relation* rewritten, Rewrite(child));
+            changed |= (rewritten != child);
+            children.push_back(rewritten);
+        }
+        Relation* result = rel;
+        if (changed) {
+            ASSIGN_OR_RETURN(result, WithChildren(rel, children));
+        }
+
+        absl::optional<Relation*> next;
+        if (auto r = DynamicCast<Relation, RelationSelect>(result)) {
+            next = PushSelect(r.value());
+        } else if (auto r = DynamicCast<Relation, RelationView>(result)) {
+            next = PushView(r.value());
+        }
+        if (next.has_value()) {
+            ASSIGN_OR_RETURN(result, Rewrite(next.value()));
+        }
+
+        memo[rel] = result;
+        memo[result] = result;
+        return result;
+    }
+
+private:
+    // A copy of `rel` that reads from `children` instead.
+    absl::StatusOr<Relation*> WithChildren(
+        Relation* rel, const std::vector<Relation*>& children) {
+        if (auto r = DynamicCast<Relation, RelationJoin>(rel)) {
+            return relations->Make<RelationJoin>(
+                children[0], children[1], r.value()->attributes);
+        } else if (auto r = DynamicCast<Relation, RelationMultiJoin>(rel)) {
+            return relations->Make<RelationMultiJoin>(
+                children, r.value()->variables, r.value()->variable_order);
+        } else if (auto r = DynamicCast<Relation, RelationSemijoin>(rel)) {
+            return relations->Make<RelationSemijoin>(
+                children[0], children[1], r.value()->attributes);
+        } else if (auto r = DynamicCast<Relation, RelationUnion>(rel)) {
+            return relations->Make<RelationUnion>(children[0], children[1]);
+        } else if (auto r = DynamicCast<Relation, RelationDifference>(rel)) {
+            return relations->Make<RelationDifference>(
+                children[0], children[1]);
+        } else if (auto r = DynamicCast<Relation, RelationSelect>(rel)) {
+            return relations->Make<RelationSelect>(
+                r.value()->predicate, children[0]);
+        } else if (auto r = DynamicCast<Relation, RelationMap>(rel)) {
+            return relations->Make<RelationMap>(
+                r.value()->function, children[0]);
+        } else if (auto r = DynamicCast<Relation, RelationView>(rel)) {
+            return relations->Make<RelationView>(
+                Viewed<Relation*>(r.value()->rel.perm, children[0]));
+        } else if (auto r = DynamicCast<Relation, RelationDistinct>(rel)) {
+            return relations->Make<RelationDistinct>(children[0]);
+        }
+        return absl::InternalError(
+            "If this is reached, a new relation op has been added but no case "
+            "was added to the rewriter. Please add one.");
+    }
+
+    Relation* Select(const std::vector<Predicate*>& conjuncts, Relation* rel) {
+        if (conjuncts.empty()) {
+            return rel;
+        }
+        return relations->Make<RelationSelect>(
+            internal::Conjunction(predicates, conjuncts), rel);
+    }
+
+    Relation* View(const AttrPartialPermutation& perm, Relation* rel) {
+        if (internal::IsIdentity(perm, rel->Arity())) {
+            return rel;
+        }
+        return relations->Make<RelationView>(Viewed<Relation*>(perm, rel));
+    }
+
+    absl::optional<Relation*> PushSelect(RelationSelect* select) {
+        Predicate* predicate = select->predicate;
+        Relation* child = select->rel;
+        if (auto r = DynamicCast<Relation, RelationSelect>(child)) {
+            std::vector<Predicate*> conjuncts;
+            internal::Conjuncts(predicate, &conjuncts);
+            internal::Conjuncts(r.value()->predicate, &conjuncts);
+            return Select(conjuncts, r.value()->rel);
+        } else if (auto r = DynamicCast<Relation, RelationView>(child)) {
+            const AttrPartialPermutation& perm = r.value()->rel.perm;
+            std::vector<absl::optional<Attr>> source(r.value()->Arity());
+            for (Attr k = 0; k < perm.size(); k++) {
+                if (perm[k].has_value()) {
+                    source[perm[k].value()] = k;
+                }
+            }
+            absl::optional<Predicate*> renamed = internal::RenamePredicate(
+                predicates, predicate,
+                [&](Attr k) -> absl::optional<Attr> {
+                    if ((k < 0) || (k >= source.size())) {
+                        return absl::nullopt;
+                    }
+                    return source[k];
+                });
+            if (!renamed.has_value()) {
+                return absl::nullopt;
+            }
+            return relations->Make<RelationView>(Viewed<Relation*>(
+                perm, Select({renamed.value()}, r.value()->rel.rel)));
+        } else if (auto r = DynamicCast<Relation, RelationUnion>(child)) {
+            return relations->Make<RelationUnion>(
+                Select({predicate}, r.value()->lhs),
+                Select({predicate}, r.value()->rhs));
+        } else if (auto r = DynamicCast<Relation, RelationDifference>(child)) {
+            return relations->Make<RelationDifference>(
+                Select({predicate}, r.value()->lhs), r.value()->rhs);
+        } else if (auto r = DynamicCast<Relation, RelationDistinct>(child)) {
+            return relations->Make<RelationDistinct>(
+                Select({predicate}, r.value()->rel));
+        } else if (auto r = DynamicCast<Relation, RelationJoin>(child)) {
+            return PushSelectIntoJoin(predicate, r.value()->lhs,
+                                      r.value()->rhs, r.value()->attributes,
+                                      false);
+        } else if (auto r = DynamicCast<Relation, RelationSemijoin>(child)) {
+            return PushSelectIntoJoin(predicate, r.value()->lhs,
+                                      r.value()->rhs, r.value()->attributes,
+                                      true);
+        } else if (auto r = DynamicCast<Relation, RelationMultiJoin>(child)) {
+            return PushSelectIntoMultiJoin(predicate, r.value());
+        }
+        return absl::nullopt;
+    }
+
+    absl::optional<Relation*> PushSelectIntoJoin(Predicate* predicate,
+                                                 Relation* lhs,
+                                                 Relation* rhs,
+                                                 const JoinOn& join_on,
+                                                 bool semijoin) {
+        int32_t lhs_arity = lhs->Arity();
+        JoinLayout layout(join_on, rhs->Arity());
+        auto on_lhs = [&](Attr k) -> absl::optional<Attr> {
+            if ((k < 0) || (k >= lhs_arity)) {
+                return absl::nullopt;
+            }
+            return k;
+        };
+        // Attributes of the result that the right-hand side has too, either
+        // as its own attributes or as the keys they are equal to.
+        auto on_rhs = [&](Attr k) -> absl::optional<Attr> {
+            if ((k >= lhs_arity) && !semijoin
+                && (k - lhs_arity < layout.rhs_included.size())) {
+                return layout.rhs_included[k - lhs_arity];
+            }
+            for (const auto& [x, y] : join_on) {
+                if (x == k) {
+                    return y;
+                }
+            }
+            return absl::nullopt;
+        };
+
+        std::vector<Predicate*> conjuncts;
+        internal::Conjuncts(predicate, &conjuncts);
+        std::vector<Predicate*> lhs_conjuncts;
+        std::vector<Predicate*> rhs_conjuncts;
+        std::vector<Predicate*> remaining;
+        for (Predicate* conjunct : conjuncts) {
+            auto lhs_renamed =
+                internal::RenamePredicate(predicates, conjunct, on_lhs);
+            auto rhs_renamed =
+                internal::RenamePredicate(predicates, conjunct, on_rhs);
+            if (lhs_renamed.has_value()) {
+                lhs_conjuncts.push_back(conjunct);
+            }
+            if (rhs_renamed.has_value()) {
+                rhs_conjuncts.push_back(rhs_renamed.value());
+            }
+            if (!lhs_renamed.has_value() && !rhs_renamed.has_value()) {
+                remaining.push_back(conjunct);
+            }
+        }
+        if (lhs_conjuncts.empty() && rhs_conjuncts.empty()) {
+            return absl::nullopt;
+        }
+
+        Relation* result = nullptr;
+        if (semijoin) {
+            result = relations->Make<RelationSemijoin>(
+                Select(lhs_conjuncts, lhs), Select(rhs_conjuncts, rhs),
+                join_on);
+        } else {
+            result = relations->Make<RelationJoin>(
+                Select(lhs_conjuncts, lhs), Select(rhs_conjuncts, rhs),
+                join_on);
+        }
+        return Select(remaining, result);
+    }
+
+    absl::optional<Relation*> PushSelectIntoMultiJoin(
+        Predicate* predicate, RelationMultiJoin* join) {
+        std::vector<Predicate*> conjuncts;
+        internal::Conjuncts(predicate, &conjuncts);
+        std::vector<std::vector<Predicate*>> input_conjuncts(
+            join->inputs.size());
+        std::vector<Predicate*> remaining;
+        for (Predicate* conjunct : conjuncts) {
+            bool pushed = false;
+            for (int32_t i = 0; i < join->inputs.size(); i++) {
+                const std::vector<int32_t>& variables = join->variables[i];
+                auto renamed = internal::RenamePredicate(
+                    predicates, conjunct,
+                    [&](Attr v) -> absl::optional<Attr> {
+                        for (Attr k = 0; k < variables.size(); k++) {
+                            if (variables[k] == v) {
+                                return k;
+                            }
+                        }
+                        return absl::nullopt;
+                    });
+                if (renamed.has_value()) {
+                    input_conjuncts[i].push_back(renamed.value());
+                    pushed = true;
+                }
+            }
+            if (!pushed) {
+                remaining.push_back(conjunct);
+            }
+        }
+        if (remaining.size() == conjuncts.size()) {
+            return absl::nullopt;
+        }
+
+        std::vector<Relation*> inputs;
+        for (int32_t i = 0; i < join->inputs.size(); i++) {
+            inputs.push_back(Select(input_conjuncts[i], join->inputs[i]));
+        }
+        return Select(remaining, relations->Make<RelationMultiJoin>(
+            inputs, join->variables, join->variable_order));
+    }
+
+    absl::optional<Relation*> PushView(RelationView* view) {
+        const AttrPartialPermutation& perm = view->rel.perm;
+        Relation* child = view->rel.rel;
+        if (internal::IsIdentity(perm, child->Arity())) {
+            return child;
+        }
+        if (auto r = DynamicCast<Relation, RelationView>(child)) {
+            AttrPartialPermutation composed;
+            for (const absl::optional<Attr>& k : r.value()->rel.perm) {
+                composed.push_back(k.has_value() ? perm.at(k.value())
+                                                 : absl::nullopt);
+            }
+            return View(composed, r.value()->rel.rel);
+        }
+        if (view->Arity() == perm.size()) {
+            // Pure permutations are cheapest where they are.
+            return absl::nullopt;
+        }
+        if (auto r = DynamicCast<Relation, RelationUnion>(child)) {
+            return relations->Make<RelationUnion>(View(perm, r.value()->lhs),
+                                                  View(perm, r.value()->rhs));
+        } else if (auto r = DynamicCast<Relation, RelationJoin>(child)) {
+            if (options.set_semantics) {
+                if (auto result = JoinToSemijoin(perm, r.value())) {
+                    return result;
+                }
+            }
+            return ProjectJoin(perm, r.value());
+        } else if (auto r = DynamicCast<Relation, RelationSemijoin>(child)) {
+            return ProjectSemijoin(perm, r.value());
+        }
+        return absl::nullopt;
+    }
+
+    // Replaces a view of a join by a view of the semijoin of the side whose
+    // attributes it keeps with the other side.
+    absl::optional<Relation*> JoinToSemijoin(const AttrPartialPermutation& perm,
+                                             RelationJoin* join) {
+        int32_t lhs_arity = join->lhs->Arity();
+        int32_t rhs_arity = join->rhs->Arity();
+        JoinLayout layout(join->attributes, rhs_arity);
+
+        bool lhs_only = true;
+        for (Attr k = lhs_arity; k < perm.size(); k++) {
+            lhs_only &= !perm[k].has_value();
+        }
+        if (lhs_only) {
+            AttrPartialPermutation lhs_perm(perm.begin(),
+                                            perm.begin() + lhs_arity);
+            return View(lhs_perm, relations->Make<RelationSemijoin>(
+                join->lhs, join->rhs, join->attributes));
+        }
+
+        // Kept keys of the left-hand side are read from the right-hand side
+        // attributes they are equal to.
+        AttrPartialPermutation rhs_perm(rhs_arity, absl::nullopt);
+        for (Attr k = 0; k < perm.size(); k++) {
+            if (!perm[k].has_value()) {
+                continue;
+            }
+            absl::optional<Attr> source;
+            if (k >= lhs_arity) {
+                source = layout.rhs_included[k - lhs_arity];
+            } else {
+                for (const auto& [x, y] : join->attributes) {
+                    if (x == k) {
+                        source = y;
+                        break;
+                    }
+                }
+            }
+            if (!source.has_value() || rhs_perm[source.value()].has_value()) {
+                return absl::nullopt;
+            }
+            rhs_perm[source.value()] = perm[k];
+        }
+        JoinOn flipped;
+        for (const auto& [x, y] : join->attributes) {
+            flipped.emplace(y, x);
+        }
+        return View(rhs_perm, relations->Make<RelationSemijoin>(
+            join->rhs, join->lhs, flipped));
+    }
+
+    absl::optional<Relation*> ProjectJoin(const AttrPartialPermutation& perm,
+                                          RelationJoin* join) {
+        int32_t lhs_arity = join->lhs->Arity();
+        int32_t rhs_arity = join->rhs->Arity();
+        JoinLayout layout(join->attributes, rhs_arity);
+
+        std::vector<bool> lhs_needed(lhs_arity, false);
+        std::vector<bool> rhs_needed(rhs_arity, false);
+        for (Attr k = 0; k < perm.size(); k++) {
+            if (!perm[k].has_value()) {
+                continue;
+            } else if (k < lhs_arity) {
+                lhs_needed[k] = true;
+            } else {
+                rhs_needed[layout.rhs_included[k - lhs_arity]] = true;
+            }
+        }
+        for (const auto& [x, y] : join->attributes) {
+            lhs_needed[x] = true;
+            rhs_needed[y] = true;
+        }
+        if ((std::count(lhs_needed.begin(), lhs_needed.end(), false) == 0)
+            && (std::count(rhs_needed.begin(), rhs_needed.end(), false) == 0)) {
+            return absl::nullopt;
+        }
+
+        AttrPartialPermutation lhs_projection =
+            internal::Projection(lhs_needed);
+        AttrPartialPermutation rhs_projection =
+            internal::Projection(rhs_needed);
+        JoinOn join_on;
+        for (const auto& [x, y] : join->attributes) {
+            join_on.emplace(lhs_projection[x].value(),
+                            rhs_projection[y].value());
+        }
+        Relation* projected = relations->Make<RelationJoin>(
+            View(lhs_projection, join->lhs),
+            View(rhs_projection, join->rhs),
+            join_on);
+
+        // The projected join keeps the needed attributes of each side in
+        // their original order, so its attributes are those of the original
+        // join that are needed.
+        AttrPartialPermutation result_perm;
+        for (Attr k = 0; k < lhs_arity; k++) {
+            if (lhs_needed[k]) {
+                result_perm.push_back(perm[k]);
+            }
+        }
+        for (int32_t i = 0; i < layout.rhs_included.size(); i++) {
+            if (rhs_needed[layout.rhs_included[i]]) {
+                result_perm.push_back(perm[lhs_arity + i]);
+            }
+        }
+        return View(result_perm, projected);
+    }
+
+    absl::optional<Relation*> ProjectSemijoin(
+        const AttrPartialPermutation& perm, RelationSemijoin* semijoin) {
+        std::vector<bool> lhs_needed(perm.size(), false);
+        for (Attr k = 0; k < perm.size(); k++) {
+            lhs_needed[k] = perm[k].has_value();
+        }
+        for (const auto& [x, y] : semijoin->attributes) {
+            lhs_needed[x] = true;
+        }
+        if (std::count(lhs_needed.begin(), lhs_needed.end(), false) == 0) {
+            return absl::nullopt;
+        }
+
+        AttrPartialPermutation lhs_projection =
+            internal::Projection(lhs_needed);
+        JoinOn join_on;
+        for (const auto& [x, y] : semijoin->attributes) {
+            join_on.emplace(lhs_projection[x].value(), y);
+        }
+        AttrPartialPermutation result_perm;
+        for (Attr k = 0; k < perm.size(); k++) {
+            if (lhs_needed[k]) {
+                result_perm.push_back(perm[k]);
+            }
+        }
+        return View(result_perm, relations->Make<RelationSemijoin>(
+            View(lhs_projection, semijoin->lhs), semijoin->rhs, join_on));
+    }
+
+    RelationFactory* relations;
+    PredicateFactory* predicates;
+    RewriteOptions options;
+    absl::flat_hash_map<Relation*, Relation*> memo;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace rdss
+
+#endif  // RDSS_REWRITE_H_
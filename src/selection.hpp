@@ -0,0 +1,280 @@
+// Copyright 2021 The RDSS Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RDSS_SELECTION_H_
+#define RDSS_SELECTION_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <absl/numeric/bits.h>
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <absl/strings/str_format.h>
+#include <absl/types/span.h>
+
+#ifdef RDSS_HAVE_HIGHWAY
+#include <hwy/highway.h>
+#endif
+
+#include "ast.hpp"
+#include "macros.hpp"
+#include "predicate.hpp"
+#include "table.hpp"
+
+namespace rdss {
+
+////////////////////////////////////////////////////////////////////////////////
+
+// One bit per row of a table, packed 64 rows to a word. Bits past `size` in
+// the last word are always zero.
+class Bitmap {
+public:
+    explicit Bitmap(int32_t size_, bool value = false)
+        : size(size_), words((size_ + 63) / 64, value ? ~uint64_t(0) : 0) {
+        ClearTail();
+    }
+
+    int32_t Size() const {
+        return size;
+    }
+
+    bool Get(int32_t index) const {
+        return (words[index / 64] >> (index % 64)) & 1;
+    }
+
+    void Set(int32_t index) {
+        words[index / 64] |= uint64_t(1) << (index % 64);
+    }
+
+    uint64_t* Words() {
+        return words.data();
+    }
+
+    void And(const Bitmap& other) {
+        for (size_t i = 0; i < words.size(); i++) {
+            words[i] &= other.words[i];
+        }
+    }
+
+    void Or(const Bitmap& other) {
+        for (size_t i = 0; i < words.size(); i++) {
+            words[i] |= other.words[i];
+        }
+    }
+
+    void Not() {
+        for (uint64_t& word : words) {
+            word = ~word;
+        }
+        ClearTail();
+    }
+
+    int32_t CountOnes() const {
+        int32_t result = 0;
+        for (uint64_t word : words) {
+            result += absl::popcount(word);
+        }
+        return result;
+    }
+
+    // Returns the indices of the set bits in increasing order, i.e. the
+    // selection vector corresponding to this bitmap, each shifted by `offset`.
+    std::vector<int32_t> SetIndices(int32_t offset = 0) const {
+        std::vector<int32_t> result;
+        result.reserve(CountOnes());
+        for (size_t i = 0; i < words.size(); i++) {
+            uint64_t word = words[i];
+            while (word != 0) {
+                result.push_back(offset + i * 64 + absl::countr_zero(word));
+                word &= word - 1;
+            }
+        }
+        return result;
+    }
+
+private:
+    void ClearTail() {
+        if ((size % 64) != 0) {
+            words.back() &= (uint64_t(1) << (size % 64)) - 1;
+        }
+    }
+
+    int32_t size;
+    std::vector<uint64_t> words;
+};
+
+namespace internal {
+
+enum class Comparison { kEquals, kLessThan };
+
+#ifdef RDSS_HAVE_HIGHWAY
+
+namespace hn = hwy::HWY_NAMESPACE;
+
+// Compares `column` against `constant` a full vector at a time, storing the
+// lane masks straight into the bitmap words. Lane counts for 32-bit values
+// are powers of two no larger than 64, so every vector lands inside a single
+// word.
+template<Comparison comparison>
+void CompareColumn(absl::Span<const Value> column,
+                   Value constant,
+                   uint64_t* words) {
+    const HWY_FULL(int32_t) d;
+    const size_t lanes = hn::Lanes(d);
+    const auto constant_vector = hn::Set(d, constant);
+    size_t i = 0;
+    for (; i + lanes <= column.size(); i += lanes) {
+        const auto values = hn::LoadU(d, column.data() + i);
+        uint8_t bytes[8] = {0};
+        if constexpr (comparison == Comparison::kEquals) {
+#if defined(HWY_MAJOR) && ((HWY_MAJOR > 0) || (HWY_MINOR >= 14))
+            hn::StoreMaskBits(d, values == constant_vector, bytes);
+#else
+            hn::StoreMaskBits(values == constant_vector, bytes);
+#endif
+        } else {
+#if defined(HWY_MAJOR) && ((HWY_MAJOR > 0) || (HWY_MINOR >= 14))
+            hn::StoreMaskBits(d, values < constant_vector, bytes);
+#else
+            hn::StoreMaskBits(values < constant_vector, bytes);
+#endif
+        }
+        uint64_t bits = 0;
+        for (size_t b = 0; b < (lanes + 7) / 8; b++) {
+            bits |= uint64_t(bytes[b]) << (8 * b);
+        }
+        words[i / 64] |= bits << (i % 64);
+    }
+    for (; i < column.size(); i++) {
+        bool bit = (comparison == Comparison::kEquals)
+            ? (column[i] == constant)
+            : (column[i] < constant);
+        words[i / 64] |= uint64_t(bit) << (i % 64);
+    }
+}
+
+#else
+
+// Portable fallback: builds each bitmap word from 64 branch-free comparisons,
+// which compilers are able to vectorize.
+template<Comparison comparison>
+void CompareColumn(absl::Span<const Value> column,
+                   Value constant,
+                   uint64_t* words) {
+    size_t n = column.size();
+    for (size_t w = 0; w * 64 < n; w++) {
+        size_t begin = w * 64;
+        size_t end = std::min(n, begin + 64);
+        uint64_t bits = 0;
+        for (size_t i = begin; i < end; i++) {
+            bool bit = (comparison == Comparison::kEquals)
+                ? (column[i] == constant)
+                : (column[i] < constant);
+            bits |= uint64_t(bit) << (i - begin);
+        }
+        words[w] = bits;
+    }
+}
+
+#endif  // RDSS_HAVE_HIGHWAY
+
+}  // namespace internal
+
+// Evaluates `predicate` over the tuples `[begin, end)` of `table` a column at
+// a time, returning a bitmap whose bit `i` is set when tuple `begin + i`
+// satisfies it. Comparisons are run as vector kernels over whole columns and
+// connectives are combined word by word, so there is no per-tuple dispatch on
+// the predicate tree.
+inline absl::StatusOr<Bitmap> EvaluatePredicate(Predicate* predicate,
+                                                const Table& table,
+                                                int32_t begin,
+                                                int32_t end) {
+    int32_t n = end - begin;
+    if (auto p = DynamicCast<Predicate, PredicateAnd>(predicate)) {
+        Bitmap result(n, true);
+        for (Predicate* child : p.value()->children) {
+            ASSIGN_OR_RETURN(Bitmap child_bitmap,
+                             EvaluatePredicate(child, table, begin, end));
+            result.And(child_bitmap);
+        }
+        return result;
+    } else if (auto p = DynamicCast<Predicate, PredicateOr>(predicate)) {
+        Bitmap result(n, false);
+        for (Predicate* child : p.value()->children) {
+            ASSIGN_OR_RETURN(Bitmap child_bitmap,
+                             EvaluatePredicate(child, table, begin, end));
+            result.Or(child_bitmap);
+        }
+        return result;
+    } else if (auto p = DynamicCast<Predicate, PredicateNot>(predicate)) {
+        ASSIGN_OR_RETURN(Bitmap result,
+                         EvaluatePredicate(p.value()->pred, table, begin, end));
+        result.Not();
+        return result;
+    } else if (auto p = DynamicCast<Predicate, PredicateLike>(predicate)) {
+        // The pattern is matched once per dictionary entry, and each tuple
+        // only looks its code up in the result.
+        const StringDictionary* dictionary =
+            table.Dictionary(p.value()->attr).get();
+        if (dictionary == nullptr) {
+            return absl::InvalidArgumentError(absl::StrFormat(
+                "LIKE on attr%d, which is not a string column",
+                p.value()->attr));
+        }
+        std::shared_ptr<const std::vector<bool>> matches =
+            dictionary->MatchLike(p.value()->string);
+        absl::Span<const Value> column =
+            table.Column(p.value()->attr).subspan(begin, n);
+        Bitmap result(n, false);
+        for (int32_t i = 0; i < n; i++) {
+            if ((uint32_t(column[i]) < matches->size())
+                && (*matches)[column[i]]) {
+                result.Set(i);
+            }
+        }
+        return result;
+    } else if (auto p = DynamicCast<Predicate, PredicateLessThan>(predicate)) {
+        Bitmap result(n, false);
+        internal::CompareColumn<internal::Comparison::kLessThan>(
+            table.Column(p.value()->attr).subspan(begin, n),
+            p.value()->integer,
+            result.Words());
+        return result;
+    } else if (auto p = DynamicCast<Predicate, PredicateEquals>(predicate)) {
+        Bitmap result(n, false);
+        internal::CompareColumn<internal::Comparison::kEquals>(
+            table.Column(p.value()->attr).subspan(begin, n),
+            p.value()->integer,
+            result.Words());
+        return result;
+    }
+    return absl::InternalError(
+        "If this is reached, a new predicate has been added but no case was "
+        "added to EvaluatePredicate. Please add one.");
+}
+
+// Evaluates `predicate` over every tuple of `table`.
+inline absl::StatusOr<Bitmap> EvaluatePredicate(Predicate* predicate,
+                                                const Table& table) {
+    return EvaluatePredicate(predicate, table, 0, table.NumberOfTuples());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace rdss
+
+#endif  // RDSS_SELECTION_H_
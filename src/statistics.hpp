@@ -0,0 +1,432 @@
+// Copyright 2021 The RDSS Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RDSS_STATISTICS_H_
+#define RDSS_STATISTICS_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include <absl/container/flat_hash_map.h>
+#include <absl/numeric/bits.h>
+#include <absl/status/status.h>
+#include <absl/types/span.h>
+
+#include "ast.hpp"
+#include "distinct.hpp"
+#include "logging/logging.hpp"
+#include "predicate.hpp"
+#include "table.hpp"
+#include "thread_pool.hpp"
+
+namespace rdss {
+
+////////////////////////////////////////////////////////////////////////////////
+
+// A HyperLogLog sketch of the number of distinct values added to it. With
+// the default precision of 12 it takes 4 KiB and its estimates are typically
+// within 2% of the true count. Sketches of the same precision can be merged.
+class HyperLogLog {
+public:
+    explicit HyperLogLog(int32_t precision_ = 12)
+        : precision(precision_), registers(size_t(1) << precision_, 0) {
+        RDSS_CHECK_GE(precision, 4);
+        RDSS_CHECK_LE(precision, 18);
+    }
+
+    void Add(Value value) {
+        uint64_t hash =
+            internal::FinalizeRowHash(internal::MixRowHash(0, value));
+        uint64_t index = hash >> (64 - precision);
+        uint64_t rest = hash << precision;
+        uint8_t rank = (rest == 0)
+            ? (64 - precision + 1)
+            : (absl::countl_zero(rest) + 1);
+        registers[index] = std::max(registers[index], rank);
+    }
+
+    void Merge(const HyperLogLog& other) {
+        RDSS_CHECK_EQ(precision, other.precision);
+        for (size_t i = 0; i < registers.size(); i++) {
+            registers[i] = std::max(registers[i], other.registers[i]);
+        }
+    }
+
+    double Estimate() const {
+        double m = registers.size();
+        double sum = 0.0;
+        int32_t zeros = 0;
+        for (uint8_t rank : registers) {
+            sum += std::ldexp(1.0, -rank);
+            zeros += (rank == 0);
+        }
+        double estimate = (0.7213 / (1.0 + 1.079 / m)) * m * m / sum;
+        // Small cardinalities are estimated better by linear counting of the
+        // registers that are still empty.
+        if ((estimate <= 2.5 * m) && (zeros > 0)) {
+            estimate = m * std::log(m / zeros);
+        }
+        return estimate;
+    }
+
+private:
+    int32_t precision;
+    std::vector<uint8_t> registers;
+};
+
+// One bucket of an equi-depth histogram: about `count` rows hold values in
+// `[lower, upper]`.
+struct HistogramBucket {
+    Value lower;
+    Value upper;
+    double count;
+};
+
+// The number of values that `ColumnStatistics` samples for its histograms.
+constexpr int32_t kStatisticsSampleSize = 4096;
+
+// The number of values that `ColumnStatistics` tracks as heavy hitters.
+constexpr int32_t kHeavyHitterCounters = 64;
+
+// The selectivity assumed for LIKE predicates, whose patterns statistics
+// over codes say nothing about.
+constexpr double kDefaultLikeSelectivity = 0.1;
+
+// Statistics of the values of one column, built by adding the column's values
+// as they are appended. All of them are maintained in one pass and constant
+// space:
+//
+// * the number of rows, and the smallest and largest value;
+// * a HyperLogLog sketch of the number of distinct values;
+// * a uniform sample of the rows, counting each occurrence, from which
+//   equi-depth histograms are built on demand;
+// * the most frequent values, found by the Misra-Gries algorithm: every value
+//   that occurs in more than 1/(k+1) of the rows is among the k counters, and
+//   each counter falls short of its value's count by at most that fraction.
+class ColumnStatistics {
+public:
+    ColumnStatistics()
+        : count(0)
+        , min(0)
+        , max(0)
+        , distinct()
+        , sample()
+        , sampled(0)
+        , next_sampled(std::numeric_limits<int64_t>::max())
+        , skip_factor(1.0)
+        , rng(0)
+        , heavy_hitters() {}
+
+    // Adds `values`, where value `i` occurs `multiplicities[i]` times, or
+    // once if `multiplicities` is empty.
+    void Add(absl::Span<const Value> values,
+             absl::Span<const int64_t> multiplicities = {}) {
+        for (int32_t i = 0; i < values.size(); i++) {
+            int64_t weight = multiplicities.empty() ? 1 : multiplicities[i];
+            if (weight == 0) {
+                continue;
+            }
+            Value value = values[i];
+            min = (count == 0) ? value : std::min(min, value);
+            max = (count == 0) ? value : std::max(max, value);
+            count += weight;
+            distinct.Add(value);
+            AddToSample(value, weight);
+            AddHeavyHitter(value, weight);
+        }
+    }
+
+    // The number of rows, counting each occurrence.
+    int64_t Count() const {
+        return count;
+    }
+
+    // The smallest and largest values; both are 0 while `Count()` is 0.
+    Value Min() const {
+        return min;
+    }
+
+    Value Max() const {
+        return max;
+    }
+
+    // The estimated number of distinct values, which is never more than the
+    // number of rows.
+    double DistinctCount() const {
+        return std::min(distinct.Estimate(), double(count));
+    }
+
+    // Returns an equi-depth histogram of at most `buckets` buckets, each
+    // holding about the same number of rows. Buckets are in increasing
+    // order and do not overlap, so a value that fills more than one bucket's
+    // share of the sample makes its bucket deeper than the others.
+    std::vector<HistogramBucket> Histogram(int32_t buckets = 64) const {
+        RDSS_CHECK_GT(buckets, 0);
+        std::vector<Value> sorted = sample;
+        std::sort(sorted.begin(), sorted.end());
+        std::vector<HistogramBucket> result;
+        double rows_per_sample = sorted.empty()
+            ? 0.0
+            : double(count) / sorted.size();
+        size_t begin = 0;
+        for (int32_t b = 0; (b < buckets) && (begin < sorted.size()); b++) {
+            size_t end = std::max(begin + 1,
+                                  sorted.size() * (b + 1) / buckets);
+            // Equal values never straddle two buckets.
+            end = std::upper_bound(sorted.begin() + end - 1, sorted.end(),
+                                   sorted[end - 1]) - sorted.begin();
+            result.push_back(HistogramBucket {
+                sorted[begin], sorted[end - 1],
+                (end - begin) * rows_per_sample });
+            begin = end;
+        }
+        return result;
+    }
+
+    // The values that may occur in more than 1/(k+1) of the rows, with lower
+    // bounds on their counts, most frequent first.
+    std::vector<std::pair<Value, int64_t>> HeavyHitters() const {
+        std::vector<std::pair<Value, int64_t>> result(heavy_hitters.begin(),
+                                                      heavy_hitters.end());
+        std::sort(result.begin(), result.end(),
+                  [](const auto& x, const auto& y) {
+                      return std::make_pair(-x.second, x.first)
+                          < std::make_pair(-y.second, y.first);
+                  });
+        return result;
+    }
+
+    // The estimated fraction of rows equal to `value`. Heavy hitters are
+    // estimated from their counters, and the other values are assumed to
+    // share the remaining rows evenly.
+    double EqualsSelectivity(Value value) const {
+        if ((count == 0) || (value < min) || (value > max)) {
+            return 0.0;
+        }
+        auto it = heavy_hitters.find(value);
+        if (it != heavy_hitters.end()) {
+            return double(it->second) / count;
+        }
+        int64_t heavy = 0;
+        for (const auto& [v, c] : heavy_hitters) {
+            heavy += c;
+        }
+        double others = std::max(1.0, DistinctCount() - heavy_hitters.size());
+        return std::max(0.0, double(count - heavy) / others / count);
+    }
+
+    // The estimated fraction of rows less than `value`, interpolating
+    // linearly within the histogram bucket that `value` falls in.
+    double LessThanSelectivity(Value value) const {
+        if ((count == 0) || (value <= min)) {
+            return 0.0;
+        }
+        if (value > max) {
+            return 1.0;
+        }
+        double rows = 0.0;
+        for (const HistogramBucket& bucket : Histogram()) {
+            if (bucket.upper < value) {
+                rows += bucket.count;
+            } else if (bucket.lower < value) {
+                rows += bucket.count
+                    * (double(value) - bucket.lower)
+                    / (double(bucket.upper) - bucket.lower + 1);
+            }
+        }
+        return std::clamp(rows / count, 0.0, 1.0);
+    }
+
+private:
+    // Reservoir sampling over occurrences, so that a value added with
+    // multiplicity `w` is as likely to be sampled as `w` copies of it and the
+    // histograms can scale the sample by `count`. Rather than drawing once
+    // per occurrence, Li's Algorithm L draws how many occurrences pass before
+    // the next one replaces a random sampled value, so adding a value costs
+    // time proportional to how many of its occurrences enter the sample.
+    void AddToSample(Value value, int64_t weight) {
+        while ((weight > 0) && (sample.size() < kStatisticsSampleSize)) {
+            sample.push_back(value);
+            sampled++;
+            weight--;
+            if (sample.size() == kStatisticsSampleSize) {
+                skip_factor = std::exp(
+                    std::log(Uniform()) / kStatisticsSampleSize);
+                next_sampled = sampled + Skip();
+            }
+        }
+        sampled += weight;
+        while (next_sampled <= sampled) {
+            sample[rng() % kStatisticsSampleSize] = value;
+            skip_factor *= std::exp(
+                std::log(Uniform()) / kStatisticsSampleSize);
+            next_sampled += Skip();
+        }
+    }
+
+    // A uniform random number in (0, 1].
+    double Uniform() {
+        return 1.0 - std::generate_canonical<double, 64>(rng);
+    }
+
+    // The distance from one sampled occurrence to the next.
+    int64_t Skip() {
+        return int64_t(std::log(Uniform()) / std::log1p(-skip_factor)) + 1;
+    }
+
+    void AddHeavyHitter(Value value, int64_t weight) {
+        auto it = heavy_hitters.find(value);
+        if (it != heavy_hitters.end()) {
+            it->second += weight;
+            return;
+        }
+        // Every round cancels `decrement` occurrences of `value` against as
+        // many of each tracked value, until `value` fits.
+        while ((weight > 0) && (heavy_hitters.size() >= kHeavyHitterCounters)) {
+            int64_t decrement = weight;
+            for (const auto& [v, c] : heavy_hitters) {
+                decrement = std::min(decrement, c);
+            }
+            weight -= decrement;
+            for (auto it = heavy_hitters.begin(); it != heavy_hitters.end();) {
+                if ((it->second -= decrement) == 0) {
+                    heavy_hitters.erase(it++);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        if (weight > 0) {
+            heavy_hitters.emplace(value, weight);
+        }
+    }
+
+    int64_t count;
+    Value min;
+    Value max;
+    HyperLogLog distinct;
+    std::vector<Value> sample;
+    // The number of occurrences added, and the position of the next one to
+    // replace a sampled value, which is never while the sample is not full.
+    int64_t sampled;
+    int64_t next_sampled;
+    double skip_factor;
+    std::mt19937_64 rng;
+    absl::flat_hash_map<Value, int64_t> heavy_hitters;
+};
+
+// Statistics of every column of a table, kept up to date as tuples are
+// appended to it. `Update` only reads the rows appended since the last
+// update, so maintaining statistics costs time proportional to the appended
+// rows.
+class TableStatistics {
+public:
+    explicit TableStatistics(int32_t width)
+        : rows_seen(0), columns(width) {}
+
+    // Computes the statistics of `table`, a column per task when a pool is
+    // given.
+    static TableStatistics Compute(const Table& table,
+                                   ThreadPool* pool = nullptr) {
+        TableStatistics result(table.Width());
+        RDSS_CHECK_OK(result.Update(table, pool));
+        return result;
+    }
+
+    // Adds the tuples of `table` past the ones these statistics were last
+    // updated with. Tuples may only have been appended since then.
+    absl::Status Update(const Table& table, ThreadPool* pool = nullptr) {
+        if (table.Width() != columns.size()) {
+            return absl::InternalError(
+                "given table does not match table width");
+        }
+        if (table.NumberOfTuples() < rows_seen) {
+            return absl::FailedPreconditionError(
+                "table has fewer tuples than its statistics have seen");
+        }
+        int32_t begin = rows_seen;
+        int32_t n = table.NumberOfTuples() - begin;
+        absl::Span<const int64_t> multiplicities;
+        if (table.HasMultiplicities()) {
+            multiplicities = table.Multiplicities().subspan(begin, n);
+        }
+        ParallelFor(pool, columns.size(), [&](int32_t k) {
+            columns[k].Add(table.Column(k).subspan(begin, n),
+                           multiplicities);
+        });
+        rows_seen = table.NumberOfTuples();
+        return absl::OkStatus();
+    }
+
+    int32_t Width() const {
+        return columns.size();
+    }
+
+    // The number of tuples, counting each occurrence.
+    int64_t NumberOfTuples() const {
+        return columns.empty() ? rows_seen : columns[0].Count();
+    }
+
+    const ColumnStatistics& Column(Attr attr) const {
+        return columns.at(attr);
+    }
+
+private:
+    int32_t rows_seen;
+    std::vector<ColumnStatistics> columns;
+};
+
+// Estimates the fraction of the tuples described by `statistics` that
+// satisfy `predicate`, assuming that the columns are independent.
+inline double EstimateSelectivity(Predicate* predicate,
+                                  const TableStatistics& statistics) {
+    if (auto p = DynamicCast<Predicate, PredicateAnd>(predicate)) {
+        double result = 1.0;
+        for (Predicate* child : p.value()->children) {
+            result *= EstimateSelectivity(child, statistics);
+        }
+        return result;
+    } else if (auto p = DynamicCast<Predicate, PredicateOr>(predicate)) {
+        double none = 1.0;
+        for (Predicate* child : p.value()->children) {
+            none *= 1.0 - EstimateSelectivity(child, statistics);
+        }
+        return 1.0 - none;
+    } else if (auto p = DynamicCast<Predicate, PredicateNot>(predicate)) {
+        return 1.0 - EstimateSelectivity(p.value()->pred, statistics);
+    } else if (auto p = DynamicCast<Predicate, PredicateLike>(predicate)) {
+        return kDefaultLikeSelectivity;
+    } else if (auto p = DynamicCast<Predicate, PredicateLessThan>(predicate)) {
+        return statistics.Column(p.value()->attr)
+            .LessThanSelectivity(p.value()->integer);
+    } else if (auto p = DynamicCast<Predicate, PredicateEquals>(predicate)) {
+        return statistics.Column(p.value()->attr)
+            .EqualsSelectivity(p.value()->integer);
+    }
+    RDSS_CHECK(false)
+        << "If this is reached, a new predicate has been added but no case "
+        << "was added to EstimateSelectivity. Please add one.";
+    return 1.0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace rdss
+
+#endif  // RDSS_STATISTICS_H_
@@ -0,0 +1,486 @@
+// Copyright 2021 The RDSS Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RDSS_TABLE_H_
+#define RDSS_TABLE_H_
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <absl/status/status.h>
+#include <absl/types/optional.h>
+#include <absl/types/span.h>
+
+#include "arena.hpp"
+#include "dictionary.hpp"
+#include "attr.hpp"
+#include "logging/logging.hpp"
+
+namespace rdss {
+
+////////////////////////////////////////////////////////////////////////////////
+
+using Value = int32_t;
+
+using Tuple = std::vector<Value>;
+
+// The storage of a single column of a `Table`.
+using ColumnBuffer = std::vector<Value, ArenaAllocator<Value>>;
+
+// The storage of the multiplicities of the tuples of a `Table`.
+using MultiplicityBuffer = std::vector<int64_t, ArenaAllocator<int64_t>>;
+
+class Table;
+
+// A non-owning reference to a single row of a `Table`. Creating one is free,
+// so operator loops should use these instead of materializing a `Tuple` for
+// every row they touch. A `TupleView` is invalidated by any insertion into
+// the underlying table.
+class TupleView {
+public:
+    TupleView(const Table* table_, int32_t index_)
+        : table(table_), index(index_) {}
+
+    Value operator[](Attr attr) const;
+
+    int32_t size() const;
+
+    // The dictionary of attribute `attr`, or null if it holds integers.
+    const StringDictionary* Dictionary(Attr attr) const;
+
+    // How many times the tuple occurs.
+    int64_t Multiplicity() const;
+
+    int32_t Index() const {
+        return index;
+    }
+
+    Tuple ToTuple() const {
+        Tuple result;
+        result.reserve(size());
+        for (int32_t i = 0; i < size(); i++) {
+            result.push_back((*this)[i]);
+        }
+        return result;
+    }
+
+private:
+    const Table* table;
+    int32_t index;
+};
+
+// A relation stored in column-major order: each attribute is kept in its own
+// contiguous vector, so scanning a single attribute touches only that
+// attribute's memory.
+//
+// Column buffers are reference-counted and copied on write, so copying a
+// `Table` costs O(width) and copies never observe each other's changes. Any
+// number of threads may read tables that share buffers; a buffer is only
+// modified in place by a table that holds the sole reference to it.
+//
+// Buffers the table allocates come from `arena` if one is given, and from the
+// global heap otherwise. Buffers shared with other tables stay where they
+// were allocated until they are copied.
+//
+// A table can also read columns that live outside of any buffer, such as a
+// memory-mapped file. Those columns are never written; the first
+// modification of a table copies them into buffers of its own.
+//
+// String columns hold the codes of a `StringDictionary` attached to the
+// column. Dictionaries describe the columns rather than their contents: they
+// are kept when the table is cleared and are not taken from tables whose
+// tuples are appended.
+//
+// A table may also record a multiplicity for every tuple, making it a bag
+// that stores each occurrence count once instead of repeating the tuple. A
+// table without multiplicities holds every tuple once per row. Appending
+// tuples that have multiplicities gives the table multiplicities of its own,
+// so that no occurrence is lost.
+class Table {
+public:
+    Table(int32_t width_, std::shared_ptr<MemoryArena> arena_ = nullptr)
+        : width(width_)
+        , number_of_tuples(0)
+        , arena(std::move(arena_))
+        , columns()
+        , external()
+        , external_owner()
+        , dictionaries(width_)
+        , multiplicities() {
+        for (int32_t i = 0; i < width; i++) {
+            columns.push_back(NewColumn());
+        }
+    }
+
+    // A table over `number_of_tuples_` rows of columns stored elsewhere,
+    // which `owner` keeps alive for as long as any table reads them.
+    Table(int32_t number_of_tuples_,
+          std::vector<const Value*> external_,
+          std::shared_ptr<const void> owner)
+        : width(external_.size())
+        , number_of_tuples(number_of_tuples_)
+        , arena()
+        , columns(external_.size())
+        , external(std::move(external_))
+        , external_owner(std::move(owner))
+        , dictionaries(width)
+        , multiplicities() {}
+
+    Tuple GetTuple(int32_t index) const {
+        return GetTupleView(index).ToTuple();
+    }
+
+    TupleView GetTupleView(int32_t index) const {
+        return TupleView(this, index);
+    }
+
+    absl::Span<const Value> Column(Attr attr) const {
+        if (columns[attr] == nullptr) {
+            return absl::Span<const Value>(external[attr], number_of_tuples);
+        }
+        return *columns[attr];
+    }
+
+    absl::Status InsertTuple(absl::Span<const Value> tuple,
+                             int64_t multiplicity = 1) {
+        if (tuple.size() != width) {
+            return absl::InternalError(
+                "given tuple does not match table width");
+        }
+        for (int32_t i = 0; i < width; i++) {
+            MutableColumn(i).push_back(tuple[i]);
+        }
+        PushMultiplicity(multiplicity);
+        number_of_tuples++;
+        return absl::OkStatus();
+    }
+
+    // Inserts the viewed tuple with its multiplicity.
+    absl::Status InsertTupleView(const TupleView& tuple) {
+        if (tuple.size() != width) {
+            return absl::InternalError(
+                "given tuple does not match table width");
+        }
+        for (int32_t i = 0; i < width; i++) {
+            MutableColumn(i).push_back(tuple[i]);
+        }
+        PushMultiplicity(tuple.Multiplicity());
+        number_of_tuples++;
+        return absl::OkStatus();
+    }
+
+    // Appends every tuple of `other` to this table, one column at a time. An
+    // empty table allocating from the same arena as `other` takes shared
+    // references to its columns instead of copying them.
+    absl::Status Append(const Table& other) {
+        if (other.width != width) {
+            return absl::InternalError(
+                "given table does not match table width");
+        }
+        if ((number_of_tuples == 0) && (arena == other.arena)) {
+            columns = other.columns;
+            external = other.external;
+            external_owner = other.external_owner;
+            multiplicities = other.multiplicities;
+            number_of_tuples = other.number_of_tuples;
+            return absl::OkStatus();
+        }
+        for (int32_t i = 0; i < width; i++) {
+            absl::Span<const Value> source = other.Column(i);
+            ColumnBuffer& column = MutableColumn(i);
+            column.insert(column.end(), source.begin(), source.end());
+        }
+        AppendMultiplicities(other, 0, other.number_of_tuples);
+        number_of_tuples += other.number_of_tuples;
+        return absl::OkStatus();
+    }
+
+    // Appends the tuples of `other` at the given row indices, in that order,
+    // gathering one column at a time.
+    absl::Status AppendRows(const Table& other,
+                            absl::Span<const int32_t> rows) {
+        if (other.width != width) {
+            return absl::InternalError(
+                "given table does not match table width");
+        }
+        for (int32_t i = 0; i < width; i++) {
+            absl::Span<const Value> source = other.Column(i);
+            ColumnBuffer& column = MutableColumn(i);
+            column.reserve(column.size() + rows.size());
+            for (int32_t row : rows) {
+                column.push_back(source[row]);
+            }
+        }
+        if (other.HasMultiplicities()) {
+            MultiplicityBuffer& buffer = MutableMultiplicities();
+            for (int32_t row : rows) {
+                buffer.push_back((*other.multiplicities)[row]);
+            }
+        } else if (HasMultiplicities()) {
+            MutableMultiplicities().resize(
+                number_of_tuples + rows.size(), 1);
+        }
+        number_of_tuples += rows.size();
+        return absl::OkStatus();
+    }
+
+    // Appends the tuples `[begin, end)` of `other`, one column at a time.
+    absl::Status AppendRange(const Table& other, int32_t begin, int32_t end) {
+        if (other.width != width) {
+            return absl::InternalError(
+                "given table does not match table width");
+        }
+        for (int32_t i = 0; i < width; i++) {
+            absl::Span<const Value> source = other.Column(i);
+            ColumnBuffer& column = MutableColumn(i);
+            column.insert(column.end(),
+                          source.begin() + begin,
+                          source.begin() + end);
+        }
+        AppendMultiplicities(other, begin, end);
+        number_of_tuples += end - begin;
+        return absl::OkStatus();
+    }
+
+    // Removes every tuple. Unshared buffers keep their capacity so that the
+    // table can be refilled without reallocating.
+    void Clear() {
+        for (std::shared_ptr<ColumnBuffer>& column : columns) {
+            if (column.use_count() == 1) {
+                column->clear();
+            } else {
+                column = NewColumn();
+            }
+        }
+        external.clear();
+        external_owner.reset();
+        if (multiplicities.use_count() == 1) {
+            multiplicities->clear();
+        } else if (multiplicities != nullptr) {
+            multiplicities = NewMultiplicities();
+        }
+        number_of_tuples = 0;
+    }
+
+    // Grows the table by `count` tuples and returns, for every column, a
+    // pointer to the first of the new values. The new values are zero until
+    // the caller overwrites them; this lets disjoint ranges of the new tuples
+    // be filled in concurrently. Pointers are invalidated by any other
+    // modification of the table. New tuples occur once, and a table with
+    // multiplicities exposes them through `MutableMultiplicities`.
+    std::vector<Value*> Extend(int32_t count) {
+        std::vector<Value*> result;
+        for (int32_t i = 0; i < width; i++) {
+            ColumnBuffer& column = MutableColumn(i);
+            column.resize(number_of_tuples + count);
+            result.push_back(column.data() + number_of_tuples);
+        }
+        if (HasMultiplicities()) {
+            MutableMultiplicities().resize(number_of_tuples + count, 1);
+        }
+        number_of_tuples += count;
+        return result;
+    }
+
+    // Ensures that `capacity` tuples can be held without reallocating.
+    void Reserve(int32_t capacity) {
+        for (int32_t i = 0; i < width; i++) {
+            MutableColumn(i).reserve(capacity);
+        }
+        if (HasMultiplicities()) {
+            MutableMultiplicities().reserve(capacity);
+        }
+    }
+
+    bool HasMultiplicities() const {
+        return multiplicities != nullptr;
+    }
+
+    // How many times tuple `index` occurs.
+    int64_t Multiplicity(int32_t index) const {
+        return HasMultiplicities() ? (*multiplicities)[index] : 1;
+    }
+
+    // The multiplicity of every tuple; empty if the table has none.
+    absl::Span<const int64_t> Multiplicities() const {
+        if (!HasMultiplicities()) {
+            return {};
+        }
+        return *multiplicities;
+    }
+
+    // Gives every tuple a multiplicity of 1 if the table has none yet.
+    void AddMultiplicities() {
+        if (!HasMultiplicities()) {
+            multiplicities = NewMultiplicities();
+            multiplicities->resize(number_of_tuples, 1);
+        }
+    }
+
+    // Returns the multiplicities for writing, first giving the table some if
+    // it has none.
+    MultiplicityBuffer& MutableMultiplicities() {
+        AddMultiplicities();
+        if (multiplicities.use_count() != 1) {
+            multiplicities = std::make_shared<MultiplicityBuffer>(
+                multiplicities->begin(), multiplicities->end(),
+                ArenaAllocator<int64_t>(arena));
+        }
+        return *multiplicities;
+    }
+
+    int32_t NumberOfTuples() const {
+        return number_of_tuples;
+    }
+
+    int32_t Width() const {
+        return width;
+    }
+
+    // The dictionary of attribute `attr`, or null if it holds integers.
+    const std::shared_ptr<const StringDictionary>& Dictionary(Attr attr) const {
+        return dictionaries[attr];
+    }
+
+    const std::vector<std::shared_ptr<const StringDictionary>>&
+    Dictionaries() const {
+        return dictionaries;
+    }
+
+    void SetDictionary(Attr attr,
+                       std::shared_ptr<const StringDictionary> dictionary) {
+        dictionaries[attr] = std::move(dictionary);
+    }
+
+    void SetDictionaries(
+        std::vector<std::shared_ptr<const StringDictionary>> dictionaries_) {
+        RDSS_CHECK_EQ(dictionaries_.size(), width);
+        dictionaries = std::move(dictionaries_);
+    }
+
+    // The arena new buffers are allocated from, or null for the global heap.
+    const std::shared_ptr<MemoryArena>& Arena() const {
+        return arena;
+    }
+
+private:
+    std::shared_ptr<ColumnBuffer> NewColumn() const {
+        return std::make_shared<ColumnBuffer>(ArenaAllocator<Value>(arena));
+    }
+
+    std::shared_ptr<MultiplicityBuffer> NewMultiplicities() const {
+        return std::make_shared<MultiplicityBuffer>(
+            ArenaAllocator<int64_t>(arena));
+    }
+
+    // Records the multiplicity of a newly inserted tuple. Tables without
+    // multiplicities only get them once a tuple does not occur exactly once.
+    void PushMultiplicity(int64_t multiplicity) {
+        if ((multiplicity != 1) || HasMultiplicities()) {
+            MutableMultiplicities().push_back(multiplicity);
+        }
+    }
+
+    // Appends the multiplicities of the tuples `[begin, end)` of `other`.
+    void AppendMultiplicities(const Table& other, int32_t begin, int32_t end) {
+        if (other.HasMultiplicities()) {
+            MultiplicityBuffer& buffer = MutableMultiplicities();
+            buffer.insert(buffer.end(),
+                          other.multiplicities->begin() + begin,
+                          other.multiplicities->begin() + end);
+        } else if (HasMultiplicities()) {
+            MutableMultiplicities().resize(
+                number_of_tuples + (end - begin), 1);
+        }
+    }
+
+    // Returns column `i` for writing, first copying it if it is shared or
+    // stored elsewhere.
+    ColumnBuffer& MutableColumn(int32_t i) {
+        if (columns[i].use_count() != 1) {
+            absl::Span<const Value> source = Column(i);
+            columns[i] = std::make_shared<ColumnBuffer>(
+                source.begin(), source.end(), ArenaAllocator<Value>(arena));
+        }
+        return *columns[i];
+    }
+
+    int32_t width;
+    int32_t number_of_tuples;
+    std::shared_ptr<MemoryArena> arena;
+    // Null for the columns that are read from `external`.
+    std::vector<std::shared_ptr<ColumnBuffer>> columns;
+    std::vector<const Value*> external;
+    std::shared_ptr<const void> external_owner;
+    std::vector<std::shared_ptr<const StringDictionary>> dictionaries;
+    // Null if every tuple occurs once per row.
+    std::shared_ptr<MultiplicityBuffer> multiplicities;
+};
+
+// A read-only window onto the tuples `[begin, end)` of a table. Like a
+// `TupleView`, it is invalidated by any modification of the table.
+class TableSlice {
+public:
+    TableSlice(const Table* table_, int32_t begin_, int32_t end_)
+        : table(table_), begin(begin_), end(end_) {}
+
+    absl::Span<const Value> Column(Attr attr) const {
+        return table->Column(attr).subspan(begin, end - begin);
+    }
+
+    TupleView GetTupleView(int32_t index) const {
+        return table->GetTupleView(begin + index);
+    }
+
+    Tuple GetTuple(int32_t index) const {
+        return table->GetTuple(begin + index);
+    }
+
+    int32_t NumberOfTuples() const {
+        return end - begin;
+    }
+
+    int32_t Width() const {
+        return table->Width();
+    }
+
+private:
+    const Table* table;
+    int32_t begin;
+    int32_t end;
+};
+
+inline Value TupleView::operator[](Attr attr) const {
+    RDSS_DCHECK_LT(index, table->NumberOfTuples());
+    return table->Column(attr)[index];
+}
+
+inline int32_t TupleView::size() const {
+    return table->Width();
+}
+
+inline const StringDictionary* TupleView::Dictionary(Attr attr) const {
+    return table->Dictionary(attr).get();
+}
+
+inline int64_t TupleView::Multiplicity() const {
+    return table->Multiplicity(index);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace rdss
+
+#endif  // RDSS_TABLE_H_
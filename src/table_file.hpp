@@ -0,0 +1,235 @@
+// Copyright 2021 The RDSS Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RDSS_TABLE_FILE_H_
+#define RDSS_TABLE_FILE_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <absl/strings/str_format.h>
+
+#include "filesystem/file_descriptor.hpp"
+#include "macros.hpp"
+#include "table.hpp"
+
+namespace rdss {
+
+////////////////////////////////////////////////////////////////////////////////
+
+// A table file stores a `Table` so that it can be memory-mapped and read in
+// place. The file starts with a `TableFileHeader`, followed by every column
+// in order, each holding one native-endian `Value` per row and starting at a
+// multiple of `kTableFileAlignment` bytes.
+
+constexpr char kTableFileMagic[8] = {'R', 'D', 'S', 'S', 'T', 'B', 'L', '\0'};
+
+constexpr uint32_t kTableFileVersion = 1;
+
+// Written as a native integer, so that a file produced on a machine of the
+// other endianness is rejected instead of misread.
+constexpr uint32_t kTableFileByteOrder = 0x01020304;
+
+constexpr uint64_t kTableFileAlignment = 64;
+
+struct TableFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t width;
+    uint32_t reserved;
+    uint64_t number_of_tuples;
+    // The distance in bytes between the starts of consecutive columns.
+    uint64_t column_stride;
+    uint8_t padding[24];
+};
+
+static_assert(sizeof(TableFileHeader) == kTableFileAlignment);
+
+namespace internal {
+
+inline uint64_t TableFileColumnStride(uint64_t number_of_tuples) {
+    uint64_t bytes = number_of_tuples * sizeof(Value);
+    return (bytes + kTableFileAlignment - 1)
+        / kTableFileAlignment * kTableFileAlignment;
+}
+
+// Stores `a * b` in `product`, unless it overflows.
+inline bool CheckedMultiply(uint64_t a, uint64_t b, uint64_t* product) {
+    if ((a != 0) && (b > std::numeric_limits<uint64_t>::max() / a)) {
+        return false;
+    }
+    *product = a * b;
+    return true;
+}
+
+inline absl::Status TableFileError(const std::filesystem::path& path,
+                                   absl::string_view message) {
+    return absl::InvalidArgumentError(absl::StrFormat(
+        "%s is not a valid table file: %s", path.string(), message));
+}
+
+inline absl::Status TableFileErrno(const std::filesystem::path& path,
+                                   absl::string_view operation) {
+    return absl::InternalError(absl::StrFormat(
+        "%s failed on %s: %s", operation, path.string(), strerror(errno)));
+}
+
+inline absl::Status WriteAll(int fd,
+                             const void* data,
+                             size_t size,
+                             const std::filesystem::path& path) {
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = write(fd, bytes, size);
+        if (n < 0) {
+            if ((errno == EAGAIN) || (errno == EINTR)) {
+                continue;
+            }
+            return TableFileErrno(path, "write");
+        }
+        bytes += n;
+        size -= n;
+    }
+    return absl::OkStatus();
+}
+
+}  // namespace internal
+
+// Writes `table` to a table file at `path`, replacing any existing file.
+inline absl::Status WriteTableFile(const Table& table,
+                                   const std::filesystem::path& path) {
+    if (table.HasMultiplicities()) {
+        return absl::InvalidArgumentError(
+            "table files cannot store multiplicities");
+    }
+    TableFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, kTableFileMagic, sizeof(header.magic));
+    header.version = kTableFileVersion;
+    header.byte_order = kTableFileByteOrder;
+    header.width = table.Width();
+    header.number_of_tuples = table.NumberOfTuples();
+    header.column_stride =
+        internal::TableFileColumnStride(table.NumberOfTuples());
+
+    FileDescriptor fd(
+        open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0664));
+    if (fd.get() == -1) {
+        return internal::TableFileErrno(path, "open");
+    }
+    RETURN_IF_ERROR(
+        internal::WriteAll(fd.get(), &header, sizeof(header), path));
+    const char zeros[kTableFileAlignment] = {};
+    for (int32_t i = 0; i < table.Width(); i++) {
+        absl::Span<const Value> column = table.Column(i);
+        uint64_t bytes = column.size() * sizeof(Value);
+        RETURN_IF_ERROR(
+            internal::WriteAll(fd.get(), column.data(), bytes, path));
+        RETURN_IF_ERROR(internal::WriteAll(
+            fd.get(), zeros, header.column_stride - bytes, path));
+    }
+    return absl::OkStatus();
+}
+
+// Maps the table file at `path` into memory and returns a table that reads
+// its columns in place: nothing is parsed or copied, and pages are only read
+// from disk when a column is first scanned. The mapping stays valid for as
+// long as the table or any copy of it does, and modifying the table copies
+// the columns it modifies.
+inline absl::StatusOr<Table> MapTableFile(const std::filesystem::path& path) {
+    FileDescriptor fd(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd.get() == -1) {
+        if (errno == ENOENT) {
+            return absl::NotFoundError(absl::StrFormat(
+                "no table file at %s", path.string()));
+        }
+        return internal::TableFileErrno(path, "open");
+    }
+    struct stat info;
+    if (fstat(fd.get(), &info) != 0) {
+        return internal::TableFileErrno(path, "fstat");
+    }
+    uint64_t size = info.st_size;
+    if (size < sizeof(TableFileHeader)) {
+        return internal::TableFileError(path, "file is too short");
+    }
+
+    void* address = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd.get(), 0);
+    if (address == MAP_FAILED) {
+        return internal::TableFileErrno(path, "mmap");
+    }
+    std::shared_ptr<const void> mapping(
+        address, [size](const void* pointer) {
+            munmap(const_cast<void*>(pointer), size);
+        });
+
+    TableFileHeader header;
+    std::memcpy(&header, address, sizeof(header));
+    if (std::memcmp(header.magic, kTableFileMagic, sizeof(header.magic))
+        != 0) {
+        return internal::TableFileError(path, "bad magic number");
+    }
+    if (header.version != kTableFileVersion) {
+        return internal::TableFileError(path, absl::StrFormat(
+            "unsupported version %d", header.version));
+    }
+    if (header.byte_order != kTableFileByteOrder) {
+        return internal::TableFileError(path, "wrong byte order");
+    }
+    if ((header.number_of_tuples > std::numeric_limits<int32_t>::max())
+        || (header.column_stride
+            != internal::TableFileColumnStride(header.number_of_tuples))) {
+        return internal::TableFileError(path, "bad column layout");
+    }
+    if (header.width > std::numeric_limits<int32_t>::max()) {
+        return internal::TableFileError(path, absl::StrFormat(
+            "width %d is too large", header.width));
+    }
+    uint64_t columns_size;
+    if (!internal::CheckedMultiply(header.width, header.column_stride,
+                                   &columns_size)
+        || (size != sizeof(header) + columns_size)) {
+        return internal::TableFileError(
+            path, "file size does not match its header");
+    }
+
+    const char* first_column =
+        static_cast<const char*>(address) + sizeof(header);
+    std::vector<const Value*> columns;
+    for (uint32_t i = 0; i < header.width; i++) {
+        columns.push_back(reinterpret_cast<const Value*>(
+            first_column + i * header.column_stride));
+    }
+    return Table(header.number_of_tuples, std::move(columns),
+                 std::move(mapping));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace rdss
+
+#endif  // RDSS_TABLE_FILE_H_
@@ -0,0 +1,161 @@
+// Copyright 2021 The RDSS Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RDSS_THREAD_POOL_H_
+#define RDSS_THREAD_POOL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <absl/base/thread_annotations.h>
+#include <absl/synchronization/mutex.h>
+
+namespace rdss {
+
+////////////////////////////////////////////////////////////////////////////////
+
+// A fixed set of worker threads that run scheduled tasks in FIFO order. The
+// destructor runs every task that has already been scheduled and then joins
+// the workers.
+class ThreadPool {
+public:
+    explicit ThreadPool(int32_t num_threads) : queue(), stopping(false) {
+        for (int32_t i = 0; i < num_threads; i++) {
+            threads.emplace_back([this]() { WorkLoop(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            absl::MutexLock lock(&mutex);
+            stopping = true;
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+
+    // Thread pools are neither copyable nor movable.
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void Schedule(std::function<void()> task) {
+        absl::MutexLock lock(&mutex);
+        queue.push_back(std::move(task));
+    }
+
+    int32_t NumThreads() const {
+        return threads.size();
+    }
+
+private:
+    bool HasWorkOrIsStopping() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex) {
+        return !queue.empty() || stopping;
+    }
+
+    void WorkLoop() {
+        while (true) {
+            std::function<void()> task;
+            {
+                absl::MutexLock lock(&mutex);
+                mutex.Await(
+                    absl::Condition(this, &ThreadPool::HasWorkOrIsStopping));
+                if (queue.empty()) {
+                    return;
+                }
+                task = std::move(queue.front());
+                queue.pop_front();
+            }
+            task();
+        }
+    }
+
+    absl::Mutex mutex;
+    std::deque<std::function<void()>> queue ABSL_GUARDED_BY(mutex);
+    bool stopping ABSL_GUARDED_BY(mutex);
+    std::vector<std::thread> threads;
+};
+
+namespace internal {
+
+struct ParallelForState {
+    std::atomic<int32_t> next = 0;
+    int32_t size = 0;
+    const std::function<void(int32_t)>* body = nullptr;
+
+    absl::Mutex mutex;
+    int32_t finished ABSL_GUARDED_BY(mutex) = 0;
+
+    // Claims and runs iterations until none are left.
+    void Drain() {
+        int32_t i;
+        while ((i = next.fetch_add(1)) < size) {
+            (*body)(i);
+            absl::MutexLock lock(&mutex);
+            finished++;
+        }
+    }
+
+    bool IsFinished() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex) {
+        return finished == size;
+    }
+};
+
+}  // namespace internal
+
+// Runs `body(i)` for every `i` in `[0, size)`, spreading the iterations over
+// `pool` and the calling thread, and returns once all of them have finished.
+// Runs everything on the calling thread if `pool` is null.
+//
+// The calling thread takes part in the work and only waits for iterations
+// that are already running, so it is safe to call this from inside a task
+// running on the same pool.
+inline void ParallelFor(ThreadPool* pool,
+                        int32_t size,
+                        const std::function<void(int32_t)>& body) {
+    if ((pool == nullptr) || (size <= 1)) {
+        for (int32_t i = 0; i < size; i++) {
+            body(i);
+        }
+        return;
+    }
+
+    // Helpers may be dequeued after this call returns; they then find no
+    // iterations left and never touch `body`, but still need the state.
+    auto state = std::make_shared<internal::ParallelForState>();
+    state->size = size;
+    state->body = &body;
+
+    int32_t helpers = std::min(pool->NumThreads(), size - 1);
+    for (int32_t h = 0; h < helpers; h++) {
+        pool->Schedule([state]() { state->Drain(); });
+    }
+    state->Drain();
+
+    absl::MutexLock lock(&state->mutex);
+    state->mutex.Await(absl::Condition(
+        state.get(), &internal::ParallelForState::IsFinished));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+}  // namespace rdss
+
+#endif  // RDSS_THREAD_POOL_H_
@@ -0,0 +1,2125 @@
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <vector>
+#include <gtest/gtest.h>
+#include <absl/container/btree_map.h>
+
+#include "../src/ast.hpp"
+#include "../src/bag.hpp"
+#include "../src/compressed_table.hpp"
+#include "../src/delimited_text.hpp"
+#include "../src/dictionary.hpp"
+#include "../src/distinct.hpp"
+#include "../src/filesystem/filesystem.hpp"
+#include "../src/filesystem/temp_directory.hpp"
+#include "../src/fixpoint.hpp"
+#include "../src/incremental.hpp"
+#include "../src/interpreter.hpp"
+#include "../src/join_order.hpp"
+#include "../src/packed_table.hpp"
+#include "../src/pipeline.hpp"
+#include "../src/radix_sort.hpp"
+#include "../src/rewrite.hpp"
+#include "../src/selection.hpp"
+#include "../src/statistics.hpp"
+#include "../src/table.hpp"
+#include "../src/table_file.hpp"
+#include "../src/thread_pool.hpp"
+
+namespace {
+
+rdss::Table MakeTable(int32_t width,
+                      const std::vector<rdss::Tuple>& tuples) {
+    rdss::Table table(width);
+    for (const rdss::Tuple& tuple : tuples) {
+        EXPECT_TRUE(table.InsertTuple(tuple).ok());
+    }
+    return table;
+}
+
+std::vector<rdss::Tuple> SortedTuples(const rdss::Table& table) {
+    std::vector<rdss::Tuple> result;
+    for (int32_t i = 0; i < table.NumberOfTuples(); i++) {
+        result.push_back(table.GetTuple(i));
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+std::vector<rdss::Tuple> Evaluate(
+    const absl::btree_map<rdss::RelName, rdss::Table>& variables,
+    rdss::Relation* relation,
+    rdss::JoinAlgorithm algorithm = rdss::JoinAlgorithm::kAuto) {
+    rdss::Interpreter interpreter(variables);
+    interpreter.SetJoinAlgorithm(relation, algorithm);
+    absl::Status status = interpreter.Interpret(relation);
+    EXPECT_TRUE(status.ok()) << status;
+    return SortedTuples(interpreter.Lookup(relation).value());
+}
+
+rdss::Table RandomTable(int32_t width,
+                        int32_t size,
+                        int32_t max_value,
+                        std::mt19937* rng) {
+    std::uniform_int_distribution<rdss::Value> dist(0, max_value);
+    rdss::Table table(width);
+    for (int32_t i = 0; i < size; i++) {
+        rdss::Tuple tuple;
+        for (int32_t j = 0; j < width; j++) {
+            tuple.push_back(dist(*rng));
+        }
+        EXPECT_TRUE(table.InsertTuple(tuple).ok());
+    }
+    return table;
+}
+
+std::vector<rdss::Tuple> NestedLoopJoin(const rdss::Table& lhs,
+                                        const rdss::Table& rhs,
+                                        const rdss::JoinOn& join_on) {
+    rdss::JoinLayout layout(join_on, rhs.Width());
+    std::vector<rdss::Tuple> result;
+    for (int32_t i = 0; i < lhs.NumberOfTuples(); i++) {
+        for (int32_t j = 0; j < rhs.NumberOfTuples(); j++) {
+            rdss::Tuple x = lhs.GetTuple(i);
+            rdss::Tuple y = rhs.GetTuple(j);
+            bool matches = true;
+            for (const auto& [a, b] : join_on) {
+                matches &= (x[a] == y[b]);
+            }
+            if (matches) {
+                for (rdss::Attr k : layout.rhs_included) {
+                    x.push_back(y[k]);
+                }
+                result.push_back(x);
+            }
+        }
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+}  // namespace
+
+TEST(Table, ColumnarStorage) {
+    rdss::Table table = MakeTable(3, {{1, 2, 3}, {4, 5, 6}});
+    EXPECT_EQ(table.NumberOfTuples(), 2);
+    EXPECT_EQ(table.Width(), 3);
+    EXPECT_EQ(std::vector<rdss::Value>(table.Column(1).begin(),
+                                       table.Column(1).end()),
+              (std::vector<rdss::Value> {2, 5}));
+
+    rdss::TupleView view = table.GetTupleView(1);
+    EXPECT_EQ(view.size(), 3);
+    EXPECT_EQ(view[0], 4);
+    EXPECT_EQ(view[2], 6);
+    EXPECT_EQ(view.ToTuple(), (rdss::Tuple {4, 5, 6}));
+
+    EXPECT_FALSE(table.InsertTuple({1, 2}).ok());
+    EXPECT_EQ(table.NumberOfTuples(), 2);
+}
+
+TEST(Table, Append) {
+    rdss::Table table = MakeTable(2, {{1, 2}});
+    rdss::Table other = MakeTable(2, {{3, 4}, {5, 6}});
+    table.Reserve(3);
+    EXPECT_TRUE(table.Append(other).ok());
+    EXPECT_TRUE(table.InsertTupleView(other.GetTupleView(0)).ok());
+    EXPECT_EQ(SortedTuples(table),
+              (std::vector<rdss::Tuple> {{1, 2}, {3, 4}, {3, 4}, {5, 6}}));
+    EXPECT_FALSE(table.Append(rdss::Table(3)).ok());
+
+    rdss::Table empty(0);
+    EXPECT_EQ(empty.NumberOfTuples(), 0);
+}
+
+TEST(Table, CopiesShareColumns) {
+    rdss::Table table = MakeTable(2, {{1, 2}, {3, 4}});
+    rdss::Table copy = table;
+    EXPECT_EQ(copy.Column(0).data(), table.Column(0).data());
+
+    EXPECT_TRUE(copy.InsertTuple({5, 6}).ok());
+    EXPECT_NE(copy.Column(0).data(), table.Column(0).data());
+    EXPECT_EQ(table.NumberOfTuples(), 2);
+    EXPECT_EQ(SortedTuples(table), (std::vector<rdss::Tuple> {{1, 2}, {3, 4}}));
+    EXPECT_EQ(SortedTuples(copy),
+              (std::vector<rdss::Tuple> {{1, 2}, {3, 4}, {5, 6}}));
+
+    copy.Clear();
+    EXPECT_EQ(copy.NumberOfTuples(), 0);
+    EXPECT_EQ(table.NumberOfTuples(), 2);
+}
+
+TEST(Interpreter, ReferencesShareBaseTables) {
+    rdss::RelationFactory fac;
+    auto r = fac.Make<rdss::RelationReference>("R", 2);
+
+    absl::btree_map<rdss::RelName, rdss::Table> variables;
+    variables.insert_or_assign(rdss::RelName("R"),
+                               MakeTable(2, {{1, 2}, {3, 4}}));
+    const rdss::Value* data = variables.at(rdss::RelName("R")).Column(1).data();
+
+    rdss::Interpreter first(variables);
+    rdss::Interpreter second(variables);
+    ASSERT_TRUE(first.Interpret(r).ok());
+    ASSERT_TRUE(second.Interpret(r).ok());
+    EXPECT_EQ(first.Lookup(r)->Column(1).data(), data);
+    EXPECT_EQ(second.Lookup(r)->Column(1).data(), data);
+}
+
+TEST(Interpreter, Operators) {
+    rdss::RelationFactory fac;
+    rdss::PredicateFactory pred_fac;
+    auto r = fac.Make<rdss::RelationReference>("R", 3);
+    auto s = fac.Make<rdss::RelationReference>("S", 2);
+    auto t = fac.Make<rdss::RelationReference>("T", 2);
+
+    absl::btree_map<rdss::RelName, rdss::Table> variables;
+    variables.insert_or_assign(
+        rdss::RelName("R"),
+        MakeTable(3, {{500, 3415, 1000},
+                      {501, 2241, 1001},
+                      {502, 3401, 1000},
+                      {503, 2202, 1002}}));
+    variables.insert_or_assign(
+        rdss::RelName("S"),
+        MakeTable(2, {{1001, 501}, {1002, 503}, {1002, 504}}));
+    variables.insert_or_assign(
+        rdss::RelName("T"),
+        MakeTable(2, {{1002, 503}, {7, 7}}));
+
+    EXPECT_EQ(Evaluate(variables,
+                       fac.Make<rdss::RelationSemijoin>(
+                           r, s, rdss::JoinOn {{2, 0}})),
+              (std::vector<rdss::Tuple> {{501, 2241, 1001},
+                                         {503, 2202, 1002}}));
+
+    EXPECT_EQ(Evaluate(variables,
+                       fac.Make<rdss::RelationJoin>(
+                           r, s, rdss::JoinOn {{2, 0}})),
+              (std::vector<rdss::Tuple> {{501, 2241, 1001, 501},
+                                         {503, 2202, 1002, 503},
+                                         {503, 2202, 1002, 504}}));
+
+    EXPECT_EQ(Evaluate(variables,
+                       fac.Make<rdss::RelationJoin>(
+                           r, s, rdss::JoinOn {{2, 0}, {0, 1}})),
+              (std::vector<rdss::Tuple> {{501, 2241, 1001},
+                                         {503, 2202, 1002}}));
+
+    EXPECT_EQ(Evaluate(variables, fac.Make<rdss::RelationUnion>(s, t)),
+              (std::vector<rdss::Tuple> {{7, 7},
+                                         {1001, 501},
+                                         {1002, 503},
+                                         {1002, 503},
+                                         {1002, 504}}));
+
+    EXPECT_EQ(Evaluate(variables, fac.Make<rdss::RelationDifference>(s, t)),
+              (std::vector<rdss::Tuple> {{1001, 501}, {1002, 504}}));
+
+    auto predicate = pred_fac.Make<rdss::PredicateOr>(
+        std::vector<rdss::Predicate*> {
+            pred_fac.Make<rdss::PredicateEquals>(0, 500),
+            pred_fac.Make<rdss::PredicateNot>(
+                pred_fac.Make<rdss::PredicateLessThan>(1, 3000))
+        });
+    EXPECT_EQ(Evaluate(variables,
+                       fac.Make<rdss::RelationSelect>(predicate, r)),
+              (std::vector<rdss::Tuple> {{500, 3415, 1000},
+                                         {502, 3401, 1000}}));
+
+    EXPECT_EQ(Evaluate(variables,
+                       fac.Make<rdss::RelationView>(
+                           rdss::Viewed<rdss::Relation*>(
+                               {absl::nullopt, 1, 0}, r))),
+              (std::vector<rdss::Tuple> {{1000, 3401},
+                                         {1000, 3415},
+                                         {1001, 2241},
+                                         {1002, 2202}}));
+}
+
+TEST(Interpreter, HashJoinMatchesNestedLoop) {
+    std::mt19937 rng(0);
+    rdss::RelationFactory fac;
+    auto r = fac.Make<rdss::RelationReference>("R", 3);
+    auto s = fac.Make<rdss::RelationReference>("S", 2);
+
+    for (auto [r_size, s_size] : {std::pair {200, 50}, std::pair {50, 200}}) {
+        absl::btree_map<rdss::RelName, rdss::Table> variables;
+        variables.insert_or_assign(rdss::RelName("R"),
+                                   RandomTable(3, r_size, 20, &rng));
+        variables.insert_or_assign(rdss::RelName("S"),
+                                   RandomTable(2, s_size, 20, &rng));
+        const rdss::Table& r_table = variables.at(rdss::RelName("R"));
+        const rdss::Table& s_table = variables.at(rdss::RelName("S"));
+
+        for (const rdss::JoinOn& join_on
+                 : {rdss::JoinOn {}, rdss::JoinOn {{2, 0}},
+                    rdss::JoinOn {{0, 1}, {1, 0}}}) {
+            EXPECT_EQ(Evaluate(variables,
+                               fac.Make<rdss::RelationJoin>(r, s, join_on)),
+                      NestedLoopJoin(r_table, s_table, join_on));
+        }
+    }
+}
+
+TEST(RadixSort, SortsLexicographically) {
+    std::mt19937 rng(1);
+    rdss::Table table = RandomTable(3, 1000, 5, &rng);
+    EXPECT_TRUE(table.InsertTuple({-7, 2000000000, -2000000000}).ok());
+    EXPECT_TRUE(table.InsertTuple({-7, -5, 3}).ok());
+
+    std::vector<rdss::Attr> key = {2, 0};
+    rdss::Permutation order = rdss::RadixSortPermutation(table, key);
+    ASSERT_EQ(order.size(), table.NumberOfTuples());
+
+    rdss::Table sorted(3);
+    for (int32_t row : order) {
+        EXPECT_TRUE(sorted.InsertTupleView(table.GetTupleView(row)).ok());
+    }
+    EXPECT_TRUE(rdss::IsSortedOn(sorted, key));
+    EXPECT_FALSE(rdss::IsSortedOn(table, key));
+    EXPECT_EQ(SortedTuples(sorted), SortedTuples(table));
+    EXPECT_EQ(sorted.GetTuple(0), (rdss::Tuple {-7, 2000000000, -2000000000}));
+}
+
+TEST(Interpreter, SortMergeMatchesHash) {
+    std::mt19937 rng(2);
+    rdss::RelationFactory fac;
+    auto r = fac.Make<rdss::RelationReference>("R", 2);
+    auto s = fac.Make<rdss::RelationReference>("S", 2);
+
+    absl::btree_map<rdss::RelName, rdss::Table> variables;
+    variables.insert_or_assign(rdss::RelName("R"),
+                               RandomTable(2, 300, 15, &rng));
+    variables.insert_or_assign(rdss::RelName("S"),
+                               RandomTable(2, 200, 15, &rng));
+
+    std::vector<rdss::Relation*> relations = {
+        fac.Make<rdss::RelationJoin>(r, s, rdss::JoinOn {{1, 0}}),
+        fac.Make<rdss::RelationJoin>(r, s, rdss::JoinOn {{0, 0}, {1, 1}}),
+        fac.Make<rdss::RelationSemijoin>(r, s, rdss::JoinOn {{1, 0}}),
+        fac.Make<rdss::RelationDifference>(r, s),
+    };
+    for (rdss::Relation* relation : relations) {
+        EXPECT_EQ(Evaluate(variables, relation, rdss::JoinAlgorithm::kHash),
+                  Evaluate(variables, relation,
+                           rdss::JoinAlgorithm::kSortMerge))
+            << relation->ToString();
+    }
+}
+
+TEST(Interpreter, LeapfrogTriejoinTriangle) {
+    std::mt19937 rng(3);
+    rdss::RelationFactory fac;
+    auto e = fac.Make<rdss::RelationReference>("E", 2);
+
+    absl::btree_map<rdss::RelName, rdss::Table> variables;
+    variables.insert_or_assign(rdss::RelName("E"),
+                               RandomTable(2, 400, 30, &rng));
+    const rdss::Table& edges = variables.at(rdss::RelName("E"));
+
+    // Triangles (a, b, c) with E(a, b), E(b, c) and E(c, a), as in
+    // test/graphs/triangle.hg.
+    std::vector<rdss::Tuple> expected;
+    {
+        absl::flat_hash_set<rdss::Tuple> edge_set;
+        for (int32_t i = 0; i < edges.NumberOfTuples(); i++) {
+            edge_set.insert(edges.GetTuple(i));
+        }
+        for (const rdss::Tuple& ab : edge_set) {
+            for (const rdss::Tuple& bc : edge_set) {
+                if ((ab[1] == bc[0]) && edge_set.contains({bc[1], ab[0]})) {
+                    expected.push_back({ab[0], ab[1], bc[1]});
+                }
+            }
+        }
+        std::sort(expected.begin(), expected.end());
+    }
+    ASSERT_FALSE(expected.empty());
+
+    std::vector<std::vector<int32_t>> binding = {{0, 1}, {1, 2}, {2, 0}};
+    for (const rdss::AttrPermutation& order
+             : {rdss::AttrPermutation {}, rdss::AttrPermutation {2, 0, 1}}) {
+        auto triangle = fac.Make<rdss::RelationMultiJoin>(
+            std::vector<rdss::Relation*> {e, e, e}, binding, order);
+        EXPECT_EQ(triangle->Arity(), 3);
+        EXPECT_EQ(Evaluate(variables, triangle), expected);
+    }
+
+    // Self-loops: a repeated variable within one input filters rows.
+    auto loops = fac.Make<rdss::RelationMultiJoin>(
+        std::vector<rdss::Relation*> {e},
+        std::vector<std::vector<int32_t>> {{0, 0}});
+    std::vector<rdss::Tuple> expected_loops;
+    for (int32_t i = 0; i < edges.NumberOfTuples(); i++) {
+        if (edges.GetTuple(i)[0] == edges.GetTuple(i)[1]) {
+            expected_loops.push_back({edges.GetTuple(i)[0]});
+        }
+    }
+    std::sort(expected_loops.begin(), expected_loops.end());
+    expected_loops.erase(
+        std::unique(expected_loops.begin(), expected_loops.end()),
+        expected_loops.end());
+    EXPECT_EQ(Evaluate(variables, loops), expected_loops);
+}
+
+TEST(Interpreter, LeapfrogTriejoinRejectsUnboundVariables) {
+    rdss::Table table = MakeTable(2, {{1, 2}});
+    rdss::Table result(3);
+    std::vector<const rdss::Table*> inputs = {&table};
+    std::vector<std::vector<int32_t>> binding = {{0, 2}};
+    EXPECT_FALSE(rdss::LeapfrogTriejoin(inputs, binding, {0, 1, 2},
+                                        &result).ok());
+}
+
+TEST(Selection, BitmapMatchesInterpretPredicate) {
+    std::mt19937 rng(4);
+    rdss::PredicateFactory pred_fac;
+    auto predicate = pred_fac.Make<rdss::PredicateAnd>(
+        std::vector<rdss::Predicate*> {
+            pred_fac.Make<rdss::PredicateOr>(
+                std::vector<rdss::Predicate*> {
+                    pred_fac.Make<rdss::PredicateEquals>(0, 3),
+                    pred_fac.Make<rdss::PredicateLessThan>(1, 4)
+                }),
+            pred_fac.Make<rdss::PredicateNot>(
+                pred_fac.Make<rdss::PredicateEquals>(2, 5))
+        });
+
+    for (int32_t size : {0, 1, 63, 64, 65, 1000}) {
+        rdss::Table table = RandomTable(3, size, 9, &rng);
+        absl::StatusOr<rdss::Bitmap> bitmap =
+            rdss::EvaluatePredicate(predicate, table);
+        ASSERT_TRUE(bitmap.ok());
+        std::vector<int32_t> expected;
+        for (int32_t i = 0; i < size; i++) {
+            if (rdss::InterpretPredicate(predicate, table.GetTupleView(i))) {
+                expected.push_back(i);
+            }
+        }
+        EXPECT_EQ(bitmap->SetIndices(), expected);
+        EXPECT_EQ(bitmap->CountOnes(), expected.size());
+    }
+}
+
+TEST(ThreadPool, ParallelForRunsEveryIterationOnce) {
+    rdss::ThreadPool pool(4);
+    std::vector<std::atomic<int32_t>> counts(1000);
+    rdss::ParallelFor(&pool, counts.size(), [&](int32_t i) {
+        // Nested loops run on the same pool must not deadlock.
+        rdss::ParallelFor(&pool, 3, [&](int32_t j) {
+            counts[i].fetch_add(1);
+        });
+    });
+    for (const std::atomic<int32_t>& count : counts) {
+        EXPECT_EQ(count.load(), 3);
+    }
+}
+
+TEST(Interpreter, ParallelMatchesSequential) {
+    std::mt19937 rng(5);
+    rdss::RelationFactory fac;
+    rdss::PredicateFactory pred_fac;
+    auto r = fac.Make<rdss::RelationReference>("R", 2);
+    auto s = fac.Make<rdss::RelationReference>("S", 2);
+
+    absl::btree_map<rdss::RelName, rdss::Table> variables;
+    variables.insert_or_assign(rdss::RelName("R"),
+                               RandomTable(2, 1000, 30, &rng));
+    variables.insert_or_assign(rdss::RelName("S"),
+                               RandomTable(2, 300, 30, &rng));
+
+    std::vector<rdss::Relation*> relations = {
+        fac.Make<rdss::RelationSelect>(
+            pred_fac.Make<rdss::PredicateLessThan>(1, 10), r),
+        fac.Make<rdss::RelationView>(
+            rdss::Viewed<rdss::Relation*>({absl::nullopt, 0}, r)),
+        fac.Make<rdss::RelationUnion>(r, s),
+        fac.Make<rdss::RelationJoin>(r, s, rdss::JoinOn {{1, 0}}),
+        fac.Make<rdss::RelationJoin>(s, r, rdss::JoinOn {{0, 1}}),
+        fac.Make<rdss::RelationSemijoin>(r, s, rdss::JoinOn {{0, 1}}),
+        fac.Make<rdss::RelationDifference>(r, s),
+        fac.Make<rdss::RelationDistinct>(fac.Make<rdss::RelationUnion>(r, s)),
+    };
+
+    rdss::ThreadPool pool(4);
+    rdss::InterpreterOptions options;
+    options.thread_pool = &pool;
+    options.morsel_size = 37;
+    for (rdss::Relation* relation : relations) {
+        rdss::Interpreter sequential(variables);
+        rdss::Interpreter parallel(variables, options);
+        ASSERT_TRUE(sequential.Interpret(relation).ok());
+        ASSERT_TRUE(parallel.Interpret(relation).ok());
+        rdss::Table expected = sequential.Lookup(relation).value();
+        rdss::Table actual = parallel.Lookup(relation).value();
+        ASSERT_EQ(actual.NumberOfTuples(), expected.NumberOfTuples())
+            << relation->ToString();
+        for (int32_t i = 0; i < expected.NumberOfTuples(); i++) {
+            EXPECT_EQ(actual.GetTuple(i), expected.GetTuple(i))
+                << relation->ToString();
+        }
+    }
+}
+
+TEST(Pipeline, MatchesMaterialized) {
+    std::mt19937 rng(6);
+    rdss::RelationFactory fac;
+    rdss::PredicateFactory pred_fac;
+    auto r = fac.Make<rdss::RelationReference>("R", 2);
+    auto s = fac.Make<rdss::RelationReference>("S", 2);
+
+    absl::btree_map<rdss::RelName, rdss::Table> variables;
+    variables.insert_or_assign(rdss::RelName("R"),
+                               RandomTable(2, 3000, 40, &rng));
+    variables.insert_or_assign(rdss::RelName("S"),
+                               RandomTable(2, 2000, 40, &rng));
+
+    auto join = fac.Make<rdss::RelationJoin>(
+        fac.Make<rdss::RelationUnion>(r, s),
+        fac.Make<rdss::RelationSemijoin>(s, r, rdss::JoinOn {{0, 1}}),
+        rdss::JoinOn {{1, 0}});
+    std::vector<rdss::Relation*> relations = {
+        fac.Make<rdss::RelationSelect>(
+            pred_fac.Make<rdss::PredicateLessThan>(2, 20),
+            fac.Make<rdss::RelationView>(
+                rdss::Viewed<rdss::Relation*>({2, 1, 0}, join))),
+        fac.Make<rdss::RelationDifference>(r, s),
+        fac.Make<rdss::RelationMultiJoin>(
+            std::vector<rdss::Relation*> {r, s, r},
+            std::vector<std::vector<int32_t>> {{0, 1}, {1, 2}, {2, 0}}),
+        fac.Make<rdss::RelationDistinct>(join),
+    };
+
+    rdss::InterpreterOptions options;
+    options.execution = rdss::ExecutionModel::kPipeline;
+    for (rdss::Relation* relation : relations) {
+        rdss::Interpreter pipelined(variables, options);
+        absl::Status status = pipelined.Interpret(relation);
+        ASSERT_TRUE(status.ok()) << status;
+        EXPECT_EQ(SortedTuples(pipelined.Lookup(relation).value()),
+                  Evaluate(variables, relation))
+            << relation->ToString();
+    }
+}
+
+TEST(Pipeline, BatchesStayBounded) {
+    rdss::RelationFactory fac;
+    auto r = fac.Make<rdss::RelationReference>("R", 2);
+
+    // Every tuple has the same key, so each probe tuple matches all 300
+    // build tuples and the join produces many batches per input batch.
+    std::vector<rdss::Tuple> tuples;
+    for (int32_t i = 0; i < 300; i++) {
+        tuples.push_back({i, 7});
+    }
+    absl::btree_map<rdss::RelName, rdss::Table> variables;
+    variables.insert_or_assign(rdss::RelName("R"), MakeTable(2, tuples));
+
+    auto join = fac.Make<rdss::RelationJoin>(r, r, rdss::JoinOn {{1, 1}});
+    auto op = rdss::BuildPipeline(join, variables);
+    ASSERT_TRUE(op.ok()) << op.status();
+
+    rdss::Table batch((*op)->Width());
+    int32_t total = 0;
+    while (true) {
+        absl::StatusOr<bool> more = (*op)->Next(&batch);
+        ASSERT_TRUE(more.ok());
+        if (!*more) {
+            break;
+        }
+        EXPECT_GT(batch.NumberOfTuples(), 0);
+        EXPECT_LE(batch.NumberOfTuples(), rdss::kBatchSize);
+        total += batch.NumberOfTuples();
+    }
+    EXPECT_EQ(total, 300 * 300);
+    EXPECT_EQ(batch.NumberOfTuples(), 0);
+}
+
+TEST(Interpreter, SharedSubplansAreEvaluatedOnce) {
+    std::mt19937 rng(7);
+    rdss::RelationFactory fac;
+    auto r = fac.Make<rdss::RelationReference>("R", 2);
+    auto s = fac.Make<rdss::RelationReference>("S", 2);
+
+    absl::btree_map<rdss::RelName, rdss::Table> variables;
+    variables.insert_or_assign(rdss::RelName("R"),
+                               RandomTable(2, 500, 20, &rng));
+    variables.insert_or_assign(rdss::RelName("S"),
+                               RandomTable(2, 500, 20, &rng));
+
+    // Each level consumes the one below twice, so evaluating the plan as a
+    // tree would take 2^40 steps.
+    rdss::Relation* plan = fac.Make<rdss::RelationSemijoin>(
+        r, s, rdss::JoinOn {{1, 0}});
+    for (int32_t i = 0; i < 40; i++) {
+        plan = fac.Make<rdss::RelationSemijoin>(
+            plan, plan, rdss::JoinOn {{0, 0}});
+    }
+    auto root = fac.Make<rdss::RelationUnion>(
+        plan, fac.Make<rdss::RelationSemijoin>(s, r, rdss::JoinOn {{0, 1}}));
+
+    rdss::ThreadPool pool(4);
+    std::vector<rdss::InterpreterOptions> all_options(3);
+    all_options[1].thread_pool = &pool;
+    all_options[2].execution = rdss::ExecutionModel::kPipeline;
+
+    std::vector<std::vector<rdss::Tuple>> results;
+    for (const rdss::InterpreterOptions& options : all_options) {
+        rdss::Interpreter interpreter(variables, options);
+        absl::Status status = interpreter.Interpret(root);
+        ASSERT_TRUE(status.ok()) << status;
+        results.push_back(SortedTuples(interpreter.Lookup(root).value()));
+
+        // Interpreting again reuses every stored result.
+        EXPECT_TRUE(interpreter.Interpret(root).ok());
+        EXPECT_EQ(SortedTuples(interpreter.Lookup(root).value()),
+                  results.back());
+    }
+    EXPECT_FALSE(results[0].empty());
+    EXPECT_EQ(results[1], results[0]);
+    EXPECT_EQ(results[2], results[0]);
+}
+
+TEST(Interpreter, ReleaseIntermediates) {
+    std::mt19937 rng(8);
+    rdss::RelationFactory fac;
+    rdss::PredicateFactory pred_fac;
+    auto r = fac.Make<rdss::RelationReference>("R", 2);
+    auto s = fac.Make<rdss::RelationReference>("S", 2);
+
+    absl::btree_map<rdss::RelName, rdss::Table> variables;
+    variables.insert_or_assign(rdss::RelName("R"),
+                               RandomTable(2, 500, 20, &rng));
+    variables.insert_or_assign(rdss::RelName("S"),
+                               RandomTable(2, 500, 20, &rng));
+
+    auto shared = fac.Make<rdss::RelationSemijoin>(
+        r, s, rdss::JoinOn {{1, 0}});
+    auto select = fac.Make<rdss::RelationSelect>(
+        pred_fac.Make<rdss::PredicateLessThan>(0, 10), shared);
+    auto root = fac.Make<rdss::RelationJoin>(
+        select, shared, rdss::JoinOn {{1, 1}});
+
+    std::vector<rdss::Tuple> expected = Evaluate(variables, root);
+
+    rdss::ThreadPool pool(4);
+    std::vector<rdss::InterpreterOptions> all_options(3);
+    all_options[1].thread_pool = &pool;
+    all_options[2].execution = rdss::ExecutionModel::kPipeline;
+    for (rdss::InterpreterOptions options : all_options) {
+        options.release_intermediates = true;
+        rdss::Interpreter interpreter(variables, options);
+        absl::Status status = interpreter.Interpret(root);
+        ASSERT_TRUE(status.ok()) << status;
+        EXPECT_EQ(SortedTuples(interpreter.Lookup(root).value()), expected);
+        for (rdss::Relation* rel
+                 : std::vector<rdss::Relation*> {r, s, shared, select}) {
+            EXPECT_FALSE(interpreter.Lookup(rel).has_value())
+                << rel->ToString();
+        }
+
+        // Released intermediates are recomputed when they are asked for.
+        EXPECT_TRUE(interpreter.Interpret(select).ok());
+        EXPECT_TRUE(interpreter.Lookup(select).has_value());
+    }
+}
+
+TEST(Interpreter, BindKeepsIndependentResults) {
+    std::mt19937 rng(23);
+    rdss::RelationFactory fac;
+    rdss::PredicateFactory pred_fac;
+    auto r = fac.Make<rdss::RelationReference>("R", 2);
+    auto s = fac.Make<rdss::RelationReference>("S", 2);
+
+    absl::btree_map<rdss::RelName, rdss::Table> variables;
+    variables.insert_or_assign(rdss::RelName("R"),
+                               RandomTable(2, 300, 20, &rng));
+    variables.insert_or_assign(rdss::RelName("S"),
+                               RandomTable(2, 3000, 20, &rng));
+
+    auto select = fac.Make<rdss::RelationSelect>(
+        pred_fac.Make<rdss::PredicateLessThan>(0, 15), s);
+    auto join = fac.Make<rdss::RelationJoin>(
+        r, select, rdss::JoinOn {{1, 0}});
+    auto semijoin = fac.Make<rdss::RelationSemijoin>(
+        r, select, rdss::JoinOn {{1, 1}});
+    std::vector<rdss::Relation*> roots = {join, semijoin};
+
+    rdss::Interpreter interpreter(variables);
+    for (rdss::Relation* root : roots) {
+        interpreter.SetJoinAlgorithm(root, rdss::JoinAlgorithm::kHash);
+        ASSERT_TRUE(interpreter.Interpret(root).ok());
+        EXPECT_EQ(SortedTuples(interpreter.Lookup(root).value()),
+                  Evaluate(variables, root,
+                           rdss::JoinAlgorithm::kSortMerge));
+    }
+
+    // Rebinding R drops what reads it and keeps the selection over S, whose
+    // indexes the joins then probe. Each round of rebinding must match a
+    // fresh evaluation.
+    for (int32_t round = 0; round < 3; round++) {
+        variables.insert_or_assign(rdss::RelName("R"),
+                                   RandomTable(2, 300, 20, &rng));
+        interpreter.Bind(rdss::RelName("R"), variables.at(rdss::RelName("R")));
+        EXPECT_TRUE(interpreter.Lookup(select).has_value());
+        EXPECT_TRUE(interpreter.Lookup(s).has_value());
+        for (rdss::Relation* rel
+                 : std::vector<rdss::Relation*> {r, join, semijoin}) {
+            EXPECT_FALSE(interpreter.Lookup(rel).has_value())
+                << rel->ToString();
+        }
+        for (rdss::Relation* root : roots) {
+            ASSERT_TRUE(interpreter.Interpret(root).ok());
+            EXPECT_EQ(SortedTuples(interpreter.Lookup(root).value()),
+                      Evaluate(variables, root,
+                               rdss::JoinAlgorithm::kSortMerge));
+        }
+    }
+}
+
+TEST(Cursor, StreamsResults) {
+    std::mt19937 rng(9);
+    rdss::RelationFactory fac;
+    auto r = fac.Make<rdss::RelationReference>("R", 2);
+    auto s = fac.Make<rdss::RelationReference>("S", 2);
+
+    absl::btree_map<rdss::RelName, rdss::Table> variables;
+    variables.insert_or_assign(rdss::RelName("R"),
+                               RandomTable(2, 3000, 50, &rng));
+    variables.insert_or_assign(rdss::RelName("S"),
+                               RandomTable(2, 3000, 50, &rng));
+
+    auto shared = fac.Make<rdss::RelationSemijoin>(
+        r, s, rdss::JoinOn {{1, 0}});
+    auto root = fac.Make<rdss::RelationJoin>(
+        shared, shared, rdss::JoinOn {{0, 1}});
+    std::vector<rdss::Tuple> expected = Evaluate(variables, root);
+
+    for (rdss::ExecutionModel execution : {rdss::ExecutionModel::kMaterialize,
+                                           rdss::ExecutionModel::kPipeline}) {
+        rdss::InterpreterOptions options;
+        options.execution = execution;
+        options.release_intermediates = true;
+        rdss::Interpreter interpreter(variables, options);
+        absl::StatusOr<rdss::Cursor> cursor = interpreter.Open(root);
+        ASSERT_TRUE(cursor.ok()) << cursor.status();
+
+        rdss::Table result(cursor->Width());
+        while (true) {
+            absl::StatusOr<bool> more = cursor->Next();
+            ASSERT_TRUE(more.ok());
+            if (!*more) {
+                break;
+            }
+            rdss::TableSlice batch = cursor->Batch();
+            EXPECT_GT(batch.NumberOfTuples(), 0);
+            EXPECT_LE(batch.NumberOfTuples(), rdss::kBatchSize);
+            for (int32_t i = 0; i < batch.NumberOfTuples(); i++) {
+                EXPECT_TRUE(result.InsertTupleView(batch.GetTupleView(i)).ok());
+            }
+        }
+        EXPECT_EQ(SortedTuples(result), expected);
+
+        // Only the materializing interpreter stores the result.
+        EXPECT_EQ(interpreter.Lookup(root).has_value(),
+                  execution == rdss::ExecutionModel::kMaterialize);
+        EXPECT_FALSE(interpreter.Lookup(shared).has_value());
+    }
+}
+
+TEST(Cursor, ReadsStoredResultsInPlace) {
+    rdss::RelationFactory fac;
+    auto r = fac.Make<rdss::RelationReference>("R", 1);
+    std::vector<rdss::Tuple> tuples;
+    for (int32_t i = 0; i < 2500; i++) {
+        tuples.push_back({i});
+    }
+    absl::btree_map<rdss::RelName, rdss::Table> variables;
+    variables.insert_or_assign(rdss::RelName("R"), MakeTable(1, tuples));
+    const rdss::Value* data = variables.at(rdss::RelName("R")).Column(0).data();
+
+    rdss::Interpreter interpreter(variables);
+    absl::StatusOr<rdss::Cursor> cursor = interpreter.Open(r);
+    ASSERT_TRUE(cursor.ok());
+    std::vector<int32_t> sizes;
+    while (cursor->Next().value()) {
+        EXPECT_EQ(cursor->Batch().Column(0).data(), data + 1024 * sizes.size());
+        sizes.push_back(cursor->Batch().NumberOfTuples());
+    }
+    EXPECT_EQ(sizes, (std::vector<int32_t> {1024, 1024, 452}));
+}
+
+TEST(Incremental, MatchesFullEvaluation) {
+    std::mt19937 rng(11);
+    rdss::RelationFactory fac;
+    rdss::PredicateFactory pred_fac;
+    auto r = fac.Make<rdss::RelationReference>("R", 2);
+    auto s = fac.Make<rdss::RelationReference>("S", 2);
+
+    auto join = fac.Make<rdss::RelationJoin>(
+        fac.Make<rdss::RelationUnion>(r, s),
+        fac.Make<rdss::RelationSemijoin>(s, r, rdss::JoinOn {{0, 1}}),
+        rdss::JoinOn {{1, 0}});
+    std::vector<rdss::Relation*> relations = {
+        fac.Make<rdss::RelationSelect>(
+            pred_fac.Make<rdss::PredicateLessThan>(2, 6),
+            fac.Make<rdss::RelationView>(
+                rdss::Viewed<rdss::Relation*>({2, 1, 0}, join))),
+        fac.Make<rdss::RelationDifference>(r, s),
+    };
+
+    std::vector<rdss::IncrementalInterpreter> interpreters;
+    for (rdss::Relation* relation : relations) {
+        absl::StatusOr<rdss::IncrementalInterpreter> interpreter =
+            rdss::IncrementalInterpreter::Create(relation);
+        ASSERT_TRUE(interpreter.ok()) << interpreter.status();
+        interpreters.push_back(std::move(*interpreter));
+    }
+
+    std::vector<rdss::Tuple> r_tuples;
+    std::vector<rdss::Tuple> s_tuples;
+    std::uniform_int_distribution<rdss::Value> value(0, 8);
+    std::uniform_int_distribution<int32_t> coin(0, 1);
+    for (int32_t round = 0; round < 30; round++) {
+        // Insert a few random tuples and delete a few existing ones from
+        // each relation.
+        absl::btree_map<rdss::RelName, rdss::ZSet> changes;
+        for (auto [name, tuples] :
+                 {std::pair("R", &r_tuples), std::pair("S", &s_tuples)}) {
+            rdss::ZSet change(2);
+            for (int32_t k = 0; k < 8; k++) {
+                if (coin(rng) && !tuples->empty()) {
+                    std::uniform_int_distribution<int32_t> pick(
+                        0, tuples->size() - 1);
+                    int32_t i = pick(rng);
+                    change.Add((*tuples)[i], -1);
+                    tuples->erase(tuples->begin() + i);
+                } else {
+                    rdss::Tuple tuple = {value(rng), value(rng)};
+                    change.Add(tuple, 1);
+                    tuples->push_back(tuple);
+                }
+            }
+            changes.insert_or_assign(rdss::RelName(name), change);
+        }
+
+        absl::btree_map<rdss::RelName, rdss::Table> variables;
+        variables.insert_or_assign(rdss::RelName("R"),
+                                   MakeTable(2, r_tuples));
+        variables.insert_or_assign(rdss::RelName("S"),
+                                   MakeTable(2, s_tuples));
+        for (int32_t i = 0; i < relations.size(); i++) {
+            absl::StatusOr<rdss::ZSet> delta =
+                interpreters[i].Update(changes);
+            ASSERT_TRUE(delta.ok()) << delta.status();
+            absl::StatusOr<rdss::Table> current =
+                interpreters[i].Current().ToTable();
+            ASSERT_TRUE(current.ok()) << current.status();
+            EXPECT_EQ(SortedTuples(*current), Evaluate(variables, relations[i]))
+                << relations[i]->ToString() << " after round " << round;
+        }
+    }
+}
+
+TEST(Incremental, EvaluatesLikeWithBaseDictionaries) {
+    auto names = std::make_shared<rdss::StringDictionary>();
+    std::vector<rdss::Value> codes;
+    for (const char* name : {"Warner Bros.", "Universal", "Warner Home Video",
+                             "Paramount"}) {
+        codes.push_back(names->Encode(name));
+    }
+    rdss::Table companies(2);
+    companies.SetDictionary(1, names);
+    absl::btree_map<rdss::RelName, rdss::Table> variables;
+    variables.insert_or_assign(rdss::RelName("C"), companies);
+
+    rdss::RelationFactory fac;
+    rdss::PredicateFactory pred_fac;
+    auto c = fac.Make<rdss::RelationReference>("C", 2);
+    auto select = fac.Make<rdss::RelationSelect>(
+        pred_fac.Make<rdss::PredicateLike>(0, "Warner%"),
+        fac.Make<rdss::RelationView>(
+            rdss::Viewed<rdss::Relation*>({1, 0}, c)));
+    absl::StatusOr<rdss::IncrementalInterpreter> created =
+        rdss::IncrementalInterpreter::Create(select, variables);
+    ASSERT_TRUE(created.ok()) << created.status();
+    rdss::IncrementalInterpreter& interpreter = *created;
+
+    rdss::ZSet insert(2);
+    for (int32_t i = 0; i < 8; i++) {
+        insert.Add({i, codes[i % codes.size()]}, 1);
+    }
+    absl::StatusOr<rdss::ZSet> delta =
+        interpreter.Update({{rdss::RelName("C"), insert}});
+    ASSERT_TRUE(delta.ok()) << delta.status();
+    EXPECT_EQ(delta->Entries().size(), 4);
+
+    rdss::ZSet remove(2);
+    remove.Add({0, codes[0]}, -1);
+    remove.Add({1, codes[1]}, -1);
+    delta = interpreter.Update({{rdss::RelName("C"), remove}});
+    ASSERT_TRUE(delta.ok()) << delta.status();
+    EXPECT_EQ(delta->Entries().size(), 1);
+    EXPECT_EQ(delta->Weight({codes[0], 0}), -1);
+    absl::StatusOr<rdss::Table> current = interpreter.Current().ToTable();
+    ASSERT_TRUE(current.ok()) << current.status();
+    EXPECT_EQ(SortedTuples(*current),
+              (std::vector<rdss::Tuple> {
+                  {codes[0], 4}, {codes[2], 2}, {codes[2], 6}}));
+
+    // Without the dictionaries, LIKE has no strings to match.
+    EXPECT_EQ(rdss::IncrementalInterpreter::Create(select).status().code(),
+              absl::StatusCode::kInvalidArgument);
+}
+
+TEST(Incremental, FailedUpdatesChangeNothing) {
+    rdss::RelationFactory fac;
+    auto r = fac.Make<rdss::RelationReference>("R", 2);
+    auto s = fac.Make<rdss::RelationReference>("S", 2);
+    auto join = fac.Make<rdss::RelationJoin>(r, s, rdss::JoinOn {{1, 0}});
+    absl::StatusOr<rdss::IncrementalInterpreter> interpreter =
+        rdss::IncrementalInterpreter::Create(join);
+    ASSERT_TRUE(interpreter.ok()) << interpreter.status();
+
+    // The change to R is valid, but the one to S has the wrong arity, so
+    // neither may reach the state of the join.
+    rdss::ZSet r_change(2);
+    r_change.Add({1, 2}, 1);
+    rdss::ZSet bad_s_change(3);
+    bad_s_change.Add({2, 3, 4}, 1);
+    EXPECT_EQ(interpreter->Update({{rdss::RelName("R"), r_change},
+                                   {rdss::RelName("S"), bad_s_change}})
+                  .status().code(),
+              absl::StatusCode::kInvalidArgument);
+
+    rdss::ZSet s_change(2);
+    s_change.Add({2, 3}, 1);
+    absl::StatusOr<rdss::ZSet> delta =
+        interpreter->Update({{rdss::RelName("S"), s_change}});
+    ASSERT_TRUE(delta.ok()) << delta.status();
+    EXPECT_TRUE(delta->Empty());
+    EXPECT_TRUE(interpreter->Current().Empty());
+
+    // Plans with unsupported nodes are rejected before any update.
+    auto multi_join = fac.Make<rdss::RelationMultiJoin>(
+        std::vector<rdss::Relation*> {r, s},
+        std::vector<std::vector<int32_t>> {{0, 1}, {1, 2}});
+    EXPECT_EQ(
+        rdss::IncrementalInterpreter::Create(multi_join).status().code(),
+        absl::StatusCode::kUnimplemented);
+}
+
+TEST(Fixpoint, TransitiveClosure) {
+    std::mt19937 rng(13);
+    rdss::Table edges = RandomTable(2, 60, 40, &rng);
+
+    // The expected closure, by repeated squaring of the reachability matrix.
+    std::vector<std::vector<bool>> reachable(41, std::vector<bool>(41));
+    for (int32_t i = 0; i < edges.NumberOfTuples(); i++) {
+        reachable[edges.GetTuple(i)[0]][edges.GetTuple(i)[1]] = true;
+    }
+    for (int32_t k = 0; k <= 40; k++) {
+        for (int32_t i = 0; i <= 40; i++) {
+            for (int32_t j = 0; j <= 40; j++) {
+                if (reachable[i][k] && reachable[k][j]) {
+                    reachable[i][j] = true;
+                }
+            }
+        }
+    }
+    std::vector<rdss::Tuple> expected;
+    for (int32_t i = 0; i <= 40; i++) {
+        for (int32_t j = 0; j <= 40; j++) {
+            if (reachable[i][j]) {
+                expected.push_back({i, j});
+            }
+        }
+    }
+
+    rdss::RelationFactory fac;
+    auto e = fac.Make<rdss::RelationReference>("E", 2);
+    auto t = fac.Make<rdss::RelationReference>("T", 2);
+    auto path = [&](rdss::Relation* lhs, rdss::Relation* rhs) {
+        return fac.Make<rdss::RelationView>(rdss::Viewed<rdss::Relation*>(
+            {0, absl::nullopt, 1},
+            fac.Make<rdss::RelationJoin>(lhs, rhs, rdss::JoinOn {{1, 0}})));
+    };
+
+    absl::btree_map<rdss::RelName, rdss::Table> variables;
+    variables.insert_or_assign(rdss::RelName("E"), edges);
+
+    // Linear recursion, which joins each round's new paths with the edges,
+    // and nonlinear recursion, which joins new paths with all paths.
+    for (rdss::Relation* step : {path(t, e), path(t, t)}) {
+        rdss::RUnionWith base(rdss::RelName("T"), e);
+        rdss::RUnionWith recurse(rdss::RelName("T"), step);
+        rdss::RReturn ret(t);
+        rdss::RSeq program({&base, &recurse, &ret});
+
+        rdss::ActionInterpreter interpreter(variables);
+        absl::StatusOr<absl::optional<rdss::Table>> result =
+            interpreter.Run(&program);
+        ASSERT_TRUE(result.ok()) << result.status();
+        ASSERT_TRUE(result->has_value());
+        EXPECT_EQ(SortedTuples(**result), expected) << step->ToString();
+    }
+}
+
+TEST(Fixpoint, MemoryBudgetCoversTheWholeRun) {
+    // The closure of a path of 300 nodes has 44850 tuples. Every round only
+    // adds a few hundred, but the run is charged for all of them.
+    std::vector<rdss::Tuple> path;
+    for (int32_t i = 0; i < 300; i++) {
+        path.push_back({i, i + 1});
+    }
+    absl::btree_map<rdss::RelName, rdss::Table> variables;
+    variables.insert_or_assign(rdss::RelName("E"), MakeTable(2, path));
+
+    rdss::RelationFactory fac;
+    auto e = fac.Make<rdss::RelationReference>("E", 2);
+    auto t = fac.Make<rdss::RelationReference>("T", 2);
+    rdss::RUnionWith base(rdss::RelName("T"), e);
+    rdss::RUnionWith recurse(
+        rdss::RelName("T"),
+        fac.Make<rdss::RelationView>(rdss::Viewed<rdss::Relation*>(
+            {0, absl::nullopt, 1},
+            fac.Make<rdss::RelationJoin>(t, e, rdss::JoinOn {{1, 0}}))));
+    rdss::RReturn ret(t);
+    rdss::RSeq program({&base, &recurse, &ret});
+
+    rdss::InterpreterOptions options;
+    options.memory_budget = 1 << 20;
+    rdss::ActionInterpreter limited(variables, options);
+    EXPECT_EQ(limited.Run(&program).status().code(),
+              absl::StatusCode::kResourceExhausted);
+
+    options.arena = std::make_shared<rdss::MemoryArena>(1 << 26);
+    rdss::ActionInterpreter interpreter(variables, options);
+    absl::StatusOr<absl::optional<rdss::Table>> result =
+        interpreter.Run(&program);
+    ASSERT_TRUE(result.ok()) << result.status();
+    EXPECT_EQ((*result)->NumberOfTuples(), 300 * 301 / 2);
+    EXPECT_GT(options.arena->PeakBytesReserved(), 1 << 20);
+}
+
+TEST(Fixpoint, ForAndReturn) {
+    rdss::RelationFactory fac;
+    rdss::PredicateFactory pred_fac;
+    auto r = fac.Make<rdss::RelationReference>("R", 1);
+    auto x = fac.Make<rdss::RelationReference>("x", 1);
+    auto out = fac.Make<rdss::RelationReference>("Out", 1);
+
+    absl::btree_map<rdss::RelName, rdss::Table> variables;
+    variables.insert_or_assign(rdss::RelName("R"),
+                               MakeTable(1, {{3}, {1}, {4}, {1}, {5}}));
+    variables.insert_or_assign(rdss::RelName("Out"), rdss::Table(1));
+
+    // Adding each tuple separately removes duplicates, and the loop variable
+    // is unbound afterwards.
+    rdss::RUnionWith add(rdss::RelName("Out"), x);
+    rdss::RFor loop(r, rdss::RelName("x"), {&add});
+    rdss::RReturn ret(out);
+    rdss::RSeq program({&loop, &ret});
+
+    rdss::ActionInterpreter interpreter(variables);
+    absl::StatusOr<absl::optional<rdss::Table>> result =
+        interpreter.Run(&program);
+    ASSERT_TRUE(result.ok()) << result.status();
+    ASSERT_TRUE(result->has_value());
+    EXPECT_EQ(SortedTuples(**result),
+              (std::vector<rdss::Tuple> {{1}, {3}, {4}, {5}}));
+    EXPECT_FALSE(interpreter.Lookup(rdss::RelName("x")).has_value());
+
+    // Negating a relation inside its own loop is rejected.
+    rdss::RUnionWith negate(
+        rdss::RelName("Out"), fac.Make<rdss::RelationDifference>(r, out));
+    EXPECT_EQ(interpreter.Run(&negate).status().code(),
+              absl::StatusCode::kFailedPrecondition);
+}
+
+TEST(Fixpoint, DifferenceOfRecursiveRelation) {
+    rdss::RelationFactory fac;
+    auto c = fac.Make<rdss::RelationReference>("C", 1);
+    auto r = fac.Make<rdss::RelationReference>("R", 1);
+    auto b = fac.Make<rdss::RelationReference>("B", 1);
+    auto x = fac.Make<rdss::RelationReference>("X", 1);
+    auto difference = fac.Make<rdss::RelationDifference>(
+        fac.Make<rdss::RelationUnion>(c, x), r);
+
+    absl::btree_map<rdss::RelName, rdss::Table> variables;
+    variables.insert_or_assign(rdss::RelName("C"), MakeTable(1, {{7}}));
+    variables.insert_or_assign(rdss::RelName("R"), MakeTable(1, {{7}}));
+    variables.insert_or_assign(rdss::RelName("B"), MakeTable(1, {{7}}));
+
+    // The second round adds 7 to X, which gives C ∪ X a second occurrence
+    // of 7 that R does not cancel, although the delta of X alone would be
+    // cancelled by R.
+    rdss::RUnionWith add_y(rdss::RelName("Y"), difference);
+    rdss::RUnionWith add_x(rdss::RelName("X"), b);
+    rdss::RSeq program({&add_y, &add_x});
+
+    rdss::ActionInterpreter interpreter(variables);
+    absl::StatusOr<absl::optional<rdss::Table>> result =
+        interpreter.Run(&program);
+    ASSERT_TRUE(result.ok()) << result.status();
+
+    absl::optional<rdss::Table> y = interpreter.Lookup(rdss::RelName("Y"));
+    ASSERT_TRUE(y.has_value());
+    variables.insert_or_assign(rdss::RelName("X"),
+                               interpreter.Lookup(rdss::RelName("X")).value());
+    EXPECT_EQ(SortedTuples(*y), Evaluate(variables, difference));
+    EXPECT_EQ(SortedTuples(*y), (std::vector<rdss::Tuple> {{7}}));
+}
+
+TEST(Interpreter, MemoryBudget) {
+    rdss::RelationFactory fac;
+    auto r = fac.Make<rdss::RelationReference>("R", 2);
+
+    // Every tuple has the same key, so the join has 600 * 600 tuples of
+    // three attributes, or about 4 MiB.
+    std::vector<rdss::Tuple> tuples;
+    for (int32_t i = 0; i < 600; i++) {
+        tuples.push_back({i, 7});
+    }
+    absl::btree_map<rdss::RelName, rdss::Table> variables;
+    variables.insert_or_assign(rdss::RelName("R"), MakeTable(2, tuples));
+    auto join = fac.Make<rdss::RelationJoin>(r, r, rdss::JoinOn {{1, 1}});
+
+    for (auto execution : {rdss::ExecutionModel::kMaterialize,
+                           rdss::ExecutionModel::kPipeline}) {
+        rdss::InterpreterOptions options;
+        options.execution = execution;
+        options.memory_budget = 1 << 20;
+        rdss::Interpreter limited(variables, options);
+        EXPECT_EQ(limited.Interpret(join).code(),
+                  absl::StatusCode::kResourceExhausted);
+
+        options.memory_budget = 1 << 26;
+        rdss::Interpreter interpreter(variables, options);
+        absl::Status status = interpreter.Interpret(join);
+        ASSERT_TRUE(status.ok()) << status;
+        EXPECT_EQ(interpreter.Lookup(join)->NumberOfTuples(), 600 * 600);
+    }
+
+    // All 360000 tuples come from one key of one morsel, but the join stops
+    // soon after exceeding the budget instead of building its whole output.
+    rdss::InterpreterOptions options;
+    options.arena = std::make_shared<rdss::MemoryArena>(1 << 20);
+    rdss::Interpreter limited(variables, options);
+    EXPECT_EQ(limited.Interpret(join).code(),
+              absl::StatusCode::kResourceExhausted);
+    EXPECT_LT(options.arena->PeakBytesReserved(), 4 << 20);
+}
+
+TEST(Interpreter, MemoryBudgetIsPerQuery) {
+    rdss::RelationFactory fac;
+
+    // Each join has 200 * 200 tuples, about 0.5 MiB; together they are over
+    // the budget, but each query is charged only for its own.
+    std::vector<rdss::Tuple> tuples;
+    for (int32_t i = 0; i < 200; i++) {
+        tuples.push_back({i, 7});
+    }
+    absl::btree_map<rdss::RelName, rdss::Table> variables;
+    rdss::InterpreterOptions options;
+    options.memory_budget = 1 << 21;
+    std::vector<rdss::Relation*> joins;
+    for (const char* name : {"R", "S", "T", "U", "V", "W"}) {
+        variables.insert_or_assign(rdss::RelName(name), MakeTable(2, tuples));
+        auto r = fac.Make<rdss::RelationReference>(name, 2);
+        joins.push_back(
+            fac.Make<rdss::RelationJoin>(r, r, rdss::JoinOn {{1, 1}}));
+    }
+
+    rdss::Interpreter interpreter(variables, options);
+    for (rdss::Relation* join : joins) {
+        absl::Status status = interpreter.Interpret(join);
+        ASSERT_TRUE(status.ok()) << status;
+    }
+    for (rdss::Relation* join : joins) {
+        EXPECT_EQ(interpreter.Lookup(join)->NumberOfTuples(), 200 * 200);
+    }
+}
+
+TEST(TableFile, MapsColumnsInPlace) {
+    absl::StatusOr<rdss::TempDirectory> dir = rdss::TempDirectory::Create();
+    ASSERT_TRUE(dir.ok()) << dir.status();
+    std::filesystem::path path = dir->path() / "r.table";
+
+    std::mt19937 rng(15);
+    rdss::Table table = RandomTable(3, 1001, 1000, &rng);
+    absl::Status status = rdss::WriteTableFile(table, path);
+    ASSERT_TRUE(status.ok()) << status;
+
+    absl::StatusOr<rdss::Table> mapped = rdss::MapTableFile(path);
+    ASSERT_TRUE(mapped.ok()) << mapped.status();
+    ASSERT_EQ(mapped->Width(), 3);
+    EXPECT_EQ(SortedTuples(*mapped), SortedTuples(table));
+    for (int32_t i = 0; i < 3; i++) {
+        uintptr_t address =
+            reinterpret_cast<uintptr_t>(mapped->Column(i).data());
+        EXPECT_EQ(address % rdss::kTableFileAlignment, 0);
+        EXPECT_NE(mapped->Column(i).data(), table.Column(i).data());
+    }
+
+    // Modifying a mapped table copies its columns and leaves the file alone.
+    rdss::Table copy = *mapped;
+    ASSERT_TRUE(copy.InsertTuple({1, 2, 3}).ok());
+    EXPECT_EQ(copy.NumberOfTuples(), 1002);
+    EXPECT_EQ(mapped->NumberOfTuples(), 1001);
+    EXPECT_EQ(rdss::MapTableFile(path)->NumberOfTuples(), 1001);
+
+    // Mapped tables can be queried like any other.
+    rdss::RelationFactory fac;
+    auto r = fac.Make<rdss::RelationReference>("R", 3);
+    auto join = fac.Make<rdss::RelationJoin>(r, r, rdss::JoinOn {{0, 1}});
+    absl::btree_map<rdss::RelName, rdss::Table> variables;
+    variables.insert_or_assign(rdss::RelName("R"), table);
+    std::vector<rdss::Tuple> expected = Evaluate(variables, join);
+    variables.insert_or_assign(rdss::RelName("R"), *mapped);
+    EXPECT_EQ(Evaluate(variables, join), expected);
+
+    ASSERT_TRUE(rdss::SetFileContents(path, "not a table").ok());
+    EXPECT_EQ(rdss::MapTableFile(path).status().code(),
+              absl::StatusCode::kInvalidArgument);
+
+    // An empty table whose header claims more columns than a Table can have
+    // is rejected rather than allocated.
+    rdss::TableFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, rdss::kTableFileMagic, sizeof(header.magic));
+    header.version = rdss::kTableFileVersion;
+    header.byte_order = rdss::kTableFileByteOrder;
+    header.width = 0xFFFFFFFF;
+    ASSERT_TRUE(rdss::SetFileContents(
+        path, std::string(reinterpret_cast<const char*>(&header),
+                          sizeof(header))).ok());
+    EXPECT_EQ(rdss::MapTableFile(path).status().code(),
+              absl::StatusCode::kInvalidArgument);
+}
+
+TEST(CompressedTable, SkipsRowGroupsByZoneMap) {
+    // Column 0 is sorted, so its zone maps are tight; column 1 has long runs
+    // and column 2 is random.
+    std::mt19937 rng(16);
+    std::uniform_int_distribution<rdss::Value> dist(-1000, 1000);
+    rdss::Table table(3);
+    for (int32_t i = 0; i < 10000; i++) {
+        ASSERT_TRUE(table.InsertTuple({i, i / 250, dist(rng)}).ok());
+    }
+    rdss::CompressedTable compressed =
+        rdss::CompressedTable::Compress(table, 1000);
+    ASSERT_EQ(compressed.NumberOfRowGroups(), 10);
+    EXPECT_LT(compressed.PayloadSize(), 10000 * 3 * sizeof(rdss::Value));
+    EXPECT_EQ(compressed.Chunk(0, 1).encoding,
+              rdss::ChunkEncoding::kRunLength);
+
+    rdss::Table decompressed(3);
+    ASSERT_TRUE(compressed.Decompress(&decompressed).ok());
+    EXPECT_EQ(SortedTuples(decompressed), SortedTuples(table));
+
+    absl::StatusOr<rdss::TempDirectory> dir = rdss::TempDirectory::Create();
+    ASSERT_TRUE(dir.ok()) << dir.status();
+    std::filesystem::path path = dir->path() / "r.ctable";
+    absl::Status status = rdss::WriteCompressedTableFile(compressed, path);
+    ASSERT_TRUE(status.ok()) << status;
+    absl::StatusOr<rdss::CompressedTable> mapped =
+        rdss::MapCompressedTableFile(path);
+    ASSERT_TRUE(mapped.ok()) << mapped.status();
+
+    rdss::PredicateFactory pred_fac;
+    auto range = pred_fac.Make<rdss::PredicateAnd>(
+        std::vector<rdss::Predicate*> {
+            pred_fac.Make<rdss::PredicateNot>(
+                pred_fac.Make<rdss::PredicateLessThan>(0, 3000)),
+            pred_fac.Make<rdss::PredicateLessThan>(0, 4000)
+        });
+    int32_t scanned = 0;
+    for (int32_t g = 0; g < mapped->NumberOfRowGroups(); g++) {
+        if (rdss::MatchRowGroup(range, *mapped, g) != rdss::ZoneMatch::kNone) {
+            scanned++;
+        }
+    }
+    EXPECT_EQ(scanned, 1);
+    EXPECT_EQ(rdss::MatchRowGroup(
+                  pred_fac.Make<rdss::PredicateLessThan>(0, 5000), *mapped, 0),
+              rdss::ZoneMatch::kAll);
+
+    rdss::RelationFactory fac;
+    auto r = fac.Make<rdss::RelationReference>("R", 3);
+    std::vector<rdss::Predicate*> predicates = {
+        range,
+        pred_fac.Make<rdss::PredicateEquals>(1, 7),
+        pred_fac.Make<rdss::PredicateOr>(
+            std::vector<rdss::Predicate*> {
+                pred_fac.Make<rdss::PredicateEquals>(0, 12),
+                pred_fac.Make<rdss::PredicateLessThan>(2, -900)
+            }),
+    };
+    absl::btree_map<rdss::RelName, rdss::Table> variables;
+    variables.insert_or_assign(rdss::RelName("R"), table);
+    auto shared = std::make_shared<const rdss::CompressedTable>(*mapped);
+    rdss::ThreadPool pool(3);
+    for (rdss::Predicate* predicate : predicates) {
+        auto select = fac.Make<rdss::RelationSelect>(predicate, r);
+        auto join = fac.Make<rdss::RelationJoin>(
+            select, r, rdss::JoinOn {{2, 2}});
+        std::vector<rdss::Tuple> expected = Evaluate(variables, join);
+
+        std::vector<rdss::InterpreterOptions> all_options(3);
+        all_options[1].thread_pool = &pool;
+        all_options[2].execution = rdss::ExecutionModel::kPipeline;
+        for (const rdss::InterpreterOptions& options : all_options) {
+            rdss::Interpreter interpreter({}, options);
+            interpreter.AddCompressedTable(rdss::RelName("R"), shared);
+            status = interpreter.Interpret(join);
+            ASSERT_TRUE(status.ok()) << status;
+            EXPECT_EQ(SortedTuples(interpreter.Lookup(join).value()),
+                      expected);
+        }
+    }
+
+    // Headers that claim more columns than a table can have, or so many
+    // chunks that the size of their descriptors wraps around to fit the
+    // file, are rejected.
+    rdss::CompressedTableHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, rdss::kCompressedTableFileMagic,
+                sizeof(header.magic));
+    header.version = rdss::kCompressedTableFileVersion;
+    header.byte_order = rdss::kTableFileByteOrder;
+    header.rows_per_group = 1;
+    header.payload_offset = sizeof(header);
+    std::filesystem::path bad_path = dir->path() / "bad.ctable";
+    for (auto [width, number_of_tuples] :
+             {std::pair<uint32_t, uint64_t>(0xFFFFFFFF, 0),
+              std::pair<uint32_t, uint64_t>(1 << 30, 1 << 29)}) {
+        header.width = width;
+        header.number_of_tuples = number_of_tuples;
+        ASSERT_TRUE(rdss::SetFileContents(
+            bad_path, std::string(reinterpret_cast<const char*>(&header),
+                                  sizeof(header))).ok());
+        EXPECT_EQ(rdss::MapCompressedTableFile(bad_path).status().code(),
+                  absl::StatusCode::kInvalidArgument);
+    }
+}
+
+TEST(DelimitedText, ParallelMatchesSequential) {
+    std::mt19937 rng(17);
+    rdss::Table table = RandomTable(3, 5000, 100000, &rng);
+    std::string text = "a\tb\tc\n";
+    for (int32_t i = 0; i < table.NumberOfTuples(); i++) {
+        rdss::Tuple tuple = table.GetTuple(i);
+        tuple[1] -= 50000;
+        text += absl::StrFormat("%d\t%d\t%d%s", tuple[0], tuple[1],
+                                tuple[2], (i % 7 == 0) ? "\r\n" : "\n");
+    }
+
+    absl::StatusOr<rdss::TempDirectory> dir = rdss::TempDirectory::Create();
+    ASSERT_TRUE(dir.ok()) << dir.status();
+    std::filesystem::path path = dir->path() / "r.tsv";
+    ASSERT_TRUE(rdss::SetFileContents(path, text).ok());
+    EXPECT_EQ(rdss::GetFileContents(path).value(), text);
+
+    rdss::DelimitedTextOptions options;
+    options.delimiter = '\t';
+    options.header = true;
+    rdss::Table sequential(3);
+    absl::Status status = rdss::LoadDelimitedFile(path, options, &sequential);
+    ASSERT_TRUE(status.ok()) << status;
+    ASSERT_EQ(sequential.NumberOfTuples(), table.NumberOfTuples());
+    for (int32_t i = 0; i < table.NumberOfTuples(); i++) {
+        rdss::Tuple tuple = table.GetTuple(i);
+        tuple[1] -= 50000;
+        EXPECT_EQ(sequential.GetTuple(i), tuple);
+    }
+
+    rdss::ThreadPool pool(4);
+    options.thread_pool = &pool;
+    options.chunk_size = 1000;
+    rdss::Table parallel(3);
+    status = rdss::LoadDelimitedFile(path, options, &parallel);
+    ASSERT_TRUE(status.ok()) << status;
+    EXPECT_EQ(SortedTuples(parallel), SortedTuples(sequential));
+    EXPECT_EQ(parallel.GetTuple(4999), sequential.GetTuple(4999));
+
+    rdss::Table csv(2);
+    ASSERT_TRUE(rdss::ParseDelimitedText("1,-2\n\n+3,4", {}, &csv).ok());
+    EXPECT_EQ(SortedTuples(csv), (std::vector<rdss::Tuple> {{1, -2}, {3, 4}}));
+
+    // Leading zeros do not count towards the range, and a lone "\r" at the
+    // end is an empty line.
+    rdss::Table padded(2);
+    status = rdss::ParseDelimitedText(
+        "00000000042,-000000000002147483648\r\n\r", {}, &padded);
+    ASSERT_TRUE(status.ok()) << status;
+    EXPECT_EQ(SortedTuples(padded),
+              (std::vector<rdss::Tuple> {{42, -2147483647 - 1}}));
+
+    for (const char* bad : {"1,2\n3\n", "1,2,3\n", "1,x\n", "1,9999999999\n",
+                            "1,2147483648\n", "1,99999999999999999999999\n"}) {
+        status = rdss::ParseDelimitedText(bad, {}, &csv);
+        EXPECT_EQ(status.code(), absl::StatusCode::kInvalidArgument) << bad;
+    }
+    EXPECT_EQ(rdss::ParseDelimitedText("1,2\n3\n", {}, &csv).message(),
+              "line 2: too few fields");
+}
+
+TEST(Dictionary, LikeMatchesEachEntryOnce) {
+    EXPECT_TRUE(rdss::MatchesLikePattern("(co-production)", "%(co%"));
+    EXPECT_TRUE(rdss::MatchesLikePattern("abc", "a_c"));
+    EXPECT_TRUE(rdss::MatchesLikePattern("abc", "%"));
+    EXPECT_TRUE(rdss::MatchesLikePattern("", "%%"));
+    EXPECT_TRUE(rdss::MatchesLikePattern("aXbXc", "%X%c"));
+    EXPECT_FALSE(rdss::MatchesLikePattern("abc", "a_"));
+    EXPECT_FALSE(rdss::MatchesLikePattern("abc", "%d%"));
+    EXPECT_FALSE(rdss::MatchesLikePattern("", "_"));
+
+    auto names = std::make_shared<rdss::StringDictionary>();
+    std::vector<std::string> strings = {
+        "Warner Bros.", "Universal", "Warner Home Video", "Paramount",
+    };
+    rdss::Table companies(2);
+    for (int32_t i = 0; i < 40; i++) {
+        rdss::Value code = names->Encode(strings[i % strings.size()]);
+        ASSERT_TRUE(companies.InsertTuple({i, code}).ok());
+    }
+    EXPECT_EQ(names->Size(), 4);
+    EXPECT_EQ(names->Decode(*names->Find("Paramount")), "Paramount");
+    EXPECT_FALSE(names->Find("Fox").has_value());
+    companies.SetDictionary(1, names);
+
+    rdss::PredicateFactory pred_fac;
+    auto like = pred_fac.Make<rdss::PredicateLike>(1, "Warner%");
+    absl::StatusOr<rdss::Bitmap> bitmap =
+        rdss::EvaluatePredicate(like, companies);
+    ASSERT_TRUE(bitmap.ok()) << bitmap.status();
+    EXPECT_EQ(bitmap->CountOnes(), 20);
+    for (int32_t i = 0; i < companies.NumberOfTuples(); i++) {
+        EXPECT_EQ(bitmap->Get(i),
+                  rdss::InterpretPredicate(like, companies.GetTupleView(i)));
+    }
+    EXPECT_EQ(names->MatchLike("Warner%"), names->MatchLike("Warner%"));
+    EXPECT_EQ(rdss::EvaluatePredicate(
+                  pred_fac.Make<rdss::PredicateLike>(0, "%"), companies)
+                  .status().code(),
+              absl::StatusCode::kInvalidArgument);
+
+    // Dictionaries follow string columns through joins and views, so LIKE
+    // can be applied above them.
+    rdss::RelationFactory fac;
+    auto c = fac.Make<rdss::RelationReference>("C", 2);
+    auto m = fac.Make<rdss::RelationReference>("M", 2);
+    auto join = fac.Make<rdss::RelationJoin>(m, c, rdss::JoinOn {{1, 0}});
+    auto view = fac.Make<rdss::RelationView>(
+        rdss::Viewed<rdss::Relation*>({absl::nullopt, 1, 0}, join));
+    auto select = fac.Make<rdss::RelationSelect>(
+        pred_fac.Make<rdss::PredicateLike>(0, "%Video"), view);
+    absl::btree_map<rdss::RelName, rdss::Table> variables;
+    variables.insert_or_assign(rdss::RelName("C"), companies);
+    variables.insert_or_assign(rdss::RelName("M"),
+                               MakeTable(2, {{100, 2}, {101, 3}, {102, 6}}));
+    std::vector<rdss::InterpreterOptions> all_options(2);
+    all_options[1].execution = rdss::ExecutionModel::kPipeline;
+    for (const rdss::InterpreterOptions& options : all_options) {
+        rdss::Interpreter interpreter(variables, options);
+        absl::Status status = interpreter.Interpret(select);
+        ASSERT_TRUE(status.ok()) << status;
+        rdss::Table result = interpreter.Lookup(select).value();
+        EXPECT_EQ(SortedTuples(result),
+                  (std::vector<rdss::Tuple> {{2, 2}, {2, 6}}));
+        EXPECT_EQ(result.Dictionary(0), names);
+        EXPECT_EQ(result.Dictionary(1), nullptr);
+    }
+}
+
+TEST(Bag, OperatorsPropagateMultiplicities) {
+    // Expands a table into one row per occurrence, sorted.
+    auto occurrences = [](const rdss::Table& table) {
+        std::vector<rdss::Tuple> result;
+        for (int32_t i = 0; i < table.NumberOfTuples(); i++) {
+            for (int64_t k = 0; k < table.Multiplicity(i); k++) {
+                result.push_back(table.GetTuple(i));
+            }
+        }
+        std::sort(result.begin(), result.end());
+        return result;
+    };
+
+    rdss::Table r = MakeTable(2, {{1, 2}, {1, 2}, {1, 2}, {3, 4}, {1, 2}});
+    rdss::Table s = MakeTable(2, {{1, 2}, {5, 6}});
+    ASSERT_FALSE(r.HasMultiplicities());
+    rdss::Table bag(2);
+    ASSERT_TRUE(rdss::Consolidate({&r, &s}, &bag).ok());
+    EXPECT_EQ(bag.NumberOfTuples(), 3);
+    EXPECT_EQ(occurrences(bag),
+              (std::vector<rdss::Tuple> {
+                  {1, 2}, {1, 2}, {1, 2}, {1, 2}, {1, 2}, {3, 4}, {5, 6}}));
+
+    rdss::RelationFactory fac;
+    rdss::PredicateFactory pred_fac;
+    auto ref_r = fac.Make<rdss::RelationReference>("R", 2);
+    auto ref_s = fac.Make<rdss::RelationReference>("S", 2);
+    auto ref_t = fac.Make<rdss::RelationReference>("T", 2);
+    auto u = fac.Make<rdss::RelationUnion>(ref_r, ref_s);
+    auto join = fac.Make<rdss::RelationJoin>(u, ref_t, rdss::JoinOn {{0, 0}});
+    auto view = fac.Make<rdss::RelationView>(
+        rdss::Viewed<rdss::Relation*>({0, absl::nullopt, 1}, join));
+    auto select = fac.Make<rdss::RelationSelect>(
+        pred_fac.Make<rdss::PredicateLessThan>(0, 3), view);
+    auto difference = fac.Make<rdss::RelationDifference>(u, ref_s);
+
+    absl::btree_map<rdss::RelName, rdss::Table> variables;
+    variables.insert_or_assign(rdss::RelName("R"), r);
+    variables.insert_or_assign(rdss::RelName("S"), s);
+    variables.insert_or_assign(rdss::RelName("T"),
+                               MakeTable(2, {{1, 7}, {1, 8}, {3, 9}}));
+
+    // Counting duplicates changes how results are stored, but not how many
+    // times each tuple occurs.
+    rdss::Interpreter appending(variables);
+    ASSERT_TRUE(appending.Interpret(select).ok());
+    rdss::InterpreterOptions options;
+    options.count_duplicates = true;
+    rdss::Interpreter counting(variables, options);
+    ASSERT_TRUE(counting.Interpret(select).ok());
+    EXPECT_EQ(counting.Lookup(u)->NumberOfTuples(), 3);
+    EXPECT_EQ(appending.Lookup(u)->NumberOfTuples(), 7);
+    EXPECT_TRUE(counting.Lookup(select)->HasMultiplicities());
+    EXPECT_EQ(counting.Lookup(select)->NumberOfTuples(), 2);
+    EXPECT_EQ(occurrences(*counting.Lookup(select)),
+              occurrences(*appending.Lookup(select)));
+    EXPECT_EQ(occurrences(*counting.Lookup(select)).size(), 10);
+
+    // Difference subtracts multiplicities once they are counted.
+    ASSERT_TRUE(counting.Interpret(difference).ok());
+    EXPECT_EQ(occurrences(*counting.Lookup(difference)),
+              (std::vector<rdss::Tuple> {
+                  {1, 2}, {1, 2}, {1, 2}, {1, 2}, {3, 4}}));
+
+    options.execution = rdss::ExecutionModel::kPipeline;
+    rdss::Interpreter pipelined(variables, options);
+    EXPECT_EQ(pipelined.Interpret(select).code(),
+              absl::StatusCode::kUnimplemented);
+}
+
+TEST(Bag, DifferenceDoesNotDependOnStorage) {
+    absl::btree_map<rdss::RelName, rdss::Table> variables;
+    variables.insert_or_assign(rdss::RelName("R"),
+                               MakeTable(1, {{1}, {1}, {2}, {1}, {3}}));
+    variables.insert_or_assign(rdss::RelName("S"),
+                               MakeTable(1, {{1}, {3}, {3}, {4}}));
+
+    rdss::RelationFactory fac;
+    auto r = fac.Make<rdss::RelationReference>("R", 1);
+    auto s = fac.Make<rdss::RelationReference>("S", 1);
+    std::vector<rdss::Relation*> plans = {
+        fac.Make<rdss::RelationDifference>(r, s),
+        fac.Make<rdss::RelationDifference>(
+            fac.Make<rdss::RelationUnion>(r, s), s),
+        fac.Make<rdss::RelationDifference>(
+            fac.Make<rdss::RelationUnion>(r, r),
+            fac.Make<rdss::RelationUnion>(s, r)),
+    };
+    std::vector<std::vector<rdss::Tuple>> expected = {
+        {{1}, {1}, {2}},
+        {{1}, {1}, {1}, {2}, {3}},
+        {{1}, {1}, {2}},
+    };
+
+    for (int32_t i = 0; i < plans.size(); i++) {
+        std::vector<std::vector<rdss::Tuple>> results;
+        for (bool count_duplicates : {false, true}) {
+            for (rdss::JoinAlgorithm algorithm :
+                     {rdss::JoinAlgorithm::kHash,
+                      rdss::JoinAlgorithm::kSortMerge}) {
+                rdss::InterpreterOptions options;
+                options.count_duplicates = count_duplicates;
+                rdss::Interpreter interpreter(variables, options);
+                interpreter.SetJoinAlgorithm(plans[i], algorithm);
+                ASSERT_TRUE(interpreter.Interpret(plans[i]).ok());
+                std::vector<rdss::Tuple> result;
+                rdss::Table table = interpreter.Lookup(plans[i]).value();
+                for (int32_t k = 0; k < table.NumberOfTuples(); k++) {
+                    for (int64_t m = 0; m < table.Multiplicity(k); m++) {
+                        result.push_back(table.GetTuple(k));
+                    }
+                }
+                std::sort(result.begin(), result.end());
+                results.push_back(result);
+            }
+        }
+        rdss::InterpreterOptions options;
+        options.execution = rdss::ExecutionModel::kPipeline;
+        rdss::Interpreter pipelined(variables, options);
+        ASSERT_TRUE(pipelined.Interpret(plans[i]).ok());
+        results.push_back(SortedTuples(pipelined.Lookup(plans[i]).value()));
+
+        for (const std::vector<rdss::Tuple>& result : results) {
+            EXPECT_EQ(result, expected[i]) << plans[i]->ToString();
+        }
+    }
+}
+
+TEST(Distinct, RadixPartitionsMatchSortedUnique) {
+    std::mt19937 rng(11);
+    // Enough tuples to be split over several partitions.
+    rdss::Table input = RandomTable(2, 100000, 150, &rng);
+    std::vector<rdss::Tuple> expected = SortedTuples(input);
+    expected.erase(std::unique(expected.begin(), expected.end()),
+                   expected.end());
+
+    rdss::ThreadPool pool(4);
+    for (rdss::ThreadPool* p : {static_cast<rdss::ThreadPool*>(nullptr),
+                                &pool}) {
+        rdss::Table result(2);
+        ASSERT_TRUE(rdss::Distinct(input, p, &result).ok());
+        EXPECT_EQ(SortedTuples(result), expected);
+    }
+
+    // Multiplicities are dropped, along with tuples that do not occur.
+    rdss::Table bag = MakeTable(1, {{1}, {2}, {1}, {3}});
+    bag.AddMultiplicities();
+    bag.MutableMultiplicities()[1] = 0;
+    bag.MutableMultiplicities()[2] = 4;
+    rdss::Table result(1);
+    ASSERT_TRUE(rdss::Distinct(bag, nullptr, &result).ok());
+    EXPECT_FALSE(result.HasMultiplicities());
+    EXPECT_EQ(SortedTuples(result), (std::vector<rdss::Tuple> {{1}, {3}}));
+
+    // Incremental maintenance only reports tuples whose presence changes.
+    rdss::RelationFactory fac;
+    auto distinct = fac.Make<rdss::RelationDistinct>(
+        fac.Make<rdss::RelationReference>("R", 1));
+    rdss::IncrementalInterpreter incremental =
+        rdss::IncrementalInterpreter::Create(distinct).value();
+    auto change = [](const std::vector<std::pair<rdss::Value, int64_t>>& c) {
+        rdss::ZSet zset(1);
+        for (const auto& [value, weight] : c) {
+            zset.Add(std::vector<rdss::Value> {value}, weight);
+        }
+        absl::btree_map<rdss::RelName, rdss::ZSet> changes;
+        changes.insert_or_assign(rdss::RelName("R"), zset);
+        return changes;
+    };
+    absl::StatusOr<rdss::ZSet> delta =
+        incremental.Update(change({{1, 2}, {2, 1}}));
+    ASSERT_TRUE(delta.ok()) << delta.status();
+    EXPECT_EQ(delta->Entries().size(), 2);
+    delta = incremental.Update(change({{1, -1}, {2, -1}}));
+    ASSERT_TRUE(delta.ok()) << delta.status();
+    EXPECT_EQ(delta->Entries().size(), 1);
+    EXPECT_EQ(delta->Weight(std::vector<rdss::Value> {2}), -1);
+}
+
+TEST(PackedTable, ScansMatchUnpacked) {
+    std::mt19937 rng(12);
+    // A sorted column, which is delta-encoded; a narrow one; and a wide one.
+    rdss::Table table(3);
+    std::uniform_int_distribution<rdss::Value> narrow(100, 163);
+    std::uniform_int_distribution<rdss::Value> wide(-2000000000, 2000000000);
+    for (int32_t i = 0; i < 5000; i++) {
+        ASSERT_TRUE(table.InsertTuple({i * 3, narrow(rng), wide(rng)}).ok());
+    }
+    absl::StatusOr<rdss::PackedTable> packed = rdss::PackedTable::Pack(table);
+    ASSERT_TRUE(packed.ok()) << packed.status();
+    EXPECT_EQ(packed->Block(1, 0).encoding, rdss::PackedEncoding::kDelta);
+    EXPECT_EQ(packed->Block(1, 0).bit_width, 5);
+    EXPECT_EQ(packed->Block(1, 1).bit_width, 6);
+    EXPECT_LT(packed->PackedSize(), 5000 * 3 * sizeof(rdss::Value) * 2 / 3);
+
+    rdss::Table unpacked(3);
+    ASSERT_TRUE(packed->Unpack(&unpacked).ok());
+    EXPECT_EQ(SortedTuples(unpacked), SortedTuples(table));
+
+    rdss::RelationFactory fac;
+    rdss::PredicateFactory pred_fac;
+    auto r = fac.Make<rdss::RelationReference>("R", 3);
+    auto s = fac.Make<rdss::RelationReference>("S", 1);
+    std::vector<rdss::Relation*> relations = {
+        fac.Make<rdss::RelationSelect>(
+            pred_fac.Make<rdss::PredicateAnd>(
+                std::vector<rdss::Predicate*> {
+                    pred_fac.Make<rdss::PredicateLessThan>(1, 120),
+                    pred_fac.Make<rdss::PredicateNot>(
+                        pred_fac.Make<rdss::PredicateLessThan>(0, 6000))}),
+            r),
+        fac.Make<rdss::RelationSelect>(
+            pred_fac.Make<rdss::PredicateOr>(
+                std::vector<rdss::Predicate*> {
+                    pred_fac.Make<rdss::PredicateEquals>(0, 2997),
+                    pred_fac.Make<rdss::PredicateLessThan>(2, 0)}),
+            r),
+        fac.Make<rdss::RelationSemijoin>(r, s, rdss::JoinOn {{1, 0}}),
+        fac.Make<rdss::RelationSemijoin>(r, s, rdss::JoinOn {{0, 0}}),
+    };
+
+    absl::btree_map<rdss::RelName, rdss::Table> variables;
+    variables.insert_or_assign(rdss::RelName("R"), table);
+    variables.insert_or_assign(rdss::RelName("S"),
+                               MakeTable(1, {{101}, {150}, {3000}, {6003}}));
+    auto shared = std::make_shared<const rdss::PackedTable>(*packed);
+
+    rdss::ThreadPool pool(4);
+    std::vector<rdss::InterpreterOptions> configurations(3);
+    configurations[1].thread_pool = &pool;
+    configurations[1].morsel_size = 700;
+    configurations[2].execution = rdss::ExecutionModel::kPipeline;
+    for (const rdss::InterpreterOptions& options : configurations) {
+        for (rdss::Relation* relation : relations) {
+            absl::btree_map<rdss::RelName, rdss::Table> without_r = variables;
+            without_r.erase(rdss::RelName("R"));
+            rdss::Interpreter interpreter(without_r, options);
+            interpreter.AddPackedTable(rdss::RelName("R"), shared);
+            absl::Status status = interpreter.Interpret(relation);
+            ASSERT_TRUE(status.ok()) << status;
+            rdss::Table result = interpreter.Lookup(relation).value();
+            EXPECT_EQ(SortedTuples(result), Evaluate(variables, relation))
+                << relation->ToString();
+            EXPECT_FALSE(interpreter.Lookup(r).has_value());
+        }
+    }
+}
+
+TEST(PackedTable, KeepsDictionariesForLike) {
+    auto names = std::make_shared<rdss::StringDictionary>();
+    std::vector<std::string> strings = {
+        "Warner Bros.", "Universal", "Warner Home Video", "Paramount",
+    };
+    rdss::Table companies(2);
+    for (int32_t i = 0; i < 3000; i++) {
+        rdss::Value code = names->Encode(strings[i % strings.size()]);
+        ASSERT_TRUE(companies.InsertTuple({i, code}).ok());
+    }
+    companies.SetDictionary(1, names);
+    absl::StatusOr<rdss::PackedTable> packed =
+        rdss::PackedTable::Pack(companies);
+    ASSERT_TRUE(packed.ok()) << packed.status();
+    auto shared = std::make_shared<const rdss::PackedTable>(*packed);
+
+    // LIKE above a selection and a semijoin that read the packed table in
+    // place, and above a view of it, which unpacks it.
+    rdss::RelationFactory fac;
+    rdss::PredicateFactory pred_fac;
+    auto c = fac.Make<rdss::RelationReference>("C", 2);
+    auto s = fac.Make<rdss::RelationReference>("S", 1);
+    auto like = pred_fac.Make<rdss::PredicateLike>(1, "Warner%");
+    std::vector<rdss::Relation*> relations = {
+        fac.Make<rdss::RelationSelect>(
+            like, fac.Make<rdss::RelationSelect>(
+                pred_fac.Make<rdss::PredicateLessThan>(0, 2100), c)),
+        fac.Make<rdss::RelationSelect>(
+            like, fac.Make<rdss::RelationSemijoin>(
+                c, s, rdss::JoinOn {{0, 0}})),
+        fac.Make<rdss::RelationSelect>(
+            pred_fac.Make<rdss::PredicateLike>(0, "%Video"),
+            fac.Make<rdss::RelationView>(rdss::Viewed<rdss::Relation*>(
+                {absl::nullopt, 0}, c))),
+    };
+
+    absl::btree_map<rdss::RelName, rdss::Table> variables;
+    variables.insert_or_assign(rdss::RelName("C"), companies);
+    variables.insert_or_assign(
+        rdss::RelName("S"), MakeTable(1, {{0}, {1}, {2}, {6}, {2999}}));
+    absl::btree_map<rdss::RelName, rdss::Table> without_c = variables;
+    without_c.erase(rdss::RelName("C"));
+
+    std::vector<rdss::InterpreterOptions> all_options(2);
+    all_options[1].execution = rdss::ExecutionModel::kPipeline;
+    for (const rdss::InterpreterOptions& options : all_options) {
+        for (rdss::Relation* relation : relations) {
+            rdss::Interpreter interpreter(without_c, options);
+            interpreter.AddPackedTable(rdss::RelName("C"), shared);
+            absl::Status status = interpreter.Interpret(relation);
+            ASSERT_TRUE(status.ok()) << status << relation->ToString();
+            rdss::Table result = interpreter.Lookup(relation).value();
+            std::vector<rdss::Tuple> expected = Evaluate(variables, relation);
+            ASSERT_FALSE(expected.empty()) << relation->ToString();
+            EXPECT_EQ(SortedTuples(result), expected) << relation->ToString();
+            EXPECT_EQ(result.Dictionaries().back(), names);
+        }
+    }
+}
+
+TEST(Statistics, EstimatesAndMaintainsColumnStatistics) {
+    // Column 0 is a key; in column 1, 7 makes up 30% of the rows and the
+    // rest are spread evenly over 700 values.
+    rdss::Table table(2);
+    for (int32_t i = 0; i < 100000; i++) {
+        rdss::Value skewed = (i % 10 < 3) ? 7 : 1000 + (i * 7919) % 1000;
+        ASSERT_TRUE(table.InsertTuple({i, skewed}).ok());
+    }
+    rdss::ThreadPool pool(2);
+    rdss::TableStatistics statistics =
+        rdss::TableStatistics::Compute(table, &pool);
+    EXPECT_EQ(statistics.NumberOfTuples(), 100000);
+
+    const rdss::ColumnStatistics& key = statistics.Column(0);
+    EXPECT_EQ(key.Min(), 0);
+    EXPECT_EQ(key.Max(), 99999);
+    EXPECT_NEAR(key.DistinctCount(), 100000, 5000);
+    EXPECT_NEAR(key.LessThanSelectivity(25000), 0.25, 0.03);
+    EXPECT_NEAR(key.EqualsSelectivity(123), 0.00001, 0.000002);
+    std::vector<rdss::HistogramBucket> histogram = key.Histogram(10);
+    ASSERT_EQ(histogram.size(), 10);
+    for (int32_t b = 0; b < histogram.size(); b++) {
+        EXPECT_NEAR(histogram[b].count, 10000, 50);
+        if (b > 0) {
+            EXPECT_LT(histogram[b - 1].upper, histogram[b].lower);
+        }
+    }
+
+    const rdss::ColumnStatistics& skewed = statistics.Column(1);
+    EXPECT_NEAR(skewed.DistinctCount(), 701, 35);
+    ASSERT_FALSE(skewed.HeavyHitters().empty());
+    EXPECT_EQ(skewed.HeavyHitters()[0].first, 7);
+    EXPECT_NEAR(skewed.EqualsSelectivity(7), 0.3, 0.02);
+    EXPECT_NEAR(skewed.EqualsSelectivity(1503), 0.001, 0.0002);
+
+    rdss::PredicateFactory pred_fac;
+    EXPECT_NEAR(
+        rdss::EstimateSelectivity(
+            pred_fac.Make<rdss::PredicateAnd>(std::vector<rdss::Predicate*> {
+                pred_fac.Make<rdss::PredicateLessThan>(0, 50000),
+                pred_fac.Make<rdss::PredicateEquals>(1, 7)}),
+            statistics),
+        0.15, 0.02);
+
+    // Appended tuples are folded in by the next update.
+    for (int32_t i = 0; i < 1000; i++) {
+        ASSERT_TRUE(table.InsertTuple({-1 - i, 7}).ok());
+    }
+    ASSERT_TRUE(statistics.Update(table).ok());
+    EXPECT_EQ(statistics.NumberOfTuples(), 101000);
+    EXPECT_EQ(statistics.Column(0).Min(), -1000);
+    EXPECT_NEAR(statistics.Column(0).DistinctCount(), 101000, 5000);
+    table.Clear();
+    EXPECT_EQ(statistics.Update(table).code(),
+              absl::StatusCode::kFailedPrecondition);
+
+    // Loading text can collect statistics on the way.
+    rdss::TableStatistics loaded(2);
+    rdss::DelimitedTextOptions options;
+    options.statistics = &loaded;
+    rdss::Table csv(2);
+    ASSERT_TRUE(rdss::ParseDelimitedText("1,5\n2,5\n3,6\n", options, &csv)
+                    .ok());
+    EXPECT_EQ(loaded.NumberOfTuples(), 3);
+    EXPECT_EQ(loaded.Column(1).HeavyHitters()[0],
+              (std::pair<rdss::Value, int64_t>(5, 2)));
+}
+
+TEST(Statistics, SamplesOccurrencesOfWeightedRows) {
+    // Values below 100 occur 1000 times each and the others once, so nine
+    // in ten occurrences are below 100 although almost every row is not.
+    rdss::Table table(1);
+    for (int32_t i = 0; i < 10000; i++) {
+        ASSERT_TRUE(table.InsertTuple({i}, (i < 100) ? 1000 : 1).ok());
+    }
+    rdss::TableStatistics statistics = rdss::TableStatistics::Compute(table);
+    const rdss::ColumnStatistics& column = statistics.Column(0);
+    EXPECT_EQ(column.Count(), 109900);
+    EXPECT_NEAR(column.LessThanSelectivity(100), 100000.0 / 109900, 0.03);
+    EXPECT_NEAR(column.LessThanSelectivity(5000), 104900.0 / 109900, 0.03);
+
+    double total = 0.0;
+    for (const rdss::HistogramBucket& bucket : column.Histogram(10)) {
+        total += bucket.count;
+        if (bucket.lower >= 100) {
+            EXPECT_LT(bucket.count, 20000) << bucket.lower;
+        }
+    }
+    EXPECT_NEAR(total, 109900, 1);
+}
+
+TEST(JoinOrder, PicksSmallIntermediatesAndMatchesMultiJoin) {
+    // A(x, y) and B(y, z) share one y value, so joining them first produces
+    // every pair of their rows; B(y, z) and C(z, w) share few z values.
+    absl::btree_map<rdss::RelName, rdss::Table> variables;
+    rdss::Table a(2);
+    rdss::Table b(2);
+    rdss::Table c(2);
+    for (int32_t i = 0; i < 200; i++) {
+        ASSERT_TRUE(a.InsertTuple({i, 0}).ok());
+        ASSERT_TRUE(b.InsertTuple({0, i}).ok());
+    }
+    for (int32_t i = 0; i < 10; i++) {
+        ASSERT_TRUE(c.InsertTuple({i * 3, i}).ok());
+    }
+    std::vector<rdss::TableStatistics> statistics = {
+        rdss::TableStatistics::Compute(a),
+        rdss::TableStatistics::Compute(b),
+        rdss::TableStatistics::Compute(c),
+    };
+    variables.insert_or_assign(rdss::RelName("A"), a);
+    variables.insert_or_assign(rdss::RelName("B"), b);
+    variables.insert_or_assign(rdss::RelName("C"), c);
+
+    rdss::RelationFactory fac;
+    auto ra = fac.Make<rdss::RelationReference>("A", 2);
+    auto rb = fac.Make<rdss::RelationReference>("B", 2);
+    auto rc = fac.Make<rdss::RelationReference>("C", 2);
+    auto join = fac.Make<rdss::RelationMultiJoin>(
+        std::vector<rdss::Relation*> {ra, rb, rc},
+        std::vector<std::vector<int32_t>> {{0, 1}, {1, 2}, {2, 3}});
+    absl::StatusOr<rdss::Relation*> plan = rdss::OrderJoins(
+        &fac, *join,
+        {&statistics[0], &statistics[1], &statistics[2]});
+    ASSERT_TRUE(plan.ok()) << plan.status();
+    EXPECT_EQ(plan.value()->Arity(), 4);
+    EXPECT_EQ(Evaluate(variables, plan.value()), Evaluate(variables, join));
+
+    // A is joined last, with the result of B and C. Its rows are not known
+    // to be distinct, so it is deduplicated first.
+    rdss::Relation* distinct_a = fac.Make<rdss::RelationDistinct>(ra);
+    rdss::Relation* root = plan.value();
+    if (auto view = rdss::DynamicCast<rdss::Relation, rdss::RelationView>(
+            root)) {
+        root = view.value()->rel.rel;
+    }
+    auto top = rdss::DynamicCast<rdss::Relation, rdss::RelationJoin>(root);
+    ASSERT_TRUE(top.has_value()) << root->ToString();
+    EXPECT_TRUE((top.value()->lhs == distinct_a)
+                || (top.value()->rhs == distinct_a))
+        << root->ToString();
+
+    // Inputs promised to be sets are used as they are.
+    plan = rdss::OrderJoins(
+        &fac, *join, {&statistics[0], &statistics[1], &statistics[2]},
+        /*inputs_are_sets=*/true);
+    ASSERT_TRUE(plan.ok()) << plan.status();
+    EXPECT_EQ(plan.value()->ToString().find("Distinct"), std::string::npos)
+        << plan.value()->ToString();
+    EXPECT_EQ(Evaluate(variables, plan.value()), Evaluate(variables, join));
+
+    // An input that binds no new variable only filters, and inputs that
+    // share no variable are cross-joined.
+    auto filtered = fac.Make<rdss::RelationMultiJoin>(
+        std::vector<rdss::Relation*> {rb, rc, rc},
+        std::vector<std::vector<int32_t>> {{0, 1}, {1, 2}, {0, 1}});
+    plan = rdss::OrderJoins(
+        &fac, *filtered,
+        {&statistics[1], &statistics[2], &statistics[2]});
+    ASSERT_TRUE(plan.ok()) << plan.status();
+    EXPECT_NE(plan.value()->ToString().find("Semijoin"), std::string::npos)
+        << plan.value()->ToString();
+    EXPECT_EQ(Evaluate(variables, plan.value()),
+              Evaluate(variables, filtered));
+    auto product = fac.Make<rdss::RelationMultiJoin>(
+        std::vector<rdss::Relation*> {rc, rc},
+        std::vector<std::vector<int32_t>> {{2, 0}, {1, 3}});
+    plan = rdss::OrderJoins(&fac, *product, {&statistics[2], &statistics[2]});
+    ASSERT_TRUE(plan.ok()) << plan.status();
+    EXPECT_EQ(Evaluate(variables, plan.value()).size(), 100);
+    EXPECT_EQ(Evaluate(variables, plan.value()),
+              Evaluate(variables, product));
+
+    // Long chains are ordered greedily.
+    std::vector<rdss::Relation*> chain_inputs;
+    std::vector<std::vector<int32_t>> chain_variables;
+    std::vector<const rdss::TableStatistics*> chain_statistics;
+    for (int32_t i = 0; i <= rdss::kMaxExhaustiveJoinInputs; i++) {
+        chain_inputs.push_back(rc);
+        chain_variables.push_back({i + 1, i});
+        chain_statistics.push_back(&statistics[2]);
+    }
+    auto chain = fac.Make<rdss::RelationMultiJoin>(chain_inputs,
+                                                   chain_variables);
+    plan = rdss::OrderJoins(&fac, *chain, chain_statistics);
+    ASSERT_TRUE(plan.ok()) << plan.status();
+    EXPECT_EQ(Evaluate(variables, plan.value()), Evaluate(variables, chain));
+
+    auto repeated = fac.Make<rdss::RelationMultiJoin>(
+        std::vector<rdss::Relation*> {ra},
+        std::vector<std::vector<int32_t>> {{0, 0}});
+    EXPECT_EQ(rdss::OrderJoins(&fac, *repeated, {&statistics[0]})
+                  .status().code(),
+              absl::StatusCode::kUnimplemented);
+}
+
+TEST(JoinOrder, MatchesMultiJoinOnInputsWithDuplicates) {
+    // Every row of A and B occurs three times, and C has a row of its own
+    // that matches nothing, so joins and semijoins both see duplicates.
+    absl::btree_map<rdss::RelName, rdss::Table> variables;
+    rdss::Table a(2);
+    rdss::Table b(2);
+    for (int32_t copy = 0; copy < 3; copy++) {
+        for (int32_t i = 0; i < 20; i++) {
+            ASSERT_TRUE(a.InsertTuple({i, i % 4}).ok());
+            ASSERT_TRUE(b.InsertTuple({i % 4, i % 5}).ok());
+        }
+    }
+    rdss::Table c = MakeTable(2, {{0, 1}, {1, 2}, {1, 2}, {9, 9}});
+    std::vector<rdss::TableStatistics> statistics = {
+        rdss::TableStatistics::Compute(a),
+        rdss::TableStatistics::Compute(b),
+        rdss::TableStatistics::Compute(c),
+    };
+    variables.insert_or_assign(rdss::RelName("A"), a);
+    variables.insert_or_assign(rdss::RelName("B"), b);
+    variables.insert_or_assign(rdss::RelName("C"), c);
+
+    rdss::RelationFactory fac;
+    auto ra = fac.Make<rdss::RelationReference>("A", 2);
+    auto rb = fac.Make<rdss::RelationReference>("B", 2);
+    auto rc = fac.Make<rdss::RelationReference>("C", 2);
+    for (auto join : {
+             fac.Make<rdss::RelationMultiJoin>(
+                 std::vector<rdss::Relation*> {ra, rb, rc},
+                 std::vector<std::vector<int32_t>> {{0, 1}, {1, 2}, {1, 2}}),
+             fac.Make<rdss::RelationMultiJoin>(
+                 std::vector<rdss::Relation*> {ra, rb, rc},
+                 std::vector<std::vector<int32_t>> {{0, 1}, {1, 2}, {2, 3}}),
+         }) {
+        absl::StatusOr<rdss::Relation*> plan = rdss::OrderJoins(
+            &fac, *join, {&statistics[0], &statistics[1], &statistics[2]});
+        ASSERT_TRUE(plan.ok()) << plan.status();
+        std::vector<rdss::Tuple> expected = Evaluate(variables, join);
+        ASSERT_FALSE(expected.empty());
+        EXPECT_EQ(Evaluate(variables, plan.value()), expected)
+            << plan.value()->ToString();
+    }
+}
+
+TEST(Rewrite, PushesSelectionsAndProjectionsTowardTheLeaves) {
+    std::mt19937 rng(23);
+    absl::btree_map<rdss::RelName, rdss::Table> variables;
+    variables.insert_or_assign(rdss::RelName("R"), RandomTable(3, 300, 9, &rng));
+    variables.insert_or_assign(rdss::RelName("S"), RandomTable(2, 100, 9, &rng));
+
+    rdss::RelationFactory fac;
+    rdss::PredicateFactory pred_fac;
+    rdss::Rewriter rewriter(&fac, &pred_fac);
+    auto r = fac.Make<rdss::RelationReference>("R", 3);
+    auto s = fac.Make<rdss::RelationReference>("S", 2);
+    auto join = fac.Make<rdss::RelationJoin>(r, s, rdss::JoinOn {{2, 0}});
+
+    // Conjuncts on one side move to it; one on the key moves to both.
+    auto selected = fac.Make<rdss::RelationSelect>(
+        pred_fac.Make<rdss::PredicateAnd>(std::vector<rdss::Predicate*> {
+            pred_fac.Make<rdss::PredicateLessThan>(0, 5),
+            pred_fac.Make<rdss::PredicateLessThan>(2, 7),
+            pred_fac.Make<rdss::PredicateNot>(
+                pred_fac.Make<rdss::PredicateEquals>(3, 2)),
+        }),
+        join);
+    absl::StatusOr<rdss::Relation*> rewritten = rewriter.Rewrite(selected);
+    ASSERT_TRUE(rewritten.ok()) << rewritten.status();
+    auto top = rdss::DynamicCast<rdss::Relation, rdss::RelationJoin>(
+        rewritten.value());
+    ASSERT_TRUE(top.has_value()) << rewritten.value()->ToString();
+    EXPECT_NE(top.value()->lhs, r);
+    EXPECT_NE(top.value()->rhs, s);
+    EXPECT_EQ(Evaluate(variables, rewritten.value()),
+              Evaluate(variables, selected));
+
+    // Views that drop attributes reach the inputs of joins, and stacked
+    // views collapse.
+    auto projected = fac.Make<rdss::RelationView>(rdss::Viewed<rdss::Relation*>(
+        {absl::nullopt, 0, absl::nullopt, absl::nullopt}, join));
+    auto restored = fac.Make<rdss::RelationView>(
+        rdss::Viewed<rdss::Relation*>({0}, projected));
+    rewritten = rewriter.Rewrite(restored);
+    ASSERT_TRUE(rewritten.ok()) << rewritten.status();
+    auto view = rdss::DynamicCast<rdss::Relation, rdss::RelationView>(
+        rewritten.value());
+    ASSERT_TRUE(view.has_value()) << rewritten.value()->ToString();
+    auto inner = rdss::DynamicCast<rdss::Relation, rdss::RelationJoin>(
+        view.value()->rel.rel);
+    ASSERT_TRUE(inner.has_value()) << rewritten.value()->ToString();
+    EXPECT_EQ(inner.value()->lhs->Arity(), 2);
+    EXPECT_EQ(inner.value()->rhs->Arity(), 1);
+    EXPECT_EQ(Evaluate(variables, rewritten.value()),
+              Evaluate(variables, restored));
+    auto swapped = fac.Make<rdss::RelationView>(
+        rdss::Viewed<rdss::Relation*>({1, 0}, s));
+    auto swapped_back = fac.Make<rdss::RelationView>(
+        rdss::Viewed<rdss::Relation*>({1, 0}, swapped));
+    EXPECT_EQ(rewriter.Rewrite(swapped_back).value(), s);
+
+    // Selections pass through views and unions, and into multiway joins.
+    auto through_union = fac.Make<rdss::RelationSelect>(
+        pred_fac.Make<rdss::PredicateLessThan>(0, 3),
+        fac.Make<rdss::RelationView>(rdss::Viewed<rdss::Relation*>(
+            {1, 0}, fac.Make<rdss::RelationUnion>(s, s))));
+    rewritten = rewriter.Rewrite(through_union);
+    ASSERT_TRUE(rewritten.ok()) << rewritten.status();
+    EXPECT_EQ(rewritten.value()->ToString(),
+              "View(Viewed([1, 0], Union(Select(<predicate>, S), "
+              "Select(<predicate>, S))))");
+    EXPECT_EQ(Evaluate(variables, rewritten.value()),
+              Evaluate(variables, through_union));
+    auto multijoin = fac.Make<rdss::RelationSelect>(
+        pred_fac.Make<rdss::PredicateEquals>(2, 4),
+        fac.Make<rdss::RelationMultiJoin>(
+            std::vector<rdss::Relation*> {r, s},
+            std::vector<std::vector<int32_t>> {{0, 1, 2}, {2, 3}}));
+    rewritten = rewriter.Rewrite(multijoin);
+    ASSERT_TRUE(rewritten.ok()) << rewritten.status();
+    EXPECT_TRUE((rdss::DynamicCast<rdss::Relation, rdss::RelationMultiJoin>(
+                     rewritten.value()).has_value()))
+        << rewritten.value()->ToString();
+    EXPECT_EQ(Evaluate(variables, rewritten.value()),
+              Evaluate(variables, multijoin));
+
+    // Under set semantics, a join viewed down to one side is a semijoin.
+    rdss::Rewriter set_rewriter(&fac, &pred_fac,
+                                rdss::RewriteOptions { .set_semantics = true });
+    auto rhs_only = fac.Make<rdss::RelationView>(rdss::Viewed<rdss::Relation*>(
+        {absl::nullopt, absl::nullopt, 1, 0}, join));
+    rewritten = set_rewriter.Rewrite(rhs_only);
+    ASSERT_TRUE(rewritten.ok()) << rewritten.status();
+    EXPECT_NE(rewritten.value()->ToString().find("Semijoin"),
+              std::string::npos) << rewritten.value()->ToString();
+    EXPECT_EQ(rewritten.value()->ToString().find("Join("), std::string::npos)
+        << rewritten.value()->ToString();
+    std::vector<rdss::Tuple> expected = Evaluate(variables, rhs_only);
+    expected.erase(std::unique(expected.begin(), expected.end()),
+                   expected.end());
+    std::vector<rdss::Tuple> actual = Evaluate(variables, rewritten.value());
+    actual.erase(std::unique(actual.begin(), actual.end()), actual.end());
+    EXPECT_EQ(actual, expected);
+}
+
+TEST(RelationFactory, SharesStructurallyEqualPlans) {
+    rdss::RelationFactory fac;
+    rdss::PredicateFactory pred_fac;
+    auto make_plan = [&](int32_t bound) {
+        auto r = fac.Make<rdss::RelationReference>("R", 2);
+        auto s = fac.Make<rdss::RelationReference>("S", 2);
+        auto predicate = pred_fac.Make<rdss::PredicateAnd>(
+            std::vector<rdss::Predicate*> {
+                pred_fac.Make<rdss::PredicateLessThan>(0, bound),
+                pred_fac.Make<rdss::PredicateLike>(1, "a%"),
+            });
+        return fac.Make<rdss::RelationView>(rdss::Viewed<rdss::Relation*>(
+            {1, absl::nullopt, 0},
+            fac.Make<rdss::RelationJoin>(
+                fac.Make<rdss::RelationSelect>(predicate, r), s,
+                rdss::JoinOn {{1, 0}})));
+    };
+
+    rdss::Relation* plan = make_plan(5);
+    int64_t relations = fac.relations.size();
+    int64_t predicates = pred_fac.predicates.size();
+    EXPECT_EQ(make_plan(5), plan);
+    EXPECT_EQ(fac.relations.size(), relations);
+    EXPECT_EQ(pred_fac.predicates.size(), predicates);
+
+    rdss::Relation* other = make_plan(6);
+    EXPECT_NE(other, plan);
+    EXPECT_NE(other->structural_hash, plan->structural_hash);
+    EXPECT_EQ(other->Children()[0]->Children()[1],
+              plan->Children()[0]->Children()[1]);
+    EXPECT_EQ(pred_fac.predicates.size(), predicates + 2);
+
+    EXPECT_NE(fac.Make<rdss::RelationReference>("R", 3),
+              fac.Make<rdss::RelationReference>("R", 2));
+    auto r = fac.Make<rdss::RelationReference>("R", 2);
+    EXPECT_NE(static_cast<rdss::Relation*>(
+                  fac.Make<rdss::RelationUnion>(r, r)),
+              static_cast<rdss::Relation*>(
+                  fac.Make<rdss::RelationDifference>(r, r)));
+}